@@ -0,0 +1,119 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Parse comma separated values into extents on several threads
+*/
+
+#ifndef DATASERIES_CSV_IMPORTER_HPP
+#define DATASERIES_CSV_IMPORTER_HPP
+
+#include <iosfwd>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/IExtentSink.hpp>
+
+class GeneralField;
+class GeneralValue;
+
+/** \brief Converts comma separated values into extents of one type.
+
+    Each line is one record.  Lines that are empty or start with the comment prefix are
+    skipped; otherwise the line is split into fields at the field separator.  A field that
+    starts with a double quote runs to the matching quote, with two quotes in a row standing
+    for one.  A line may end in a carriage return and a newline.  Fields of nullable columns
+    that are exactly the null string are null.  Bools are true, on, yes, false, off or no;
+    integers are decimal and have to fit the column; fixedwidth fields have to be exactly the
+    width of the column.  A value that can't be converted is an error in its line, like a
+    missing field, rather than fatal.  csv2ds(1) has examples.
+
+    The input is read in chunks that end at a newline.  Worker threads parse whole chunks into
+    extents of their own, and import() writes the extents to the sink in the order of the
+    input, so the rows come out as a serial parse would make them; only the extent boundaries
+    differ, as the last extent of each chunk is usually short.  Records can't span lines, so
+    the chunk boundaries are found by searching for newlines alone. */
+class CSVImporter : boost::noncopyable {
+  public:
+    /** Write extents of about target_extent_size bytes to sink; n_threads == -1 ==> one
+        thread per CPU.  The sink must already have had a library containing type written
+        to it. */
+    CSVImporter(const ExtentType::Ptr &type, dataseries::IExtentSink &sink,
+                uint32_t target_extent_size, int n_threads = -1);
+    ~CSVImporter();
+
+    /** Defaults to ","; if it starts with 0x it is decoded as hex, so 0x00 separates fields
+        with nulls */
+    void setFieldSeparator(const std::string &separator);
+
+    /** Defaults to "#"; empty ==> no comments */
+    void setCommentPrefix(const std::string &prefix) {
+        comment_prefix = prefix;
+    }
+
+    /** Defaults to "null" */
+    void setNullString(const std::string &null) {
+        null_string = null;
+    }
+
+    /** Decode variable32 fields from hex; defaults to false */
+    void setHexEncodedVariable32(bool hex) {
+        hex_encoded_variable32 = hex;
+    }
+
+    /** Bytes of input parsed by a thread at a time; defaults to 4MiB */
+    void setChunkSize(size_t bytes) {
+        chunk_size = bytes;
+    }
+
+    /** Parse all of input and write it to the sink.  Returns true on success; otherwise sets
+        error to a description of the first bad line and returns false, having written the
+        lines before it. */
+    bool import(std::istream &input, std::string &error);
+
+    /** Records written by import() */
+    uint64_t nRecords() const {
+        return nrecords;
+    }
+
+    /// \cond INTERNAL_ONLY
+    class Worker;
+    void workerThread(Worker &worker);
+    /// \endcond
+
+  private:
+    struct Chunk;
+
+    Chunk *readChunk(std::istream &input, std::vector<char> &carry);
+    bool writeChunk(Chunk &chunk, uint64_t &line_num, std::string &error);
+    void parseChunk(Chunk &chunk, Worker &worker);
+    bool parseLine(const char *line, const char *newline, Chunk &chunk, Worker &worker);
+    static bool convert(const GeneralField &field, const std::string &from, GeneralValue &to,
+                        std::string &error);
+    void stopWorkers();
+
+    const ExtentType::Ptr type;
+    dataseries::IExtentSink &sink;
+    uint32_t target_extent_size;
+    int n_threads;
+    std::string field_separator, comment_prefix, null_string;
+    bool hex_encoded_variable32;
+    size_t chunk_size;
+    uint64_t nrecords;
+
+    std::vector<Worker *> workers;
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<Chunk *> to_parse; // under mutex
+    bool stop; // under mutex
+};
+
+#endif
@@ -103,6 +103,12 @@ class DSExpr : boost::noncopyable {
 
     virtual void dump(std::ostream &) = 0;
 
+    /// Evaluate valBool() for every row of series' current extent, setting selected[i] to the
+    /// value for row i.  The expression must be over series, whose position is left unchanged.
+    /// Compiled expressions evaluate the rows in batches straight from the fixed data, so
+    /// filtering an extent this way is much faster than calling valBool() on each row.
+    virtual void selectRows(ExtentSeries &series, std::vector<bool> &selected);
+
     /// Make an expression over a single series.
     static DSExpr *make(ExtentSeries &series, const std::string &expr_string) {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -118,6 +124,11 @@ class DSExpr : boost::noncopyable {
         return parser->parse(field_name_to_selector, expr_string);
     }
 
+    /// Get the names of the fields an expression over series reads, for example to tell
+    /// IndexSourceModule::setUnpackFields() which fields need to be unpacked.
+    static std::vector<std::string> fieldNames(ExtentSeries &series, 
+                                               const std::string &expr_string);
+
     /// Get the current usage description for expressions.
     static std::string usage() {
         boost::scoped_ptr<DSExprParser> parser(DSExprParser::MakeDefaultParser());
@@ -13,12 +13,19 @@
 #ifndef __DATASERIES_DSSTATGROUPBY_H
 #define __DATASERIES_DSSTATGROUPBY_H
 
-#include <Lintel/HashMap.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/GeneralField.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
 
+/** \brief Calculates a statistic over an expression, optionally grouped by
+    one or more fields.
+
+    * groupby is empty, a field name, or a comma separated list of field names.
+    * Each row's group is found in an open addressing hash table keyed on the
+    * native bytes of the group-by fields, read through their typed fields,
+    * so the per-row work is an expression evaluation, a hash and a compare. */
 class DSStatGroupByModule : public RowAnalysisModule {
   public:
     DSStatGroupByModule(DataSeriesModule &source,
@@ -28,8 +35,6 @@ class DSStatGroupByModule : public RowAnalysisModule {
                         const std::string &whereexpr = "",
                         ExtentSeries::typeCompatibilityT tc = ExtentSeries::typeExact);
 
-    typedef HashMap<GeneralValue, Stats *> mytableT;
-
     virtual ~DSStatGroupByModule();
     
     virtual void prepareForProcessing();
@@ -39,11 +44,22 @@ class DSStatGroupByModule : public RowAnalysisModule {
     /// return true if the specified stat_type is valid for constructing a
     /// DSStatGroupByModule.
     static bool validStatType(const std::string &stat_type);
+
+    /// Fold the groups of from into into.  Both have to be DSStatGroupByModules
+    /// made with the same arguments, and basic statistics; quantiles can't be
+    /// merged.  Used to run the module under a ParallelRowAnalysisModule.
+    static void merge(RowAnalysisModule &into, RowAnalysisModule &from);
+
   private:
-    mytableT mystats;
+    class GroupTable;
+
+    void makeKey();
+
     std::string expression, groupby_name, stattype;
-    GeneralField *groupby;
+    std::vector<GeneralField *> groupby;
     DSExpr *expr;
+    boost::scoped_ptr<GroupTable> groups;
+    std::string key; // the current row's key, reused to avoid allocation
 };
 
 #endif
@@ -12,6 +12,9 @@
 #ifndef __DSTOTEXTMODULE_H
 #define __DSTOTEXTMODULE_H
 
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
 #include <DataSeries/DataSeriesModule.hpp>
 
 class DSExpr;
@@ -62,6 +65,14 @@ class DStoTextModule : public DataSeriesModule {
     
     void setHeaderOnlyOnce();
 
+    /** Format extents on n_threads threads; -1 ==> one per CPU, 1 (the default) ==> format
+        each extent as getSharedExtent() returns it.  With more than one thread, extents are
+        read ahead and formatted into a buffer each, which are written in order, so the
+        output is unchanged.  Rows of types with fields printed relative to the first row
+        are still formatted in order by the calling thread.  Only applies when printing to a
+        FILE *; must be called before the first getSharedExtent(). */
+    void setThreads(int n_threads);
+
     // need to keep around state because relative printing should be
     // done relative to the first row of the first extent, not the
     // first row of each extent.
@@ -76,11 +87,25 @@ class DStoTextModule : public DataSeriesModule {
         std::vector<GeneralField *> fields;
         std::string where_expr_str;
         DSExpr *where_expr;
+        bool format_in_order; // set when fields is made
     };
 
     uint64_t processed_rows, ignored_rows;
 
+    /// \cond INTERNAL_ONLY
+    class Worker;
+    void workerThread(Worker &worker);
+    /// \endcond
+
   private:
+    struct Job;
+
+    Extent::Ptr getFormattedExtent();
+    void formatRows(ExtentSeries &series, std::vector<GeneralField *> &fields,
+                    DSExpr *where_expr, Job &job);
+    static bool formatInOrder(const std::vector<GeneralField *> &fields);
+    void stopWorkers();
+
     static xmlNodePtr parseXML(std::string xml, const std::string &roottype);
 
     void setPrintSpec(const std::string &extenttype,
@@ -92,7 +117,7 @@ class DStoTextModule : public DataSeriesModule {
     void getExtentPrintSpecs(PerTypeState &state);
 
     // Also initializes state.fields if necessary.
-    void getExtentPrintHeaders(PerTypeState &state);
+    void getExtentPrintHeaders(PerTypeState &state, std::string &header);
 
     // Intiailizes state.where_expr if necessary.
     void getExtentParseWhereExpr(PerTypeState &state);
@@ -109,6 +134,15 @@ class DStoTextModule : public DataSeriesModule {
     std::string separator; 
     bool header_only_once;
     bool header_printed;
+
+    int n_threads;
+    Deque<Job *> pending; // read ahead, in order
+    std::vector<Worker *> workers;
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<Job *> to_format; // under mutex
+    bool stop_workers; // under mutex
+    bool source_done;
 };
 
 #endif
@@ -0,0 +1,84 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    A persistent cache of the metadata of many DataSeries files
+*/
+
+#ifndef DATASERIES_CATALOG_HPP
+#define DATASERIES_CATALOG_HPP
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/HashMap.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesSource.hpp>
+
+/** \brief Caches the type library and index of many DataSeries files in one DataSeries file.
+
+ * Opening a DataSeriesSource reads the header, the type extent and the
+ * index extent of the file, three random reads and an XML parse per file.
+ * For a set of tens of thousands of files that dominates the startup time
+ * of a job.  The catalog remembers the metadata of each file it has opened,
+ * along with the file's modify time and size, and stores it all in one file
+ * that is read sequentially when the catalog is created.  Sources opened
+ * through the catalog skip reading the metadata when the file hasn't changed;
+ * files that are new or have changed are read as usual and their entries
+ * updated, so a catalog is refreshed incrementally by using it.  Call save()
+ * to write back any changes.
+ *
+ * Index source modules use a catalog if given one with
+ * IndexSourceModule::setCatalog().  A catalog may be shared by several
+ * modules and threads. */
+class DataSeriesCatalog : boost::noncopyable {
+  public:
+    typedef boost::shared_ptr<DataSeriesCatalog> Ptr;
+
+    /** Reads the catalog stored in catalog_path; if the file doesn't exist, the catalog
+        starts out empty. */
+    explicit DataSeriesCatalog(const std::string &catalog_path);
+    ~DataSeriesCatalog();
+
+    static Ptr make(const std::string &catalog_path) {
+        return Ptr(new DataSeriesCatalog(catalog_path));
+    }
+
+    /** Opens filename, using the cached metadata if the file has the same modify time and
+        size as when it was cached, and otherwise reading the metadata from the file and
+        updating the catalog. */
+    boost::shared_ptr<DataSeriesSource> openSource(const std::string &filename);
+
+    /** Makes sure the catalog has current metadata for filename */
+    void update(const std::string &filename) {
+        openSource(filename);
+    }
+
+    /** Writes the catalog to its path if it has changed since it was read.  The catalog is
+        written to a temporary file and renamed into place, so a concurrent reader sees either
+        the old or the new catalog. */
+    void save();
+
+    /** true iff some entry has changed since the catalog was read or saved */
+    bool changed();
+
+    /** number of files in the catalog */
+    size_t size();
+
+    const std::string &getPath() const { return catalog_path; }
+
+  private:
+    void read();
+
+    const std::string catalog_path;
+    PThreadMutex mutex;
+    HashMap<std::string, DataSeriesSource::Metadata> files;
+    bool is_changed;
+};
+
+#endif
@@ -76,6 +76,7 @@ class DataSeriesModule : boost::noncopyable {
   public:
     typedef boost::shared_ptr<DataSeriesModule> Ptr;
 
+    DataSeriesModule();
     virtual ~DataSeriesModule();
 
     /** Returns an Extent which ought to have been allocated with global new. It is the caller's
@@ -95,6 +96,77 @@ class DataSeriesModule : boost::noncopyable {
 
     /** get all the extents from module and delete them via the getExtentShared() interface. */
     void getAndDeleteShared();
+
+    /** \brief Performance counters for one module.
+
+        Output is counted for each extent a module returns to a caller that
+        gets it through getUpstreamExtent() or getAndDeleteShared(), as all of
+        the library modules do; input is counted for each extent a module gets
+        through getUpstreamExtent(), or for source modules, each extent read
+        from a file, with bytes_in the packed size.  Times are summed over
+        all the threads calling the module, so they can exceed elapsed time.
+        The time a module spends computing is its get_seconds less its
+        upstream_seconds. */
+    struct ModuleStats {
+        ModuleStats();
+        uint64_t extents_in, rows_in, bytes_in;
+        uint64_t extents_out, rows_out, bytes_out;
+        /// time spent in getSharedExtent(), as measured by counting callers
+        double get_seconds;
+        /// time blocked waiting for upstream modules, reader or prefetch threads
+        double upstream_seconds;
+        /// samples, sum and maximum of the number of extents in the module's queue
+        uint64_t queue_samples, queue_sum, queue_max;
+
+        double computeSeconds() const {
+            return get_seconds > upstream_seconds ? get_seconds - upstream_seconds : 0;
+        }
+        double meanQueue() const {
+            return queue_samples == 0 ? 0 : static_cast<double>(queue_sum) / queue_samples;
+        }
+        void printText(std::ostream &to, const std::string &name) const;
+    };
+
+    ModuleStats getStats();
+
+    /** name of the module in statistics reports; defaults to the class name, which is filled
+        in the first time the module passes an extent, or by this call, so call it only from a
+        thread that is using the module. */
+    std::string getModuleName();
+    void setModuleName(const std::string &name);
+
+    /** Get the statistics of every module that currently exists, in order of creation, so
+        usually with the sources first.  Modules that haven't passed an extent yet and weren't
+        named are reported as DataSeriesModule. */
+    static void getAllStats(std::vector<std::pair<std::string, ModuleStats> > &into);
+
+    /** Print a report on every module that currently exists */
+    static void printAllStats(std::ostream &to);
+
+  protected:
+    /** Get the next extent from upstream, counting it as input to this
+        module and output from upstream, and the call as time blocked
+        upstream unless blocking is false, which is for calls from a helper
+        thread that does not hold up this module's callers.  Modules should
+        use this rather than calling upstream.getSharedExtent() directly. */
+    Extent::Ptr getUpstreamExtent(DataSeriesModule &upstream, bool blocking = true);
+
+    /** count an extent of rows and bytes as input to this module */
+    void noteInput(uint64_t rows, uint64_t bytes);
+
+    /** count seconds as time this module's caller was blocked upstream */
+    void noteBlocked(double seconds);
+
+    /** sample the number of extents in the module's queue */
+    void noteQueue(size_t extents);
+
+  private:
+    static Extent::Ptr countedGet(DataSeriesModule &from, DataSeriesModule *into, bool blocking);
+    static std::string typeName(DataSeriesModule &module);
+
+    PThreadMutex stats_mutex;
+    ModuleStats stats;
+    std::string module_name; // under stats_mutex; empty until first set or used
 };
 
 /** \brief Base class for source modules that keeps statistics about
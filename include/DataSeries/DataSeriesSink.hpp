@@ -13,10 +13,12 @@
 */
 
 #include <Lintel/Deque.hpp>
+#include <Lintel/HashMap.hpp>
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/PThread.hpp>
 
 #include <DataSeries/ExtentField.hpp>
+#include <DataSeries/GeneralField.hpp>
 #include <DataSeries/IExtentSink.hpp>
 
 /** \brief Writes Extents to a DataSeries file.
@@ -93,6 +95,22 @@ class DataSeriesSink : public dataseries::IExtentSink {
         are not used. */
     void writeExtentLibrary(const ExtentTypeLibrary &lib);
 
+    /** Embeds a min/max index (zone map) for @param fields of @param type in the file.  While
+        each non-empty extent of that type is being compressed, the sink computes the minimum,
+        maximum and null count of each field; close() then writes one
+        minMaxIndexTypeName(type->getName()) extent with a row per extent.  The rows use the
+        same layout as the indices written by dsextentindex (plus nullcount:<field>), with an
+        empty filename meaning the file containing the index, so MinMaxIndexModule and
+        SortedIndexModule can be pointed directly at the data files.  Must be called before
+        writeExtentLibrary(); the index type is added to the written library.  Applies to
+        every file subsequently written by this sink. */
+    void addMinMaxIndex(const ExtentType::Ptr &type, const std::vector<std::string> &fields);
+
+    /** Name of the type of the min/max index for extents named @param type_name */
+    static std::string minMaxIndexTypeName(const std::string &type_name) {
+        return "DSIndex::Extent::MinMax::" + type_name;
+    }
+
     /** See dataseries::IExtentSink documentation */
     virtual void writeExtent(Extent &e, Stats *toUpdate);
 
@@ -128,15 +146,46 @@ class DataSeriesSink : public dataseries::IExtentSink {
         worker_info.setMaxBytesInProgress(mutex, nbytes);
     }
 
+    /** Switches the sink to adaptive compression.  Rather than trying every algorithm in
+        compression_modes on every extent, the sink tries all of them on one in every
+        sample_interval extents of each type, separately for the fixed and variable parts,
+        and only uses the winners on the extents in between.  The winner minimizes
+        packed bytes + unpack_bytes_per_second * seconds to decompress, so a non-zero
+        value trades file size for read speed; 0 picks the smallest, as without adaptive
+        compression.  sample_interval 0 or 1 tries every algorithm on every extent.  Affects
+        extents compressed after the call. */
+    void setAdaptiveCompression(uint32_t sample_interval = 16, 
+                                double unpack_bytes_per_second = 0);
+
+    /** Stores the fixed data of every extent a column at a time, each compressed separately;
+        see Extent::packDataSplit().  Files written this way are marked DSv2 so older
+        readers reject them rather than misreading them.  Must be called before
+        writeExtentLibrary(); applies to every file subsequently written by this sink. */
+    void setColumnarFixed(bool columnar = true);
+
+    /** Also writes the extended index, see DataSeriesSource::getIndexV1(), just before the
+        V0 index, and lists its type in the file's type library so that readers which walk
+        the file sequentially can decode it.  Off by default, so files are unchanged for
+        readers that don't expect it.  Must be called before writeExtentLibrary(); applies to
+        every file subsequently written by this sink. */
+    void setIndexV1(bool index_v1 = true);
+
   private:
+    struct MinMaxIndex; // defined in DataSeriesSink.cpp
+
     struct ToCompress {
         Extent::Ptr extent;
         Stats *to_update;
         bool in_progress;
         uint32_t checksum;
         Extent::ByteArray compressed;
-        ToCompress(Extent::Ptr e, Stats *_to_update)
-                : extent(e), to_update(_to_update), in_progress(false), checksum(0) 
+        // min/max/nullcount of the extent if its type has an embedded index
+        MinMaxIndex *minmax_index;
+        std::vector<GeneralValue> mins, maxs;
+        std::vector<int32_t> nullcounts;
+        ToCompress(Extent::Ptr e, Stats *_to_update, MinMaxIndex *minmax_index = NULL)
+                : extent(e), to_update(_to_update), in_progress(false), checksum(0),
+                  minmax_index(minmax_index)
         { }
         void wipeExtent() {
             Extent tmp(extent->getTypePtr());
@@ -190,6 +239,17 @@ class DataSeriesSink : public dataseries::IExtentSink {
         ExtentSeries index_series;
         Int64Field field_extentOffset;
         Variable32Field field_extentType;
+        // extended index, see ExtentType::getDataSeriesIndexTypeV1Ptr()
+        ExtentSeries index_v1_series;
+        Int64Field v1_offset;
+        Int32Field v1_size;
+        Variable32Field v1_extent_type;
+        Int32Field v1_nrecords;
+        ByteField v1_fixed_compress_mode;
+        Int32Field v1_fixed_uncompressed_size, v1_fixed_compressed_size;
+        ByteField v1_variable_compress_mode;
+        Int32Field v1_variable_uncompressed_size, v1_variable_compressed_size;
+        Int32Field v1_compressed_adler32, v1_uncompressed_bjhash;
         ExtentWriteCallback extent_write_callback;
 
         WriterInfo()
@@ -197,13 +257,28 @@ class DataSeriesSink : public dataseries::IExtentSink {
                   index_series(ExtentType::getDataSeriesIndexTypeV0Ptr()), 
                   field_extentOffset(index_series,"offset"),
                   field_extentType(index_series,"extenttype"), 
+                  index_v1_series(ExtentType::getDataSeriesIndexTypeV1Ptr()),
+                  v1_offset(index_v1_series, "offset"), v1_size(index_v1_series, "size"),
+                  v1_extent_type(index_v1_series, "extenttype"),
+                  v1_nrecords(index_v1_series, "nrecords"),
+                  v1_fixed_compress_mode(index_v1_series, "fixed_compress_mode"),
+                  v1_fixed_uncompressed_size(index_v1_series, "fixed_uncompressed_size"),
+                  v1_fixed_compressed_size(index_v1_series, "fixed_compressed_size"),
+                  v1_variable_compress_mode(index_v1_series, "variable_compress_mode"),
+                  v1_variable_uncompressed_size(index_v1_series, "variable_uncompressed_size"),
+                  v1_variable_compressed_size(index_v1_series, "variable_compressed_size"),
+                  v1_compressed_adler32(index_v1_series, "compressed_adler32"),
+                  v1_uncompressed_bjhash(index_v1_series, "uncompressed_bjhash"),
                   extent_write_callback()
         { }
         void writeOutPending(PThreadScopedLock &lock, WorkerInfo &worker_info);
+        void addIndexV1Record(const Extent &extent, const Extent::ByteArray &compressed);
+        void writeIndexV1(int compression_modes, int compression_level);
         void checkedWrite(const void *buf, int bufsize);
         bool isQuiesced() {
             return fd == -1 && wrote_library == false && cur_offset == -1
-                    && !index_series.hasExtent() && chained_checksum == 0;
+                    && !index_series.hasExtent() && !index_v1_series.hasExtent()
+                    && chained_checksum == 0;
         }
     };
 
@@ -214,6 +289,19 @@ class DataSeriesSink : public dataseries::IExtentSink {
 
     void queueWriteExtent(Extent::Ptr e, Stats *to_update);
     void lockedProcessToCompress(PThreadScopedLock &lock, ToCompress *work);
+    void lockedWriteMinMaxIndices(PThreadScopedLock &lock);
+
+    // Algorithms chosen by adaptive compression for one type, protected by mutex
+    struct AdaptiveChoice {
+        uint32_t nextents;
+        bool sampled; // false until the first sample finishes
+        uint32_t fixed_modes, variable_modes;
+        AdaptiveChoice() : nextents(0), sampled(false), fixed_modes(0), variable_modes(0) { }
+    };
+    uint32_t adaptiveChoose(const Extent::CompressionSample &sample);
+    std::string fileMagic() const {
+        return columnar_fixed ? "DSv2" : "DSv1";
+    }
 
     static int compressor_count;
 
@@ -223,9 +311,16 @@ class DataSeriesSink : public dataseries::IExtentSink {
                lintel::SharedPointerEqual<const ExtentType> > valid_types;
     const int compression_modes;
     const int compression_level;
+    uint32_t adaptive_sample_interval;
+    double adaptive_unpack_weight;
+    HashMap<ExtentType::Ptr, AdaptiveChoice, lintel::SharedPointerHash<const ExtentType>,
+            lintel::SharedPointerEqual<const ExtentType> > adaptive_choices;
+    bool columnar_fixed;
+    bool index_v1;
 
     WriterInfo writer_info;
     WorkerInfo worker_info;
+    std::vector<MinMaxIndex *> minmax_indices;
                                    
     std::string filename;
     friend class DataSeriesSinkPThreadCompressor;
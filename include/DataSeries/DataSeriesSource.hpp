@@ -12,6 +12,8 @@
 #ifndef DATASERIES_SOURCE_H
 #define DATASERIES_SOURCE_H
 
+#include <vector>
+
 #include <DataSeries/Extent.hpp>
 
 /** \brief Reads Extents from a DataSeries file.
@@ -32,6 +34,25 @@ class DataSeriesSource {
         Postconditions:
         - isactive() */
     DataSeriesSource(const std::string &filename, bool read_index = true, bool check_tail = true);
+
+    /** Everything a source reads from a file when opening it.  types does not include the
+        XML and index types every file has; first_extent_offset is the offset of the extent
+        after the type extent. */
+    struct Metadata {
+        Metadata() : need_bitflip(false), mtime_nanosec(0), file_size(0),
+                     first_extent_offset(0), types(), index_extent() { }
+        bool need_bitflip;
+        int64_t mtime_nanosec, file_size, first_extent_offset;
+        std::vector<ExtentType::Ptr> types;
+        Extent::Ptr index_extent;
+    };
+
+    /** Opens the specified file using metadata previously returned by getMetadata(), e.g.
+        from a DataSeriesCatalog, rather than reading the header, type extent and index.  If
+        the modify time or size of the file no longer match, the metadata is read from the file
+        as usual; compare getMetadata().mtime_nanosec to tell. */
+    DataSeriesSource(const std::string &filename, const Metadata &metadata);
+
     ~DataSeriesSource();
 
     /** Returns the @c Extent at the current offset. Sets the current offset
@@ -66,9 +87,22 @@ class DataSeriesSource {
         to the size of the file.
         - isactive() */
     bool preadCompressed(off64_t &offset, Extent::ByteArray &bytes) {
-        return Extent::preadExtent(fd,offset, bytes, need_bitflip);
+        if (use_mmap) {
+            return Extent::mmapExtent(fd, offset, bytes, need_bitflip);
+        } else {
+            return Extent::preadExtent(fd, offset, bytes, need_bitflip);
+        }
     }
 
+    /** If true, extents whose fixed data is stored uncompressed (e.g. files
+        written with compression none) are mapped from the file, and the
+        unpacked extent uses the mapped fixed data without copying it when
+        no bitflip, scaling, relative packing or null compaction needs to be
+        undone.  The file must not be modified or truncated while those
+        extents are alive.  Defaults to false unless the environment
+        variable DATASERIES_READ_MMAP is set to 1. */
+    void setUseMmap(bool v) { use_mmap = v; }
+
     /** Returns true if the file is currently open. */
     bool isactive() { return fd >= 0; }
 
@@ -92,6 +126,12 @@ class DataSeriesSource {
         all of the types used in the file. */
     ExtentTypeLibrary &getLibrary() { return mylibrary; }
 
+    /** Returns the metadata read when the file was opened.
+
+        Preconditions:
+        - the source was opened with read_index = true */
+    Metadata getMetadata();
+
     /** This Extent describes all of the Extents and their offsets within the file. Its type
         is globally accessible through ExtentType::getDataSeriesIndexTypeV0.
 
@@ -106,6 +146,19 @@ class DataSeriesSource {
         for the file. */
     Extent::Ptr index_extent; 
 
+    /** Returns the extended index for the file, or an empty pointer if the
+        file was written without one (see DataSeriesSink::setIndexV1()).  Its type is
+        ExtentType::getDataSeriesIndexTypeV1Ptr(); it has one row for each
+        extent in index_extent other than the V0 index itself, with the
+        packed size, record count, compression modes and sizes, and checksums
+        of the extent.  It is read on the first call, so opening a file does
+        not get any slower.
+
+        Preconditions:
+        - isactive()
+        - the source was opened with read_index = true */
+    Extent::Ptr getIndexV1();
+
     /** Returns true if the endianness of the file is different from the
         endianness of the host processor. */
     bool needBitflip() { return need_bitflip; }
@@ -116,15 +169,18 @@ class DataSeriesSource {
     void checkHeader();
     void readTypeExtent();
     void readTailIndex();
+    void resetLibrary();
 
     ExtentTypeLibrary mylibrary;
 
     const std::string filename;
     typedef ExtentType::byte byte;
     int fd;
-    off64_t cur_offset;
-    bool need_bitflip, read_index, check_tail;
-    int64_t mtime_nanosec;
+    off64_t cur_offset, first_extent_offset;
+    bool need_bitflip, read_index, check_tail, use_mmap;
+    int64_t mtime_nanosec, file_size;
+    Extent::Ptr index_v1_extent;
+    bool checked_index_v1;
 };
 
 #endif
@@ -90,7 +90,7 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // arrays have to be contiguous, so we could switch back at some point.
     class ByteArray {
       public:
-        ByteArray() { beginV = endV = maxV = NULL; }
+        ByteArray() : mapping() { beginV = endV = maxV = NULL; }
         ~ByteArray();
         size_t size() const { return endV - beginV; }
         void resize(size_t newsize, bool zero_it = true) {
@@ -119,6 +119,24 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
             swap(beginV,with.beginV);
             swap(endV,with.endV);
             swap(maxV,with.maxV);
+            mapping.swap(with.mapping);
+        }
+
+        /** True if the bytes live in a private (copy-on-write) file mapping
+            rather than on the heap.  Writes stay in this process; growing
+            the array past the mapped region copies it to the heap. */
+        bool isMapped() const { return mapping != NULL; }
+
+        /** Make this array hold [begin, end) of a file mapping; mapping
+            unmaps the region when the last array referring to it lets go. */
+        void setMapping(const boost::shared_ptr<void> &mapping, byte *begin, byte *end);
+
+        /** Make this array refer to [begin, end), which must be inside
+            the mapping held by from.  Used to hand uncompressed sections of a
+            mapped packed extent straight to the unpacked extent. */
+        void shareMapping(const ByteArray &from, byte *begin, byte *end) {
+            SINVARIANT(from.isMapped() && begin >= from.begin() && end <= from.end());
+            setMapping(from.mapping, begin, end);
         }
       
         typedef byte * iterator;
@@ -132,6 +150,30 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         // d5bb884b572b07590a8131710f01513577e24813, prior to 2007-10-25
         // will have a copy of the old code.
         static void initMallocTuning();
+
+        /** Counters for the pool that recycles the storage of large
+            ByteArrays.  Arrays of at least pool_min_bytes round their
+            capacity up to one of four size classes per power of two, and
+            on release their storage goes back to a pool shared by all
+            threads, up to the pool limit, rather than to malloc.  This
+            removes the mmap/munmap and page fault churn of unpacking,
+            compressing and building multi-megabyte extents one after
+            another. */
+        struct PoolStats {
+            uint64_t hits, misses; // allocations satisfied from the pool or not
+            uint64_t returned, discarded; // releases kept by the pool or freed
+            size_t pooled_bytes; // bytes of free buffers in the pool now
+        };
+
+        static const size_t pool_min_bytes = 64 * 1024;
+
+        static PoolStats getPoolStats();
+
+        /** Set the most bytes of free buffers the pool will hold on to
+            (default 128MiB); setting a smaller limit frees the excess
+            and 0 disables the pool. */
+        static void setPoolLimit(size_t max_bytes);
+
       private:
         void swap(byte * &a, byte * &b) {
             byte *tmp = a;
@@ -140,7 +182,9 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         }
       
         void copyResize(size_t newsize, bool zero_it);
+        void release();
         byte *beginV, *endV, *maxV;
+        boost::shared_ptr<void> mapping; // NULL unless the bytes are mmapped
     };
   
     /// \cond INTERNAL_ONLY
@@ -224,6 +268,14 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     static const Extent::byte compress_mode_snappy = 5;
     static const Extent::byte compress_mode_lz4 = 6;
     static const Extent::byte compress_mode_lz4hc = 7;
+    /** Not an algorithm: the fixed compression mode in the header of an extent whose fixed
+        data is stored a column at a time, since each column records its own mode. */
+    static const Extent::byte compress_mode_columnar = 0xFF;
+
+    /** Flags in the byte following the type name length in the packed header; readers
+        reject extents with flags they don't understand.  pack_flag_columnar_fixed means the
+        fixed data is stored a column at a time, see packDataSplit(). */
+    static const Extent::byte pack_flag_columnar_fixed = 1;
     /// \endcond
 
     // Should be equal to the number of constants compress_mode_{name}
@@ -283,6 +335,42 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
                       uint32_t *fixed_packed = NULL, 
                       uint32_t *variable_packed = NULL); 
 
+    /** What each compression algorithm did to one part (fixed or variable data) of an extent;
+        filled in by packDataSplit() so that callers can pick the algorithm to use for later
+        extents, see DataSeriesSink::setAdaptiveCompression(). */
+    struct CompressionSample {
+        /** in: also decompress each result and record the time taken */
+        bool time_unpack;
+        /** out: input size, and per algorithm the packed size or -1 if it wasn't tried or
+            didn't shrink the data.  packed_size[compress_mode_none] is the input size. */
+        int32 input_size, packed_size[num_comp_algs];
+        /** out: seconds to decompress, if time_unpack, 0 otherwise */
+        double unpack_seconds[num_comp_algs];
+
+        explicit CompressionSample(bool time_unpack = false) : time_unpack(time_unpack) {
+            reset(0);
+        }
+        void reset(int32 size);
+    };
+
+    /** As packData, but the fixed and variable parts of the extent are compressed with
+        separate sets of algorithms.  If fixed_sample or variable_sample are not NULL the results
+        of all the tried algorithms for that part are recorded in them.
+
+        If columnar_fixed is true, the fixed data is transposed so that the bytes of each
+        non-bool field form one stream (bools, null flags and padding share one more), and
+        each stream is compressed on its own.  This usually packs better for wide types
+        mixing timestamps, counters and flags, and lets unpacking skip columns; pack_null_compact
+        is not applied to columnar extents.  Files with columnar extents can't be read by
+        versions of DataSeries from before the format existed, see
+        DataSeriesSink::setColumnarFixed(). */
+    uint32_t packDataSplit(Extent::ByteArray &into, uint32_t fixed_compression_modes,
+                           uint32_t variable_compression_modes, uint32_t compression_level,
+                           bool columnar_fixed,
+                           CompressionSample *fixed_sample, CompressionSample *variable_sample,
+                           uint32_t *header_packed = NULL, uint32_t *fixed_packed = NULL, 
+                           uint32_t *variable_packed = NULL); 
+
     /** Loads an Extent from the external representation.
 
         \arg need_bitflip Indicates whether the endianness of
@@ -291,9 +379,17 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
         Preconditions:
         - The type of the data must be the type of this Extent.
 
+        \arg field_mask If not NULL, only the fields it selects are unpacked,
+        see ExtentType::unpackFieldMask().  The values of the other fields are
+        unspecified; the variable data is skipped entirely if no variable32
+        field is selected, and for columnar extents so are the streams of
+        unselected fields.  The post-uncompress hash check is only done if
+        all of the data was uncompressed.
+
         Note you can't unpack the same data twice, it may modify the
         input data */
-    void unpackData(Extent::ByteArray &from, bool need_bitflip);
+    void unpackData(Extent::ByteArray &from, bool need_bitflip,
+                    const std::vector<bool> *field_mask = NULL);
 
     /** Returns true if position is inside the fixed data for this extent, otherwise false */
     bool insideExtentFixed(byte *position) const {
@@ -399,6 +495,16 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // updates offset to the end of the extent
     static bool preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip);
 
+    // same as preadExtent, but if the fixed data is stored uncompressed, maps
+    // the extent from the file rather than copying it so that unpackData can
+    // use the mapped fixed data in place.  The file must not be modified or
+    // truncated while the extent (or any extent unpacked from it) is in use.
+    static bool mmapExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip);
+
+    // returns the packed size of the extent at offset by reading only its
+    // header; returns 0 if offset is at the tail of the file.
+    static uint64_t preadExtentSize(int fd, off64_t offset, bool need_bitflip);
+
     // returns true if it read amount bytes, returns false if it read
     // 0 bytes and eof_ok; aborts otherwise
     static bool checkedPread(int fd, off64_t offset, byte *into, int amount, 
@@ -447,14 +553,26 @@ class Extent : boost::noncopyable, public boost::enable_shared_from_this<Extent>
     // you are responsible for deleting the return buffer
     static Extent::ByteArray *compressBytes(byte *input, int32 input_size,
                                             int compression_modes,
-                                            int compression_level, byte *mode);
+                                            int compression_level, byte *mode,
+                                            CompressionSample *sample = NULL);
 
     static int32 uncompressBytes(byte *into, byte *from,
                                  byte compression_mode, int32 intosize,
                                  int32 fromsize);
 
+    // columnar fixed data, see packDataSplit()
+    Extent::ByteArray *compressFixedColumnar(Extent::ByteArray &fixed_coded, int32 nrecords,
+                                             int compression_modes, int compression_level,
+                                             byte *mode, CompressionSample *sample);
+    // returns false if some of the columns were skipped because of field_mask
+    bool uncompressFixedColumnar(byte *from, int32 fromsize, int32 nrecords,
+                                 bool fix_endianness, const std::vector<bool> *field_mask);
+
     void compactNulls(Extent::ByteArray &fixed_coded);
     void uncompactNulls(Extent::ByteArray &fixed_coded, int32_t &size);
+    bool canUseMappedFixed(const Extent::ByteArray &from, byte *compressed_fixed_begin,
+                           byte compressed_fixed_mode, int32 compressed_fixed_size,
+                           bool fix_endianness);
     friend class ExtentSeries;
     void createRecords(unsigned int nrecords); // will leave iterator pointing at the current record
     void init();
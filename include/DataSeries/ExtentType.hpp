@@ -183,6 +183,12 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
     static const ExtentType &getDataSeriesIndexTypeV0() FUNC_DEPRECATED {
         return *dataseries_index_type_v0;
     }
+    /** Returns the type of the extended index of a DataSeries file, which
+        adds the sizes, record count, compression modes and checksums of
+        each extent; see DataSeriesSource::getIndexV1() */
+    static const ExtentType::Ptr getDataSeriesIndexTypeV1Ptr() {
+        return dataseries_index_type_v1;
+    }
 
 
     // we have visible and invisible fields; visible fields are
@@ -305,6 +311,13 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
         whether the specified field is null. */
     static std::string nullableFieldname(const std::string &fieldname);
 
+    /** Returns which fields, indexed like the internal field list so including the
+        hidden null fields, have to be decoded for the named fields to be readable:
+        the fields themselves, their null fields, and the bases of any fields packed
+        relative to another field.  Names not in this type are ignored.  Used by
+        Extent::unpackData() to skip the work of unpacking the other fields. */
+    std::vector<bool> unpackFieldMask(const std::vector<std::string> &fields) const;
+
     /** Returns the XML associated with the given field as a @c std::string */
     std::string xmlFieldDesc(const std::string &column) const {
         int cnum = getColumnNumber(rep, column, false);
@@ -397,6 +410,7 @@ class ExtentType : boost::noncopyable, public boost::enable_shared_from_this<con
   private:
     static const ExtentType::Ptr dataseries_xml_type;
     static const ExtentType::Ptr dataseries_index_type_v0;
+    static const ExtentType::Ptr dataseries_index_type_v1;
 
     // a compelling case has been made that identifying fields by
     // column number is not necessary (the only use so far is for
@@ -234,6 +234,9 @@ class GeneralField {
     // interfaces; summary ostream is very slow
     virtual void write(FILE *to) = 0;
     virtual void write(std::ostream &to) = 0;
+    /// Append the value to to, formatted as write(FILE *) would print it; the integer
+    /// formats that fields print by default are converted without going through printf.
+    virtual void write(std::string &to) = 0;
 
     bool isNull() const {
         return typed_field.isNull();
@@ -323,6 +326,7 @@ class GF_Bool : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     // set(bool) -> copy
     // set(byte,int32,int64,double) -> val = from->val == 0
@@ -360,6 +364,7 @@ class GF_Byte : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     // set(bool) -> 1 if true, 0 if false
     // set(byte, int32, int64) -> val = from->val & 0xFF;
@@ -385,6 +390,7 @@ class GF_Int32 : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     virtual void set(GeneralField *from);
     virtual void set(const GeneralValue *from);
@@ -415,6 +421,7 @@ class GF_Int64 : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     virtual void set(GeneralField *from);
     virtual void set(const GeneralValue *from);
@@ -440,6 +447,7 @@ class GF_Double : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     virtual void set(GeneralField *from);
     virtual void set(const GeneralValue *from);
@@ -464,6 +472,7 @@ class GF_Variable32 : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     virtual void set(GeneralField *from);
     virtual void set(const GeneralValue *from);
@@ -506,6 +515,7 @@ class GF_FixedWidth : public GeneralField {
 
     virtual void write(FILE *to);
     virtual void write(std::ostream &to);
+    virtual void write(std::string &to);
 
     virtual void set(GeneralField *from);
     virtual void set(const GeneralValue *from);
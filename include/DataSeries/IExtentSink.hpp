@@ -43,6 +43,10 @@ namespace dataseries {
                 algorithm. */
             uint32_t num_var_per_alg[ Extent::num_comp_algs ];
 
+            /** Stores the number of Extents whose fixed-sized fields were compressed a column
+                at a time; these are not counted in num_fixed_per_alg. */
+            uint32_t num_fixed_columnar;
+
             uint64_t
             /** The total number of bytes in the Extents before compression. */
             unpacked_size,
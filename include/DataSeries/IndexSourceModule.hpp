@@ -16,6 +16,7 @@
 #include <Lintel/Deque.hpp>
 #include <Lintel/Stats.hpp>
 
+#include <DataSeries/DataSeriesCatalog.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
 
 /** \brief Base class for source modules that select a subset of the
@@ -52,12 +53,15 @@
 // decompression threads and prefetching threads across multiple new-style
 // index source modules which would reduce the number of threads and give us
 // better control over the priority of decompression, and the memory used
-// during it (effectively a global pool rather than a per-type pool).  While
-// making those changes, also fixing the code so that we have parallel
-// compressed reading would be a good idea.  With large disk subsystem
-// machines, and the really many cores we have now, it is not difficult to need
-// to have multiple threads reading in extents in order to read them fast
-// enough to keep the pipeline full.
+// during it (effectively a global pool rather than a per-type pool).  The
+// global pool part is done: modules started with n_unpack_threads == -1 share
+// one set of unpack threads and one unpacked byte budget, see
+// setSharedUnpackLimits().
+//
+// Compressed reading can now be done in parallel: sub-classes that hand a
+// shared DataSeriesSource to readCompressed() only queue the read, and a pool
+// of reader threads issues the preads.  Results still go through the
+// compressed queue in index order, so extents come out in the same order.
 
 class IndexSourceModule : public SourceModule {
   public:
@@ -69,11 +73,38 @@ class IndexSourceModule : public SourceModule {
     /** call this to start prefetching; if you don't call it, it will
         be automatically called when you call getExtent; Max
         compressed may slightly overrun because we don't know the size
-        of compressed extents until we read them. nthreads == -1 ==>
-        use # cpus */
+        of compressed extents until we read them. n_unpack_threads == -1 ==>
+        use the process-wide unpack pool shared with other index source
+        modules, otherwise start that many private unpack threads.
+        prefetch_max_unpacked still limits each module when using the
+        pool.  n_reader_threads is the number of threads issuing
+        compressed reads in parallel; more than one only helps for
+        sub-classes that use the shared pointer readCompressed(), and
+        is useful on disk arrays or SSDs that need multiple outstanding
+        reads to reach full bandwidth. */
     virtual void startPrefetching(unsigned prefetch_max_compressed = 8 * 1024 * 1024,
                                   unsigned prefetch_max_unpacked = 32 * 1024 * 1024,
-                                  int n_unpack_threads = -1);
+                                  int n_unpack_threads = -1,
+                                  int n_reader_threads = 1);
+    /** Set the size of the process-wide unpack pool; n_threads == -1 ==>
+        use # cpus.  The thread count takes effect the next time the pool
+        starts (when the first module joins an idle pool), the byte
+        budget takes effect immediately.  The budget limits the unpacked
+        bytes held across all modules using the pool. */
+    static void setSharedUnpackLimits(int n_threads = -1,
+                                      size_t max_unpacked_bytes = 256 * 1024 * 1024);
+
+    /** Only unpack the named fields (and the ones they depend on) in the
+        extents returned; the values of the other fields are unspecified, see
+        Extent::unpackData().  An empty list, the default, unpacks everything.
+        Must be called before prefetching starts. */
+    void setUnpackFields(const std::vector<std::string> &fields);
+
+    /** Open the input files through catalog, so that files it already knows about are opened
+        without reading their type extent and index.  Must be called before prefetching
+        starts. */
+    void setCatalog(const DataSeriesCatalog::Ptr &catalog);
+
     /** call this to start the index source module over again from the 
         beginning */
     virtual void resetPos();
@@ -98,6 +129,8 @@ class IndexSourceModule : public SourceModule {
         uint64_t unpack_no_upstream, unpack_downstream_full;
         uint64_t unpack_yield_front, unpack_yield_ready;
         uint64_t skip_unpack_signal;
+        uint64_t unpack_wait_read, reader_no_work, reads_outstanding_full;
+        uint64_t unpack_pool_full;
 
         Stats active_unpack_stats;
         int active_unpackers;
@@ -108,7 +141,8 @@ class IndexSourceModule : public SourceModule {
                 : nextents(0), consumer(0), compressed_downstream_full(0),
                   unpack_no_upstream(0), unpack_downstream_full(0),
                   unpack_yield_front(0), unpack_yield_ready(0),
-                  skip_unpack_signal(0), active_unpackers(0)
+                  skip_unpack_signal(0), unpack_wait_read(0), reader_no_work(0),
+                  reads_outstanding_full(0), unpack_pool_full(0), active_unpackers(0)
         { }
     };
 
@@ -121,22 +155,41 @@ class IndexSourceModule : public SourceModule {
         Extent::ByteArray bytes;
         ExtentType::Ptr type;
         Extent::Ptr unpacked;
-        bool need_bitflip;
+        bool need_bitflip, reading;
         std::string uncompressed_type, extent_source;
         int64_t extent_source_offset;
+        /// non-NULL until one of the reader threads has filled in bytes
+        boost::shared_ptr<DataSeriesSource> read_source;
         PrefetchExtent() 
-                : type(), unpacked(), need_bitflip(false), extent_source_offset(-1) { }
+                : type(), unpacked(), need_bitflip(false), reading(false),
+                  extent_source_offset(-1), read_source() { }
+
+        bool readPending() {
+            return read_source != NULL;
+        }
     };
 
   protected:
     bool startedPrefetching() { return prefetch != NULL; }
 
+    /** utility function to open an input file, through the catalog if there is one */
+    boost::shared_ptr<DataSeriesSource> openSource(const std::string &filename);
+
     /** utility function to read compressed data, it will unlock and relock
         the mutex associated with prefetching */
     PrefetchExtent *readCompressed(DataSeriesSource *dss,
                                    off64_t offset, 
                                    const std::string &uncompressed_type);
 
+    /** utility function to queue a read of compressed data; the mutex
+        associated with prefetching stays locked, and the actual read is
+        done later by one of the reader threads.  The reader keeps a
+        reference to dss, so it is safe for the caller to drop its own
+        reference before the read completes. */
+    PrefetchExtent *readCompressed(const boost::shared_ptr<DataSeriesSource> &dss,
+                                   off64_t offset,
+                                   const std::string &uncompressed_type);
+
     /** function that is called from the prefetch thread to restart; parent
         will clear out any remaining data */
     virtual void lockedResetModule() = 0;
@@ -155,10 +208,21 @@ class IndexSourceModule : public SourceModule {
 
     friend class IndexSourceModuleCompressedPrefetchThread;
     friend class IndexSourceModuleUnpackThread;
+    friend class IndexSourceModuleReaderThread;
+    friend class IndexSourceModuleUnpackPool;
     void compressedPrefetchThread();
     void unpackThread();
+    void readerThread();
+    /// called from the shared unpack pool; returns true if it unpacked an extent
+    bool sharedUnpackOne();
+    /// unpack the front of the compressed queue if possible; unlocks and
+    /// relocks the mutex while unpacking
+    bool lockedUnpackFront();
+    void lockedSignalUnpack();
 
     bool getting_extent;
+    std::vector<std::string> unpack_fields;
+    DataSeriesCatalog::Ptr catalog;
 
     struct Queue {
         Queue(unsigned _limit) : cur(0), limit(_limit) { }
@@ -181,6 +245,9 @@ class IndexSourceModule : public SourceModule {
             cur += size;
             data.push_back(pe);
         }
+        void addSize(unsigned size) {
+            cur += size;
+        }
         void subtract(unsigned size) {
             SINVARIANT(cur >= size);
             cur -= size;
@@ -203,14 +270,17 @@ class IndexSourceModule : public SourceModule {
         Queue compressed, unpacked;
         WaitStats stats;
         PThread *compressed_prefetch_thread;
-        std::vector<PThread *> unpack_threads;
+        std::vector<PThread *> unpack_threads, reader_threads;
         PThreadMutex mutex;
-        PThreadCond compressed_cond, unpack_cond, ready_cond;
-        bool source_done;
+        PThreadCond compressed_cond, unpack_cond, ready_cond, read_cond;
+        bool source_done, shared_unpack;
         uint32_t abort_prefetching; // number of threads remaining to abort 
+        uint32_t pending_reads; // entries in compressed that still need to be read
 
         PrefetchInfo(unsigned cmm, unsigned tum) 
-                : compressed(cmm), unpacked(tum), source_done(false), abort_prefetching(0)
+                : compressed(cmm), unpacked(tum), source_done(false), shared_unpack(false),
+                  abort_prefetching(0),
+                  pending_reads(0)
         { }
 
         bool allDone() {
@@ -220,6 +290,21 @@ class IndexSourceModule : public SourceModule {
         bool unpackedReady() {
             return unpacked.empty() == false && unpacked.front()->unpacked != NULL;
         }
+
+        /// Keep a couple of reads queued per reader so none of them go idle
+        /// between preads, but don't walk arbitrarily far ahead of the data.
+        bool canQueueRead() {
+            return pending_reads < 2 * reader_threads.size();
+        }
+
+        /// The front of the compressed queue has been read, and there is
+        /// room for it in the unpacked queue.
+        bool canUnpackFront() {
+            return !compressed.empty() && !compressed.front()->readPending()
+                && unpacked.can_add(compressed.front());
+        }
+
+        PrefetchExtent *nextToRead();
     };
 
     PrefetchInfo *prefetch; // NULL until startPrefetching() is called
@@ -94,20 +94,30 @@ class MinMaxIndexModule : public IndexSourceModule {
                       std::vector<selector> intersection_list,
                       const std::string &sort_fieldname);
 
+    /** as above, but reads the index from each of index_filenames.  Index
+        rows with an empty filename (as embedded by
+        DataSeriesSink::addMinMaxIndex) refer to the file they are in, so the
+        data files themselves can be passed here. */
+    MinMaxIndexModule(const std::vector<std::string> &index_filenames,
+                      const std::string &index_type,
+                      std::vector<selector> intersection_list,
+                      const std::string &sort_fieldname,
+                      const bool _use_or = false);
+
   protected:
     virtual void lockedResetModule();
 
     virtual PrefetchExtent *lockedGetCompressedExtent();
 
   private:
-    void init(const std::string &index_filename,
+    void init(const std::vector<std::string> &index_filenames,
               std::vector<selector> &intersection_list,
               const std::string &sort_fieldname);
 
     std::vector<kept_extent> kept_extents;
     const std::string index_type;
     unsigned cur_extent;
-    DataSeriesSource *cur_source;
+    boost::shared_ptr<DataSeriesSource> cur_source;
     std::string cur_source_filename;
     bool use_or;
 };
@@ -0,0 +1,71 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Periodic snapshots of the statistics of every module
+*/
+
+#ifndef DATASERIES_MODULE_STATS_LOGGER_HPP
+#define DATASERIES_MODULE_STATS_LOGGER_HPP
+
+#include <iosfwd>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesModule.hpp>
+
+/** \brief Records DataSeriesModule::ModuleStats for every module while a pipeline runs.
+
+    Takes a snapshot of the statistics of every module that exists each interval, and a final
+    one when stopped, so that the throughput and blocked time of each stage can be followed over
+    a long run.  Snapshots are printed as text, or written as a DataSeries file with one row
+    per module per snapshot of the type in stats_xml; the counters are cumulative, so rates
+    are differences between successive snapshots. */
+class ModuleStatsLogger : boost::noncopyable {
+  public:
+    /** Print snapshots to to */
+    ModuleStatsLogger(std::ostream &to, double interval_seconds);
+
+    /** Write snapshots to the DataSeries file filename */
+    ModuleStatsLogger(const std::string &filename, double interval_seconds);
+
+    /** Calls stop() if it hasn't been called */
+    ~ModuleStatsLogger();
+
+    /** Start taking snapshots every interval in a separate thread */
+    void start();
+
+    /** Take a snapshot now */
+    void snapshot();
+
+    /** Stop the thread if it was started, take a final snapshot and close the file */
+    void stop();
+
+    static const std::string stats_xml;
+
+  private:
+    class Thread;
+    friend class Thread;
+
+    void init();
+    void loggerThread();
+
+    std::ostream *to;
+    boost::scoped_ptr<DataSeriesSink> sink;
+    ExtentSeries series;
+    boost::scoped_ptr<OutputModule> output;
+    double interval_seconds;
+
+    PThreadMutex mutex;
+    boost::scoped_ptr<Thread> thread;
+    bool stopping, stopped;
+};
+
+#endif
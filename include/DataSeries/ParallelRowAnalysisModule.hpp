@@ -0,0 +1,101 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Run a row analysis over several threads
+*/
+
+#ifndef __DATASERIES_PARALLEL_ROW_ANALYSIS_MODULE_H
+#define __DATASERIES_PARALLEL_ROW_ANALYSIS_MODULE_H
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/RowAnalysisModule.hpp>
+
+/** \brief Row analysis spread over several threads, each with its own copy of
+    the analysis state, merged at the end.
+
+    * Each worker thread gets its own RowAnalysisModule from the factory, with
+    * its own ExtentSeries and Fields, and runs it over whichever extents it
+    * pulls from the source.  Once the source is exhausted, the merge function
+    * folds each worker's analysis into the first one that got an extent,
+    * completeProcessing() is called on the result, and printResult() prints
+    * it.  Analyses that never got an extent are not merged.  Extents are handed
+    * on to the next module as the workers finish with them, so the order of
+    * both the rows each analysis sees and the extents returned is arbitrary;
+    * this is only useful for analyses that don't depend on order, like
+    * counts, sums, histograms and group-bys.
+    *
+    * This is a RowAnalysisModule so that it can sit in a SequenceModule and
+    * be printed by RowAnalysisModule::printAllResults like the analysis it
+    * runs.  A where expression set with setWhereExpr() before the first
+    * getSharedExtent() is passed on to every worker's analysis, replacing any
+    * set by the factory. */
+class ParallelRowAnalysisModule : public RowAnalysisModule {
+  public:
+    /// Make an analysis that reads from source
+    typedef boost::function<RowAnalysisModule *(DataSeriesModule &source)> Factory;
+    /// Fold the state of from into into
+    typedef boost::function<void (RowAnalysisModule &into, RowAnalysisModule &from)> Merge;
+
+    /** n_threads == -1 ==> one thread per CPU.  Workers stop taking extents
+        from the source when more than max_queued_bytes of analyzed extents
+        are waiting to be returned by getSharedExtent(). */
+    ParallelRowAnalysisModule(DataSeriesModule &source, const Factory &factory,
+                              const Merge &merge, int n_threads = -1,
+                              size_t max_queued_bytes = 64*1024*1024);
+    virtual ~ParallelRowAnalysisModule();
+
+    /** Returns the analyzed extents in the order the workers finish them;
+        returns NULL once every extent has been analyzed and the results
+        have been merged. */
+    virtual Extent::Ptr getSharedExtent();
+
+    /** never called; the workers' analyses process the rows */
+    virtual void processRow();
+
+    /** Prints the merged result */
+    virtual void printResult();
+
+    /** The merged analysis; valid once getSharedExtent() has returned NULL */
+    RowAnalysisModule &getResult();
+
+    /// \cond INTERNAL_ONLY
+    void workerThread(unsigned worker_num);
+    /// \endcond
+
+  private:
+    class Worker;
+    class WorkerSource;
+
+    void startWorkers();
+    void finish();
+
+    Factory factory;
+    Merge merge;
+    int n_threads;
+    size_t max_queued_bytes, queued_bytes;
+    std::vector<Worker *> workers;
+    std::vector<RowAnalysisModule *> analyses;
+
+    PThreadMutex source_mutex; // serializes getSharedExtent() on the source
+    bool source_exhausted; // under source_mutex
+
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<Extent::Ptr> analyzed;
+    unsigned running_workers;
+    bool started, stop_workers, finished;
+    RowAnalysisModule *result; // set by finish()
+};
+
+#endif
@@ -0,0 +1,91 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Run a chain of modules on several threads
+*/
+
+#ifndef __DATASERIES_PARALLEL_SEQUENCE_MODULE_H
+#define __DATASERIES_PARALLEL_SEQUENCE_MODULE_H
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/SequenceModule.hpp>
+
+/** \brief Runs a chain of modules, as built in a SequenceModule, on several threads at once.
+
+    * Each worker thread gets its own chain from the factory, which adds modules to a
+    * SequenceModule whose head hands out extents from the shared source one at a time.  The
+    * workers pull their chains, and each extent the head hands out (a "morsel") goes through
+    * one chain on one thread, so modules that filter, project or transform extents run in
+    * parallel without any changes to them.
+    *
+    * The modules in the chain have to treat each extent on its own: everything a module
+    * returns has to come from the last extent it got, and it has to return all of that
+    * before it asks for another.  Modules that drop extents, or make a new extent from each
+    * one they get, work this way; modules that sort, merge, group or count across extents
+    * don't, and belong after the ParallelSequenceModule.
+    *
+    * If in_order is true, getSharedExtent() returns the extents in the order of the morsels
+    * they came from, so the output is the same as running the chain on one thread; otherwise
+    * extents are returned as soon as any worker finishes them, which avoids holding up
+    * everything behind a slow morsel for modules that don't care about order. */
+class ParallelSequenceModule : public DataSeriesModule {
+  public:
+    /// Add modules to chain, starting from chain.tail()
+    typedef boost::function<void (SequenceModule &chain)> Factory;
+
+    /** n_threads == -1 ==> one thread per CPU.  Workers stop taking morsels from the source
+        when more than max_queued_bytes of finished extents are waiting to be returned by
+        getSharedExtent(). */
+    ParallelSequenceModule(DataSeriesModule &source, const Factory &factory,
+                           bool in_order = true, int n_threads = -1,
+                           size_t max_queued_bytes = 64*1024*1024);
+    virtual ~ParallelSequenceModule();
+
+    /** Returns the extents from the chains' tails; NULL once the source is exhausted and
+        every chain has finished. */
+    virtual Extent::Ptr getSharedExtent();
+
+    /// \cond INTERNAL_ONLY
+    class Worker;
+    void workerThread(Worker &worker);
+    Extent::Ptr nextMorsel(Worker &worker);
+    /// \endcond
+
+  private:
+    struct Morsel;
+    class WorkerSource;
+
+    void startWorkers();
+    void stopWorkers();
+    void finishMorsel(Worker &worker);
+
+    DataSeriesModule &source;
+    Factory factory;
+    bool in_order;
+    int n_threads;
+    size_t max_queued_bytes, queued_bytes;
+    std::vector<Worker *> workers;
+
+    PThreadMutex source_mutex; // serializes getSharedExtent() on the source
+    bool source_exhausted; // under source_mutex
+
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<Morsel *> morsels; // in_order: handed out and not yet returned, in source order
+    Deque<Extent::Ptr> finished; // !in_order: ready to return
+    unsigned running_workers;
+    bool started, stop;
+};
+
+#endif
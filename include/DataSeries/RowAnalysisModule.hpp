@@ -12,6 +12,8 @@
 #ifndef __ROW_ANALYSIS_MODULE_H
 #define __ROW_ANALYSIS_MODULE_H
 
+#include <vector>
+
 #include <DataSeries/DataSeriesModule.hpp>
 
 class DSExpr;
@@ -104,6 +106,9 @@ class RowAnalysisModule : public DataSeriesModule {
 
     std::string where_expr_str;
     DSExpr *where_expr;
+
+  private:
+    std::vector<bool> where_selected; // rows of the current extent that match where_expr
 };
 
 #endif
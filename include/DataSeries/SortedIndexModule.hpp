@@ -47,53 +47,19 @@ class SortedIndexModule : public IndexSourceModule {
               const std::string &fieldname)
                 : index_type(index_type)
         {
-            // we are going to read all index entries for the fieldname specified,
-            // set up series and relevant fields to read from it
-            TypeIndexModule tim("DSIndex::Extent::MinMax::" + index_type);
-            tim.addSource(index_filename);
-            ExtentSeries s;
-            Int64Field extent_offset(s, "extent_offset");
-            Variable32Field filename(s, "filename");
-            FieldType min_field(s, "min:" + fieldname);
-            FieldType max_field(s, "max:" + fieldname);
-            // keep track of current filename and source being processed
-            // along with the index for that filename
-            std::string cur_fname("");
-            boost::shared_ptr<DataSeriesSource> cur_source;
-            IndexEntryVector *cur_index = NULL;
-            // these variables are used to check if input file is sorted
-            ValueType last_max; 
-            while (true) {
-                boost::shared_ptr<Extent> e(tim.getSharedExtent());
-                if (!e) {
-                    break;
-                }
-                s.setExtent(e);
-                for (; s.morerecords(); ++s) {
-                    // check to see if this is a new set of per-file entries
-                    if (cur_fname != filename.stringval()) {
-                        cur_fname = filename.stringval();
-                        cur_source.reset(new DataSeriesSource(cur_fname, false));
-                        index.push_back(IndexEntryVector());
-                        cur_index = &index[index.size()-1];
-                    }
-                    if (!cur_index->empty()) {
-                        if (!less_than(min_field.val(), last_max)) {
-                            // ok
-                        } else {
-                            tim.close(); // we're dead, allow for exception to be raised
-                            FATAL_ERROR(boost::format("file %s is not sorted, %s > %s") 
-                                        % cur_fname % last_max % min_field.val());
-                        }
-                    }
-                    last_max = max_field.val();
+            load(std::vector<std::string>(1, index_filename), fieldname);
+        }
 
-                    cur_index->push_back(IndexEntry(cur_source,
-                                                    min_field.val(), max_field.val(),
-                                                    extent_offset.val()));
-                }
-            }
-            tim.close();
+        /** Create a new Index from several index files.  Index rows with an
+            empty filename (as embedded by DataSeriesSink::addMinMaxIndex)
+            refer to the file they are in, so the data files themselves can be
+            used as index files. */
+        Index(const std::vector<std::string> &index_filenames,
+              const std::string &index_type,
+              const std::string &fieldname)
+                : index_type(index_type)
+        {
+            load(index_filenames, fieldname);
         }
 
         /** Destructor */
@@ -150,6 +116,63 @@ class SortedIndexModule : public IndexSourceModule {
 
       private:
         typedef std::vector<IndexEntry> IndexEntryVector; // an index for a single file
+
+        void load(const std::vector<std::string> &index_filenames,
+                  const std::string &fieldname) {
+            // we are going to read all index entries for the fieldname specified,
+            // set up series and relevant fields to read from it
+            TypeIndexModule tim("DSIndex::Extent::MinMax::" + index_type);
+            BOOST_FOREACH(const std::string &index_filename, index_filenames) {
+                tim.addSource(index_filename);
+            }
+            ExtentSeries s;
+            Int64Field extent_offset(s, "extent_offset");
+            Variable32Field filename(s, "filename");
+            FieldType min_field(s, "min:" + fieldname);
+            FieldType max_field(s, "max:" + fieldname);
+            // keep track of current filename and source being processed
+            // along with the index for that filename
+            std::string cur_fname("");
+            boost::shared_ptr<DataSeriesSource> cur_source;
+            IndexEntryVector *cur_index = NULL;
+            // these variables are used to check if input file is sorted
+            ValueType last_max; 
+            while (true) {
+                boost::shared_ptr<Extent> e(tim.getSharedExtent());
+                if (!e) {
+                    break;
+                }
+                s.setExtent(e);
+                for (; s.morerecords(); ++s) {
+                    // an empty filename is an index embedded in the data file
+                    const std::string fname(filename.size() == 0 ? e->extent_source
+                                            : filename.stringval());
+                    // check to see if this is a new set of per-file entries
+                    if (cur_fname != fname) {
+                        cur_fname = fname;
+                        cur_source.reset(new DataSeriesSource(cur_fname, false));
+                        index.push_back(IndexEntryVector());
+                        cur_index = &index[index.size()-1];
+                    }
+                    if (!cur_index->empty()) {
+                        if (!less_than(min_field.val(), last_max)) {
+                            // ok
+                        } else {
+                            tim.close(); // we're dead, allow for exception to be raised
+                            FATAL_ERROR(boost::format("file %s is not sorted, %s > %s") 
+                                        % cur_fname % last_max % min_field.val());
+                        }
+                    }
+                    last_max = max_field.val();
+
+                    cur_index->push_back(IndexEntry(cur_source,
+                                                    min_field.val(), max_field.val(),
+                                                    extent_offset.val()));
+                }
+            }
+            tim.close();
+        }
+
         std::vector<IndexEntryVector> index; // index for all indexed files
         const std::string index_type; 
         LessThan less_than;
@@ -236,7 +259,7 @@ class SortedIndexModule : public IndexSourceModule {
         }
 
         SINVARIANT(cur_extent < extents.size());
-        PrefetchExtent *ret = readCompressed(extents[cur_extent].source.get(), 
+        PrefetchExtent *ret = readCompressed(extents[cur_extent].source, 
                                              extents[cur_extent].offset,
                                              index_type);
     
@@ -43,7 +43,7 @@ class TypeFilterModule : public IndexSourceModule {
     TypeFilterModule(Filter &f)
     : IndexSourceModule(), filter(f), index_series(ExtentSeries::typeExact),
       extent_offset(index_series, "offset"), extent_type(index_series, "extenttype"),
-      cur_file(0), cur_source(NULL)
+      cur_file(0), cur_source()
     { }
 
     void addSource(const std::string &filename) {
@@ -62,7 +62,7 @@ class TypeFilterModule : public IndexSourceModule {
                     INVARIANT(!input_files.empty(), "type index module had no input files??");
                     return NULL;
                 }
-                cur_source = new DataSeriesSource(input_files[cur_file]);
+                cur_source.reset(new DataSeriesSource(input_files[cur_file]));
                 INVARIANT(cur_source->index_extent != NULL,
                           "can't handle source with null index extent\n");
                 index_series.setExtent(cur_source->index_extent);
@@ -77,8 +77,7 @@ class TypeFilterModule : public IndexSourceModule {
             }
             if (index_series.morerecords() == false) {
                 index_series.clearExtent();
-                delete cur_source;
-                cur_source = NULL;
+                cur_source.reset();
                 ++cur_file;
             }
         }
@@ -93,7 +92,7 @@ class TypeFilterModule : public IndexSourceModule {
 
   private:
     unsigned int cur_file;
-    DataSeriesSource *cur_source;
+    boost::shared_ptr<DataSeriesSource> cur_source;
     std::vector<std::string> input_files;
 };
 
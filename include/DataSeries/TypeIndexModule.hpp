@@ -65,7 +65,7 @@ class TypeIndexModule : public IndexSourceModule {
     const ExtentType::Ptr matchType(); // May return NULL
 
     unsigned int cur_file;
-    DataSeriesSource *cur_source;
+    boost::shared_ptr<DataSeriesSource> cur_source;
     std::vector<std::string> inputFiles;
     ExtentType::Ptr my_type;
 };
@@ -18,17 +18,31 @@ struct commonPackingArgs {
     int compress_level;
     int compress_modes;
     int extent_size;
+    // see DataSeriesSink::setAdaptiveCompression; 0 is off
+    int adaptive_sample_interval;
+    double unpack_bytes_per_second;
+    // see DataSeriesSink::setColumnarFixed
+    bool columnar_fixed;
+    // see DataSeriesSink::setIndexV1
+    bool index_v1;
     commonPackingArgs() 
             : compress_level(9), 
               compress_modes(Extent::compress_all), 
-              extent_size(-1)
+              extent_size(-1), adaptive_sample_interval(0), unpack_bytes_per_second(0),
+              columnar_fixed(false), index_v1(false)
     { }
 };
 
+class DataSeriesSink;
+
 // ignores unrecognized arguments, stops getting arguments at a --
 void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs);
 const std::string packingOptions();
 
+// applies the options that are set on the sink rather than passed to its
+// constructor; call before sink.writeExtentLibrary()
+void setSinkPackingArgs(DataSeriesSink &sink, const commonPackingArgs &commonArgs);
+
 // Provided for backwards compatability, checks for arguments passed in the
 // old format (e.g. --compress-lzf instead of -- compress lzf).
 bool oldStyle(char* argv[], int& cur_arg,  int& num_munged_args, 
@@ -0,0 +1,274 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    DataSeriesCatalog implementation
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <boost/foreach.hpp>
+
+#include <Lintel/LintelLog.hpp>
+
+#include <DataSeries/DataSeriesCatalog.hpp>
+#include <DataSeries/DataSeriesModule.hpp>
+#include <DataSeries/DataSeriesSink.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+// The catalog is three tables; rows of the type and index tables refer to a file by its row
+// number in the file table.  Extent types are almost always repeated from one file to the next,
+// so pack_unique keeps the type table small.
+
+static const string catalog_file_xml =
+    "<ExtentType name=\"DataSeries: CatalogFile\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"variable32\" name=\"filename\" />\n"
+    "  <field type=\"int64\" name=\"mtime_nanosec\" />\n"
+    "  <field type=\"int64\" name=\"file_size\" />\n"
+    "  <field type=\"bool\" name=\"need_bitflip\" />\n"
+    "  <field type=\"int64\" name=\"first_extent_offset\" />\n"
+    "  <field type=\"int64\" name=\"index_offset\" />\n"
+    "</ExtentType>\n";
+
+static const string catalog_type_xml =
+    "<ExtentType name=\"DataSeries: CatalogType\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"int32\" name=\"file\" />\n"
+    "  <field type=\"variable32\" name=\"xmltype\" pack_unique=\"yes\" />\n"
+    "</ExtentType>\n";
+
+static const string catalog_index_xml =
+    "<ExtentType name=\"DataSeries: CatalogIndex\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"int32\" name=\"file\" pack_relative=\"file\" />\n"
+    "  <field type=\"int64\" name=\"offset\" pack_relative=\"offset\" />\n"
+    "  <field type=\"variable32\" name=\"extenttype\" pack_unique=\"yes\" />\n"
+    "</ExtentType>\n";
+
+DataSeriesCatalog::DataSeriesCatalog(const string &catalog_path)
+    : catalog_path(catalog_path), mutex(), files(), is_changed(false)
+{
+    struct stat stat_buf;
+    if (stat(catalog_path.c_str(), &stat_buf) == 0) {
+        read();
+    } else {
+        INVARIANT(errno == ENOENT, format("error on catalog '%s' for stat: %s")
+                  % catalog_path % strerror(errno));
+    }
+}
+
+DataSeriesCatalog::~DataSeriesCatalog() {
+    if (is_changed) {
+        LintelLogDebug("DataSeriesCatalog", format("discarding unsaved changes to %s")
+                       % catalog_path);
+    }
+}
+
+boost::shared_ptr<DataSeriesSource> DataSeriesCatalog::openSource(const string &filename) {
+    DataSeriesSource::Metadata cached;
+    {
+        PThreadScopedLock lock(mutex);
+        DataSeriesSource::Metadata *entry = files.lookup(filename);
+        if (entry != NULL) {
+            cached = *entry;
+        }
+    }
+
+    boost::shared_ptr<DataSeriesSource> ret;
+    if (cached.index_extent != NULL) {
+        ret.reset(new DataSeriesSource(filename, cached));
+    } else {
+        ret.reset(new DataSeriesSource(filename));
+    }
+    DataSeriesSource::Metadata metadata(ret->getMetadata());
+    if (metadata.mtime_nanosec != cached.mtime_nanosec
+        || metadata.file_size != cached.file_size) {
+        LintelLogDebug("DataSeriesCatalog", format("%s metadata for %s")
+                       % (cached.index_extent == NULL ? "adding" : "refreshing") % filename);
+        PThreadScopedLock lock(mutex);
+        files[filename] = metadata;
+        is_changed = true;
+    }
+    return ret;
+}
+
+bool DataSeriesCatalog::changed() {
+    PThreadScopedLock lock(mutex);
+    return is_changed;
+}
+
+size_t DataSeriesCatalog::size() {
+    PThreadScopedLock lock(mutex);
+    return files.size();
+}
+
+void DataSeriesCatalog::read() {
+    DataSeriesSource source(catalog_path);
+    ExtentTypeLibrary &library(source.getLibrary());
+    ExtentType::Ptr file_type(library.getTypeByNamePtr("DataSeries: CatalogFile"));
+    ExtentType::Ptr type_type(library.getTypeByNamePtr("DataSeries: CatalogType"));
+    ExtentType::Ptr index_type(library.getTypeByNamePtr("DataSeries: CatalogIndex"));
+
+    ExtentSeries file_series, type_series, index_series;
+    Variable32Field filename(file_series, "filename");
+    Int64Field mtime_nanosec(file_series, "mtime_nanosec"), file_size(file_series, "file_size");
+    BoolField need_bitflip(file_series, "need_bitflip");
+    Int64Field first_extent_offset(file_series, "first_extent_offset");
+    Int64Field index_offset(file_series, "index_offset");
+    Int32Field type_file(type_series, "file");
+    Variable32Field xmltype(type_series, "xmltype");
+    Int32Field index_file(index_series, "file");
+    Int64Field offset(index_series, "offset");
+    Variable32Field extenttype(index_series, "extenttype");
+
+    vector<string> filenames;
+    vector<DataSeriesSource::Metadata> metadata;
+    vector<ExtentSeries *> indices; // writing into each file's index extent
+    vector<Int64Field *> index_offsets;
+    vector<Variable32Field *> index_types;
+    HashMap<string, ExtentType::Ptr> xml_to_type; // skip the lock in sharedExtentTypePtr
+
+    // The file table is written first, so all of a file's rows come after its file row.
+    while (true) {
+        Extent::Ptr e(source.readExtent());
+        if (e == NULL) {
+            break;
+        }
+        if (e->getTypePtr() == file_type) {
+            for (file_series.setExtent(e); file_series.more(); file_series.next()) {
+                filenames.push_back(filename.stringval());
+                metadata.push_back(DataSeriesSource::Metadata());
+                DataSeriesSource::Metadata &m(metadata.back());
+                m.mtime_nanosec = mtime_nanosec.val();
+                m.file_size = file_size.val();
+                m.need_bitflip = need_bitflip.val();
+                m.first_extent_offset = first_extent_offset.val();
+                m.index_extent.reset(new Extent(ExtentType::getDataSeriesIndexTypeV0Ptr()));
+                m.index_extent->extent_source = filenames.back();
+                m.index_extent->extent_source_offset = index_offset.val();
+                indices.push_back(new ExtentSeries(m.index_extent));
+                index_offsets.push_back(new Int64Field(*indices.back(), "offset"));
+                index_types.push_back(new Variable32Field(*indices.back(), "extenttype"));
+            }
+        } else if (e->getTypePtr() == type_type) {
+            for (type_series.setExtent(e); type_series.more(); type_series.next()) {
+                INVARIANT(type_file.val() >= 0
+                          && static_cast<size_t>(type_file.val()) < metadata.size(),
+                          format("bad file %d in catalog %s") % type_file.val() % catalog_path);
+                ExtentType::Ptr &type(xml_to_type[xmltype.stringval()]);
+                if (type == NULL) {
+                    type = ExtentTypeLibrary::sharedExtentTypePtr(xmltype.stringval());
+                }
+                metadata[type_file.val()].types.push_back(type);
+            }
+        } else if (e->getTypePtr() == index_type) {
+            for (index_series.setExtent(e); index_series.more(); index_series.next()) {
+                INVARIANT(index_file.val() >= 0
+                          && static_cast<size_t>(index_file.val()) < metadata.size(),
+                          format("bad file %d in catalog %s") % index_file.val() % catalog_path);
+                int32_t f = index_file.val();
+                indices[f]->newRecord();
+                index_offsets[f]->set(offset.val());
+                index_types[f]->set(extenttype.val(), extenttype.size());
+            }
+        } else {
+            // the catalog's own indices
+        }
+    }
+
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        files[filenames[i]] = metadata[i];
+        delete index_types[i];
+        delete index_offsets[i];
+        delete indices[i];
+    }
+    LintelLogDebug("DataSeriesCatalog", format("read %d files from %s")
+                   % filenames.size() % catalog_path);
+}
+
+void DataSeriesCatalog::save() {
+    PThreadScopedLock lock(mutex);
+    if (!is_changed) {
+        return;
+    }
+
+    string tmp_path(str(format("%s.tmp-%d") % catalog_path % getpid()));
+    {
+        ExtentTypeLibrary library;
+        ExtentType::Ptr file_type(library.registerTypePtr(catalog_file_xml));
+        ExtentType::Ptr type_type(library.registerTypePtr(catalog_type_xml));
+        ExtentType::Ptr index_type(library.registerTypePtr(catalog_index_xml));
+
+        DataSeriesSink sink(tmp_path,
+                            Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
+        sink.writeExtentLibrary(library);
+
+        ExtentSeries file_series, type_series, index_series;
+        OutputModule file_out(sink, file_series, file_type, 96*1024);
+        OutputModule type_out(sink, type_series, type_type, 96*1024);
+        OutputModule index_out(sink, index_series, index_type, 96*1024);
+        Variable32Field filename(file_series, "filename");
+        Int64Field mtime_nanosec(file_series, "mtime_nanosec"), file_size(file_series, "file_size");
+        BoolField need_bitflip(file_series, "need_bitflip");
+        Int64Field first_extent_offset(file_series, "first_extent_offset");
+        Int64Field index_offset(file_series, "index_offset");
+        Int32Field type_file(type_series, "file");
+        Variable32Field xmltype(type_series, "xmltype");
+        Int32Field index_file(index_series, "file");
+        Int64Field offset(index_series, "offset");
+        Variable32Field extenttype(index_series, "extenttype");
+
+        int32_t file_num = 0;
+        for (HashMap<string, DataSeriesSource::Metadata>::iterator i = files.begin();
+             i != files.end(); ++i, ++file_num) {
+            const DataSeriesSource::Metadata &m(i->second);
+            file_out.newRecord();
+            filename.set(i->first);
+            mtime_nanosec.set(m.mtime_nanosec);
+            file_size.set(m.file_size);
+            need_bitflip.set(m.need_bitflip);
+            first_extent_offset.set(m.first_extent_offset);
+            index_offset.set(m.index_extent->extent_source_offset);
+        }
+        // Separate pass so that every file row is written before the rows that refer to it
+        file_out.close();
+
+        file_num = 0;
+        for (HashMap<string, DataSeriesSource::Metadata>::iterator i = files.begin();
+             i != files.end(); ++i, ++file_num) {
+            const DataSeriesSource::Metadata &m(i->second);
+            BOOST_FOREACH(const ExtentType::Ptr &type, m.types) {
+                type_out.newRecord();
+                type_file.set(file_num);
+                xmltype.set(type->getXmlDescriptionString());
+            }
+            ExtentSeries s(m.index_extent);
+            Int64Field in_offset(s, "offset");
+            Variable32Field in_extenttype(s, "extenttype");
+            for (; s.more(); s.next()) {
+                index_out.newRecord();
+                index_file.set(file_num);
+                offset.set(in_offset.val());
+                extenttype.set(in_extenttype.val(), in_extenttype.size());
+            }
+        }
+        type_out.close();
+        index_out.close();
+        sink.close();
+    }
+    INVARIANT(rename(tmp_path.c_str(), catalog_path.c_str()) == 0,
+              format("rename %s to %s failed: %s") % tmp_path % catalog_path % strerror(errno));
+    is_changed = false;
+    LintelLogDebug("DataSeriesCatalog", format("wrote %d files to %s")
+                   % files.size() % catalog_path);
+}
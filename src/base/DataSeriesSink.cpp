@@ -47,6 +47,119 @@ class DataSeriesSinkPThreadWriter : public PThread {
 
 int DataSeriesSink::compressor_count = -1;
 
+// Embedded min/max index for one type, see addMinMaxIndex().  summarize() is
+// called by the compressors, addRow() only by the writer.
+struct DataSeriesSink::MinMaxIndex {
+    ExtentType::Ptr indexed_type;
+    vector<string> fields;
+    ExtentTypeLibrary library; // owns index_type
+    const ExtentType::Ptr index_type;
+    ExtentSeries series;
+    Variable32Field filename;
+    Int64Field extent_offset;
+    Int32Field rowcount;
+    vector<GeneralField *> mins, maxs;
+    vector<BoolField *> hasnulls;
+    vector<Int32Field *> nullcounts;
+
+    MinMaxIndex(const ExtentType::Ptr &indexed_type, const vector<string> &fields)
+        : indexed_type(indexed_type), fields(fields), library(),
+          index_type(library.registerTypePtr(indexXml(*indexed_type, fields))),
+          series(index_type), filename(series, "filename"),
+          extent_offset(series, "extent_offset"), rowcount(series, "rowcount")
+    {
+        for (vector<string>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+            mins.push_back(GeneralField::create(series, "min:" + *i));
+            maxs.push_back(GeneralField::create(series, "max:" + *i));
+            hasnulls.push_back(new BoolField(series, "hasnull:" + *i));
+            nullcounts.push_back(new Int32Field(series, "nullcount:" + *i));
+        }
+    }
+
+    ~MinMaxIndex() {
+        GeneralField::deleteFields(mins);
+        GeneralField::deleteFields(maxs);
+        for (unsigned i = 0; i < fields.size(); ++i) {
+            delete hasnulls[i];
+            delete nullcounts[i];
+        }
+    }
+
+    // Same layout as dsextentindex's generateMinMaxType(), plus the null counts
+    static string indexXml(const ExtentType &type, const vector<string> &fields) {
+        string ret = (format("<ExtentType namespace=\"%s\" name=\"%s\" version=\"%d.%d\" >\n")
+                      % type.getNamespace() % minMaxIndexTypeName(type.getName())
+                      % type.majorVersion() % type.minorVersion()).str();
+        ret += "  <field type=\"variable32\" name=\"filename\" />\n";
+        ret += "  <field type=\"int64\" name=\"extent_offset\" />\n";
+        ret += "  <field type=\"int32\" name=\"rowcount\" />\n";
+        for (vector<string>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+            INVARIANT(type.hasColumn(*i), format("type %s has no field %s to index")
+                      % type.getName() % *i);
+            ret += (format("  <field type=\"%1%\" name=\"min:%2%\" />\n"
+                           "  <field type=\"%1%\" name=\"max:%2%\" />\n"
+                           "  <field type=\"bool\" name=\"hasnull:%2%\" />\n"
+                           "  <field type=\"int32\" name=\"nullcount:%2%\" />\n")
+                    % ExtentType::fieldTypeString(type.getFieldType(*i)) % *i).str();
+        }
+        ret += "</ExtentType>\n";
+        return ret;
+    }
+
+    // Until the first non-null value the min/max come from the first row, as
+    // in dsextentindex, so an all-null column still has values of the right type.
+    void summarize(ToCompress &work) {
+        ExtentSeries s(work.extent);
+        vector<GeneralField *> in;
+        for (vector<string>::iterator i = fields.begin(); i != fields.end(); ++i) {
+            in.push_back(GeneralField::create(s, *i));
+        }
+        work.mins.resize(fields.size());
+        work.maxs.resize(fields.size());
+        work.nullcounts.assign(fields.size(), 0);
+        vector<bool> have_value(fields.size(), false);
+        for (bool first = true; s.morerecords(); ++s, first = false) {
+            for (unsigned i = 0; i < in.size(); ++i) {
+                if (in[i]->isNull()) {
+                    ++work.nullcounts[i];
+                    if (first) {
+                        work.mins[i].set(in[i]);
+                        work.maxs[i].set(in[i]);
+                    }
+                    continue;
+                }
+                GeneralValue v(in[i]);
+                if (!have_value[i]) {
+                    work.mins[i] = v;
+                    work.maxs[i] = v;
+                    have_value[i] = true;
+                } else if (v < work.mins[i]) {
+                    work.mins[i] = v;
+                } else if (work.maxs[i] < v) {
+                    work.maxs[i] = v;
+                }
+            }
+        }
+        GeneralField::deleteFields(in);
+    }
+
+    void addRow(int64_t offset, int32_t nrecords, const ToCompress &work) {
+        if (!series.hasExtent()) {
+            series.newExtent();
+        }
+        series.newRecord();
+        filename.set(""); // this file
+        extent_offset.set(offset);
+        rowcount.set(nrecords);
+        for (unsigned i = 0; i < fields.size(); ++i) {
+            mins[i]->set(work.mins[i]);
+            maxs[i]->set(work.maxs[i]);
+            hasnulls[i]->set(work.nullcounts[i] > 0);
+            nullcounts[i]->set(work.nullcounts[i]);
+        }
+    }
+};
+
 void DataSeriesSink::WorkerInfo::startThreads(PThreadScopedLock &lock, DataSeriesSink *sink) {
     int pthread_count = compressor_count;
     if (pthread_count == -1) {
@@ -79,9 +192,11 @@ void DataSeriesSink::WorkerInfo::stopThreads(PThreadScopedLock &lock) {
         delete *i;
     }
     compressors.clear();
-    writer->join();
-    delete writer;
-    writer = NULL;
+    if (writer != NULL) { // no writer thread without compressors
+        writer->join();
+        delete writer;
+        writer = NULL;
+    }
 }
 
 void DataSeriesSink::WorkerInfo::setMaxBytesInProgress(PThreadMutex &mutex, size_t nbytes) {
@@ -104,14 +219,18 @@ void DataSeriesSink::WorkerInfo::flushPending(PThreadMutex &mutex) {
 
 DataSeriesSink::DataSeriesSink(int compression_modes, int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(), 
+          compression_level(compression_level), adaptive_sample_interval(0),
+          adaptive_unpack_weight(0), adaptive_choices(), columnar_fixed(false), index_v1(false),
+          writer_info(),
           worker_info(256*1024*1024), filename()
 { }
 
 DataSeriesSink::DataSeriesSink(const string &filename, int compression_modes,
                                int compression_level)
         : stats(), mutex(), valid_types(), compression_modes(compression_modes),
-          compression_level(compression_level), writer_info(),
+          compression_level(compression_level), adaptive_sample_interval(0),
+          adaptive_unpack_weight(0), adaptive_choices(), columnar_fixed(false), index_v1(false),
+          writer_info(),
           worker_info(256*1024*1024), filename()
 {
     open(filename);
@@ -121,6 +240,37 @@ DataSeriesSink::~DataSeriesSink() {
     if (writer_info.cur_offset > 0) {
         close();
     }
+    for (vector<MinMaxIndex *>::iterator i = minmax_indices.begin();
+         i != minmax_indices.end(); ++i) {
+        delete *i;
+    }
+}
+
+void DataSeriesSink::setAdaptiveCompression(uint32_t sample_interval, 
+                                            double unpack_bytes_per_second) {
+    INVARIANT(unpack_bytes_per_second >= 0, "negative unpack cost makes no sense");
+    PThreadScopedLock lock(mutex);
+    adaptive_sample_interval = sample_interval;
+    adaptive_unpack_weight = unpack_bytes_per_second;
+    adaptive_choices.clear();
+}
+
+void DataSeriesSink::setColumnarFixed(bool columnar) {
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!writer_info.wrote_library, "must set the fixed layout before writeExtentLibrary");
+    columnar_fixed = columnar;
+    if (writer_info.fd >= 0) { // already wrote the header in open()
+        const string filetype = fileMagic();
+        ssize_t ret = pwrite(writer_info.fd, filetype.data(), 4, 0);
+        INVARIANT(ret == 4, format("Error rewriting header of %s: %s") % filename
+                  % strerror(errno));
+    }
+}
+
+void DataSeriesSink::setIndexV1(bool index_v1) {
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!writer_info.wrote_library, "must enable the extended index before writeExtentLibrary");
+    this->index_v1 = index_v1;
 }
 
 void DataSeriesSink::setExtentWriteCallback(const ExtentWriteCallback &callback) {
@@ -141,7 +291,7 @@ void DataSeriesSink::open(const string &in_filename) {
     writer_info.fd = ::open(filename.c_str(), O_WRONLY | O_LARGEFILE | O_CREAT | O_TRUNC, 0666);
     INVARIANT(writer_info.fd >= 0,
               format("Error opening %s for write: %s") % filename % strerror(errno));
-    const string filetype = "DSv1";
+    const string filetype = fileMagic();
     checkedWrite(filetype.data(),4);
     ExtentType::int32 int32check = 0x12345678;
     checkedWrite(&int32check,4);
@@ -170,6 +320,10 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     writer_info.writeOutPending(lock, worker_info);
 
     SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    lockedWriteMinMaxIndices(lock);
+    if (writer_info.index_v1_series.hasExtent()) {
+        writer_info.writeIndexV1(compression_modes, compression_level);
+    }
     ExtentType::int64 index_offset = writer_info.cur_offset;
     
     // Special case handling of record for index series; this will
@@ -228,6 +382,25 @@ void DataSeriesSink::close(bool do_fsync, Stats *to_update) {
     stats.reset();
 }
 
+// Like the index special case in close(), but the extents are listed in the
+// index so they can be found with TypeIndexModule.
+void DataSeriesSink::lockedWriteMinMaxIndices(PThreadScopedLock &lock) {
+    for (vector<MinMaxIndex *>::iterator i = minmax_indices.begin();
+         i != minmax_indices.end(); ++i) {
+        ExtentSeries &series((**i).series);
+        if (!series.hasExtent()) {
+            continue; // no extents of that type
+        }
+        worker_info.bytes_in_progress += series.getExtentRef().size();
+        worker_info.pending_work.push_back(new ToCompress(series.getSharedExtent(), NULL));
+        series.clearExtent();
+        worker_info.pending_work.front()->in_progress = true;
+        lockedProcessToCompress(lock, worker_info.pending_work.front());
+        writer_info.writeOutPending(lock, worker_info);
+        SINVARIANT(worker_info.pending_work.empty() && worker_info.bytes_in_progress == 0);
+    }
+}
+
 void DataSeriesSink::rotate(const string &new_filename, const ExtentTypeLibrary &library,
                             bool do_fsync, Stats *to_update) {
     FATAL_ERROR("unimplemented");
@@ -253,6 +426,17 @@ void DataSeriesSink::writeExtent(Extent &e, Stats *stats) {
     queueWriteExtent(we, stats);
 }
 
+void DataSeriesSink::addMinMaxIndex(const ExtentType::Ptr &type, const vector<string> &fields) {
+    INVARIANT(!writer_info.wrote_library, "must add min/max indices before writeExtentLibrary");
+    INVARIANT(!fields.empty(), "need at least one field for a min/max index");
+    for (vector<MinMaxIndex *>::iterator i = minmax_indices.begin();
+         i != minmax_indices.end(); ++i) {
+        INVARIANT((**i).indexed_type != type, format("duplicate min/max index for type %s")
+                  % type->getName());
+    }
+    minmax_indices.push_back(new MinMaxIndex(type, fields));
+}
+
 void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
     INVARIANT(!writer_info.wrote_library, "Can only write extent library once");
     ExtentSeries type_extent_series(ExtentType::getDataSeriesXMLTypePtr());
@@ -265,6 +449,9 @@ void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
         if (et->getName() == "DataSeries: XmlType") {
             continue; // no point of writing this out; can't use it.
         }
+        if (et->getName() == ExtentType::getDataSeriesIndexTypeV1Ptr()->getName()) {
+            continue; // written below iff this file has an extended index
+        }
 
         type_extent_series.newRecord();
         const string &type_desc(et->getXmlDescriptionString());
@@ -279,6 +466,25 @@ void DataSeriesSink::writeExtentLibrary(const ExtentTypeLibrary &lib) {
                     % et->getName() << endl;
         }
     }
+    for (vector<MinMaxIndex *>::iterator i = minmax_indices.begin();
+         i != minmax_indices.end(); ++i) {
+        ExtentType::Ptr et = (**i).index_type;
+        INVARIANT(valid_types.exists((**i).indexed_type), 
+                  format("type %s has a min/max index but isn't in the library")
+                  % (**i).indexed_type->getName());
+        INVARIANT(lib.getTypeByNamePtr(et->getName(), true) == NULL,
+                  format("library already has a type named %s") % et->getName());
+        type_extent_series.newRecord();
+        typevar.set(et->getXmlDescriptionString());
+        valid_types.add(et);
+    }
+    if (index_v1) {
+        // otherwise a reader that walks the file rather than the index can't decode it
+        type_extent_series.newRecord();
+        typevar.set(ExtentType::getDataSeriesIndexTypeV1Ptr()->getXmlDescriptionString());
+        PThreadScopedLock lock(mutex);
+        writer_info.index_v1_series.newExtent(); // before the library is written, so it's listed
+    }
     queueWriteExtent(type_extent_series.getSharedExtent(), NULL);
 
     PThreadScopedLock lock(mutex);
@@ -335,13 +541,23 @@ void DataSeriesSink::queueWriteExtent(Extent::Ptr e, Stats *to_update) {
     INVARIANT(worker_info.keep_going, "got to qWE after call to close()??");
     INVARIANT(writer_info.cur_offset > 0, "queueWriteExtent on closed file");
     LintelLogDebug("DataSeriesSink", format("queueWriteExtent(%d bytes)") % e->size());
+    MinMaxIndex *minmax_index = NULL;
+    if (e->nRecords() > 0) {
+        for (vector<MinMaxIndex *>::iterator i = minmax_indices.begin();
+             i != minmax_indices.end(); ++i) {
+            if ((**i).indexed_type == e->getTypePtr()) {
+                minmax_index = *i;
+                break;
+            }
+        }
+    }
     worker_info.bytes_in_progress += e->size(); // putting this into ToCompress erases e
-    worker_info.pending_work.push_back(new ToCompress(e, to_update));
+    worker_info.pending_work.push_back(new ToCompress(e, to_update, minmax_index));
 
     if (worker_info.compressors.empty()) {
-        SINVARIANT(worker_info.pending_work.size() == 1 && worker_info.bytes_in_progress == 0);
+        SINVARIANT(worker_info.pending_work.size() == 1 
+                   && worker_info.bytes_in_progress == e->size());
         worker_info.pending_work.front()->in_progress = true;
-        worker_info.bytes_in_progress += e->size();
         lockedProcessToCompress(lock, worker_info.pending_work.front());
         worker_info.pending_work.front()->in_progress = false;
         writer_info.writeOutPending(lock, worker_info);
@@ -396,6 +612,14 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
             index_series.newRecord();
             field_extentOffset.set(cur_offset);
             field_extentType.set(tc->extent->getTypePtr()->getName());
+            if (index_v1_series.hasExtent()) { // false for the V0 index itself
+                addIndexV1Record(*tc->extent, tc->compressed);
+            }
+            if (tc->minmax_index != NULL) {
+                // nrecords from the header, see Extent::packData()
+                tc->minmax_index->addRow(cur_offset, reinterpret_cast<const ExtentType::int32 *>
+                                         (tc->compressed.begin())[2], *tc);
+            }
             
             checkedWrite(tc->compressed.begin(), tc->compressed.size());
             cur_offset += tc->compressed.size();
@@ -416,6 +640,39 @@ void DataSeriesSink::WriterInfo::writeOutPending(PThreadScopedLock &lock, Worker
     }
 }
 
+void DataSeriesSink::WriterInfo::addIndexV1Record(const Extent &extent, 
+                                                 const Extent::ByteArray &compressed) {
+    typedef ExtentType::int32 int32;
+    // See Extent::packData() for the layout of the header
+    const int32 *header = reinterpret_cast<const int32 *>(compressed.begin());
+    int32 nrecords = header[2];
+
+    index_v1_series.newRecord();
+    v1_offset.set(cur_offset);
+    v1_size.set(compressed.size());
+    v1_extent_type.set(extent.getTypePtr()->getName());
+    v1_nrecords.set(nrecords);
+    v1_fixed_compress_mode.set(compressed[6*4]);
+    v1_fixed_uncompressed_size.set(nrecords * extent.getTypePtr()->fixedrecordsize());
+    v1_fixed_compressed_size.set(header[0]);
+    v1_variable_compress_mode.set(compressed[6*4+1]);
+    v1_variable_uncompressed_size.set(header[3]);
+    v1_variable_compressed_size.set(header[1]);
+    v1_compressed_adler32.set(header[4]);
+    v1_uncompressed_bjhash.set(header[5]);
+}
+
+// Written directly rather than through the compressors so that it is not
+// listed in the V0 index and doesn't change the chained checksum; old readers
+// never see it.  Not counted in the stats for the same reason.
+void DataSeriesSink::WriterInfo::writeIndexV1(int compression_modes, int compression_level) {
+    Extent::ByteArray packed;
+    index_v1_series.getExtentRef().packData(packed, compression_modes, compression_level);
+    checkedWrite(packed.begin(), packed.size());
+    cur_offset += packed.size();
+    index_v1_series.clearExtent();
+}
+
 static void get_thread_cputime(struct timespec &ts) {
 
 #ifndef __linux__
@@ -463,18 +720,39 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
     INVARIANT(work->in_progress, "??");
     INVARIANT(writer_info.cur_offset > 0,"Error: processToCompress on closed file\n");
 
+    uint32_t fixed_modes = compression_modes, variable_modes = compression_modes;
+    bool sample = false;
+    if (adaptive_sample_interval > 1) {
+        AdaptiveChoice &choice(adaptive_choices[work->extent->getTypePtr()]);
+        if (choice.nextents == 0) {
+            choice.fixed_modes = choice.variable_modes = compression_modes;
+        }
+        sample = !choice.sampled || choice.nextents % adaptive_sample_interval == 0;
+        ++choice.nextents;
+        if (!sample) {
+            fixed_modes = choice.fixed_modes;
+            variable_modes = choice.variable_modes;
+        }
+    }
+    Extent::CompressionSample fixed_sample(adaptive_unpack_weight > 0),
+        variable_sample(adaptive_unpack_weight > 0);
+
     Stats tmp;
     {
         PThreadScopedUnlock unlock(lock);
 
         size_t nrecords = work->extent->nRecords();
+        if (work->minmax_index != NULL) {
+            work->minmax_index->summarize(*work);
+        }
         struct timespec pack_start, pack_end;
         get_thread_cputime(pack_start);
 
         uint32_t headersize, fixedsize, variablesize;
-        work->checksum = work->extent->packData(work->compressed, compression_modes,
-                                                compression_level, &headersize,
-                                                &fixedsize, &variablesize);
+        work->checksum = work->extent->packDataSplit
+            (work->compressed, fixed_modes, variable_modes, compression_level, columnar_fixed,
+             sample ? &fixed_sample : NULL, sample ? &variable_sample : NULL,
+             &headersize, &fixedsize, &variablesize);
         get_thread_cputime(pack_end);
 
         double pack_extent_time = (pack_end.tv_sec - pack_start.tv_sec) 
@@ -496,6 +774,17 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
 
         SINVARIANT(work->extent->size() == uncompressed_size);
     }
+    if (sample) {
+        AdaptiveChoice &choice(adaptive_choices[work->extent->getTypePtr()]);
+        // an empty part tells us nothing about the next extent
+        if (fixed_sample.input_size > 0) {
+            choice.fixed_modes = adaptiveChoose(fixed_sample);
+        }
+        if (variable_sample.input_size > 0) {
+            choice.variable_modes = adaptiveChoose(variable_sample);
+        }
+        choice.sampled = true;
+    }
     // update stats, have to do this before we complete the extent
     // as otherwise the work pointer could vanish under us
 
@@ -515,6 +804,22 @@ void DataSeriesSink::lockedProcessToCompress(PThreadScopedLock &lock, ToCompress
     worker_info.bytes_in_progress += work->compressed.size(); // add in the compressed bits
 }
 
+uint32_t DataSeriesSink::adaptiveChoose(const Extent::CompressionSample &sample) {
+    int best = Extent::compress_mode_none;
+    double best_cost = sample.input_size;
+    for (int i = 1; i < Extent::num_comp_algs; ++i) {
+        if (sample.packed_size[i] < 0) {
+            continue;
+        }
+        double cost = sample.packed_size[i] + adaptive_unpack_weight * sample.unpack_seconds[i];
+        if (cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    return Extent::compression_algs[best].compress_flag;
+}
+
 void  DataSeriesSink::compressorThread()  {
 #if 0
     // This didn't seem to have any actual effect; it should have let the
@@ -581,6 +886,7 @@ void DataSeriesSink::Stats::reset() {
 
     std::fill( num_fixed_per_alg, num_fixed_per_alg + sizeof(num_fixed_per_alg)/sizeof(num_fixed_per_alg[0]), 0 );
     std::fill( num_var_per_alg, num_var_per_alg + sizeof(num_var_per_alg)/sizeof(num_var_per_alg[0]), 0 );
+    num_fixed_columnar = 0;
 
     unpacked_size = unpacked_fixed = unpacked_variable = 
             unpacked_variable_raw = packed_size = nrecords = 0;
@@ -601,6 +907,7 @@ DataSeriesSink::Stats &DataSeriesSink::Stats::operator+=(const DataSeriesSink::S
         num_fixed_per_alg[i] += from.num_fixed_per_alg[i];
         num_var_per_alg[i] += from.num_var_per_alg[i];
     } 
+    num_fixed_columnar += from.num_fixed_columnar;
 
     unpacked_size += from.unpacked_size;
     unpacked_fixed += from.unpacked_fixed;
@@ -620,6 +927,7 @@ DataSeriesSink::Stats &DataSeriesSink::Stats::operator-=(const DataSeriesSink::S
         num_fixed_per_alg[i] -= from.num_fixed_per_alg[i];
         num_var_per_alg[i] -= from.num_var_per_alg[i];
     }   
+    num_fixed_columnar -= from.num_fixed_columnar;
 
     unpacked_size -= from.unpacked_size;
     unpacked_fixed -= from.unpacked_fixed;
@@ -659,7 +967,11 @@ void DataSeriesSink::Stats::update(uint32_t unp_size, uint32_t unp_fixed,
 
     /*  X_compress_mode should be the index of the algorithm used to compress the
         corresponding data (fixed or variable) in the appropriate array */
-    ++num_fixed_per_alg[fixed_compress_mode];
+    if (fixed_compress_mode == Extent::compress_mode_columnar) {
+        ++num_fixed_columnar;
+    } else {
+        ++num_fixed_per_alg[fixed_compress_mode];
+    }
     if (pkd_var_size > 0) {
         ++num_var_per_alg[variable_compress_mode];
     }
@@ -678,6 +990,9 @@ void DataSeriesSink::Stats::printText(ostream &to, const string &extent_type) {
         to << Extent::compression_algs[i].name << "(fixed, variable): ";
         to << num_fixed_per_alg[i] << ", " << num_var_per_alg[i] << endl;
     }
+    if (num_fixed_columnar > 0) {
+        to << "columnar(fixed): " << num_fixed_columnar << endl;
+    }
     
     to << format("  unpacked: %d = %d (fixed) + %d (variable, %d raw)\n")
             % unpacked_size % unpacked_fixed % unpacked_variable % unpacked_variable_raw;
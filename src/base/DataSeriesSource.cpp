@@ -19,6 +19,7 @@
 
 #include <ostream>
 
+#include <boost/foreach.hpp>
 #include <boost/static_assert.hpp>
 
 #include <Lintel/Double.hpp>
@@ -45,14 +46,38 @@ using boost::format;
 #define O_LARGEFILE 0
 #endif
 
+static bool defaultUseMmap() {
+    static int use_mmap = -1;
+    if (use_mmap == -1) {
+        const char *env = getenv("DATASERIES_READ_MMAP");
+        use_mmap = env != NULL && strcmp(env, "1") == 0 ? 1 : 0;
+    }
+    return use_mmap == 1;
+}
+
 DataSeriesSource::DataSeriesSource(const string &filename, bool read_index, bool check_tail)
-        : index_extent(), filename(filename), fd(-1), cur_offset(0), read_index(read_index),
-          check_tail(check_tail), mtime_nanosec(0)
+        : index_extent(), filename(filename), fd(-1), cur_offset(0), first_extent_offset(0),
+          read_index(read_index), check_tail(check_tail), use_mmap(defaultUseMmap()),
+          mtime_nanosec(0), file_size(0), index_v1_extent(), checked_index_v1(false)
 {
-    mylibrary.registerType(ExtentType::getDataSeriesXMLTypePtr());
-    mylibrary.registerType(ExtentType::getDataSeriesIndexTypeV0Ptr());
-    SINVARIANT(mylibrary.getTypeByNamePtr("DataSeries: XmlType")
-               == ExtentType::getDataSeriesXMLTypePtr());
+    resetLibrary();
+    reopenfile();
+}
+
+DataSeriesSource::DataSeriesSource(const string &filename, const Metadata &metadata)
+        : index_extent(metadata.index_extent), filename(filename), fd(-1),
+          cur_offset(metadata.first_extent_offset),
+          first_extent_offset(metadata.first_extent_offset), need_bitflip(metadata.need_bitflip),
+          read_index(true), check_tail(true), use_mmap(defaultUseMmap()),
+          mtime_nanosec(metadata.mtime_nanosec), file_size(metadata.file_size),
+          index_v1_extent(), checked_index_v1(false)
+{
+    INVARIANT(index_extent != NULL && index_extent->getTypePtr()
+              == ExtentType::getDataSeriesIndexTypeV0Ptr(), "metadata is missing the index");
+    resetLibrary();
+    BOOST_FOREACH(const ExtentType::Ptr &type, metadata.types) {
+        mylibrary.registerType(type);
+    }
     reopenfile();
 }
 
@@ -76,14 +101,44 @@ void DataSeriesSource::reopenfile() {
     struct stat stat_buf;
     int error = fstat(fd, &stat_buf);
     INVARIANT(error == 0, format("error on file '%s' for stat: %s") % filename % strerror(errno));
-    if (lintel::modifyTimeNanoSec(stat_buf) != mtime_nanosec) {
+    if (lintel::modifyTimeNanoSec(stat_buf) != mtime_nanosec || stat_buf.st_size != file_size) {
+        if (mtime_nanosec != 0) { // re-reading a changed file, forget the old types
+            resetLibrary();
+        }
         checkHeader();
         readTypeExtent();
         readTailIndex();
         mtime_nanosec = lintel::modifyTimeNanoSec(stat_buf);
+        file_size = stat_buf.st_size;
     }      
 }
 
+void DataSeriesSource::resetLibrary() {
+    mylibrary.name_to_type.clear();
+    mylibrary.registerType(ExtentType::getDataSeriesXMLTypePtr());
+    mylibrary.registerType(ExtentType::getDataSeriesIndexTypeV0Ptr());
+    SINVARIANT(mylibrary.getTypeByNamePtr("DataSeries: XmlType")
+               == ExtentType::getDataSeriesXMLTypePtr());
+}
+
+DataSeriesSource::Metadata DataSeriesSource::getMetadata() {
+    INVARIANT(index_extent != NULL, "getMetadata requires the source to read the index");
+    Metadata ret;
+    ret.need_bitflip = need_bitflip;
+    ret.mtime_nanosec = mtime_nanosec;
+    ret.file_size = file_size;
+    ret.first_extent_offset = first_extent_offset;
+    typedef ExtentTypeLibrary::NameToType::value_type nt_vt;
+    BOOST_FOREACH(const nt_vt &v, mylibrary.name_to_type) {
+        if (v.second != ExtentType::getDataSeriesXMLTypePtr()
+            && v.second != ExtentType::getDataSeriesIndexTypeV0Ptr()) {
+            ret.types.push_back(v.second);
+        }
+    }
+    ret.index_extent = index_extent;
+    return ret;
+}
+
 void DataSeriesSource::checkHeader() {
     cur_offset = 0;
     Extent::ByteArray data;
@@ -91,9 +146,10 @@ void DataSeriesSource::checkHeader() {
     data.resize(file_header_size);
     Extent::checkedPread(fd,0,data.begin(),file_header_size);
     cur_offset = file_header_size;
+    // DSv2 files may contain columnar extents, see DataSeriesSink::setColumnarFixed()
     INVARIANT(data[0] == 'D' && data[1] == 'S' &&
-              data[2] == 'v' && data[3] == '1',
-              "Invalid data series source, not DSv1");
+              data[2] == 'v' && (data[3] == '1' || data[3] == '2'),
+              "Invalid data series source, not DSv1 or DSv2");
     int32_t check_int = *(int32_t *)(data.begin() + 4);
     if (check_int == 0x12345678) {
         need_bitflip = false;
@@ -135,6 +191,7 @@ void DataSeriesSource::readTypeExtent() {
         string v = typevar.stringval();
         mylibrary.registerTypePtr(v);
     }
+    first_extent_offset = cur_offset;
 }
 
 void DataSeriesSource::readTailIndex() {
@@ -164,17 +221,57 @@ void DataSeriesSource::readTailIndex() {
                   % tailoffset % packedsize % indexoffset);
     }
     index_extent.reset();
+    index_v1_extent.reset();
+    checked_index_v1 = false;
     if (read_index) {
         index_extent.reset(preadExtent(indexoffset));
         INVARIANT(index_extent != NULL, "index extent read failed");
     }
 }    
 
+Extent::Ptr DataSeriesSource::getIndexV1() {
+    if (checked_index_v1) {
+        return index_v1_extent;
+    }
+    INVARIANT(index_extent != NULL, "getIndexV1 requires the source to read the index");
+    checked_index_v1 = true;
+
+    // The extended index is written immediately after the last extent listed
+    // in the V0 index, and immediately before the V0 index.
+    off64_t v0_offset = index_extent->extent_source_offset;
+    off64_t last_offset = -1;
+    ExtentSeries s(index_extent);
+    Int64Field offset(s, "offset");
+    for (; s.morerecords(); ++s) {
+        if (offset.val() < v0_offset && offset.val() > last_offset) {
+            last_offset = offset.val();
+        }
+    }
+    INVARIANT(last_offset > 0, "V0 index is missing the type extent?!");
+    off64_t v1_offset = last_offset + Extent::preadExtentSize(fd, last_offset, need_bitflip);
+    INVARIANT(v1_offset <= v0_offset, format("extent at %d overlaps the index at %d")
+              % last_offset % v0_offset);
+    if (v1_offset < v0_offset) {
+        Extent::ByteArray extentdata;
+        off64_t save_offset = v1_offset;
+        INVARIANT(Extent::preadExtent(fd, v1_offset, extentdata, need_bitflip),
+                  "extended index read failed");
+        INVARIANT(v1_offset == v0_offset, "garbage between the extended index and the index");
+        index_v1_extent.reset(new Extent(mylibrary, extentdata, need_bitflip));
+        INVARIANT(index_v1_extent->getTypePtr() == ExtentType::getDataSeriesIndexTypeV1Ptr(),
+                  format("unexpected %s extent before the index")
+                  % index_v1_extent->getTypePtr()->getName());
+        index_v1_extent->extent_source = filename;
+        index_v1_extent->extent_source_offset = save_offset;
+    }
+    return index_v1_extent;
+}
+
 Extent *DataSeriesSource::preadExtent(off64_t &offset, unsigned *compressedSize) {
     Extent::ByteArray extentdata;
     
     off64_t save_offset = offset;
-    if (Extent::preadExtent(fd, offset, extentdata, need_bitflip) == false) {
+    if (preadCompressed(offset, extentdata) == false) {
         return NULL;
     }
     if (compressedSize) *compressedSize = extentdata.size();
@@ -12,11 +12,27 @@
 #include <math.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #if defined(__linux__)
 #   include <malloc.h>
 #endif
 
+// Unpacking uses AVX2 when the CPU has it, see useAVX2()
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#   define DATASERIES_UNPACK_AVX2 1
+#   include <immintrin.h>
+#else
+#   define DATASERIES_UNPACK_AVX2 0
+#endif
+
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <vector>
 
 #include <boost/limits.hpp>
 
@@ -108,15 +124,137 @@ void Extent::ByteArray::initMallocTuning() {
 #endif
 }
 
+namespace {
+    // Free buffers of the large ByteArray size classes; one pool shared by
+    // all threads, so a buffer released by a compression thread or an
+    // extent destroyed in an analysis thread is reused by whichever thread
+    // next unpacks or builds an extent.
+    class BufferPool {
+      public:
+        typedef Extent::byte byte;
+
+        BufferPool() : max_bytes(128 * 1024 * 1024) {
+            memset(&stats, 0, sizeof(stats));
+        }
+
+        // size rounded up to a size class; we keep four classes per power of
+        // two so that rounding wastes at most 25% of a buffer.
+        static size_t classSize(size_t size) {
+            if (size < Extent::ByteArray::pool_min_bytes) {
+                return size;
+            }
+            size_t pow2 = Extent::ByteArray::pool_min_bytes;
+            while (pow2 <= size / 2) {
+                pow2 *= 2;
+            }
+            size_t step = pow2 / 4;
+            return ((size + step - 1) / step) * step;
+        }
+
+        byte *allocate(size_t size) {
+            if (size >= Extent::ByteArray::pool_min_bytes) {
+                PThreadScopedLock lock(mutex);
+                Free::iterator i = free_buffers.find(size);
+                if (i != free_buffers.end() && !i->second.empty()) {
+                    byte *ret = i->second.back();
+                    i->second.pop_back();
+                    stats.pooled_bytes -= size;
+                    ++stats.hits;
+                    return ret;
+                }
+                ++stats.misses;
+            }
+            return new byte[size];
+        }
+
+        void release(byte *buf, size_t size) {
+            if (buf == NULL) {
+                return;
+            }
+            if (size >= Extent::ByteArray::pool_min_bytes) {
+                DEBUG_SINVARIANT(classSize(size) == size);
+                PThreadScopedLock lock(mutex);
+                if (stats.pooled_bytes + size <= max_bytes) {
+                    free_buffers[size].push_back(buf);
+                    stats.pooled_bytes += size;
+                    ++stats.returned;
+                    return;
+                }
+                ++stats.discarded;
+            }
+            delete [] buf;
+        }
+
+        void setLimit(size_t new_max_bytes) {
+            PThreadScopedLock lock(mutex);
+            max_bytes = new_max_bytes;
+            for (Free::iterator i = free_buffers.begin(); 
+                 i != free_buffers.end() && stats.pooled_bytes > max_bytes; ++i) {
+                while (!i->second.empty() && stats.pooled_bytes > max_bytes) {
+                    delete [] i->second.back();
+                    i->second.pop_back();
+                    stats.pooled_bytes -= i->first;
+                }
+            }
+        }
+
+        Extent::ByteArray::PoolStats getStats() {
+            PThreadScopedLock lock(mutex);
+            return stats;
+        }
+
+      private:
+        typedef std::map<size_t, std::vector<byte *> > Free;
+
+        PThreadMutex mutex;
+        Free free_buffers;
+        size_t max_bytes;
+        Extent::ByteArray::PoolStats stats;
+    };
+
+    // Never destroyed, ByteArrays in static objects may be released after
+    // any destructor here would have run.
+    BufferPool &bufferPool() {
+        static BufferPool *pool = new BufferPool();
+        return *pool;
+    }
+}
+
+Extent::ByteArray::PoolStats Extent::ByteArray::getPoolStats() {
+    return bufferPool().getStats();
+}
+
+void Extent::ByteArray::setPoolLimit(size_t max_bytes) {
+    bufferPool().setLimit(max_bytes);
+}
+
 Extent::ByteArray::~ByteArray() {
-    delete [] beginV;
+    release();
+}
+
+void Extent::ByteArray::release() {
+    if (mapping != NULL) {
+        mapping.reset();
+    } else {
+        bufferPool().release(beginV, maxV - beginV);
+    }
 }
 
 void Extent::ByteArray::clear() {
-    delete [] beginV;
+    release();
     beginV = endV = maxV = NULL;
 }
 
+void Extent::ByteArray::setMapping(const boost::shared_ptr<void> &new_mapping,
+                                   byte *begin, byte *end) {
+    SINVARIANT(new_mapping != NULL && begin <= end);
+    boost::shared_ptr<void> keep(new_mapping); // in case we already hold it
+    release();
+    mapping = keep;
+    beginV = begin;
+    endV = maxV = end;
+}
+
 void Extent::ByteArray::reserve(size_t reserve_bytes) {
     if (reserve_bytes <= static_cast<size_t>(maxV - beginV)) {
         return; // have enough already;
@@ -125,7 +263,8 @@ void Extent::ByteArray::reserve(size_t reserve_bytes) {
         initMallocTuning();
     }
     size_t oldsize = size();
-    byte *newV = new byte [reserve_bytes];
+    reserve_bytes = BufferPool::classSize(reserve_bytes);
+    byte *newV = bufferPool().allocate(reserve_bytes);
 
     size_t expect_align = 8;
     if (reserve_bytes == 4) { expect_align = 4; }
@@ -135,7 +274,7 @@ void Extent::ByteArray::reserve(size_t reserve_bytes) {
               format("internal error, misaligned malloc(%d) return %d mod %d\n")
               % reserve_bytes % actual_align % expect_align);
     memcpy(newV,beginV,oldsize);
-    delete [] beginV;
+    release();
     beginV = newV;
     endV = newV + oldsize;
     maxV = newV + reserve_bytes;
@@ -578,6 +717,15 @@ static const unsigned variable_sizes_batch_size = 1024;
 uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
                           uint32_t compression_level, uint32_t *header_packed,
                           uint32_t *fixed_packed, uint32_t *variable_packed) {
+    return packDataSplit(into, compression_modes, compression_modes, compression_level,
+                         false, NULL, NULL, header_packed, fixed_packed, variable_packed);
+}
+
+uint32_t Extent::packDataSplit(Extent::ByteArray &into, uint32_t fixed_compression_modes,
+                               uint32_t variable_compression_modes, uint32_t compression_level,
+                               bool columnar_fixed, CompressionSample *fixed_sample,
+                               CompressionSample *variable_sample, uint32_t *header_packed,
+                               uint32_t *fixed_packed, uint32_t *variable_packed) {
     // Don't need to zero the coded arrays as we will be filling them
     // all in.
     Extent::ByteArray fixed_coded;
@@ -799,7 +947,7 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     uint32_t bjhash = lintel::bobJenkinsHash(1972, fixed_coded.begin(),
                                              type->rep.fixed_record_size * nrecords);
 
-    if (type->getPackNullCompact() != ExtentType::CompactNo) {
+    if (type->getPackNullCompact() != ExtentType::CompactNo && !columnar_fixed) {
         // do this after we do the fixed hash, so the checksum will
         // verify this is reversable.
 
@@ -830,9 +978,12 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
 
     byte compressed_fixed_mode;
     Extent::ByteArray *compressed_fixed
-            = compressBytes(fixed_coded.begin(),fixed_coded.size(),
-                            compression_modes, compression_level,
-                            &compressed_fixed_mode);
+            = columnar_fixed 
+            ? compressFixedColumnar(fixed_coded, nrecords, fixed_compression_modes,
+                                    compression_level, &compressed_fixed_mode, fixed_sample)
+            : compressBytes(fixed_coded.begin(),fixed_coded.size(),
+                            fixed_compression_modes, compression_level,
+                            &compressed_fixed_mode, fixed_sample);
     byte compressed_variable_mode;
     Extent::ByteArray *compressed_variable;
     // beginning at 4 bytes into the array avoids packing the 0 bytes at the beginning of the
@@ -840,8 +991,8 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     compressed_variable
             = compressBytes(variable_coded.begin() + 4,
                             variable_coded.size() - 4,
-                            compression_modes, compression_level,
-                            &compressed_variable_mode);
+                            variable_compression_modes, compression_level,
+                            &compressed_variable_mode, variable_sample);
 
     int headersize = 6*4+4*1+type->getName().size();
     headersize += (4 - headersize % 4) % 4;
@@ -866,7 +1017,7 @@ uint32_t Extent::packData(Extent::ByteArray &into, uint32_t compression_modes,
     *l = compressed_fixed_mode; l += 1;
     *l = compressed_variable_mode; l += 1;
     *l = (byte)type->getName().size(); l += 1;
-    *l = 0; l += 1;
+    *l = columnar_fixed ? pack_flag_columnar_fixed : 0; l += 1;
     memcpy(l, type->getName().data(), type->getName().size()); l += type->getName().size();
     // TODO: verify that aligning speeds up the copy, I'm 90% sure
     // that's why it was done here since we will always copy out the
@@ -1152,15 +1303,213 @@ bool Extent::unpackLZ4(byte* output, byte* input,
 #endif
 }
 
+namespace {
+    // One stream of the columnar fixed layout: the (offset, size) byte runs
+    // taken from each record.  Every non-bool field is a stream of its own;
+    // the bool and null bytes and any padding go in a final shared stream,
+    // which has a field_num of -1.
+    struct FixedColumn {
+        int32_t record_bytes;
+        int field_num;
+        vector<pair<int32_t, int32_t> > runs;
+        FixedColumn(int field_num = -1) : record_bytes(0), field_num(field_num) { }
+        void addRun(int32_t offset, int32_t size) {
+            if (!runs.empty() && runs.back().first + runs.back().second == offset) {
+                runs.back().second += size;
+            } else {
+                runs.push_back(make_pair(offset, size));
+            }
+            record_bytes += size;
+        }
+    };
+
+    void columnarLayout(const vector<ExtentType::fieldInfo> &field_info,
+                        int32_t fixed_record_size, vector<FixedColumn> &columns) {
+        vector<bool> covered(fixed_record_size, false);
+        vector<pair<int32_t, int> > fields; // offset, field number
+        for (unsigned i = 0; i < field_info.size(); ++i) {
+            if (field_info[i].type != ExtentType::ft_bool) {
+                fields.push_back(make_pair(field_info[i].offset, i));
+            }
+        }
+        sort(fields.begin(), fields.end());
+        columns.clear();
+        for (vector<pair<int32_t, int> >::iterator i = fields.begin(); 
+             i != fields.end(); ++i) {
+            int32_t size = field_info[i->second].size;
+            columns.push_back(FixedColumn(i->second));
+            columns.back().addRun(i->first, size);
+            for (int32_t j = i->first; j < i->first + size; ++j) {
+                covered[j] = true;
+            }
+        }
+        FixedColumn rest;
+        for (int32_t j = 0; j < fixed_record_size; ++j) {
+            if (!covered[j]) {
+                rest.addRun(j, 1);
+            }
+        }
+        if (rest.record_bytes > 0) {
+            columns.push_back(rest);
+        }
+    }
+
+    // directory entry for each stream, followed by the streams, each 4 byte aligned
+    struct ColumnarDirEntry {
+        ExtentType::int32 compressed_size;
+        ExtentType::byte mode, pad[3];
+    };
+}
+
+Extent::ByteArray *Extent::compressFixedColumnar(Extent::ByteArray &fixed_coded, 
+                                                 int32 nrecords, int compression_modes,
+                                                 int compression_level, byte *mode,
+                                                 CompressionSample *sample) {
+    vector<FixedColumn> columns;
+    columnarLayout(type->rep.field_info, type->rep.fixed_record_size, columns);
+    SINVARIANT(fixed_coded.size() == static_cast<size_t>(nrecords * type->rep.fixed_record_size));
+
+    CompressionSample column_sample(sample == NULL ? false : sample->time_unpack);
+    if (sample != NULL) {
+        sample->reset(fixed_coded.size());
+        std::fill(sample->packed_size + 1, sample->packed_size + num_comp_algs, 0);
+    }
+
+    vector<Extent::ByteArray *> packed;
+    vector<byte> modes;
+    Extent::ByteArray stream;
+    *mode = compress_mode_columnar;
+    for (vector<FixedColumn>::iterator c = columns.begin(); c != columns.end(); ++c) {
+        stream.resize(nrecords * c->record_bytes, false);
+        byte *to = stream.begin();
+        for (byte *record = fixed_coded.begin(); record != fixed_coded.end(); 
+             record += type->rep.fixed_record_size) {
+            for (vector<pair<int32_t, int32_t> >::iterator r = c->runs.begin();
+                 r != c->runs.end(); ++r) {
+                memcpy(to, record + r->first, r->second);
+                to += r->second;
+            }
+        }
+        modes.push_back(0);
+        packed.push_back(compressBytes(stream.begin(), stream.size(), compression_modes,
+                                       compression_level, &modes.back(), 
+                                       sample == NULL ? NULL : &column_sample));
+        if (sample != NULL) {
+            // cost if every stream used the algorithm, falling back to none if it doesn't help
+            for (int i = 1; i < num_comp_algs; ++i) {
+                bool worked = column_sample.packed_size[i] >= 0;
+                sample->packed_size[i] += worked ? column_sample.packed_size[i] : stream.size();
+                sample->unpack_seconds[i] += worked ? column_sample.unpack_seconds[i] : 0;
+            }
+        }
+    }
+
+    size_t total = columns.size() * sizeof(ColumnarDirEntry) + 4;
+    for (vector<Extent::ByteArray *>::iterator i = packed.begin(); i != packed.end(); ++i) {
+        total += (**i).size() + (4 - (**i).size() % 4) % 4;
+    }
+    Extent::ByteArray *ret = new Extent::ByteArray;
+    ret->resize(total, false);
+    byte *l = ret->begin();
+    *reinterpret_cast<int32 *>(l) = columns.size(); l += 4;
+    for (unsigned i = 0; i < columns.size(); ++i) {
+        ColumnarDirEntry *entry = reinterpret_cast<ColumnarDirEntry *>(l);
+        entry->compressed_size = packed[i]->size();
+        entry->mode = modes[i];
+        memset(entry->pad, 0, sizeof(entry->pad));
+        l += sizeof(ColumnarDirEntry);
+    }
+    for (unsigned i = 0; i < columns.size(); ++i) {
+        memcpy(l, packed[i]->begin(), packed[i]->size());
+        l += packed[i]->size();
+        int align = (4 - packed[i]->size() % 4) % 4;
+        memset(l, 0, align); l += align;
+        delete packed[i];
+    }
+    SINVARIANT(l == ret->end());
+    if (sample != NULL) {
+        for (int i = 1; i < num_comp_algs; ++i) { // as in compressBytes, only if it shrinks
+            if (sample->packed_size[i] >= sample->input_size) {
+                sample->packed_size[i] = -1;
+            }
+        }
+    }
+    return ret;
+}
+
+bool Extent::uncompressFixedColumnar(byte *from, int32 fromsize, int32 nrecords,
+                                     bool fix_endianness, const vector<bool> *field_mask) {
+    vector<FixedColumn> columns;
+    columnarLayout(type->rep.field_info, type->rep.fixed_record_size, columns);
+    INVARIANT(fromsize >= 4, "Invalid extent data, bad columnar fixed data");
+    int32 ncolumns = *reinterpret_cast<int32 *>(from);
+    if (fix_endianness) {
+        ncolumns = flip4bytes(ncolumns);
+    }
+    INVARIANT(ncolumns == static_cast<int32>(columns.size()),
+              format("Invalid extent data, %d columns in the fixed data, expected %d")
+              % ncolumns % columns.size());
+    INVARIANT(fromsize >= static_cast<int32>(4 + ncolumns * sizeof(ColumnarDirEntry)),
+              "Invalid extent data, bad columnar fixed data");
+
+    const ColumnarDirEntry *dir = reinterpret_cast<const ColumnarDirEntry *>(from + 4);
+    byte *compressed = from + 4 + ncolumns * sizeof(ColumnarDirEntry);
+    Extent::ByteArray stream;
+    bool all_columns = true;
+    for (int32 c = 0; c < ncolumns; ++c) {
+        int32 compressed_size = dir[c].compressed_size;
+        if (fix_endianness) {
+            compressed_size = flip4bytes(compressed_size);
+        }
+        INVARIANT(compressed_size >= 0 && compressed + compressed_size <= from + fromsize,
+                  "Invalid extent data, bad columnar fixed data");
+        const FixedColumn &column(columns[c]);
+        if (field_mask != NULL && column.field_num >= 0 && !(*field_mask)[column.field_num]) {
+            // not wanted; the caller zeroed the fixed data
+            all_columns = false;
+            compressed += compressed_size + (4 - compressed_size % 4) % 4;
+            continue;
+        }
+        stream.resize(nrecords * column.record_bytes, false);
+        int32 size = uncompressBytes(stream.begin(), compressed, dir[c].mode, stream.size(),
+                                     compressed_size);
+        INVARIANT(size == static_cast<int32>(stream.size()), "internal");
+        const byte *l = stream.begin();
+        for (byte *record = fixeddata.begin(); record != fixeddata.end();
+             record += type->rep.fixed_record_size) {
+            for (vector<pair<int32_t, int32_t> >::const_iterator r = column.runs.begin();
+                 r != column.runs.end(); ++r) {
+                memcpy(record + r->first, l, r->second);
+                l += r->second;
+            }
+        }
+        compressed += compressed_size + (4 - compressed_size % 4) % 4;
+    }
+    return all_columns;
+}
+
 // TODO: test that this works, but I believe that if we do a resize on
 // the extent that is about to be used when we pass it in to the sub
 // pack functions then the compression algorithms will stop early if
 // they can't compress into the smaller amount of space.
 
+void Extent::CompressionSample::reset(int32 size) {
+    input_size = size;
+    for (int i = 0; i < num_comp_algs; ++i) {
+        packed_size[i] = i == compress_mode_none ? size : -1;
+        unpack_seconds[i] = 0;
+    }
+}
+
 Extent::ByteArray *Extent::compressBytes(byte *input, int32 input_size,
                                          int compression_modes,
-                                         int compression_level, byte *mode) {
+                                         int compression_level, byte *mode,
+                                         CompressionSample *sample) {
+    if (sample != NULL) {
+        sample->reset(input_size);
+    }
     if (input_size == 0) {
+        *mode = compress_mode_none;
         return new Extent::ByteArray;
     }
 
@@ -1202,6 +1551,17 @@ Extent::ByteArray *Extent::compressBytes(byte *input, int32 input_size,
                                                        compression_level);
 
 
+        if (sample != NULL && packResult && next_pack->size() < (size_t)input_size) {
+            sample->packed_size[i] = next_pack->size();
+            if (sample->time_unpack) {
+                Extent::ByteArray unpacked;
+                unpacked.resize(input_size, false);
+                Clock::Tdbl start = Clock::tod();
+                uncompressBytes(unpacked.begin(), next_pack->begin(), i, input_size,
+                                next_pack->size());
+                sample->unpack_seconds[i] = Clock::tod() - start;
+            }
+        }
         if ( (packResult && next_pack->size() < (size_t)input_size) &&
              (best_packed == NULL || next_pack->size() < best_packed->size()) ) {
                 delete best_packed;
@@ -1256,6 +1616,198 @@ int32_t Extent::uncompressBytes(byte *into, byte *from, byte compression_mode,
     return outsize;
 }
 
+namespace {
+    // Column kernels for unpackData.  Each does one decoding step to one field of n records,
+    // record_size bytes apart, starting at column.  Working a column at a time takes the loops
+    // over fields and the switches on field type out of the loop over records.  When the
+    // column is contiguous (records of a single field) and the CPU has AVX2, the byte flips,
+    // scaling and integer prefix sums are done 32 bytes at a time.  Setting
+    // DATASERIES_UNPACK_SIMD=no in the environment forces the scalar loops.
+
+    typedef ExtentType::byte byte;
+
+#if DATASERIES_UNPACK_AVX2
+    bool useAVX2() {
+        static bool ret = false, did_init = false;
+        if (!did_init) { // racing threads all compute the same answer
+            const char *env = getenv("DATASERIES_UNPACK_SIMD");
+            __builtin_cpu_init();
+            ret = __builtin_cpu_supports("avx2") && (env == NULL || strcmp(env, "no") != 0);
+            did_init = true;
+        }
+        return ret;
+    }
+
+    __attribute__((target("avx2")))
+    size_t flip4AVX2(byte *column, size_t n) {
+        const __m256i order = _mm256_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+                                               3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i *at = reinterpret_cast<__m256i *>(column + 4 * i);
+            _mm256_storeu_si256(at, _mm256_shuffle_epi8(_mm256_loadu_si256(at), order));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t flip8AVX2(byte *column, size_t n) {
+        const __m256i order = _mm256_setr_epi8(7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8,
+                                               7,6,5,4,3,2,1,0, 15,14,13,12,11,10,9,8);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i *at = reinterpret_cast<__m256i *>(column + 8 * i);
+            _mm256_storeu_si256(at, _mm256_shuffle_epi8(_mm256_loadu_si256(at), order));
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t scaleAVX2(byte *column, size_t n, double scale) {
+        const __m256d by = _mm256_set1_pd(scale);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            double *at = reinterpret_cast<double *>(column + 8 * i);
+            _mm256_storeu_pd(at, _mm256_mul_pd(_mm256_loadu_pd(at), by));
+        }
+        return i;
+    }
+
+    // Prefix sums; the partial sums within a vector take log2(lanes) shifted adds, and the
+    // total so far is carried from one vector to the next broadcast to every lane.
+    __attribute__((target("avx2")))
+    size_t prefixSum4AVX2(byte *column, size_t n) {
+        const __m256i last = _mm256_set1_epi32(7);
+        __m256i carry = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i *at = reinterpret_cast<__m256i *>(column + 4 * i);
+            __m256i x = _mm256_loadu_si256(at);
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4)); // within each 128 bit half
+            x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+            __m256i low_total = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+            x = _mm256_add_epi32(x, _mm256_permute2x128_si256(low_total, low_total, 0x08));
+            x = _mm256_add_epi32(x, carry);
+            _mm256_storeu_si256(at, x);
+            carry = _mm256_permutevar8x32_epi32(x, last);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t prefixSum8AVX2(byte *column, size_t n) {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i carry = zero;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i *at = reinterpret_cast<__m256i *>(column + 8 * i);
+            __m256i x = _mm256_loadu_si256(at);
+            // [a, b, c, d] + [0, a, b, c] + [0, 0, a, a+b]
+            __m256i shift1 = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0));
+            x = _mm256_add_epi64(x, _mm256_blend_epi32(shift1, zero, 0x03));
+            __m256i shift2 = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0));
+            x = _mm256_add_epi64(x, _mm256_blend_epi32(shift2, zero, 0x0F));
+            x = _mm256_add_epi64(x, carry);
+            _mm256_storeu_si256(at, x);
+            carry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        return i;
+    }
+#endif
+
+    void flipColumn4(byte *column, size_t record_size, size_t n) {
+        size_t i = 0;
+#if DATASERIES_UNPACK_AVX2
+        if (record_size == 4 && useAVX2()) {
+            i = flip4AVX2(column, n);
+        }
+#endif
+        for (byte *p = column + i * record_size; i < n; ++i, p += record_size) {
+            Extent::flip4bytes(p);
+        }
+    }
+
+    void flipColumn8(byte *column, size_t record_size, size_t n) {
+        size_t i = 0;
+#if DATASERIES_UNPACK_AVX2
+        if (record_size == 8 && useAVX2()) {
+            i = flip8AVX2(column, n);
+        }
+#endif
+        for (byte *p = column + i * record_size; i < n; ++i, p += record_size) {
+            Extent::flip8bytes(p);
+        }
+    }
+
+    void scaleColumn(byte *column, size_t record_size, size_t n, double scale) {
+        size_t i = 0;
+#if DATASERIES_UNPACK_AVX2
+        if (record_size == 8 && useAVX2()) {
+            i = scaleAVX2(column, n, scale);
+        }
+#endif
+        for (byte *p = column + i * record_size; i < n; ++i, p += record_size) {
+            *reinterpret_cast<double *>(p) *= scale;
+        }
+    }
+
+    // Null fields under pack_null_compact were packed as 0 and are skipped, so they stay 0.
+    inline bool isNull(const byte *record, const ExtentType::nullCompactInfo *null_info) {
+        return null_info != NULL && (record[null_info->null_offset] & null_info->null_bitmask);
+    }
+
+    template<typename T>
+    void selfRelativeColumn(byte *records, size_t record_size, size_t n, int32_t offset,
+                            const ExtentType::nullCompactInfo *null_info) {
+        size_t i = 0;
+        T prev = 0;
+#if DATASERIES_UNPACK_AVX2
+        if (null_info == NULL && record_size == sizeof(T) && useAVX2()) {
+            i = sizeof(T) == 4 ? prefixSum4AVX2(records, n) : prefixSum8AVX2(records, n);
+            if (i > 0) {
+                prev = *reinterpret_cast<T *>(records + (i - 1) * record_size);
+            }
+        }
+#endif
+        for (byte *record = records + i * record_size; i < n; ++i, record += record_size) {
+            if (isNull(record, null_info)) {
+                continue;
+            }
+            T &v(*reinterpret_cast<T *>(record + offset));
+            v += prev;
+            prev = v;
+        }
+    }
+
+    // Rounding to the scale each time keeps the sum from drifting from what was packed, so
+    // this is a serial dependency that doesn't vectorize.
+    void selfRelativeDoubleColumn(byte *records, size_t record_size, size_t n, int32_t offset,
+                                  const ExtentType::nullCompactInfo *null_info,
+                                  double multiplier, double scale) {
+        double prev = 0;
+        for (byte *end = records + n * record_size; records != end; records += record_size) {
+            if (isNull(records, null_info)) {
+                continue;
+            }
+            double &v(*reinterpret_cast<double *>(records + offset));
+            v = round((v + prev) * multiplier) * scale;
+            prev = v;
+        }
+    }
+
+    template<typename T>
+    void otherRelativeColumn(byte *records, size_t record_size, size_t n, int32_t offset,
+                             int32_t base_offset, const ExtentType::nullCompactInfo *null_info) {
+        for (byte *end = records + n * record_size; records != end; records += record_size) {
+            if (isNull(records, null_info)) {
+                continue;
+            }
+            *reinterpret_cast<T *>(records + offset)
+                += *reinterpret_cast<const T *>(records + base_offset);
+        }
+    }
+}
+
 #define TIME_UNPACKING(x)
 
 const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
@@ -1271,12 +1823,28 @@ const string Extent::getPackedExtentType(const Extent::ByteArray &from) {
     return type_name;
 }
 
-void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
+bool Extent::canUseMappedFixed(const Extent::ByteArray &from, byte *compressed_fixed_begin,
+                               byte compressed_fixed_mode, int32 compressed_fixed_size,
+                               bool fix_endianness) {
+    // The mapped bytes are used as-is, so there must be nothing for the
+    // per-record loop below to rewrite, and doubles/int64s need to stay
+    // aligned; extents are only 4 byte aligned in the file.
+    return from.isMapped() && compressed_fixed_mode == compress_mode_none 
+        && compressed_fixed_size > 0 && !fix_endianness
+        && type->getPackNullCompact() == ExtentType::CompactNo
+        && type->rep.pack_scale.empty() && type->rep.pack_self_relative.empty()
+        && type->rep.pack_other_relative.empty()
+        && reinterpret_cast<size_t>(compressed_fixed_begin) % 8 == 0;
+}
+
+void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness,
+                        const vector<bool> *field_mask) {
     if (!did_checks_init) {
         setReadChecksFromEnv();
     }
     INVARIANT(type->getName() == getPackedExtentType(from),
               "Internal: type mismatch") ;
+    SINVARIANT(field_mask == NULL || field_mask->size() == type->rep.field_info.size());
 
     TIME_UNPACKING(Clock::Tdbl time_start = Clock::tod());
     INVARIANT(from.size() > (6*4+2), "Invalid extent data, too small.");
@@ -1305,6 +1873,11 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     byte compressed_fixed_mode = from[6*4];
     byte compressed_variable_mode = from[6*4+1];
     byte type_name_len = from[6*4+2];
+    byte pack_flags = from[6*4+3];
+    INVARIANT((pack_flags & ~pack_flag_columnar_fixed) == 0,
+              format("Unknown extent packing flags %x; written by a newer DataSeries?")
+              % static_cast<int>(pack_flags));
+    bool columnar_fixed = (pack_flags & pack_flag_columnar_fixed) != 0;
 
     uint32_t header_len = 6*4+4+type_name_len;
     header_len += (4 - (header_len % 4))%4;
@@ -1320,28 +1893,52 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     INVARIANT(header_len + rounded_fixed + rounded_variable == from.size(),
               "Invalid extent data");
 
-    fixeddata.resize(nrecords * type->rep.fixed_record_size, false);
-
-    int32 fixed_uncompressed_size
+    int32 fixed_uncompressed_size;
+    bool all_decoded = true; // the hash check needs all of the uncompressed data
+    if (columnar_fixed) {
+        fixeddata.resize(nrecords * type->rep.fixed_record_size, field_mask != NULL);
+        all_decoded = uncompressFixedColumnar(compressed_fixed_begin, compressed_fixed_size,
+                                              nrecords, fix_endianness, field_mask);
+        fixed_uncompressed_size = fixeddata.size();
+    } else if (canUseMappedFixed(from, compressed_fixed_begin, compressed_fixed_mode,
+                                 compressed_fixed_size, fix_endianness)) {
+        fixeddata.shareMapping(from, compressed_fixed_begin, 
+                               compressed_fixed_begin + compressed_fixed_size);
+        fixed_uncompressed_size = compressed_fixed_size;
+    } else {
+        fixeddata.resize(nrecords * type->rep.fixed_record_size, false);
+        fixed_uncompressed_size
             = uncompressBytes(fixeddata.begin(),compressed_fixed_begin,
                               compressed_fixed_mode,
                               nrecords * type->rep.fixed_record_size,
                               compressed_fixed_size);
-    if (type->getPackNullCompact() != ExtentType::CompactNo) {
-        uncompactNulls(fixeddata, fixed_uncompressed_size);
+        if (type->getPackNullCompact() != ExtentType::CompactNo) {
+            uncompactNulls(fixeddata, fixed_uncompressed_size);
+        }
     }
     INVARIANT(fixed_uncompressed_size == nrecords * type->rep.fixed_record_size, "internal");
 
-    variabledata.resize(variable_size, false);
     INVARIANT(variable_size >= 4, "error unpacking, invalid variable size");
+    bool want_variable = field_mask == NULL;
+    for (unsigned j = 0; !want_variable && j < type->rep.variable32_field_columns.size(); ++j) {
+        want_variable = (*field_mask)[type->rep.variable32_field_columns[j]];
+    }
+    if (!want_variable) {
+        variable_size = 4; // just the empty string
+        all_decoded = false;
+    }
+    variabledata.resize(variable_size, false);
     *(int32 *)variabledata.begin() = 0;
-    int32 variable_uncompressed_size
+    if (want_variable) {
+        int32 variable_uncompressed_size
             = uncompressBytes(variabledata.begin()+4, compressed_variable_begin,
                               compressed_variable_mode,
                               variable_size-4, compressed_variable_size);
-    INVARIANT(variable_uncompressed_size == variable_size - 4, "internal");
+        INVARIANT(variable_uncompressed_size == variable_size - 4, "internal");
+    }
+    const bool check_hash = postuncompress_check && all_decoded;
     uint32_t bjhash = 0;
-    if (postuncompress_check) {
+    if (check_hash) {
         bjhash = lintel::bobJenkinsHash(1972, fixeddata.begin(), fixeddata.size());
         bjhash = lintel::bobJenkinsHash(bjhash, variabledata.begin(), variabledata.size());
     }
@@ -1350,7 +1947,7 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
     byte *endvarpos = variabledata.begin() + variabledata.size();
     for (byte *curvarpos = &variabledata[4];curvarpos != endvarpos;) {
         int32 size = *(int32 *)curvarpos;
-        if (postuncompress_check) {
+        if (check_hash) {
             variable_sizes.push_back(size);
 
             if (variable_sizes.size() == variable_sizes_batch_size) {
@@ -1366,173 +1963,138 @@ void Extent::unpackData(Extent::ByteArray &from, bool fix_endianness) {
         curvarpos += 4 + Variable32Field::roundupSize(size);
         INVARIANT(curvarpos <= endvarpos,"internal error on variable data");
     }
-    if (postuncompress_check) {
+    if (check_hash) {
         bjhash = lintel::bobJenkinsHash(bjhash,&(variable_sizes[0]),4*variable_sizes.size());
     }
 
     variable_sizes.resize(0);
 
-    INVARIANT(postuncompress_check == false
+    INVARIANT(check_hash == false
               || *(int32 *)(from.begin() + 5*4) == (int32)bjhash,
               "final partially unpacked hash check failed");
 
-    vector<ExtentType::pack_self_relativeT> psr_copy
-            = type->rep.pack_self_relative;
-    for (unsigned int j=0;j<type->rep.pack_self_relative.size();++j) {
-        SINVARIANT(psr_copy[j].field_num < type->rep.field_info.size());
-
-        SINVARIANT(psr_copy[j].double_prev_v == 0 &&
-                   psr_copy[j].int32_prev_v == 0 &&
-                   psr_copy[j].int64_prev_v == 0);
-    }
+    // Only the fields in field_mask are decoded; the others are left as they were packed.
+    // Unpacking is done in the reverse order as packing, one step at a time over all the
+    // selected fields, each a column at a time.
     TIME_UNPACKING(Clock::Tdbl time_postuc = Clock::tod());
-    int record_count = 0;
-    // 2004-09-26: each one of these is worth a small speedup, 0.5-1%
-    // or so I'd guess, while not inherently worth it, the fix was
-    // made when profiling accidentally with the debugging library,
-    // and there is no point in removing the fix.
-    const size_t type_variable32_field_columns_size
-            = type->rep.variable32_field_columns.size();
-    const size_t type_pack_scale_size = type->rep.pack_scale.size();
-    const size_t type_pack_self_relative_size = psr_copy.size();
-    const size_t type_pack_other_relative_size
-            = type->rep.pack_other_relative.size();
+    const ExtentType::ParsedRepresentation &rep(type->rep);
+    const size_t record_size = rep.fixed_record_size;
     const bool null_compact = type->getPackNullCompact() != ExtentType::CompactNo;
-    for (ExtentSeries::iterator pos(this); pos.morerecords(); ++pos) {
-        ++record_count;
-        if (fix_endianness) {
-            for (unsigned int j=0; j<type->rep.field_info.size(); j++) {
-                switch(type->rep.field_info[j].type)
-                {
-                    case ExtentType::ft_bool:
-                    case ExtentType::ft_byte:
-                        break;
-                    case ExtentType::ft_int32:
-                    case ExtentType::ft_variable32:
-                        Extent::flip4bytes(pos.record_start()
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    case ExtentType::ft_int64:
-                    case ExtentType::ft_double:
-                        Extent::flip8bytes(pos.record_start()
-                                           + type->rep.field_info[j].offset);
-                        break;
-                    default:
-                        FATAL_ERROR(format("unknown field type %d for fix_endianness") % type->rep.field_info[j].type);
-                        break;
-                }
-            }
-        }
-        // check variable sized fields ...
-        if (unpack_variable32_check) {
-            for (unsigned int j=0;j<type_variable32_field_columns_size;j++) {
-                int field = type->rep.variable32_field_columns[j];
-                int32 offset = type->rep.field_info[field].offset;
-                int32 varoffset
-                        = Variable32Field::getVarOffset(pos.record_start(),
-                                                        offset);
-                // now check with the standard verification routine
-                Variable32Field::selfcheck(variabledata,varoffset);
-            }
-        }
-        // Unpacking is done in the reverse order as packing.
+    byte *records = fixeddata.begin();
+    INVARIANT(fixeddata.size() == nrecords * record_size, "internal error");
 
-        // unpack scaled fields ...
-        for (unsigned int j=0;j<type_pack_scale_size;++j) {
-            int field = type->rep.pack_scale[j].field_num;
-            INVARIANT(type->rep.field_info[field].type == ExtentType::ft_double,
-                      "internal error, scaled only supported for ft_double");
-            int offset = type->rep.field_info[field].offset;
-            double scale = type->rep.pack_scale[j].scale;
-            double v = *(double *)(pos.record_start() + offset);
-            *(double *)(pos.record_start() + offset) = v * scale;
-        }
-
-        // unpack self-relative fields ...
-        for (unsigned int j=0;j<type_pack_self_relative_size;++j) {
-            unsigned field_num = psr_copy[j].field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(),
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
+    if (fix_endianness) {
+        for (unsigned int j = 0; j < rep.field_info.size(); ++j) {
+            if (field_mask != NULL && !(*field_mask)[j]) {
                 continue;
             }
-            int offset = field.offset;
-            switch(field.type)
-            {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + offset) + psr_copy[j].double_prev_v;
-                    double multiplier = psr_copy[j].multiplier;
-                    double scale = psr_copy[j].scale;
-                    v = round(v * multiplier) * scale;
-                    *(double *)(pos.record_start() + offset) = v;
-                    psr_copy[j].double_prev_v = v;
-                }
+            const ExtentType::fieldInfo &field(rep.field_info[j]);
+            switch (field.type)
+                {
+                case ExtentType::ft_bool:
+                case ExtentType::ft_byte:
                     break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + offset) + psr_copy[j].int32_prev_v;
-                    *(int32 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int32_prev_v = v;
-                }
+                case ExtentType::ft_int32:
+                case ExtentType::ft_variable32:
+                    flipColumn4(records + field.offset, record_size, nrecords);
                     break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + offset) + psr_copy[j].int64_prev_v;
-                    *(int64 *)(pos.record_start() + offset) = v;
-                    psr_copy[j].int64_prev_v = v;
-                }
+                case ExtentType::ft_int64:
+                case ExtentType::ft_double:
+                    flipColumn8(records + field.offset, record_size, nrecords);
                     break;
                 default:
-                    INVARIANT(field_num < type->rep.field_info.size(),
-                              format("bad field number %d > %d")
-                              % field_num % type->rep.field_info.size());
-
-                    FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
-                                % field.type % field.name
-                                % field_num % offset % type->rep.name);
-            }
+                    FATAL_ERROR(format("unknown field type %d for fix_endianness") % field.type);
+                    break;
+                }
         }
-        // unpack other-relative fields ...
-        for (unsigned int j=0;j<type_pack_other_relative_size;++j) {
-            // 2004-09-26 I cannot believe this is worth a 1% speedup (pulling out v).
-            const ExtentType::pack_other_relativeT &v
-                    = type->rep.pack_other_relative[j];
-            int field_num = v.field_num;
-            const ExtentType::fieldInfo &field(type->rep.field_info[field_num]);
-            if (null_compact && compactIsNull(pos.record_start(),
-                                              *field.null_compact_info)) {
-                // Don't overwrite nulls, must remain 0 to unpack properly.
+    }
+
+    // check variable sized fields ...
+    if (unpack_variable32_check) {
+        for (unsigned int j = 0; j < rep.variable32_field_columns.size(); ++j) {
+            int field = rep.variable32_field_columns[j];
+            if (field_mask != NULL && !(*field_mask)[field]) {
                 continue;
             }
-            int base_field = v.base_field_num;
-            int field_offset = field.offset;
-            byte *base_ptr = pos.record_start()
-                             + type->rep.field_info[base_field].offset;
-            switch(field.type)
+            int32 offset = rep.field_info[field].offset;
+            for (byte *record = records; record != fixeddata.end(); record += record_size) {
+                int32 varoffset = Variable32Field::getVarOffset(record, offset);
+                Variable32Field::selfcheck(variabledata, varoffset);
+            }
+        }
+    }
+
+    // unpack scaled fields ...
+    for (unsigned int j = 0; j < rep.pack_scale.size(); ++j) {
+        const ExtentType::pack_scaleT &ps(rep.pack_scale[j]);
+        if (field_mask != NULL && !(*field_mask)[ps.field_num]) {
+            continue;
+        }
+        const ExtentType::fieldInfo &field(rep.field_info[ps.field_num]);
+        INVARIANT(field.type == ExtentType::ft_double,
+                  "internal error, scaled only supported for ft_double");
+        scaleColumn(records + field.offset, record_size, nrecords, ps.scale);
+    }
+
+    // unpack self-relative fields ...
+    for (unsigned int j = 0; j < rep.pack_self_relative.size(); ++j) {
+        const ExtentType::pack_self_relativeT &psr(rep.pack_self_relative[j]);
+        unsigned field_num = psr.field_num;
+        INVARIANT(field_num < rep.field_info.size(),
+                  format("bad field number %d > %d") % field_num % rep.field_info.size());
+        if (field_mask != NULL && !(*field_mask)[field_num]) {
+            continue;
+        }
+        const ExtentType::fieldInfo &field(rep.field_info[field_num]);
+        const ExtentType::nullCompactInfo *null_info
+            = null_compact ? field.null_compact_info : NULL;
+        switch (field.type)
             {
-                case ExtentType::ft_double: {
-                    double v = *(double *)(pos.record_start() + field_offset);
-                    double base_v = *reinterpret_cast<double *>(base_ptr);
-                    *(double *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                case ExtentType::ft_int32: {
-                    int32 v = *(int32 *)(pos.record_start() + field_offset);
-                    int32 base_v = *reinterpret_cast<int32 *>(base_ptr);
-                    *(int32 *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                case ExtentType::ft_int64: {
-                    int64 v = *(int64 *)(pos.record_start() + field_offset);
-                    int64 base_v = *reinterpret_cast<int64 *>(base_ptr);
-                    *(int64 *)(pos.record_start() + field_offset) = v + base_v;
-                }
-                    break;
-                default:
-                    FATAL_ERROR("Internal error");
+            case ExtentType::ft_double:
+                selfRelativeDoubleColumn(records, record_size, nrecords, field.offset, null_info,
+                                         psr.multiplier, psr.scale);
+                break;
+            case ExtentType::ft_int32:
+                selfRelativeColumn<int32>(records, record_size, nrecords, field.offset, null_info);
+                break;
+            case ExtentType::ft_int64:
+                selfRelativeColumn<int64>(records, record_size, nrecords, field.offset, null_info);
+                break;
+            default:
+                FATAL_ERROR(format("Internal Error: unrecognized field type %d for field %s (#%d) offset %d in type %s")
+                            % field.type % field.name
+                            % field_num % field.offset % rep.name);
             }
+    }
+
+    // unpack other-relative fields, in the order listed so each base field is decoded first
+    for (unsigned int j = 0; j < rep.pack_other_relative.size(); ++j) {
+        const ExtentType::pack_other_relativeT &por(rep.pack_other_relative[j]);
+        if (field_mask != NULL && !(*field_mask)[por.field_num]) {
+            continue;
         }
+        const ExtentType::fieldInfo &field(rep.field_info[por.field_num]);
+        const ExtentType::nullCompactInfo *null_info
+            = null_compact ? field.null_compact_info : NULL;
+        int32 base_offset = rep.field_info[por.base_field_num].offset;
+        switch (field.type)
+            {
+            case ExtentType::ft_double:
+                otherRelativeColumn<double>(records, record_size, nrecords, field.offset,
+                                            base_offset, null_info);
+                break;
+            case ExtentType::ft_int32:
+                otherRelativeColumn<int32>(records, record_size, nrecords, field.offset,
+                                           base_offset, null_info);
+                break;
+            case ExtentType::ft_int64:
+                otherRelativeColumn<int64>(records, record_size, nrecords, field.offset,
+                                           base_offset, null_info);
+                break;
+            default:
+                FATAL_ERROR("Internal error");
+            }
     }
-    INVARIANT(record_count == nrecords,"internal error");
     TIME_UNPACKING(Clock::Tdbl time_done = Clock::tod();
                    printf("%d records, unpackcheck %.6g; uncompress %.6g; unpack %.6g\n",
                           nrecords,
@@ -1565,25 +2127,19 @@ bool Extent::checkedPread(int fd, off64_t offset, byte *into, int amount, bool e
     return true;
 }
 
-bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
-    int prefix_size = 6*4 + 4*1;
-    into.resize(prefix_size, false);
-    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
-        into.resize(0);
-        return false;
-    }
-    offset += prefix_size;
-    byte *l = into.begin();
-    int32_t compressed_fixed = *(int32_t *)l; l += 4;
-    int32_t compressed_variable = *(int32_t *)l; l += 4;
-    int32 typenamelen = into[6*4+2];
+// Returns the size of the packed extent described by the prefix, or 0 if the
+// prefix is actually the file tail.
+static uint64_t packedExtentSize(Extent::byte *prefix, int prefix_size, bool need_bitflip) {
+    int32_t compressed_fixed = *(int32_t *)prefix;
+    int32_t compressed_variable = *(int32_t *)(prefix + 4);
+    int32_t typenamelen = prefix[6*4+2];
     if (need_bitflip) {
-        compressed_fixed = flip4bytes(compressed_fixed);
-        compressed_variable = flip4bytes(compressed_variable);
+        compressed_fixed = Extent::flip4bytes(compressed_fixed);
+        compressed_variable = Extent::flip4bytes(compressed_variable);
     }
     if (compressed_fixed == -1) {
-        DataSeriesSink::verifyTail(into.begin(), need_bitflip,"*unknown*");
-        return false;
+        DataSeriesSink::verifyTail(prefix, need_bitflip,"*unknown*");
+        return 0;
     }
     INVARIANT(compressed_fixed >= 0 && compressed_variable >= 0
               && typenamelen >= 0, "Error reading extent");
@@ -1599,6 +2155,21 @@ bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool
     extentsize += (4 - extentsize % 4) % 4;
     LintelLogDebug("Extent/size", format("%d %d %d %d ~= %d") % prefix_size % typenamelen
                    % compressed_fixed % compressed_variable % extentsize);
+    return extentsize;
+}
+
+bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    int prefix_size = 6*4 + 4*1;
+    into.resize(prefix_size, false);
+    if (checkedPread(fd,offset,into.begin(),prefix_size, true) == false) {
+        into.resize(0);
+        return false;
+    }
+    offset += prefix_size;
+    uint64_t extentsize = packedExtentSize(into.begin(), prefix_size, need_bitflip);
+    if (extentsize == 0) {
+        return false;
+    }
     into.resize(extentsize, false);
     checkedPread(fd, offset, into.begin() + prefix_size,
                  extentsize - prefix_size);
@@ -1606,6 +2177,56 @@ bool Extent::preadExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool
     return true;
 }
 
+uint64_t Extent::preadExtentSize(int fd, off64_t offset, bool need_bitflip) {
+    const int prefix_size = 6*4 + 4*1;
+    byte prefix[prefix_size];
+    checkedPread(fd, offset, prefix, prefix_size);
+    return packedExtentSize(prefix, prefix_size, need_bitflip);
+}
+
+namespace {
+    struct Munmapper {
+        size_t len;
+        Munmapper(size_t len) : len(len) { }
+        void operator()(void *p) {
+            CHECKED(munmap(p, len) == 0, format("munmap failed: %s") % strerror(errno));
+        }
+    };
+}
+
+bool Extent::mmapExtent(int fd, off64_t &offset, Extent::ByteArray &into, bool need_bitflip) {
+    const int prefix_size = 6*4 + 4*1;
+    byte prefix[prefix_size];
+    if (need_bitflip || checkedPread(fd, offset, prefix, prefix_size, true) == false
+        || prefix[6*4] != compress_mode_none) {
+        // unpacking would have to rewrite or decompress the fixed data anyway
+        return preadExtent(fd, offset, into, need_bitflip);
+    }
+    uint64_t extentsize = packedExtentSize(prefix, prefix_size, need_bitflip);
+    if (extentsize == 0) {
+        into.clear();
+        return false;
+    }
+
+    // mapping past the end of the file would get us a SIGBUS rather than
+    // the partial read error from preadExtent
+    struct stat stat_buf;
+    CHECKED(fstat(fd, &stat_buf) == 0, format("fstat failed: %s") % strerror(errno));
+    INVARIANT(offset + static_cast<off64_t>(extentsize) <= stat_buf.st_size,
+              format("partial read of %d byte extent at %d") % extentsize % offset);
+
+    static const off64_t page_size = sysconf(_SC_PAGESIZE);
+    off64_t map_offset = offset - offset % page_size;
+    size_t map_len = (offset - map_offset) + extentsize;
+    void *base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, map_offset);
+    INVARIANT(base != MAP_FAILED, format("mmap of %d bytes at %d failed: %s")
+              % map_len % map_offset % strerror(errno));
+    byte *begin = static_cast<byte *>(base) + (offset - map_offset);
+    into.setMapping(boost::shared_ptr<void>(base, Munmapper(map_len)), begin, begin + extentsize);
+    offset += extentsize;
+    return true;
+}
+
 void Extent::run_flip4bytes(uint32_t *buf, unsigned buflen) {
     for (unsigned i=0;i<buflen;++i) {
         buf[i] = Extent::flip4bytes(buf[i]);
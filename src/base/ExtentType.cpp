@@ -36,38 +36,39 @@ const string dataseries_index_type_v0_xml =
         "  <field type=\"variable32\" name=\"extenttype\" />\n"
         "</ExtentType>\n";
 
-// The following is here as we are working out what the next version
-// of the extent index should look like; I think we will be able to
-// get away with putting it into the xmltype index and hence be able 
-// to update this as we see fit.
+// The extended index is optional, see DataSeriesSink::setIndexV1().  It is
+// written just before the V0 index, and is not listed in it, so readers that
+// only know about V0 never see it; its type is in the file's type library so
+// that readers which walk the file can still decode it.  It is found by
+// skipping over the last extent listed in the V0 index.  The namespace and
+// version from the earlier draft of this type were dropped since they are
+// available from the type library via extenttype.
 
 const string dataseries_index_type_v1_xml =
-        "<ExtentType name=\"DataSeries::ExtentIndex\" >\n"
-        "  <!-- next fields are necessary/useful for finding the extents that\n"
-        "       a program wants to process without having a separate index file -->\n"
+        "<ExtentType name=\"DataSeries: ExtentIndexV1\" >\n"
+        // next fields are necessary/useful for finding the extents that a
+        // program wants to process without having a separate index file
         "  <field type=\"int64\" name=\"offset\" pack_relative=\"offset\" />\n"
         "  <field type=\"int32\" name=\"size\" comment=\"header+data+padding\" />\n"
         "  <field type=\"variable32\" name=\"extenttype\" pack_unique=\"yes\" />\n"
-        "  <field type=\"variable32\" name=\"namespace\" pack_unique=\"yes\" />\n"
-        "  <field type=\"variable32\" name=\"version\" pack_unique=\"yes\" />\n"
-        // Technically the next bits are in the header for each extent; this
-        // would allow for the possibility of reading the files without
-        // reading the index at the end, although this is not currently
-        // supported.  However, these end up being useful for figuring out
-        // properties of a given DS file without having to write a separate
-        // interface that can skitter through a file and extract all of this
-        // information.
+        // Technically the next bits are in the header for each extent; having
+        // them here lets readers size buffers and plan reads, and answer
+        // questions like the number of records, without reading the extents.
+        "  <field type=\"int32\" name=\"nrecords\" />\n"
         "  <field type=\"byte\" name=\"fixed_compress_mode\" />\n"
         "  <field type=\"int32\" name=\"fixed_uncompressed_size\" />\n"
         "  <field type=\"int32\" name=\"fixed_compressed_size\" />\n"
         "  <field type=\"byte\" name=\"variable_compress_mode\" />\n"
         "  <field type=\"int32\" name=\"variable_uncompressed_size\" />\n"
         "  <field type=\"int32\" name=\"variable_compressed_size\" />\n"
+        "  <field type=\"int32\" name=\"compressed_adler32\" />\n"
+        "  <field type=\"int32\" name=\"uncompressed_bjhash\" />\n"
         "</ExtentType>\n";
 
 
 const ExtentType::Ptr ExtentType::dataseries_xml_type(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_xml_type_xml));
 const ExtentType::Ptr ExtentType::dataseries_index_type_v0(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_index_type_v0_xml));
+const ExtentType::Ptr ExtentType::dataseries_index_type_v1(ExtentTypeLibrary::sharedExtentTypePtr(dataseries_index_type_v1_xml));
 
 string ExtentType::strGetXMLProp(xmlNodePtr cur, const string &option_name, bool empty_ok) {
     xmlChar *option = xmlGetProp(cur, reinterpret_cast<const xmlChar *>(option_name.c_str()));
@@ -696,6 +697,33 @@ string ExtentType::nullableFieldname(const string &fieldname) {
     return ret;
 }
 
+vector<bool> ExtentType::unpackFieldMask(const vector<string> &fields) const {
+    vector<bool> ret(rep.field_info.size(), false);
+    for (vector<string>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+        int field_num = getColumnNumber(rep, *i);
+        if (field_num != -1) {
+            ret[field_num] = true;
+        }
+    }
+    // bases can themselves be relative to other fields, so repeat until nothing changes
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (vector<pack_other_relativeT>::const_iterator i = rep.pack_other_relative.begin();
+             i != rep.pack_other_relative.end(); ++i) {
+            if (ret[i->field_num] && !ret[i->base_field_num]) {
+                ret[i->base_field_num] = true;
+                changed = true;
+            }
+        }
+    }
+    for (unsigned i = 0; i < rep.field_info.size(); ++i) {
+        if (ret[i] && rep.field_info[i].null_fieldnum >= 0) {
+            ret[rep.field_info[i].null_fieldnum] = true;
+        }
+    }
+    return ret;
+}
+
 string ExtentType::xmlFieldDesc(int field_num) const {
     INVARIANT(field_num >= 0 && field_num < (int)rep.field_info.size(),
               "bad field num");
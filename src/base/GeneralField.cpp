@@ -9,7 +9,10 @@
     General field implementation
 */
 
+#include <stdarg.h>
+
 #include <algorithm>
+#include <cmath>
 
 #include <boost/format.hpp>
 
@@ -29,6 +32,44 @@ namespace {
     static const string s_yes("yes");
     static const string s_no("no");
     static const string s_null("null");
+
+    // Appends what sprintf(buf, "%d" or "%lld", v) would
+    void appendInteger(string &to, int64_t v) {
+        char buf[24];
+        char *end = buf + sizeof(buf), *p = end;
+        uint64_t u = v < 0 ? -static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+        do {
+            *--p = '0' + u % 10;
+            u /= 10;
+        } while (u != 0);
+        if (v < 0) {
+            *--p = '-';
+        }
+        to.append(p, end);
+    }
+
+    void appendPrintf(string &to, const char *printspec, ...) {
+        char buf[256];
+        va_list args;
+        va_start(args, printspec);
+        int len = vsnprintf(buf, sizeof(buf), printspec, args);
+        va_end(args);
+        INVARIANT(len >= 0, format("bad printspec '%s'") % printspec);
+        if (static_cast<size_t>(len) < sizeof(buf)) {
+            to.append(buf, len);
+        } else {
+            size_t old_size = to.size();
+            to.resize(old_size + len + 1);
+            va_start(args, printspec);
+            vsnprintf(&to[old_size], len + 1, printspec, args);
+            va_end(args);
+            to.resize(old_size + len);
+        }
+    }
+
+    bool isPrintspec(const char *printspec, const char *default_spec) {
+        return strcmp(printspec, default_spec) == 0;
+    }
 }
 
 // TODO: performance time boost::format, and if possible, unify the
@@ -564,6 +605,14 @@ void GF_Bool::write(std::ostream &to) {
     }
 }
 
+void GF_Bool::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else {
+        to.append(myfield.val() ? s_true : s_false);
+    }
+}
+
 // TODO: see whether it's worth optimizing the set functions to special
 // case the same-type copy; that's probably the common case.
 // one experiment with this for GF_Bool did not show any benefit.
@@ -661,6 +710,16 @@ void GF_Byte::write(std::ostream &to) {
     }
 }
 
+void GF_Byte::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else if (isPrintspec(printspec, "%d")) {
+        appendInteger(to, myfield.val());
+    } else {
+        appendPrintf(to, printspec, myfield.val());
+    }
+}
+
 void GF_Byte::set(GeneralField *from) {
     if (from->isNull()) {
         myfield.setNull();
@@ -762,6 +821,20 @@ void GF_Int32::write(std::ostream &to) {
     }
 }
 
+void GF_Int32::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else if (printspec == ipv4addr) {
+        SINVARIANT(divisor == 1);
+        uint32_t v = static_cast<uint32_t>(myfield.val());
+        appendPrintf(to, "%d.%d.%d.%d", v >> 24, (v >> 16) & 0xFF, (v >> 8) & 0xFF, v & 0xFF);
+    } else if (isPrintspec(printspec, "%d")) {
+        appendInteger(to, myfield.val() / divisor);
+    } else {
+        appendPrintf(to, printspec, myfield.val() / divisor);
+    }
+}
+
 void GF_Int32::set(GeneralField *from) {
     if (from->isNull()) {
         myfield.setNull();
@@ -909,6 +982,27 @@ void GF_Int64::write(std::ostream &to) {
     }
 }
 
+void GF_Int64::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else {
+        if (offset_first) {
+            offset = myfield.val();
+            offset_first = false;
+        } else if (relative_field != NULL) {
+            offset = relative_field->val();
+        }
+        if (myfield_time != NULL) {
+            DEBUG_SINVARIANT(printspec == str_sec_nanosec);
+            to.append(myfield_time->rawToStrSecNano(myfield.val() - offset));
+        } else if (isPrintspec(printspec, "%lld")) {
+            appendInteger(to, (myfield.val() - offset) / divisor);
+        } else {
+            appendPrintf(to, printspec, (myfield.val() - offset) / divisor);
+        }
+    }
+}
+
 void GF_Int64::set(GeneralField *from) {
     if (from->isNull()) {
         myfield.setNull();
@@ -1045,6 +1139,29 @@ void GF_Double::write(std::ostream &to) {
     }
 }
 
+void GF_Double::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else {
+        if (isnan(offset)) {
+            offset = myfield.val();
+        }
+        if (relative_field != NULL) {
+            // offset needs to be calculated in absolute space, but things may be
+            // offset differently.
+            offset = relative_field->val() + (relative_field->base_val - myfield.base_val);
+        }
+        double v = multiplier * (myfield.val() - offset);
+        // %.9g prints whole numbers of up to 9 digits as integers
+        if (isPrintspec(printspec, "%.9g") && v == floor(v) && fabs(v) < 1.0e9
+            && !(v == 0 && signbit(v))) {
+            appendInteger(to, static_cast<int64_t>(v));
+        } else {
+            appendPrintf(to, printspec, v);
+        }
+    }
+}
+
 void GF_Double::set(GeneralField *from) {
     if (from->isNull()) {
         myfield.setNull();
@@ -1173,6 +1290,17 @@ void GF_Variable32::write(FILE *to) {
     }
 }
 
+void GF_Variable32::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else if (isPrintspec(printspec, "%s")) {
+        to.append(valFormatted().c_str()); // stops at a null as printf would
+    } else {
+        string v = valFormatted();
+        appendPrintf(to, printspec, v.c_str());
+    }
+}
+
 void GF_Variable32::write(std::ostream &to) {
     if (myfield.isNull()) {
         to << "null";
@@ -1300,6 +1428,14 @@ void GF_FixedWidth::write(FILE *to) {
     }
 }
 
+void GF_FixedWidth::write(std::string &to) {
+    if (myfield.isNull()) {
+        to.append(s_null);
+    } else {
+        to.append(maybehexstring(myfield.val(), myfield.size()).c_str());
+    }
+}
+
 void GF_FixedWidth::write(std::ostream &to) {
     if (myfield.isNull()) {
         to << "null";
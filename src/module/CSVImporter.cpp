@@ -0,0 +1,430 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <istream>
+#include <limits>
+
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/CSVImporter.hpp>
+#include <DataSeries/GeneralField.hpp>
+
+using namespace std;
+using boost::format;
+
+// Whole lines of input, and the extents parsed from them
+struct CSVImporter::Chunk {
+    Chunk() : nlines(0), nrecords(0), error_line(0), parsed(false) { }
+
+    vector<char> data; // ends in a newline
+    vector<Extent::Ptr> extents;
+    uint64_t nlines, nrecords;
+    uint64_t error_line; // 0 ==> no error, else line within the chunk, counting from 1
+    string error; // what is wrong with error_line
+    bool parsed; // under mutex
+};
+
+// Each worker parses into its own series with its own fields
+class CSVImporter::Worker : public PThread {
+  public:
+    Worker(CSVImporter &importer)
+        : importer(importer), series(importer.type),
+          converted(importer.type->getNFields(), GeneralValue()),
+          is_null(importer.type->getNFields(), false) {
+        const ExtentType &type(*importer.type);
+        for (uint32_t i = 0; i < type.getNFields(); ++i) {
+            fields.push_back(GeneralField::create(series, type.getFieldName(i)));
+            is_nullable.push_back(type.getNullable(type.getFieldName(i)));
+        }
+    }
+
+    virtual ~Worker() {
+        GeneralField::deleteFields(fields);
+    }
+
+    virtual void *run() {
+        importer.workerThread(*this);
+        return NULL;
+    }
+
+    CSVImporter &importer;
+    ExtentSeries series;
+    vector<GeneralField *> fields;
+    vector<bool> is_nullable;
+    vector<string> values; // fields of the current line; reused so the strings keep their space
+    vector<GeneralValue> converted; // one per field, as a GeneralValue can't change type
+    vector<bool> is_null; // of the fields of the current line
+};
+
+CSVImporter::CSVImporter(const ExtentType::Ptr &type, dataseries::IExtentSink &sink,
+                         uint32_t target_extent_size, int n_threads)
+    : type(type), sink(sink), target_extent_size(target_extent_size), n_threads(n_threads),
+      field_separator(","), comment_prefix("#"), null_string("null"),
+      hex_encoded_variable32(false), chunk_size(4*1024*1024), nrecords(0), stop(false)
+{
+    if (this->n_threads == -1) {
+        this->n_threads = PThreadMisc::getNCpus();
+    }
+    INVARIANT(this->n_threads > 0, "need at least one thread");
+    SINVARIANT(type != NULL);
+}
+
+CSVImporter::~CSVImporter() {
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        delete *i;
+    }
+}
+
+void CSVImporter::setFieldSeparator(const string &separator) {
+    field_separator = separator;
+    if (prefixequal(field_separator, "0x")) {
+        INVARIANT(field_separator.size() >= 4,
+                  "--field-separator=0x.. needs to be at least 4 characters long");
+        field_separator = hex2raw(field_separator.c_str() + 2, field_separator.size() - 2);
+    }
+    INVARIANT(!field_separator.empty(), "empty field separator");
+}
+
+bool CSVImporter::import(istream &input, string &error) {
+    INVARIANT(workers.empty(), "import() can only be called once");
+    INVARIANT(chunk_size > 0, "need a positive chunk size");
+    for (int i = 0; i < n_threads; ++i) {
+        workers.push_back(new Worker(*this));
+        workers.back()->start();
+    }
+
+    // Read ahead far enough to keep every worker busy while the oldest chunk is parsed
+    const size_t max_pending = 2 * workers.size();
+    Deque<Chunk *> pending;
+    vector<char> carry;
+    uint64_t line_num = 0;
+    bool ok = true, more_input = true;
+    while (ok && (more_input || !pending.empty())) {
+        if (more_input && pending.size() < max_pending) {
+            Chunk *chunk = readChunk(input, carry);
+            if (chunk == NULL) {
+                more_input = false;
+            } else {
+                pending.push_back(chunk);
+                PThreadScopedLock lock(mutex);
+                to_parse.push_back(chunk);
+                cond.broadcast();
+            }
+            continue;
+        }
+        Chunk *chunk = pending.front();
+        pending.pop_front();
+        {
+            PThreadScopedLock lock(mutex);
+            while (!chunk->parsed) {
+                cond.wait(mutex);
+            }
+        }
+        ok = writeChunk(*chunk, line_num, error);
+        delete chunk;
+    }
+
+    stopWorkers();
+    // only left after an error; the workers are gone, so nothing refers to them
+    while (!pending.empty()) {
+        delete pending.front();
+        pending.pop_front();
+    }
+    return ok;
+}
+
+void CSVImporter::workerThread(Worker &worker) {
+    while (true) {
+        Chunk *chunk;
+        {
+            PThreadScopedLock lock(mutex);
+            while (to_parse.empty() && !stop) {
+                cond.wait(mutex);
+            }
+            if (stop) {
+                return;
+            }
+            chunk = to_parse.front();
+            to_parse.pop_front();
+        }
+        parseChunk(*chunk, worker);
+
+        PThreadScopedLock lock(mutex);
+        chunk->parsed = true;
+        cond.broadcast();
+    }
+}
+
+void CSVImporter::stopWorkers() {
+    {
+        PThreadScopedLock lock(mutex);
+        stop = true;
+        to_parse.clear();
+        cond.broadcast();
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).join();
+    }
+}
+
+CSVImporter::Chunk *CSVImporter::readChunk(istream &input, vector<char> &carry) {
+    Chunk *chunk = new Chunk;
+    vector<char> &data(chunk->data);
+    data.swap(carry); // the partial line left over from the last chunk; has no newline
+    while (true) {
+        size_t have = data.size();
+        data.resize(have + chunk_size);
+        input.read(&data[have], chunk_size);
+        INVARIANT(input.good() || input.eof(), format("error reading csv input: %s")
+                  % strerror(errno));
+        data.resize(have + input.gcount());
+
+        // cut after the last newline; lines are short, so this only looks at a few bytes
+        size_t end = data.size();
+        while (end > have && data[end - 1] != '\n') {
+            --end;
+        }
+        if (end > have) {
+            carry.assign(data.begin() + end, data.end());
+            data.resize(end);
+            return chunk;
+        }
+        if (input.eof()) {
+            if (data.empty()) {
+                delete chunk;
+                return NULL;
+            }
+            data.push_back('\n'); // pretend it was always there
+            return chunk;
+        }
+        // a line longer than chunk_size; keep reading
+    }
+}
+
+bool CSVImporter::writeChunk(Chunk &chunk, uint64_t &line_num, string &error) {
+    for (vector<Extent::Ptr>::iterator i = chunk.extents.begin();
+         i != chunk.extents.end(); ++i) {
+        sink.writeExtent(**i, NULL);
+    }
+    nrecords += chunk.nrecords;
+    if (chunk.error_line > 0) {
+        error = str(format("csv line %d %s") % (line_num + chunk.error_line) % chunk.error);
+        return false;
+    }
+    line_num += chunk.nlines;
+    return true;
+}
+
+void CSVImporter::parseChunk(Chunk &chunk, Worker &worker) {
+    worker.series.newExtent();
+    const char *pos = &chunk.data[0];
+    const char *end = pos + chunk.data.size();
+    while (pos < end) {
+        const char *newline = static_cast<const char *>(memchr(pos, '\n', end - pos));
+        SINVARIANT(newline != NULL);
+        ++chunk.nlines;
+        if (!parseLine(pos, newline, chunk, worker)) {
+            chunk.error_line = chunk.nlines;
+            break;
+        }
+        pos = newline + 1;
+    }
+    Extent::Ptr last(worker.series.getSharedExtent());
+    if (last->nRecords() > 0) {
+        chunk.extents.push_back(last);
+    }
+    worker.series.clearExtent();
+}
+
+// line ... newline is the line; *newline == '\n'
+bool CSVImporter::parseLine(const char *line, const char *newline, Chunk &chunk,
+                            Worker &worker) {
+    const size_t line_size = newline + 1 - line; // counting the newline
+    if (line == newline || (line_size == 2 && line[0] == '\r')) {
+        return true;
+    }
+    if (!comment_prefix.empty() && line_size >= comment_prefix.size()
+        && memcmp(line, comment_prefix.data(), comment_prefix.size()) == 0) {
+        return true;
+    }
+
+    const char string_quote_character('"');
+    const char *separator = field_separator.data();
+    const size_t separator_size = field_separator.size();
+    vector<string> &values(worker.values);
+    size_t nvalues = 0;
+    const char *pos = line;
+    while (true) {
+        if (nvalues == values.size()) {
+            values.push_back(string());
+        }
+        string &field(values[nvalues]);
+        ++nvalues;
+        if (*pos == string_quote_character) {
+            field.clear();
+            for (++pos; true; ++pos) {
+                if (pos == newline) {
+                    chunk.error = "ends in middle of string";
+                    return false;
+                }
+                if (*pos == string_quote_character) {
+                    if (pos[1] == string_quote_character) {
+                        ++pos;
+                    } else {
+                        ++pos; // skip terminating string quote char
+                        break;
+                    }
+                }
+                field.push_back(*pos);
+            }
+        } else {
+            const char *start = pos;
+            for (; *pos != '\r' && *pos != '\n'; ++pos) {
+                if (*pos == separator[0]
+                    && static_cast<size_t>(newline + 1 - pos) >= separator_size
+                    && memcmp(pos, separator, separator_size) == 0) {
+                    break;
+                }
+            }
+            field.assign(start, pos);
+        }
+
+        if (*pos == '\r') {
+            if (pos + 1 != newline) {
+                chunk.error = "has a carriage return not followed by a newline";
+                return false;
+            }
+            break;
+        }
+        if (pos == newline) {
+            break;
+        }
+        if (static_cast<size_t>(newline + 1 - pos) < separator_size
+            || memcmp(pos, separator, separator_size) != 0) {
+            chunk.error = str(format("at pos %d is '%c', not a field separator")
+                              % (pos - line) % *pos);
+            return false;
+        }
+        pos += separator_size;
+    }
+
+    vector<GeneralField *> &fields(worker.fields);
+    if (nvalues != fields.size()) {
+        chunk.error = str(format("has %d fields, not %d as in type definition")
+                          % nvalues % fields.size());
+        return false;
+    }
+
+    // convert everything before adding the record, so a bad value leaves no partial row
+    for (size_t i = 0; i < nvalues; ++i) {
+        worker.is_null[i] = worker.is_nullable[i] && values[i] == null_string;
+        if (worker.is_null[i]) {
+            continue;
+        }
+        if (hex_encoded_variable32 && fields[i]->getType() == ExtentType::ft_variable32) {
+            values[i] = hex2raw(values[i]);
+        }
+        if (!convert(*fields[i], values[i], worker.converted[i], chunk.error)) {
+            chunk.error = str(format("field %d %s") % (i + 1) % chunk.error);
+            return false;
+        }
+    }
+
+    ExtentSeries &series(worker.series);
+    Extent &extent(*series.getSharedExtent());
+    if (extent.nRecords() > 0 && extent.size() + type->fixedrecordsize() > target_extent_size) {
+        chunk.extents.push_back(series.getSharedExtent());
+        series.newExtent();
+    }
+    series.newRecord();
+    ++chunk.nrecords;
+    for (size_t i = 0; i < nvalues; ++i) {
+        if (worker.is_null[i]) {
+            fields[i]->setNull();
+        } else {
+            fields[i]->set(worker.converted[i]);
+        }
+    }
+    return true;
+}
+
+// Bad values are errors in the input rather than fatal, as the importer may be running in a
+// server shared with other requests.
+bool CSVImporter::convert(const GeneralField &field, const string &from, GeneralValue &to,
+                          string &error) {
+    const ExtentType::fieldType type = field.getType();
+    const char *start = from.c_str();
+    char *end = NULL;
+    errno = 0;
+    switch (type)
+        {
+        case ExtentType::ft_bool:
+            if (from == "true" || from == "on" || from == "yes") {
+                to.setBool(true);
+            } else if (from == "false" || from == "off" || from == "no") {
+                to.setBool(false);
+            } else {
+                error = str(format("is '%s', not true, on, yes, false, off or no") % from);
+                return false;
+            }
+            return true;
+        case ExtentType::ft_byte: case ExtentType::ft_int32: case ExtentType::ft_int64: {
+            long long v = strtoll(start, &end, 10);
+            long long min_v = type == ExtentType::ft_byte ? 0
+                : type == ExtentType::ft_int32 ? numeric_limits<int32_t>::min()
+                : numeric_limits<int64_t>::min();
+            long long max_v = type == ExtentType::ft_byte ? numeric_limits<uint8_t>::max()
+                : type == ExtentType::ft_int32 ? numeric_limits<int32_t>::max()
+                : numeric_limits<int64_t>::max();
+            if (from.empty() || *end != '\0' || errno != 0 || v < min_v || v > max_v) {
+                break;
+            }
+            if (type == ExtentType::ft_byte) {
+                to.setByte(static_cast<uint8_t>(v));
+            } else if (type == ExtentType::ft_int32) {
+                to.setInt32(static_cast<int32_t>(v));
+            } else {
+                to.setInt64(v);
+            }
+            return true;
+        }
+        case ExtentType::ft_double: {
+            double v = strtod(start, &end);
+            if (from.empty() || *end != '\0' || (errno != 0 && v != 0)) { // underflow is ok
+                break;
+            }
+            to.setDouble(v);
+            return true;
+        }
+        case ExtentType::ft_variable32:
+            to.setVariable32(from);
+            return true;
+        case ExtentType::ft_fixedwidth: {
+            int32_t size = static_cast<const GF_FixedWidth &>(field).size();
+            if (from.size() != static_cast<size_t>(size)) {
+                error = str(format("is %d bytes, not %d as the fixedwidth column needs")
+                            % from.size() % size);
+                return false;
+            }
+            to.setFixedWidth(from);
+            return true;
+        }
+        default:
+            FATAL_ERROR("internal error, unexpected type");
+        }
+    error = str(format("is '%s', not a valid %s") % from % ExtentType::fieldTypeString(type));
+    return false;
+}
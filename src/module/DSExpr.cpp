@@ -13,13 +13,13 @@ class DefaultParser : public DSExprParser {
         // change.
         DSExprImpl::Driver driver(series);
         driver.doit(expr);
-        return driver.expr;
+        return DSExprImpl::ExprCompiled::make(driver.expr);
     }
 
     DSExpr *parse(const FieldNameToSelector &field_name_to_selector, const string &expr) {
         DSExprImpl::Driver driver(field_name_to_selector);
         driver.doit(expr);
-        return driver.expr;
+        return DSExprImpl::ExprCompiled::make(driver.expr);
     }
 
     const string getUsage() const {
@@ -43,6 +43,28 @@ class DefaultParser : public DSExprParser {
 
 //////////////////////////////////////////////////////////////////////
 
+vector<string> DSExpr::fieldNames(ExtentSeries &series, const string &expr_string) {
+    DSExprImpl::Driver driver(series);
+    driver.doit(expr_string);
+    delete driver.expr;
+    return driver.field_names;
+}
+
+void DSExpr::selectRows(ExtentSeries &series, vector<bool> &selected) {
+    selected.clear();
+    if (!series.hasExtent()) {
+        return;
+    }
+    const void *saved_pos = series.getCurPos();
+    series.setCurPos(series.getExtentRef().fixeddata.begin());
+    for (; series.more(); series.next()) {
+        selected.push_back(valBool());
+    }
+    series.setCurPos(saved_pos);
+}
+
+//////////////////////////////////////////////////////////////////////
+
 class DefaultParserFactory : public DSExprParserFactory {
     DSExprParser *make() {
         return new DefaultParser();
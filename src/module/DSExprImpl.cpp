@@ -6,6 +6,7 @@
 
 #include "DSExprImpl.hpp"
 
+#include <algorithm>
 #include <ios>
 
 #include <boost/format.hpp>
@@ -40,6 +41,7 @@ void DSExprImpl::ExprNumericConstant::dump(ostream &out) {
 //////////////////////////////////////////////////////////////////////
 
 DSExprImpl::ExprField::ExprField(ExtentSeries &series, const string &fieldname_)
+    : series(series)
 { 
     // Allow for almost arbitrary fieldnames through escaping...
     if (fieldname_.find('\\', 0) != string::npos) {
@@ -64,6 +66,35 @@ void DSExprImpl::ExprField::dump(ostream &out) {
     out << format("{Field: %1%}") % fieldname;
 }
 
+int DSExprImpl::ExprNode::compileOperand(Program &program, DSExpr *expr, expr_type_t want) {
+    if (expr->getType() != want && dynamic_cast<ExprField *>(expr) == NULL) {
+        return -1;
+    }
+    return compile(program, expr);
+}
+
+int DSExprImpl::ExprField::compile(Program &program) {
+    switch (field->getType()) {
+        case ExtentType::ft_bool:
+            return program.field(Program::op_bool_field, 
+                                 &static_cast<GF_Bool *>(field)->myfield, series);
+        case ExtentType::ft_byte:
+            return program.field(Program::op_byte_field, 
+                                 &static_cast<GF_Byte *>(field)->myfield, series);
+        case ExtentType::ft_int32:
+            return program.field(Program::op_int32_field, 
+                                 &static_cast<GF_Int32 *>(field)->myfield, series);
+        case ExtentType::ft_int64:
+            return program.field(Program::op_int64_field, 
+                                 &static_cast<GF_Int64 *>(field)->myfield, series);
+        case ExtentType::ft_double:
+            return program.field(Program::op_double_field, 
+                                 &static_cast<GF_Double *>(field)->myfield, series);
+        default:
+            return -1; // strings go through GeneralValue
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void DSExprImpl::ExprStrLiteral::dump(ostream &out) {
@@ -169,6 +200,167 @@ DSExprImpl::ExprFunctionApplication::dump(ostream &out) {
 }
 
 
+//////////////////////////////////////////////////////////////////////
+
+int DSExprImpl::Program::constant(double v) {
+    code.push_back(Instruction(op_constant, -1, -1, v, NULL));
+    registers.resize(code.size() * batch_rows);
+    return code.size() - 1;
+}
+
+int DSExprImpl::Program::field(OpCode opcode, Field *field, ExtentSeries &field_series) {
+    if (series == NULL) {
+        series = &field_series;
+    } else if (series != &field_series) {
+        single_series = false;
+    }
+    code.push_back(Instruction(opcode, -1, -1, 0, field));
+    registers.resize(code.size() * batch_rows);
+    return code.size() - 1;
+}
+
+int DSExprImpl::Program::op(OpCode opcode, int a, int b) {
+    SINVARIANT(a >= 0 && a < static_cast<int>(code.size()) && b < static_cast<int>(code.size()));
+    code.push_back(Instruction(opcode, a, b, 0, NULL));
+    registers.resize(code.size() * batch_rows);
+    return code.size() - 1;
+}
+
+namespace {
+    template<typename T> inline double rawValue(const uint8_t *pos, uint8_t bit_mask) {
+        return *reinterpret_cast<const T *>(pos);
+    }
+
+    template<> inline double rawValue<bool>(const uint8_t *pos, uint8_t bit_mask) {
+        return (*pos & bit_mask) ? 1 : 0;
+    }
+}
+
+void DSExprImpl::Program::bind(const ExtentType::Ptr &type) {
+    if (type == bound_type) {
+        return;
+    }
+    for (vector<Instruction>::iterator i = code.begin(); i != code.end(); ++i) {
+        if (i->field == NULL) {
+            continue;
+        }
+        const string &name(i->field->getName());
+        i->offset = type->getOffset(name);
+        if (i->code == op_bool_field) {
+            i->bit_mask = 1 << type->getBitPos(name);
+        }
+        i->nullable = type->getNullable(name);
+        if (i->nullable) {
+            string null_name(ExtentType::nullableFieldname(name));
+            i->null_offset = type->getOffset(null_name);
+            i->null_bit_mask = 1 << type->getBitPos(null_name);
+        }
+    }
+    bound_type = type;
+}
+
+template<typename FieldT, typename T> 
+void DSExprImpl::Program::load(double *to, const Instruction &i, const Extent *e, 
+                               size_t first_row, size_t nrows) {
+    if (e == NULL) {
+        to[0] = static_cast<const FieldT *>(i.field)->val();
+        return;
+    }
+    size_t record_size = bound_type->fixedrecordsize();
+    const uint8_t *row = e->fixeddata.begin() + first_row * record_size;
+    for (size_t j = 0; j < nrows; ++j) {
+        to[j] = rawValue<T>(row + j * record_size + i.offset, i.bit_mask);
+    }
+    if (i.nullable) { // nulls read as the fields' default value of 0
+        for (size_t j = 0; j < nrows; ++j) {
+            if (row[j * record_size + i.null_offset] & i.null_bit_mask) {
+                to[j] = 0;
+            }
+        }
+    }
+}
+
+const double *DSExprImpl::Program::run(const Extent *e, size_t first_row, size_t nrows) {
+    SINVARIANT(!code.empty() && nrows <= batch_rows && (e != NULL || nrows == 1));
+    if (e != NULL) {
+        SINVARIANT(single_series);
+        bind(e->getTypePtr());
+        SINVARIANT((first_row + nrows) * bound_type->fixedrecordsize() <= e->fixeddata.size());
+    }
+    for (size_t n = 0; n < code.size(); ++n) {
+        const Instruction &i(code[n]);
+        double *to = &registers[n * batch_rows];
+        const double *a = i.a < 0 ? NULL : &registers[i.a * batch_rows];
+        const double *b = i.b < 0 ? NULL : &registers[i.b * batch_rows];
+        switch (i.code) 
+            {
+            case op_constant: std::fill(to, to + nrows, i.constant); break;
+            case op_bool_field: load<BoolField, bool>(to, i, e, first_row, nrows); break;
+            case op_byte_field: load<ByteField, ExtentType::byte>(to, i, e, first_row, nrows); break;
+            case op_int32_field: load<Int32Field, int32_t>(to, i, e, first_row, nrows); break;
+            case op_int64_field: load<Int64Field, int64_t>(to, i, e, first_row, nrows); break;
+            case op_double_field: load<DoubleField, double>(to, i, e, first_row, nrows); break;
+
+#define DSEXPR_PROGRAM_LOOP(expr) for (size_t j = 0; j < nrows; ++j) { to[j] = (expr); } break
+
+            case op_tfrac_to_seconds: DSEXPR_PROGRAM_LOOP(a[j] / 4294967296.0);
+            case op_minus: DSEXPR_PROGRAM_LOOP(-a[j]);
+            case op_add: DSEXPR_PROGRAM_LOOP(a[j] + b[j]);
+            case op_subtract: DSEXPR_PROGRAM_LOOP(a[j] - b[j]);
+            case op_multiply: DSEXPR_PROGRAM_LOOP(a[j] * b[j]);
+            case op_divide: DSEXPR_PROGRAM_LOOP(a[j] / b[j]);
+            case op_eq: DSEXPR_PROGRAM_LOOP(Double::eq(a[j], b[j]) ? 1 : 0);
+            case op_neq: DSEXPR_PROGRAM_LOOP(Double::eq(a[j], b[j]) ? 0 : 1);
+            case op_gt: DSEXPR_PROGRAM_LOOP(Double::gt(a[j], b[j]) ? 1 : 0);
+            case op_lt: DSEXPR_PROGRAM_LOOP(Double::lt(a[j], b[j]) ? 1 : 0);
+            case op_geq: DSEXPR_PROGRAM_LOOP(Double::geq(a[j], b[j]) ? 1 : 0);
+            case op_leq: DSEXPR_PROGRAM_LOOP(Double::leq(a[j], b[j]) ? 1 : 0);
+            // operands are 0 or 1 and have no side effects, so no need to short-circuit
+            case op_lor: DSEXPR_PROGRAM_LOOP((a[j] != 0 || b[j] != 0) ? 1 : 0);
+            case op_land: DSEXPR_PROGRAM_LOOP((a[j] != 0 && b[j] != 0) ? 1 : 0);
+            case op_lnot: DSEXPR_PROGRAM_LOOP(a[j] != 0 ? 0 : 1);
+
+#undef DSEXPR_PROGRAM_LOOP
+
+            default: FATAL_ERROR(format("internal error, bad opcode %d") % i.code);
+            }
+    }
+    return &registers[(code.size() - 1) * batch_rows];
+}
+
+//////////////////////////////////////////////////////////////////////
+
+DSExpr *DSExprImpl::ExprCompiled::make(DSExpr *expr) {
+    ExprCompiled *ret = new ExprCompiled(expr);
+    if (ExprNode::compile(ret->program, expr) < 0) {
+        ret->expr = NULL;
+        delete ret;
+        return expr;
+    }
+    // valDouble() of a boolean and valBool() of arithmetic are errors
+    // that the expression has to report.
+    ret->double_ok = expr->getType() == t_Numeric;
+    ret->bool_ok = expr->getType() == t_Bool || dynamic_cast<ExprField *>(expr) != NULL;
+    return ret;
+}
+
+void DSExprImpl::ExprCompiled::selectRows(ExtentSeries &series, vector<bool> &selected) {
+    if (!bool_ok || program.getSeries() != &series || !series.hasExtent()) {
+        DSExpr::selectRows(series, selected);
+        return;
+    }
+    Extent &e(series.getExtentRef());
+    size_t nrows = e.nRecords();
+    selected.resize(nrows);
+    for (size_t first_row = 0; first_row < nrows; first_row += Program::batch_rows) {
+        size_t n = min(nrows - first_row, Program::batch_rows);
+        const double *v = program.run(&e, first_row, n);
+        for (size_t j = 0; j < n; ++j) {
+            selected[first_row + j] = v[j] != 0;
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 
 void
@@ -22,7 +22,95 @@ namespace DSExprImpl {
 
     // TODO: make valGV to do general value calculations.
 
-    class ExprNumericConstant : public DSExpr {
+    /// A compiled form of a numeric or boolean expression: a flat list of
+    /// instructions, one per expression node, each of which computes its
+    /// value for a batch of rows at once into a register of doubles
+    /// (booleans are 0 or 1).  A single row is read through the typed
+    /// fields; batches of rows are read straight out of the fixed data using
+    /// offsets bound to the extent type, so there are no virtual calls,
+    /// GeneralValue conversions or per-row checks.
+    class Program : boost::noncopyable {
+      public:
+        enum OpCode { op_constant, op_bool_field, op_byte_field, op_int32_field,
+                      op_int64_field, op_double_field, op_tfrac_to_seconds, op_minus,
+                      op_add, op_subtract, op_multiply, op_divide, op_eq, op_neq, op_gt,
+                      op_lt, op_geq, op_leq, op_lor, op_land, op_lnot, op_invalid };
+
+        static const size_t batch_rows = 256;
+
+        Program() : series(NULL), single_series(true), bound_type() { }
+
+        // Each of these adds an instruction and returns its register number.
+        int constant(double v);
+        int field(OpCode code, Field *field, ExtentSeries &series);
+        int op(OpCode code, int a, int b = -1);
+
+        /// Evaluate the series' current row
+        double valDouble() {
+            return run(NULL, 0, 1)[0];
+        }
+        bool valBool() {
+            return run(NULL, 0, 1)[0] != 0;
+        }
+
+        /// Evaluate nrows <= batch_rows rows starting at row number
+        /// first_row of e, which must be an extent for the only series the
+        /// fields are in; or if e is NULL, the current row of each of the
+        /// fields' series.  Returns the value for each row.
+        const double *run(const Extent *e, size_t first_row, size_t nrows);
+
+        /// The series all the fields are in, NULL if there is more than one
+        ExtentSeries *getSeries() { 
+            return single_series ? series : NULL;
+        }
+
+      private:
+        struct Instruction {
+            OpCode code;
+            int a, b;
+            double constant;
+            Field *field;
+            // where the field is in a record of bound_type
+            int32_t offset, null_offset;
+            uint8_t bit_mask, null_bit_mask;
+            bool nullable;
+            Instruction(OpCode code, int a, int b, double constant, Field *field)
+                : code(code), a(a), b(b), constant(constant), field(field), offset(-1),
+                  null_offset(-1), bit_mask(0), null_bit_mask(0), nullable(false) { }
+        };
+
+        void bind(const ExtentType::Ptr &type);
+
+        template<typename FieldT, typename T> 
+        void load(double *to, const Instruction &i, const Extent *e, size_t first_row, 
+                  size_t nrows);
+
+        vector<Instruction> code;
+        vector<double> registers; // batch_rows for each instruction
+        ExtentSeries *series;
+        bool single_series;
+        ExtentType::Ptr bound_type;
+    };
+
+    /// All the expression nodes are ExprNodes so that they can be compiled
+    class ExprNode : public DSExpr {
+      public:
+        /// Add the instructions to compute this node to program, returning the
+        /// register with the result, or -1 if the node can't be compiled.
+        virtual int compile(Program &program) {
+            return -1;
+        }
+        
+        static int compile(Program &program, DSExpr *expr) {
+            return static_cast<ExprNode *>(expr)->compile(program);
+        }
+
+        /// Compile an operand that has to be of type want; anything else is left to the
+        /// tree, which reports the error.  Fields convert to either numbers or booleans.
+        static int compileOperand(Program &program, DSExpr *expr, expr_type_t want);
+    };
+
+    class ExprNumericConstant : public ExprNode {
       public:
         // TODO: consider parsing the string as both a double and an
         // int64 to get better precision.
@@ -43,11 +131,15 @@ namespace DSExprImpl {
         virtual bool isNull() { 
             return false;
         }
+
+        virtual int compile(Program &program) {
+            return program.constant(val);
+        }
       private:
         double val;
     };
 
-    class ExprField : public DSExpr {
+    class ExprField : public ExprNode {
       public:
         ExprField(ExtentSeries &series, const string &fieldname);
         
@@ -81,12 +173,27 @@ namespace DSExprImpl {
 
         virtual void dump(ostream &out);
 
+        const string &getFieldName() const {
+            return fieldname;
+        }
+
+        virtual int compile(Program &program);
+
+        /// true if valInt64() of this field is exact
+        bool isIntegral() const {
+            return field->getType() == ExtentType::ft_bool 
+                || field->getType() == ExtentType::ft_byte
+                || field->getType() == ExtentType::ft_int32
+                || field->getType() == ExtentType::ft_int64;
+        }
+
       private:
+        ExtentSeries &series;
         GeneralField *field;
         string fieldname;
     };
 
-    class ExprStrLiteral : public DSExpr {
+    class ExprStrLiteral : public ExprNode {
       public:
         ExprStrLiteral(const string &l);
 
@@ -118,7 +225,7 @@ namespace DSExprImpl {
         string s;
     };
 
-    class ExprUnary : public DSExpr {
+    class ExprUnary : public ExprNode {
       public:
         ExprUnary(DSExpr *_subexpr)
         : subexpr(_subexpr) {}
@@ -135,11 +242,28 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return subexpr->isNull();
         }
+
+        virtual Program::OpCode opcode() const {
+            return Program::op_invalid;
+        }
+
+        /// the type the operand has to be
+        virtual expr_type_t operandType() const {
+            return t_Numeric;
+        }
+
+        virtual int compile(Program &program) {
+            if (opcode() == Program::op_invalid) {
+                return -1;
+            }
+            int a = compileOperand(program, subexpr, operandType());
+            return a < 0 ? -1 : program.op(opcode(), a);
+        }
       protected:
         DSExpr *subexpr;
     };
 
-    class ExprBinary : public DSExpr {
+    class ExprBinary : public ExprNode {
       public:
         ExprBinary(DSExpr *_left, DSExpr *_right)
                 : left(_left), right(_right) {}
@@ -163,6 +287,24 @@ namespace DSExprImpl {
         virtual bool isNull() {
             return left->isNull() || right->isNull();
         }
+
+        virtual Program::OpCode opcode() const {
+            return Program::op_invalid;
+        }
+
+        /// the type both operands have to be
+        virtual expr_type_t operandType() const {
+            return t_Numeric;
+        }
+
+        virtual int compile(Program &program) {
+            if (opcode() == Program::op_invalid || either_string()) {
+                return -1;
+            }
+            int a = compileOperand(program, left, operandType());
+            int b = a < 0 ? -1 : compileOperand(program, right, operandType());
+            return b < 0 ? -1 : program.op(opcode(), a, b);
+        }
       protected:
         DSExpr *left, *right;
     };
@@ -190,6 +332,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("-"); }
+        virtual Program::OpCode opcode() const { return Program::op_minus; }
     };
 
     class ExprAdd : public ExprBinary {
@@ -216,6 +359,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("+"); }
+        virtual Program::OpCode opcode() const { return Program::op_add; }
     };
 
     class ExprSubtract : public ExprBinary {
@@ -239,6 +383,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("-"); }
+        virtual Program::OpCode opcode() const { return Program::op_subtract; }
     };
 
     class ExprMultiply : public ExprBinary {
@@ -266,6 +411,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("*"); }
+        virtual Program::OpCode opcode() const { return Program::op_multiply; }
     };
 
     class ExprDivide : public ExprBinary {
@@ -291,6 +437,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("/"); }
+        virtual Program::OpCode opcode() const { return Program::op_divide; }
     };
 
     class ExprEq : public ExprBinary {
@@ -318,6 +465,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("=="); }
+        virtual Program::OpCode opcode() const { return Program::op_eq; }
     };
 
     class ExprNeq : public ExprBinary {
@@ -347,6 +495,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("!="); }
+        virtual Program::OpCode opcode() const { return Program::op_neq; }
     };
 
     class ExprGt : public ExprBinary {
@@ -376,6 +525,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string(">"); }
+        virtual Program::OpCode opcode() const { return Program::op_gt; }
     };
 
     class ExprLt : public ExprBinary {
@@ -403,6 +553,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("<"); }
+        virtual Program::OpCode opcode() const { return Program::op_lt; }
     };
 
     class ExprGeq : public ExprBinary {
@@ -432,6 +583,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string(">="); }
+        virtual Program::OpCode opcode() const { return Program::op_geq; }
     };
 
     class ExprLeq : public ExprBinary {
@@ -461,6 +613,7 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("<="); }
+        virtual Program::OpCode opcode() const { return Program::op_leq; }
     };
 
     class ExprLor : public ExprBinary {
@@ -486,6 +639,8 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("||"); }
+        virtual Program::OpCode opcode() const { return Program::op_lor; }
+        virtual expr_type_t operandType() const { return t_Bool; }
     };
 
     class ExprLand : public ExprBinary {
@@ -509,6 +664,8 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("&&"); }
+        virtual Program::OpCode opcode() const { return Program::op_land; }
+        virtual expr_type_t operandType() const { return t_Bool; }
     };
 
     class ExprLnot : public ExprUnary {
@@ -534,6 +691,8 @@ namespace DSExprImpl {
         }
 
         virtual string opname() const { return string("!"); }
+        virtual Program::OpCode opcode() const { return Program::op_lnot; }
+        virtual expr_type_t operandType() const { return t_Bool; }
     };
 
     class ExprFnTfracToSeconds : public ExprUnary {
@@ -564,9 +723,19 @@ namespace DSExprImpl {
             subexpr->dump(out);
             out << ")";
         }
+
+        virtual int compile(Program &program) {
+            // valInt64() of anything but an integer field is not a double calculation
+            ExprField *field = dynamic_cast<ExprField *>(subexpr);
+            if (field == NULL || !field->isIntegral()) {
+                return -1;
+            }
+            int a = field->compile(program);
+            return a < 0 ? -1 : program.op(Program::op_tfrac_to_seconds, a);
+        }
     };
 
-    class ExprFunctionApplication : public DSExpr {
+    class ExprFunctionApplication : public ExprNode {
       public:
         ExprFunctionApplication(const string &fnname, const DSExpr::List &fnargs) 
                 : name(fnname), args(fnargs)
@@ -601,6 +770,48 @@ namespace DSExprImpl {
         DSExpr::List args;
     };
 
+    /// Evaluates the numeric and boolean values of an expression with its
+    /// compiled program, everything else with the expression itself.
+    class ExprCompiled : public DSExpr {
+      public:
+        /// Returns expr, or a compiled version of it that takes ownership of expr
+        static DSExpr *make(DSExpr *expr);
+
+        virtual ~ExprCompiled() {
+            delete expr;
+        }
+
+        virtual expr_type_t getType() {
+            return expr->getType();
+        }
+        virtual double valDouble() {
+            return double_ok ? program.valDouble() : expr->valDouble();
+        }
+        virtual int64_t valInt64() {
+            return expr->valInt64();
+        }
+        virtual bool valBool() {
+            return bool_ok ? program.valBool() : expr->valBool();
+        }
+        virtual const string valString() {
+            return expr->valString();
+        }
+        virtual bool isNull() {
+            return expr->isNull();
+        }
+        virtual void dump(ostream &out) {
+            expr->dump(out);
+        }
+        virtual void selectRows(ExtentSeries &series, std::vector<bool> &selected);
+
+      private:
+        ExprCompiled(DSExpr *expr) : expr(expr), double_ok(false), bool_ok(false) { }
+
+        DSExpr *expr;
+        Program program;
+        bool double_ok, bool_ok;
+    };
+
     class Driver {
       public:
         typedef DSExprParser::Selector Selector;
@@ -619,13 +830,16 @@ namespace DSExprImpl {
         }
 
         ExprField *makeExprField(const string &field_name) {
+            ExprField *ret;
             if (series == NULL) {
                 Selector tmp = field_name_to_selector(field_name);
                 INVARIANT(tmp.first != NULL, format("field_name '%s' is not defined") % field_name);
-                return new ExprField(*tmp.first, tmp.second);
+                ret = new ExprField(*tmp.first, tmp.second);
             } else {
-                return new ExprField(*series, field_name); 
+                ret = new ExprField(*series, field_name); 
             }
+            field_names.push_back(ret->getFieldName());
+            return ret;
         }
         ~Driver();
 
@@ -639,6 +853,7 @@ namespace DSExprImpl {
         const FieldNameToSelector field_name_to_selector;
         void *scanner_state;
         DSExpr::List current_fnargs;
+        vector<string> field_names; // in the order makeExprField() saw them
     };
 
 };
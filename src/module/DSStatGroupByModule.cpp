@@ -9,8 +9,12 @@
     implementation
 */
 
+#include <algorithm>
+
 #include <Lintel/AssertBoost.hpp>
+#include <Lintel/HashFns.hpp>
 #include <Lintel/StatsQuantile.hpp>
+#include <Lintel/StringUtil.hpp>
 
 #include <DataSeries/DSStatGroupByModule.hpp>
 
@@ -19,8 +23,159 @@ using namespace std;
 namespace {
     const string str_basic("basic");
     const string str_quantile("quantile");
+
+    template<typename T> void appendValue(string &to, T v) {
+        to.append(reinterpret_cast<const char *>(&v), sizeof(v));
+    }
+
+    void printKey(ostream &to, const vector<GeneralValue> &key) {
+        for (vector<GeneralValue>::const_iterator i = key.begin(); i != key.end(); ++i) {
+            if (i != key.begin()) {
+                to << ", ";
+            }
+            to << *i;
+        }
+    }
 }
 
+// Open addressing (linear probing) table from the bytes of a group's key to
+// its statistic.  The keys live in one arena and the slots are just group
+// numbers, so a lookup touches the slot array and one key.  Consecutive
+// rows are often in the same group, so that is checked before hashing.
+class DSStatGroupByModule::GroupTable {
+  public:
+    struct Group {
+        size_t key_offset;
+        uint32_t key_size, hash;
+        Stats *stat;
+        vector<GeneralValue> print_key;
+    };
+
+    GroupTable(bool quantile) : quantile(quantile), last_group(-1) {
+        slots.resize(64, -1);
+    }
+
+    ~GroupTable() {
+        for (vector<Group>::iterator i = groups.begin(); i != groups.end(); ++i) {
+            delete i->stat;
+        }
+    }
+
+    /// The stat for key; a new group takes its printable key from groupby
+    Stats *get(const string &key, const vector<GeneralField *> &groupby) {
+        if (last_group >= 0 && sameKey(groups[last_group], key)) {
+            return groups[last_group].stat;
+        }
+        uint32_t hash = lintel::hashBytes(key.data(), key.size());
+        size_t slot = 0;
+        int32_t g = find(key, hash, &slot);
+        if (g < 0) {
+            g = add(key, hash, slot);
+            Group &group(groups[g]);
+            group.print_key.resize(groupby.size());
+            for (size_t i = 0; i < groupby.size(); ++i) {
+                group.print_key[i].set(groupby[i]);
+            }
+        }
+        last_group = g;
+        return groups[g].stat;
+    }
+
+    void merge(const GroupTable &from) {
+        for (vector<Group>::const_iterator i = from.groups.begin(); i != from.groups.end(); ++i) {
+            string key(from.key_arena, i->key_offset, i->key_size);
+            size_t slot = 0;
+            int32_t g = find(key, i->hash, &slot);
+            if (g < 0) {
+                g = add(key, i->hash, slot);
+                groups[g].print_key = i->print_key;
+            }
+            groups[g].stat->add(*i->stat);
+        }
+        last_group = -1;
+    }
+
+    /// Group numbers in order of their printable keys
+    vector<int32_t> sorted() const {
+        vector<int32_t> ret;
+        for (size_t i = 0; i < groups.size(); ++i) {
+            ret.push_back(i);
+        }
+        sort(ret.begin(), ret.end(), KeyLess(groups));
+        return ret;
+    }
+
+    const Group &operator[](int32_t g) const {
+        return groups[g];
+    }
+
+  private:
+    struct KeyLess {
+        KeyLess(const vector<Group> &groups) : groups(groups) { }
+        bool operator()(int32_t a, int32_t b) const {
+            return lexicographical_compare(groups[a].print_key.begin(), 
+                                           groups[a].print_key.end(),
+                                           groups[b].print_key.begin(), 
+                                           groups[b].print_key.end());
+        }
+        const vector<Group> &groups;
+    };
+
+    bool sameKey(const Group &group, const string &key) const {
+        return group.key_size == key.size()
+            && memcmp(key_arena.data() + group.key_offset, key.data(), key.size()) == 0;
+    }
+
+    // Returns the group with key, or -1 and sets *slot to the empty slot it would go in
+    int32_t find(const string &key, uint32_t hash, size_t *slot) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            int32_t g = slots[i];
+            if (g < 0) {
+                *slot = i;
+                return -1;
+            }
+            if (groups[g].hash == hash && sameKey(groups[g], key)) {
+                return g;
+            }
+        }
+    }
+
+    int32_t add(const string &key, uint32_t hash, size_t slot) {
+        int32_t g = groups.size();
+        groups.resize(g + 1);
+        Group &group(groups.back());
+        group.key_offset = key_arena.size();
+        group.key_size = key.size();
+        group.hash = hash;
+        group.stat = quantile ? new StatsQuantile() : new Stats();
+        key_arena.append(key);
+        slots[slot] = g;
+        if (groups.size() * 2 > slots.size()) { // keep probe sequences short
+            rehash(slots.size() * 2);
+        }
+        return g;
+    }
+
+    void rehash(size_t nslots) {
+        slots.assign(nslots, -1);
+        size_t mask = nslots - 1;
+        for (size_t g = 0; g < groups.size(); ++g) {
+            size_t i = groups[g].hash & mask;
+            while (slots[i] >= 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = g;
+        }
+    }
+
+    bool quantile;
+    vector<Group> groups;
+    string key_arena;
+    vector<int32_t> slots; // group number, or -1 if empty; size is a power of 2
+    int32_t last_group;
+};
+
 DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
                                          const string &_expression,
                                          const string &_groupby,
@@ -28,8 +183,8 @@ DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
                                          const string &where_expr,
                                          ExtentSeries::typeCompatibilityT tc)
         : RowAnalysisModule(source, tc), expression(_expression), 
-          groupby_name(_groupby), stattype(_stattype), groupby(NULL),
-          expr(NULL)
+          groupby_name(_groupby), stattype(_stattype), expr(NULL),
+          groups(new GroupTable(_stattype == str_quantile))
 {
     SINVARIANT(validStatType(stattype));
     if (!where_expr.empty()) {
@@ -40,8 +195,7 @@ DSStatGroupByModule::DSStatGroupByModule(DataSeriesModule &source,
 DSStatGroupByModule::~DSStatGroupByModule() {
     delete expr;
     expr = NULL;
-    delete groupby;
-    groupby = NULL;
+    GeneralField::deleteFields(groupby);
 }
 
 void DSStatGroupByModule::prepareForProcessing() {
@@ -50,29 +204,72 @@ void DSStatGroupByModule::prepareForProcessing() {
 
     expr = DSExpr::make(series, expression);
     if (!groupby_name.empty()) {
-        groupby = GeneralField::create(NULL, series, groupby_name);
+        vector<string> names;
+        split(groupby_name, ",", names);
+        for (vector<string>::iterator i = names.begin(); i != names.end(); ++i) {
+            groupby.push_back(GeneralField::create(NULL, series, *i));
+        }
     }
 }
 
-void DSStatGroupByModule::processRow() {
-    GeneralValue groupby_val;
-    if (groupby != NULL) {
-        groupby_val.set(groupby);
-    } else {
-        groupby_val.setInt32(1);
-    }
-    Stats *stat = mystats[groupby_val];
-    if (stat == NULL) {
-        if (stattype == str_basic) {
-            stat = new Stats();
-        } else if (stattype == str_quantile) {
-            stat = new StatsQuantile();
-        } else {
-            FATAL_ERROR(boost::format("unknown stattype %s") % stattype);
+void DSStatGroupByModule::makeKey() {
+    key.clear();
+    for (vector<GeneralField *>::iterator i = groupby.begin(); i != groupby.end(); ++i) {
+        GeneralField *f = *i;
+        if (f->isNull()) {
+            key.push_back('\0');
+            continue;
         }
-        mystats[groupby_val] = stat;
+        key.push_back('\1');
+        switch (f->getType()) 
+            {
+            case ExtentType::ft_bool: 
+                key.push_back(static_cast<GF_Bool *>(f)->myfield.val() ? 1 : 0);
+                break;
+            case ExtentType::ft_byte: 
+                appendValue(key, static_cast<GF_Byte *>(f)->myfield.val());
+                break;
+            case ExtentType::ft_int32: 
+                appendValue(key, static_cast<GF_Int32 *>(f)->myfield.val());
+                break;
+            case ExtentType::ft_int64: 
+                appendValue(key, static_cast<GF_Int64 *>(f)->myfield.val());
+                break;
+            case ExtentType::ft_double: {
+                double v = static_cast<GF_Double *>(f)->myfield.val();
+                appendValue(key, v == 0 ? 0.0 : v); // -0 == 0
+                break;
+            }
+            case ExtentType::ft_variable32: {
+                const Variable32Field &v(static_cast<GF_Variable32 *>(f)->myfield);
+                appendValue(key, v.size());
+                key.append(reinterpret_cast<const char *>(v.val()), v.size());
+                break;
+            }
+            case ExtentType::ft_fixedwidth: {
+                const FixedWidthField &v(static_cast<GF_FixedWidth *>(f)->myfield);
+                key.append(reinterpret_cast<const char *>(v.val()), v.size());
+                break;
+            }
+            default:
+                FATAL_ERROR(boost::format("can't group by %s, unknown field type %d")
+                            % groupby_name % f->getType());
+            }
     }
-    stat->add(expr->valDouble());
+}
+
+void DSStatGroupByModule::processRow() {
+    makeKey();
+    groups->get(key, groupby)->add(expr->valDouble());
+}
+
+void DSStatGroupByModule::merge(RowAnalysisModule &into, RowAnalysisModule &from) {
+    DSStatGroupByModule &a(dynamic_cast<DSStatGroupByModule &>(into));
+    DSStatGroupByModule &b(dynamic_cast<DSStatGroupByModule &>(from));
+    INVARIANT(a.stattype == str_basic && b.stattype == str_basic,
+              "only basic statistics can be merged");
+    SINVARIANT(a.expression == b.expression && a.groupby_name == b.groupby_name);
+    a.groups->merge(*b.groups);
 }
 
 void DSStatGroupByModule::printResult() {
@@ -80,10 +277,7 @@ void DSStatGroupByModule::printResult() {
     cout << boost::format("# processed %d rows, where clause eliminated %d rows\n") 
             % processed_rows % ignored_rows;
 
-    // Someone might call printResult on an interim basis so we can't sort 
-    // the underlying hashtable.
-    vector<GeneralValue> keys = mystats.keys();
-    sort(keys.begin(), keys.end());
+    vector<int32_t> order(groups->sorted());
 
     if (stattype == str_basic) {
         if (groupby_name.empty()) {
@@ -92,12 +286,13 @@ void DSStatGroupByModule::printResult() {
             cout << boost::format("# %s, count(*), mean(%s), stddev, min, max\n")
                     % groupby_name % expression;
         }
-        for (vector<GeneralValue>::iterator i = keys.begin(); i != keys.end(); ++i) {
-            GeneralValue &k(*i);
-            Stats *v = mystats[k];
+        for (vector<int32_t>::iterator i = order.begin(); i != order.end(); ++i) {
+            const GroupTable::Group &g((*groups)[*i]);
+            Stats *v = g.stat;
 
             if (!groupby_name.empty()) {
-                cout << k << ", ";
+                printKey(cout, g.print_key);
+                cout << ", ";
             }
             cout << boost::format("%1%, %2$.6g, %3$.6g, %4$.6g, %5$.6g\n")
                     % v->count() % v->mean() % v->stddev() % v->min() % v->max();
@@ -108,13 +303,14 @@ void DSStatGroupByModule::printResult() {
         } else {
             cout << boost::format("# %s(%s) group by %s\n") % stattype % expression % groupby_name;
         }
-        for (vector<GeneralValue>::iterator i = keys.begin(); i != keys.end(); ++i) {
-            GeneralValue &k(*i);
-            Stats *v = mystats[k];
+        for (vector<int32_t>::iterator i = order.begin(); i != order.end(); ++i) {
+            const GroupTable::Group &g((*groups)[*i]);
             if (!groupby_name.empty()) {
-                cout << boost::format("# group %1%\n") % k;
+                cout << "# group ";
+                printKey(cout, g.print_key);
+                cout << "\n";
             }
-            v->printText(cout);
+            g.stat->printText(cout);
         }
     } else {
         FATAL_ERROR("wasn't stat type already checked?");
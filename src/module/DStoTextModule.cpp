@@ -9,6 +9,8 @@
     implementation
 */
 
+#include <cmath>
+
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/DStoTextModule.hpp>
 #include <DataSeries/GeneralField.hpp>
@@ -18,6 +20,76 @@ using boost::format;
 
 static const string str_star("*");
 
+// An extent and the text made from it
+struct DStoTextModule::Job {
+    Job(const Extent::Ptr &extent)
+        : extent(extent), state(NULL), processed_rows(0), ignored_rows(0), done(false) { }
+
+    Extent::Ptr extent;
+    PerTypeState *state; // NULL ==> formatted by the time it is queued
+    string text;
+    uint64_t processed_rows, ignored_rows;
+    bool done; // under mutex
+};
+
+// Each worker has its own series, fields and where expression for each type
+class DStoTextModule::Worker : public PThread {
+  public:
+    struct TypeState {
+        TypeState() : where_expr(NULL) { }
+        ~TypeState() {
+            GeneralField::deleteFields(fields);
+            delete where_expr;
+        }
+
+        ExtentSeries series;
+        vector<GeneralField *> fields;
+        DSExpr *where_expr;
+    };
+
+    Worker(DStoTextModule &module) : module(module) { }
+
+    virtual ~Worker() {
+        for (map<const PerTypeState *, TypeState *>::iterator i = types.begin();
+             i != types.end(); ++i) {
+            delete i->second;
+        }
+    }
+
+    virtual void *run() {
+        module.workerThread(*this);
+        return NULL;
+    }
+
+    // the main thread may be moving state.series on, so the type comes from the extent
+    TypeState &getTypeState(const PerTypeState &state, const ExtentType::Ptr &type,
+                            bool csv_enabled) {
+        TypeState *&ret(types[&state]);
+        if (ret == NULL) {
+            ret = new TypeState();
+            ret->series.setType(type);
+            // state.fields is the same length as state.field_names once it has been made
+            for (size_t i = 0; i < state.fields.size(); ++i) {
+                const string &name(state.field_names[i]);
+                map<string, xmlNodePtr>::const_iterator spec = state.print_specs.find(name);
+                ret->fields.push_back(GeneralField::create(spec == state.print_specs.end()
+                                                           ? NULL : spec->second,
+                                                           ret->series, name));
+                if (csv_enabled) {
+                    ret->fields.back()->enableCSV();
+                }
+            }
+            if (state.where_expr != NULL) {
+                ret->where_expr = DSExpr::make(ret->series, state.where_expr_str);
+            }
+        }
+        return *ret;
+    }
+
+    DStoTextModule &module;
+    map<const PerTypeState *, TypeState *> types;
+};
+
 DStoTextModule::DStoTextModule(DataSeriesModule &_source,
                                ostream &text_dest)
         : processed_rows(), ignored_rows(),
@@ -25,7 +97,8 @@ DStoTextModule::DStoTextModule(DataSeriesModule &_source,
           text_dest(NULL), print_index(true),
           print_extent_type(true), print_extent_fieldnames(true), 
           csvEnabled(false), separator(" "), 
-          header_only_once(false), header_printed(false)
+          header_only_once(false), header_printed(false), n_threads(1), stop_workers(false),
+          source_done(false)
 {
 }
 
@@ -36,13 +109,19 @@ DStoTextModule::DStoTextModule(DataSeriesModule &_source,
           text_dest(_text_dest), print_index(true),
           print_extent_type(true), print_extent_fieldnames(true),
           csvEnabled(false), separator(" "),
-          header_only_once(false), header_printed(false)
+          header_only_once(false), header_printed(false), n_threads(1), stop_workers(false),
+          source_done(false)
 {
 }
 
 DStoTextModule::~DStoTextModule()
 {
     // TODO: delete all the general fields in PerTypeState.
+    stopWorkers();
+    while (!pending.empty()) {
+        delete pending.front();
+        pending.pop_front();
+    }
 }
 
 void
@@ -150,6 +229,17 @@ DStoTextModule::setHeaderOnlyOnce()
     header_only_once = true;
 }
 
+void
+DStoTextModule::setThreads(int n_threads)
+{
+    INVARIANT(workers.empty(), "setThreads() after the first getSharedExtent()");
+    if (n_threads == -1) {
+        n_threads = PThreadMisc::getNCpus();
+    }
+    INVARIANT(n_threads > 0, "need at least one thread");
+    this->n_threads = n_threads;
+}
+
 void
 DStoTextModule::getExtentPrintSpecs(PerTypeState &state)
 {
@@ -188,7 +278,7 @@ DStoTextModule::getExtentParseWhereExpr(PerTypeState &state)
 
 
 DStoTextModule::PerTypeState::PerTypeState()
-        : where_expr(NULL)
+        : where_expr(NULL), format_in_order(false)
 {}
 
 DStoTextModule::PerTypeState::~PerTypeState()
@@ -210,35 +300,23 @@ DStoTextModule::PerTypeState::~PerTypeState()
 }
 
 void
-DStoTextModule::getExtentPrintHeaders(PerTypeState &state) 
+DStoTextModule::getExtentPrintHeaders(PerTypeState &state, string &header) 
 {
     if (header_only_once && header_printed) return;
     header_printed = true;
 
     const string &type_name = state.series.getTypePtr()->getName();
     if (print_extent_type) {
-        if (text_dest == NULL) {
-            *stream_text_dest << "# Extent, type='" << type_name << "'";
-            if (state.where_expr) {
-                *stream_text_dest << ", where='" << state.where_expr_str << "'";
-            }
-            *stream_text_dest << "\n";
-        } else {
-            fprintf(text_dest,"# Extent, type='%s'", type_name.c_str());
-            if (state.where_expr) {
-                fprintf(text_dest, ", where='%s'", state.where_expr_str.c_str());
-            }
-            fputc('\n', text_dest);
+        header.append("# Extent, type='").append(type_name).append("'");
+        if (state.where_expr) {
+            header.append(", where='").append(state.where_expr_str).append("'");
         }
+        header.push_back('\n');
     }
 
     bool print_default_fieldnames = print_extent_fieldnames;
     if (print_extent_fieldnames && !state.header.empty()) {
-        if (text_dest == NULL) {
-            *stream_text_dest << state.header << "\n";
-        } else {
-            fprintf(text_dest,"%s\n",state.header.c_str());
-        }
+        header.append(state.header).push_back('\n');
         print_default_fieldnames = false;
     }
     if (state.field_names.empty() && !default_fields.empty()) {
@@ -260,37 +338,26 @@ DStoTextModule::getExtentPrintHeaders(PerTypeState &state)
                 state.fields.back()->enableCSV();
             }
         }
+        state.format_in_order = formatInOrder(state.fields);
     }
     if (print_default_fieldnames) {
         bool printed_any = false;
         for (vector<string>::iterator i = state.field_names.begin();
             i != state.field_names.end(); ++i) {
-            if (text_dest == NULL) {
-                if (printed_any)
-                    *stream_text_dest << separator;
-                *stream_text_dest << *i;
-            } else {
-                if (printed_any)
-                    fputs(separator.c_str(), text_dest);
-                fputs(i->c_str(), text_dest);
-            }
+            if (printed_any)
+                header.append(separator);
+            header.append(*i);
             printed_any = true;
         }
-    }
-
-    if (print_default_fieldnames) {
-        if (text_dest == NULL) {
-            *stream_text_dest << "\n";
-        } else {
-            fputc('\n', text_dest);
-        }
+        header.push_back('\n');
     }
 }
 
-
-
 Extent::Ptr DStoTextModule::getSharedExtent() {
-    Extent::Ptr e = source.getSharedExtent();
+    if (n_threads > 1 && text_dest != NULL) {
+        return getFormattedExtent();
+    }
+    Extent::Ptr e = getUpstreamExtent(source);
     if (e == NULL) {
         return e;
     }
@@ -307,7 +374,13 @@ Extent::Ptr DStoTextModule::getSharedExtent() {
     state.series.setExtent(e);
     getExtentParseWhereExpr(state);
     getExtentPrintSpecs(state);
-    getExtentPrintHeaders(state);
+    string header;
+    getExtentPrintHeaders(state, header);
+    if (text_dest == NULL) {
+        *stream_text_dest << header;
+    } else {
+        fputs(header.c_str(), text_dest);
+    }
 
     for (;state.series.morerecords();++state.series) {
         if (state.where_expr && !state.where_expr->valBool()) {
@@ -336,6 +409,143 @@ Extent::Ptr DStoTextModule::getSharedExtent() {
     return e;
 }
 
+Extent::Ptr DStoTextModule::getFormattedExtent() {
+    if (workers.empty()) {
+        for (int i = 0; i < n_threads; ++i) {
+            workers.push_back(new Worker(*this));
+            workers.back()->start();
+        }
+    }
+    // Read far enough ahead to keep every worker busy while the oldest extent is formatted
+    while (!source_done && pending.size() < 2 * workers.size()) {
+        Extent::Ptr e = getUpstreamExtent(source);
+        if (e == NULL) {
+            source_done = true;
+            break;
+        }
+        Job *job = new Job(e);
+        pending.push_back(job);
+        // never print these, as for getSharedExtent()
+        if (e->type->getName() == "DataSeries: XmlType"
+            || (print_index == false && e->type->getName() == "DataSeries: ExtentIndex")) {
+            job->done = true;
+            continue;
+        }
+
+        PerTypeState &state = type_to_state[e->type->getName()];
+        state.series.setExtent(e);
+        getExtentParseWhereExpr(state);
+        getExtentPrintSpecs(state);
+        getExtentPrintHeaders(state, job->text);
+        if (state.format_in_order) {
+            formatRows(state.series, state.fields, state.where_expr, *job);
+            job->done = true;
+        } else {
+            job->state = &state;
+            PThreadScopedLock lock(mutex);
+            to_format.push_back(job);
+            cond.broadcast();
+        }
+    }
+    if (pending.empty()) {
+        return Extent::Ptr();
+    }
+
+    Job *job = pending.front();
+    pending.pop_front();
+    {
+        PThreadScopedLock lock(mutex);
+        while (!job->done) {
+            cond.wait(mutex);
+        }
+    }
+    if (!job->text.empty()) {
+        size_t written = fwrite(job->text.data(), 1, job->text.size(), text_dest);
+        INVARIANT(written == job->text.size(), format("error writing text: %s")
+                  % strerror(errno));
+    }
+    processed_rows += job->processed_rows;
+    ignored_rows += job->ignored_rows;
+    Extent::Ptr ret = job->extent;
+    delete job;
+    return ret;
+}
+
+void DStoTextModule::workerThread(Worker &worker) {
+    while (true) {
+        Job *job;
+        {
+            PThreadScopedLock lock(mutex);
+            while (to_format.empty() && !stop_workers) {
+                cond.wait(mutex);
+            }
+            if (stop_workers) {
+                return;
+            }
+            job = to_format.front();
+            to_format.pop_front();
+        }
+        Worker::TypeState &ts(worker.getTypeState(*job->state, job->extent->getTypePtr(),
+                                                  csvEnabled));
+        formatRows(ts.series, ts.fields, ts.where_expr, *job);
+
+        PThreadScopedLock lock(mutex);
+        job->done = true;
+        cond.broadcast();
+    }
+}
+
+void DStoTextModule::formatRows(ExtentSeries &series, vector<GeneralField *> &fields,
+                                DSExpr *where_expr, Job &job) {
+    string &text(job.text);
+    for (series.setExtent(job.extent); series.morerecords(); ++series) {
+        if (where_expr && !where_expr->valBool()) {
+            ++job.ignored_rows;
+        } else {
+            ++job.processed_rows;
+            for (unsigned int i = 0; i < fields.size(); ++i) {
+                fields[i]->write(text);
+                if (i != (fields.size() - 1)) {
+                    text.append(separator);
+                }
+            }
+            text.push_back('\n');
+        }
+    }
+}
+
+// Fields printed relative to the first row they print depend on all of the rows before them;
+// has to be called before any of fields are written
+bool DStoTextModule::formatInOrder(const vector<GeneralField *> &fields) {
+    for (vector<GeneralField *>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+        if ((**i).getType() == ExtentType::ft_int64) {
+            if (static_cast<const GF_Int64 &>(**i).offset_first) {
+                return true;
+            }
+        } else if ((**i).getType() == ExtentType::ft_double) {
+            const GF_Double &f(static_cast<const GF_Double &>(**i));
+            if (f.relative_field == NULL && isnan(f.offset)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void DStoTextModule::stopWorkers() {
+    {
+        PThreadScopedLock lock(mutex);
+        stop_workers = true;
+        to_format.clear();
+        cond.broadcast();
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+    workers.clear();
+}
+
 // this interface assumes you're just going to leak the document
 xmlNodePtr
 DStoTextModule::parseXML(string xml, const string &roottype)
@@ -9,10 +9,17 @@
     implementation
 */
 
+#include <cxxabi.h>
+#include <stdlib.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <typeinfo>
+
+#include <Lintel/Clock.hpp>
+
 #define DS_RAW_EXTENT_PTR_DEPRECATED /* allowed */
 #define DSM_VAR_DEPRECATED /* allowed */
 #include <DataSeries/DataSeriesModule.hpp>
@@ -22,9 +29,37 @@ namespace dataseries { namespace hack {
         size_t extentSharedPtrSize();
     }}
 
+using namespace std;
 using namespace dataseries;
+using boost::format;
 
-DataSeriesModule::~DataSeriesModule() { }
+namespace {
+    /// Every module that exists, so that statistics can be reported for a whole pipeline
+    struct ModuleRegistry {
+        PThreadMutex mutex;
+        vector<DataSeriesModule *> modules;
+    };
+
+    ModuleRegistry &registry() {
+        // never destroyed, modules may be destroyed during static destruction
+        static ModuleRegistry *ret = new ModuleRegistry();
+        return *ret;
+    }
+}
+
+DataSeriesModule::DataSeriesModule() : stats_mutex(), stats(), module_name() {
+    ModuleRegistry &r(registry());
+    PThreadScopedLock lock(r.mutex);
+    r.modules.push_back(this);
+}
+
+DataSeriesModule::~DataSeriesModule() {
+    ModuleRegistry &r(registry());
+    PThreadScopedLock lock(r.mutex);
+    vector<DataSeriesModule *>::iterator i = find(r.modules.begin(), r.modules.end(), this);
+    SINVARIANT(i != r.modules.end());
+    r.modules.erase(i);
+}
 
 Extent *DataSeriesModule::getExtent() {
     Extent::Ptr e(getSharedExtent());
@@ -68,10 +103,141 @@ void DataSeriesModule::getAndDelete() {
 void DataSeriesModule::getAndDeleteShared() {
     Extent::Ptr e;
     do {
-        e = getSharedExtent();
+        e = countedGet(*this, NULL, false);
     } while (e != NULL);
 }
 
+DataSeriesModule::ModuleStats::ModuleStats()
+    : extents_in(0), rows_in(0), bytes_in(0), extents_out(0), rows_out(0), bytes_out(0),
+      get_seconds(0), upstream_seconds(0), queue_samples(0), queue_sum(0), queue_max(0)
+{ }
+
+void DataSeriesModule::ModuleStats::printText(ostream &to, const string &name) const {
+    to << format("%s: in %d extents, %d rows, %.2f MiB; out %d extents, %d rows, %.2f MiB\n")
+        % name % extents_in % rows_in % (bytes_in / (1024.0 * 1024.0))
+        % extents_out % rows_out % (bytes_out / (1024.0 * 1024.0));
+    to << format("  %.3fs in getSharedExtent, %.3fs blocked upstream, %.3fs computing")
+        % get_seconds % upstream_seconds % computeSeconds();
+    if (queue_samples > 0) {
+        to << format("; queue mean %.1f max %d extents") % meanQueue() % queue_max;
+    }
+    to << "\n";
+}
+
+DataSeriesModule::ModuleStats DataSeriesModule::getStats() {
+    PThreadScopedLock lock(stats_mutex);
+    return stats;
+}
+
+string DataSeriesModule::typeName(DataSeriesModule &module) {
+    const char *mangled = typeid(module).name();
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(mangled, NULL, NULL, &status);
+    string ret(status == 0 && demangled != NULL ? demangled : mangled);
+    free(demangled);
+    return ret;
+}
+
+string DataSeriesModule::getModuleName() {
+    PThreadScopedLock lock(stats_mutex);
+    if (module_name.empty()) {
+        module_name = typeName(*this);
+    }
+    return module_name;
+}
+
+void DataSeriesModule::setModuleName(const string &name) {
+    PThreadScopedLock lock(stats_mutex);
+    module_name = name;
+}
+
+void DataSeriesModule::getAllStats(vector<pair<string, ModuleStats> > &into) {
+    ModuleRegistry &r(registry());
+    PThreadScopedLock lock(r.mutex);
+    into.clear();
+    into.reserve(r.modules.size());
+    // Only the stored name: a module may be part way through its destructor on another thread,
+    // waiting for r.mutex, so typeid() on it here would race with the destruction.
+    for (vector<DataSeriesModule *>::iterator i = r.modules.begin(); i != r.modules.end(); ++i) {
+        PThreadScopedLock stats_lock((*i)->stats_mutex);
+        into.push_back(make_pair((*i)->module_name.empty() ? string("DataSeriesModule")
+                                 : (*i)->module_name, (*i)->stats));
+    }
+}
+
+void DataSeriesModule::printAllStats(ostream &to) {
+    vector<pair<string, ModuleStats> > all;
+    getAllStats(all);
+    for (vector<pair<string, ModuleStats> >::iterator i = all.begin(); i != all.end(); ++i) {
+        i->second.printText(to, i->first);
+    }
+}
+
+Extent::Ptr DataSeriesModule::getUpstreamExtent(DataSeriesModule &upstream, bool blocking) {
+    return countedGet(upstream, this, blocking);
+}
+
+void DataSeriesModule::noteInput(uint64_t rows, uint64_t bytes) {
+    PThreadScopedLock lock(stats_mutex);
+    ++stats.extents_in;
+    stats.rows_in += rows;
+    stats.bytes_in += bytes;
+}
+
+void DataSeriesModule::noteBlocked(double seconds) {
+    PThreadScopedLock lock(stats_mutex);
+    stats.upstream_seconds += seconds;
+}
+
+void DataSeriesModule::noteQueue(size_t extents) {
+    PThreadScopedLock lock(stats_mutex);
+    ++stats.queue_samples;
+    stats.queue_sum += extents;
+    stats.queue_max = max(stats.queue_max, static_cast<uint64_t>(extents));
+}
+
+// One clock read per extent on each side of the call; small next to the per-extent work.
+Extent::Ptr DataSeriesModule::countedGet(DataSeriesModule &from, DataSeriesModule *into,
+                                         bool blocking) {
+    Clock::Tdbl start = Clock::tod();
+    Extent::Ptr ret(from.getSharedExtent());
+    double seconds = Clock::tod() - start;
+
+    uint64_t rows = 0, bytes = 0;
+    if (ret != NULL) {
+        rows = ret->nRecords();
+        bytes = ret->size();
+    }
+    // Both modules are in use on this thread, so this is a safe place to name them.
+    {
+        PThreadScopedLock lock(from.stats_mutex);
+        if (from.module_name.empty()) {
+            from.module_name = typeName(from);
+        }
+        from.stats.get_seconds += seconds;
+        if (ret != NULL) {
+            ++from.stats.extents_out;
+            from.stats.rows_out += rows;
+            from.stats.bytes_out += bytes;
+        }
+    }
+    if (into != NULL) {
+        PThreadScopedLock lock(into->stats_mutex);
+        if (into->module_name.empty()) {
+            into->module_name = typeName(*into);
+        }
+        if (blocking) {
+            into->stats.upstream_seconds += seconds;
+        }
+        if (ret != NULL) {
+            ++into->stats.extents_in;
+            into->stats.rows_in += rows;
+            into->stats.bytes_in += bytes;
+        }
+    }
+    return ret;
+}
+
 SourceModule::SourceModule()
         : total_uncompressed_bytes(0), total_compressed_bytes(0)
 { }
@@ -91,7 +257,7 @@ FilterModule::~FilterModule() { }
 
 Extent::Ptr FilterModule::getSharedExtent() {
     while (true) {
-        Extent::Ptr e = from.getSharedExtent();
+        Extent::Ptr e = getUpstreamExtent(from);
         if (e == NULL || prefixequal(e->type->getName(), type_prefix)) {
             return e;
         }
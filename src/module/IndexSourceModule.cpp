@@ -13,6 +13,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 
+#include <Lintel/Clock.hpp>
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PThread.hpp>
 
@@ -53,11 +54,240 @@ class IndexSourceModuleUnpackThread : public PThread {
     IndexSourceModule &ism;
 };
 
+class IndexSourceModuleReaderThread : public PThread {
+  public:
+    IndexSourceModuleReaderThread(IndexSourceModule &_ism)
+    : ism(_ism) { 
+        setStackSize(256*1024); // shouldn't need much
+    }
+
+    virtual ~IndexSourceModuleReaderThread() { }
+
+    virtual void *run() {
+        ism.readerThread();
+        return NULL;
+    }
+    IndexSourceModule &ism;
+};
+
+/// Process-wide set of unpack threads shared by all of the IndexSourceModules
+/// that were started with n_unpack_threads == -1.  Modules are served in list
+/// order, and a module whose consumer is blocked moves to the front.  The
+/// bytes held in unpacked queues across all members are limited by a global
+/// budget, except that a member with nothing unpacked can always unpack its
+/// next extent, otherwise a consumer waiting on one module could deadlock
+/// behind extents that another module's consumer hasn't taken yet.
+///
+/// Lock ordering: a module's prefetch mutex may be held while taking the pool
+/// mutex, never the reverse.
+class IndexSourceModuleUnpackPool {
+  public:
+    IndexSourceModuleUnpackPool()
+        : n_threads(-1), max_unpacked_bytes(256 * 1024 * 1024), unpacked_bytes(0),
+          generation(0), stopping(false) { }
+
+    void setLimits(int _n_threads, size_t _max_unpacked_bytes) {
+        SINVARIANT(_n_threads == -1 || (_n_threads > 0 && _n_threads <= MAX_THREADS));
+        SINVARIANT(_max_unpacked_bytes > 0);
+        PThreadScopedLock lock(mutex);
+        n_threads = _n_threads;
+        max_unpacked_bytes = _max_unpacked_bytes;
+        ++generation;
+        work_cond.broadcast();
+    }
+
+    void add(IndexSourceModule *ism);
+    void remove(IndexSourceModule *ism); // caller must not hold ism's mutex
+
+    void notify(IndexSourceModule *ism, bool consumer_waiting) {
+        PThreadScopedLock lock(mutex);
+        ++generation;
+        if (consumer_waiting && !members.empty() && members.front().ism != ism) {
+            for (vector<Member>::iterator i = members.begin(); i != members.end(); ++i) {
+                if (i->ism == ism) {
+                    Member tmp = *i;
+                    members.erase(i);
+                    members.insert(members.begin(), tmp);
+                    break;
+                }
+            }
+        }
+        work_cond.signal();
+    }
+
+    bool reserve(size_t bytes, bool force) {
+        PThreadScopedLock lock(mutex);
+        if (force || unpacked_bytes == 0 || unpacked_bytes + bytes <= max_unpacked_bytes) {
+            unpacked_bytes += bytes;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    void release(size_t bytes) {
+        if (bytes == 0) {
+            return;
+        }
+        PThreadScopedLock lock(mutex);
+        SINVARIANT(unpacked_bytes >= bytes);
+        unpacked_bytes -= bytes;
+        ++generation;
+        work_cond.signal();
+    }
+
+    void run();
+
+  private:
+    struct Member {
+        IndexSourceModule *ism;
+        unsigned busy;
+        bool removing;
+        Member(IndexSourceModule *_ism) : ism(_ism), busy(0), removing(false) { }
+    };
+
+    Member *find(IndexSourceModule *ism) {
+        for (vector<Member>::iterator i = members.begin(); i != members.end(); ++i) {
+            if (i->ism == ism) {
+                return &*i;
+            }
+        }
+        return NULL;
+    }
+
+    PThreadMutex mutex;
+    PThreadCond work_cond, idle_cond;
+    vector<Member> members;
+    vector<PThread *> threads;
+    int n_threads;
+    size_t max_unpacked_bytes, unpacked_bytes;
+    uint64_t generation; // bumped whenever there may be new work
+    bool stopping;
+};
+
+static IndexSourceModuleUnpackPool unpack_pool;
+
+class IndexSourceModuleUnpackPoolThread : public PThread {
+  public:
+    IndexSourceModuleUnpackPoolThread() { 
+        setStackSize(256*1024); // shouldn't need much
+    }
+
+    virtual ~IndexSourceModuleUnpackPoolThread() { }
+
+    virtual void *run() {
+        unpack_pool.run();
+        return NULL;
+    }
+};
+
+void IndexSourceModuleUnpackPool::add(IndexSourceModule *ism) {
+    PThreadScopedLock lock(mutex);
+    while (stopping) { // last member just left, wait for the old threads to exit
+        idle_cond.wait(mutex);
+    }
+    SINVARIANT(find(ism) == NULL);
+    members.push_back(Member(ism));
+    if (threads.empty()) {
+        unsigned count = n_threads == -1 ? min(PThreadMisc::getNCpus(), MAX_THREADS/2) 
+            : static_cast<unsigned>(n_threads);
+        SINVARIANT(count > 0);
+        for (unsigned i = 0; i < count; ++i) {
+            threads.push_back(new IndexSourceModuleUnpackPoolThread());
+            threads.back()->start();
+        }
+    }
+    ++generation;
+    work_cond.signal();
+}
+
+void IndexSourceModuleUnpackPool::remove(IndexSourceModule *ism) {
+    PThreadScopedLock lock(mutex);
+    Member *m = find(ism);
+    SINVARIANT(m != NULL && !m->removing);
+    m->removing = true;
+    while (m->busy > 0) {
+        idle_cond.wait(mutex);
+        m = find(ism); // members may have been reordered
+    }
+    members.erase(members.begin() + (m - &members[0]));
+
+    if (members.empty()) {
+        // Nothing left to serve; stop the threads so an idle process doesn't
+        // keep them around, and so nothing is running at static destruction.
+        stopping = true;
+        work_cond.broadcast();
+        vector<PThread *> to_join;
+        to_join.swap(threads);
+        {
+            PThreadScopedUnlock unlock(lock);
+            for (vector<PThread *>::iterator i = to_join.begin(); i != to_join.end(); ++i) {
+                (**i).join();
+                delete *i;
+            }
+        }
+        stopping = false;
+        idle_cond.broadcast();
+    }
+}
+
+void IndexSourceModuleUnpackPool::run() {
+    PThreadScopedLock lock(mutex);
+    while (!stopping) {
+        uint64_t start_generation = generation;
+        bool did_work = false;
+        // Restart from the front after each extent so the most urgent member
+        // is always checked first.
+        for (size_t i = 0; i < members.size() && !did_work; ++i) {
+            if (members[i].removing) {
+                continue;
+            }
+            IndexSourceModule *ism = members[i].ism;
+            ++members[i].busy;
+            {
+                PThreadScopedUnlock unlock(lock);
+                did_work = ism->sharedUnpackOne();
+            }
+            Member *m = find(ism);
+            SINVARIANT(m != NULL && m->busy > 0);
+            --m->busy;
+            if (m->busy == 0 && m->removing) {
+                idle_cond.broadcast();
+            }
+        }
+        if (!did_work && generation == start_generation && !stopping) {
+            work_cond.wait(mutex);
+        }
+    }
+}
+
+void IndexSourceModule::setSharedUnpackLimits(int n_threads, size_t max_unpacked_bytes) {
+    unpack_pool.setLimits(n_threads, max_unpacked_bytes);
+}
+
 IndexSourceModule::IndexSourceModule()
         : getting_extent(false), prefetch(NULL)
 {
 }
 
+void IndexSourceModule::setUnpackFields(const vector<string> &fields) {
+    INVARIANT(prefetch == NULL, "setUnpackFields must be called before prefetching starts");
+    unpack_fields = fields;
+}
+
+void IndexSourceModule::setCatalog(const DataSeriesCatalog::Ptr &to) {
+    INVARIANT(prefetch == NULL, "setCatalog must be called before prefetching starts");
+    catalog = to;
+}
+
+boost::shared_ptr<DataSeriesSource> IndexSourceModule::openSource(const string &filename) {
+    if (catalog != NULL) {
+        return catalog->openSource(filename);
+    } else {
+        return boost::shared_ptr<DataSeriesSource>(new DataSeriesSource(filename));
+    }
+}
+
 IndexSourceModule::~IndexSourceModule() {
     INVARIANT(prefetch == NULL || isClosed(),
               "Must either have never read data or be done reading data");
@@ -68,7 +298,8 @@ IndexSourceModule::~IndexSourceModule() {
 void
 IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
                                     unsigned prefetch_max_unpacked,
-                                    int n_unpack_threads)
+                                    int n_unpack_threads,
+                                    int n_reader_threads)
 {
     INVARIANT(prefetch == NULL, "invalid to start prefetching twice without closing.");
     SINVARIANT(prefetch_max_compressed > 0);
@@ -79,18 +310,18 @@ IndexSourceModule::startPrefetching(unsigned prefetch_max_compressed,
     tmp->mutex.lock();
     prefetch = tmp;
 
-    unsigned unpack_count;
     if (n_unpack_threads == -1) {
-        unpack_count = min(PThreadMisc::getNCpus(), MAX_THREADS/2);
+        tmp->shared_unpack = true;
     } else {
         // TODO: Add support (and test) for 0 unpack threads which should
         // disable all of the prefetching.
         SINVARIANT(n_unpack_threads > 0);
-        unpack_count = static_cast<unsigned>(n_unpack_threads);
+        tmp->unpack_threads.resize(n_unpack_threads);
     } 
 
-    INVARIANT(unpack_count > 0, "?");
-    tmp->unpack_threads.resize(unpack_count);
+    INVARIANT(n_reader_threads > 0 && n_reader_threads <= MAX_THREADS,
+              format("invalid number of reader threads %d") % n_reader_threads);
+    tmp->reader_threads.resize(n_reader_threads);
     INVARIANT(prefetch == tmp, "two simulataneous calls to startPrefetching??");
     lockedStartThreads();
     tmp->mutex.unlock();
@@ -105,6 +336,13 @@ void IndexSourceModule::lockedStartThreads() {
         prefetch->unpack_threads[i] = new IndexSourceModuleUnpackThread(*this);
         prefetch->unpack_threads[i]->start();
     }
+    for (unsigned i = 0; i < prefetch->reader_threads.size(); ++i) {
+        prefetch->reader_threads[i] = new IndexSourceModuleReaderThread(*this);
+        prefetch->reader_threads[i]->start();
+    }
+    if (prefetch->shared_unpack) {
+        unpack_pool.add(this);
+    }
 }
 
 static inline double 
@@ -122,11 +360,20 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     }
     SINVARIANT(prefetch != NULL);
     prefetch->mutex.lock();
-    while (!prefetch->allDone() &&
-          !prefetch->unpackedReady()) {
-        ++prefetch->stats.consumer;
-        prefetch->unpack_cond.broadcast();
-        prefetch->ready_cond.wait(prefetch->mutex);
+    noteQueue(prefetch->unpacked.data.size());
+    if (!prefetch->allDone() && !prefetch->unpackedReady()) {
+        Clock::Tdbl start = Clock::tod();
+        while (!prefetch->allDone() &&
+               !prefetch->unpackedReady()) {
+            ++prefetch->stats.consumer;
+            if (prefetch->shared_unpack) {
+                unpack_pool.notify(this, true);
+            } else {
+                prefetch->unpack_cond.broadcast();
+            }
+            prefetch->ready_cond.wait(prefetch->mutex);
+        }
+        noteBlocked(Clock::tod() - start);
     }
     if (prefetch->allDone()) {
         prefetch->mutex.unlock();
@@ -139,9 +386,11 @@ Extent::Ptr IndexSourceModule::getSharedExtent() {
     PrefetchExtent *buf = prefetch->unpacked.getFront();
     SINVARIANT(buf->bytes.empty() && buf->unpacked != NULL);
     prefetch->unpacked.subtract(buf->unpacked->size());
-    if (!prefetch->compressed.empty() &&
-        prefetch->unpacked.can_add(prefetch->compressed.front())) {
-        prefetch->unpack_cond.signal();
+    if (prefetch->shared_unpack) {
+        unpack_pool.release(buf->unpacked->size());
+    }
+    if (prefetch->canUnpackFront()) {
+        lockedSignalUnpack();
     } else {
         ++prefetch->stats.skip_unpack_signal;
     }
@@ -180,12 +429,19 @@ void IndexSourceModule::close() {
         return;
     }
     if (prefetch->abort_prefetching == 0) {
-        //                          me + compressed_prefetch + unpackers
-        prefetch->abort_prefetching = 2 + prefetch->unpack_threads.size();
+        //                          me + compressed_prefetch + unpackers + readers
+        prefetch->abort_prefetching = 2 + prefetch->unpack_threads.size()
+            + prefetch->reader_threads.size();
         prefetch->compressed_cond.broadcast();
         prefetch->unpack_cond.broadcast();
         prefetch->ready_cond.broadcast();
+        prefetch->read_cond.broadcast();
 
+        if (prefetch->shared_unpack) {
+            // the pool may be part way through unpacking one of our extents
+            PThreadScopedUnlock unlock(lock);
+            unpack_pool.remove(this);
+        }
         while (prefetch->abort_prefetching > 1) {
             prefetch->compressed_cond.wait(prefetch->mutex);
         }
@@ -199,9 +455,19 @@ void IndexSourceModule::close() {
             delete *i;
             *i = NULL;
         }
+        for (vector<PThread *>::iterator i = prefetch->reader_threads.begin();
+            i != prefetch->reader_threads.end(); ++i) {
+            (**i).join();
+            delete *i;
+            *i = NULL;
+        }
+        prefetch->pending_reads = 0;
         while (prefetch->compressed.empty() == false) {
             delete prefetch->compressed.getFront();
         }
+        if (prefetch->shared_unpack) {
+            unpack_pool.release(prefetch->unpacked.cur);
+        }
         while (prefetch->unpacked.empty() == false) {
             delete prefetch->unpacked.getFront();
         }
@@ -236,6 +502,12 @@ bool IndexSourceModule::lockedIsClosed() {
             return false;
         }
     }
+    for (vector<PThread *>::iterator i = prefetch->reader_threads.begin(); 
+         i != prefetch->reader_threads.end(); ++i) {
+        if (*i != NULL) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -273,7 +545,8 @@ IndexSourceModule::getWaitStats(WaitStats &stats)
 void IndexSourceModule::compressedPrefetchThread() {
     prefetch->mutex.lock();
     while (prefetch->abort_prefetching == 0) {
-        if (!prefetch->source_done && prefetch->compressed.can_add(0)) {
+        if (!prefetch->source_done && prefetch->compressed.can_add(0)
+            && prefetch->canQueueRead()) {
             PrefetchExtent *p = lockedGetCompressedExtent();
             if (p == NULL) {
                 prefetch->source_done = true;
@@ -281,14 +554,24 @@ void IndexSourceModule::compressedPrefetchThread() {
             } else {
                 SINVARIANT(p->extent_source != Extent::in_memory_str &&
                            p->extent_source_offset > 0);
-                prefetch->compressed.add(p, p->bytes.size());
-                if (prefetch->unpacked.can_add(prefetch->compressed.front())) {
-                    prefetch->unpack_cond.signal();
+                if (p->readPending()) {
+                    // size is added by the reader once it knows it
+                    prefetch->compressed.add(p, 0);
+                    ++prefetch->pending_reads;
+                    prefetch->read_cond.signal();
+                } else {
+                    prefetch->compressed.add(p, p->bytes.size());
+                }
+                if (prefetch->canUnpackFront()) {
+                    lockedSignalUnpack();
                 } else {
                     ++prefetch->stats.skip_unpack_signal;
                 }
             }
         } else {
+            if (!prefetch->source_done && !prefetch->canQueueRead()) {
+                ++prefetch->stats.reads_outstanding_full;
+            }
             prefetch->compressed_cond.wait(prefetch->mutex);
         }
     }
@@ -302,11 +585,12 @@ void IndexSourceModule::unpackThread() {
     prefetch->mutex.lock();
     ++prefetch->stats.active_unpackers;
     while (prefetch->abort_prefetching == 0) {
-        if (prefetch->compressed.data.empty() || 
-            !prefetch->unpacked.can_add(prefetch->compressed.front())) {
+        if (!prefetch->canUnpackFront()) {
             --prefetch->stats.active_unpackers;
             if (prefetch->compressed.data.empty()) {
                 ++prefetch->stats.unpack_no_upstream;
+            } else if (prefetch->compressed.front()->readPending()) {
+                ++prefetch->stats.unpack_wait_read;
             } else {
                 ++prefetch->stats.unpack_downstream_full;
             }
@@ -319,53 +603,7 @@ void IndexSourceModule::unpackThread() {
         }
 
         prefetch->stats.lockedUpdateActive();
-        if (!prefetch->compressed.data.empty() &&
-            prefetch->unpacked.can_add(prefetch->compressed.front())) {
-            PrefetchExtent *pe = prefetch->compressed.getFront();
-            prefetch->compressed.subtract(pe->bytes.size());
-            uint32_t unpacked_size 
-                    = Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type);
-            prefetch->unpacked.add(pe, unpacked_size);
-            prefetch->compressed_cond.signal();
-            bool should_yield; 
-            if (prefetch->unpackedReady()) {
-                // For small extents, almost equivalent to just having the
-                // next condition, but not equivalent with large extents.
-                // really want a directed yield here to the consumer.
-                ++prefetch->stats.unpack_yield_ready;
-                should_yield = true;
-            } else if (prefetch->unpacked.data.size() > 2*prefetch->unpack_threads.size()) {
-                ++prefetch->stats.unpack_yield_front;
-                // The front of the queue isn't done, but we have a lot of 
-                // things in the queue, this means whatever thread is working
-                // on that element has been preempted.
-                // really want a directed yield to the thread processing the
-                // first extent.
-                should_yield = true;
-            } else {
-                should_yield = false;
-            }
-            prefetch->mutex.unlock();
-            if (should_yield) {
-                sched_yield();
-            }
-            Extent::Ptr e(new Extent(pe->type));
-            e->unpackData(pe->bytes, pe->need_bitflip);
-            e->extent_source = pe->extent_source;
-            e->extent_source_offset = pe->extent_source_offset;
-            SINVARIANT(e->type->getName() == pe->uncompressed_type);
-            SINVARIANT(e->size() == unpacked_size);
-            prefetch->mutex.lock();
-            SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
-            total_compressed_bytes += pe->bytes.size();
-            total_uncompressed_bytes += e->size();
-            pe->bytes.clear();
-            pe->unpacked = e;
-            SINVARIANT(!prefetch->unpacked.empty());
-            if (prefetch->unpackedReady()) {
-                prefetch->ready_cond.signal();
-            }
-        }
+        lockedUnpackFront();
     }
     --prefetch->stats.active_unpackers;
     SINVARIANT(prefetch->abort_prefetching > 0);
@@ -374,6 +612,91 @@ void IndexSourceModule::unpackThread() {
     prefetch->mutex.unlock();
 }
 
+bool IndexSourceModule::sharedUnpackOne() {
+    prefetch->mutex.lock();
+    bool ret = prefetch->abort_prefetching == 0 && lockedUnpackFront();
+    prefetch->mutex.unlock();
+    return ret;
+}
+
+void IndexSourceModule::lockedSignalUnpack() {
+    if (prefetch->shared_unpack) {
+        unpack_pool.notify(this, false);
+    } else {
+        prefetch->unpack_cond.signal();
+    }
+}
+
+bool IndexSourceModule::lockedUnpackFront() {
+    if (!prefetch->canUnpackFront()) {
+        return false;
+    }
+    PrefetchExtent *pe = prefetch->compressed.front();
+    uint32_t unpacked_size 
+            = Extent::unpackedSize(pe->bytes, pe->need_bitflip,pe->type);
+    if (prefetch->shared_unpack 
+        && !unpack_pool.reserve(unpacked_size, prefetch->unpacked.empty())) {
+        ++prefetch->stats.unpack_pool_full;
+        return false;
+    }
+    prefetch->compressed.getFront();
+    prefetch->compressed.subtract(pe->bytes.size());
+    prefetch->unpacked.add(pe, unpacked_size);
+    prefetch->compressed_cond.signal();
+    bool should_yield; 
+    if (prefetch->unpackedReady()) {
+        // For small extents, almost equivalent to just having the
+        // next condition, but not equivalent with large extents.
+        // really want a directed yield here to the consumer.
+        ++prefetch->stats.unpack_yield_ready;
+        should_yield = true;
+    } else if (!prefetch->shared_unpack 
+               && prefetch->unpacked.data.size() > 2*prefetch->unpack_threads.size()) {
+        ++prefetch->stats.unpack_yield_front;
+        // The front of the queue isn't done, but we have a lot of 
+        // things in the queue, this means whatever thread is working
+        // on that element has been preempted.
+        // really want a directed yield to the thread processing the
+        // first extent.
+        should_yield = true;
+    } else {
+        should_yield = false;
+    }
+    prefetch->mutex.unlock();
+    if (should_yield) {
+        sched_yield();
+    }
+    Extent::Ptr e(new Extent(pe->type));
+    if (unpack_fields.empty()) {
+        e->unpackData(pe->bytes, pe->need_bitflip);
+    } else {
+        vector<bool> field_mask(pe->type->unpackFieldMask(unpack_fields));
+        e->unpackData(pe->bytes, pe->need_bitflip, &field_mask);
+    }
+    e->extent_source = pe->extent_source;
+    e->extent_source_offset = pe->extent_source_offset;
+    SINVARIANT(e->type->getName() == pe->uncompressed_type);
+    SINVARIANT(e->size() <= unpacked_size);
+    prefetch->mutex.lock();
+    SINVARIANT(pe->unpacked == NULL && pe->bytes.size() > 0);
+    if (e->size() < unpacked_size) { // skipped the variable data
+        prefetch->unpacked.subtract(unpacked_size - e->size());
+        if (prefetch->shared_unpack) {
+            unpack_pool.release(unpacked_size - e->size());
+        }
+    }
+    total_compressed_bytes += pe->bytes.size();
+    total_uncompressed_bytes += e->size();
+    noteInput(e->nRecords(), pe->bytes.size());
+    pe->bytes.clear();
+    pe->unpacked = e;
+    SINVARIANT(!prefetch->unpacked.empty());
+    if (prefetch->unpackedReady()) {
+        prefetch->ready_cond.signal();
+    }
+    return true;
+}
+
 IndexSourceModule::PrefetchExtent *
 IndexSourceModule::readCompressed(DataSeriesSource *dss,
                                   off64_t offset,
@@ -391,3 +714,72 @@ IndexSourceModule::readCompressed(DataSeriesSource *dss,
     prefetch->mutex.lock();
     return p;
 }
+
+IndexSourceModule::PrefetchExtent *
+IndexSourceModule::readCompressed(const boost::shared_ptr<DataSeriesSource> &dss,
+                                  off64_t offset,
+                                  const string &uncompressed_type)
+{
+    SINVARIANT(dss != NULL);
+    PrefetchExtent *p = new PrefetchExtent;
+    p->extent_source = dss->getFilename();
+    p->extent_source_offset = offset;
+    p->need_bitflip = dss->needBitflip();
+    p->uncompressed_type = uncompressed_type;
+    p->read_source = dss;
+    return p;
+}
+
+IndexSourceModule::PrefetchExtent *IndexSourceModule::PrefetchInfo::nextToRead() {
+    // Reads are handed out in queue order so that the front of the queue,
+    // which the unpackers are waiting on, is always read first.
+    for (Deque<PrefetchExtent *>::iterator i = compressed.data.begin();
+         i != compressed.data.end(); ++i) {
+        if ((**i).readPending() && !(**i).reading) {
+            return *i;
+        }
+    }
+    return NULL;
+}
+
+void IndexSourceModule::readerThread() {
+    prefetch->mutex.lock();
+    while (prefetch->abort_prefetching == 0) {
+        PrefetchExtent *pe = prefetch->nextToRead();
+        if (pe == NULL) {
+            ++prefetch->stats.reader_no_work;
+            prefetch->read_cond.wait(prefetch->mutex);
+            continue;
+        }
+        pe->reading = true;
+        // Safe to use the source and offset unlocked; close() waits for us to
+        // exit before deleting any queued entries.
+        boost::shared_ptr<DataSeriesSource> dss = pe->read_source;
+        off64_t offset = pe->extent_source_offset;
+        prefetch->mutex.unlock();
+
+        Extent::ByteArray bytes;
+        bool ok = dss->preadCompressed(offset, bytes);
+        INVARIANT(ok,"whoa, shouldn't have hit eof!");
+        ExtentType::Ptr type 
+            = dss->getLibrary().getTypeByNamePtr(Extent::getPackedExtentType(bytes));
+
+        prefetch->mutex.lock();
+        SINVARIANT(pe->reading && pe->bytes.empty());
+        pe->bytes.swap(bytes);
+        pe->type = type;
+        pe->read_source.reset();
+        pe->reading = false;
+        SINVARIANT(prefetch->pending_reads > 0);
+        --prefetch->pending_reads;
+        prefetch->compressed.addSize(pe->bytes.size());
+        prefetch->compressed_cond.signal();
+        if (prefetch->canUnpackFront()) {
+            lockedSignalUnpack();
+        }
+    }
+    SINVARIANT(prefetch->abort_prefetching > 0);
+    --prefetch->abort_prefetching;
+    prefetch->compressed_cond.broadcast();
+    prefetch->mutex.unlock();
+}
@@ -35,12 +35,15 @@ static bool intervalOverlap(const GeneralValue &a_min, const GeneralValue &a_max
 }
 
 void
-MinMaxIndexModule::init(const std::string &index_filename,
+MinMaxIndexModule::init(const std::vector<std::string> &index_filenames,
                         std::vector<selector> &intersection_list,
                         const std::string &sort_fieldname)
 {
     TypeIndexModule tim("DSIndex::Extent::MinMax::" + index_type);
-    tim.addSource(index_filename);
+    for (vector<string>::const_iterator i = index_filenames.begin();
+         i != index_filenames.end(); ++i) {
+        tim.addSource(*i);
+    }
 
     ExtentSeries s;
     Variable32Field filename(s,"filename");
@@ -66,6 +69,9 @@ MinMaxIndexModule::init(const std::string &index_filename,
             }
         }
         for (;s.morerecords();++s) {
+            // an empty filename is an index embedded in the data file
+            const string extent_filename(filename.size() == 0 ? e->extent_source 
+                                         : filename.stringval());
             bool all_overlap = true;
             bool any_overlap = false;
             GeneralValue extent_sort(sort_val);
@@ -88,30 +94,30 @@ MinMaxIndexModule::init(const std::string &index_filename,
                 if (all_overlap) {
                     if (false) {
                         cout << format("keep %s @ %d\n")
-                                % filename.stringval() % extent_offset.val();
+                                % extent_filename % extent_offset.val();
                     }
-                    kept_extents.push_back(kept_extent(filename.stringval(),
+                    kept_extents.push_back(kept_extent(extent_filename,
                                                        extent_offset.val(),
                                                        extent_sort));
                 } else {
                     if (false) {
                         cout << format("skip %s @ %d\n")
-                                % filename.stringval() % extent_offset.val();
+                                % extent_filename % extent_offset.val();
                     }
                 }
             } else {
                 if (any_overlap) {
                     if (false) {
                         cout << format("keep %s @ %d\n")
-                                % filename.stringval() % extent_offset.val();
+                                % extent_filename % extent_offset.val();
                     }
-                    kept_extents.push_back(kept_extent(filename.stringval(),
+                    kept_extents.push_back(kept_extent(extent_filename,
                                                        extent_offset.val(),
                                                        extent_sort));
                 } else {
                     if (false) {
                         cout << format("skip %s @ %d\n")
-                                % filename.stringval() % extent_offset.val();
+                                % extent_filename % extent_offset.val();
                     }
                 }
             }
@@ -135,12 +141,12 @@ MinMaxIndexModule::MinMaxIndexModule(const string &index_filename,
                                      const string &max_fieldname,
                                      const string &sort_fieldname)
         : IndexSourceModule(), index_type(_index_type), 
-          cur_extent(0), cur_source(NULL), use_or(false)
+          cur_extent(0), cur_source(), use_or(false)
 {
     vector<selector> tmp;
     selector foo(minv,maxv,min_fieldname,max_fieldname);
     tmp.push_back(foo);
-    init(index_filename,tmp,sort_fieldname);
+    init(vector<string>(1, index_filename),tmp,sort_fieldname);
 }
 
 MinMaxIndexModule::MinMaxIndexModule(const std::string &index_filename,
@@ -148,9 +154,9 @@ MinMaxIndexModule::MinMaxIndexModule(const std::string &index_filename,
                                      std::vector<selector> intersection_list,
                                      const std::string &sort_fieldname)
         : IndexSourceModule(), index_type(_index_type), 
-          cur_extent(0), cur_source(NULL), use_or(false)
+          cur_extent(0), cur_source(), use_or(false)
 {
-    init(index_filename,intersection_list,sort_fieldname);
+    init(vector<string>(1, index_filename),intersection_list,sort_fieldname);
 }
 
 MinMaxIndexModule::MinMaxIndexModule(const std::string &index_filename,
@@ -159,11 +165,21 @@ MinMaxIndexModule::MinMaxIndexModule(const std::string &index_filename,
                                      const std::string &sort_fieldname,
                                      const bool _use_or)
         : IndexSourceModule(), index_type(_index_type), 
-          cur_extent(0), cur_source(NULL), use_or(_use_or)
+          cur_extent(0), cur_source(), use_or(_use_or)
 {
-    init(index_filename,intersection_list,sort_fieldname);
+    init(vector<string>(1, index_filename),intersection_list,sort_fieldname);
 }
 
+MinMaxIndexModule::MinMaxIndexModule(const vector<string> &index_filenames,
+                                     const string &_index_type,
+                                     vector<selector> intersection_list,
+                                     const string &sort_fieldname,
+                                     const bool _use_or)
+        : IndexSourceModule(), index_type(_index_type), 
+          cur_extent(0), cur_source(), use_or(_use_or)
+{
+    init(index_filenames,intersection_list,sort_fieldname);
+}
 
 void
 MinMaxIndexModule::lockedResetModule()
@@ -175,15 +191,13 @@ IndexSourceModule::PrefetchExtent *
 MinMaxIndexModule::lockedGetCompressedExtent()
 {
     if (cur_extent >= kept_extents.size()) {
-        delete cur_source;
-        cur_source = NULL;
+        cur_source.reset();
         cur_source_filename.clear();
         return NULL;
     }
     if (cur_source_filename != kept_extents[cur_extent].filename) {
-        delete cur_source;
         cur_source_filename = kept_extents[cur_extent].filename;
-        cur_source = new DataSeriesSource(cur_source_filename);
+        cur_source = openSource(cur_source_filename);
     }
     PrefetchExtent *ret = 
             readCompressed(cur_source,
@@ -0,0 +1,175 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <ostream>
+
+#include <Lintel/Clock.hpp>
+
+#include <DataSeries/ModuleStatsLogger.hpp>
+
+using namespace std;
+using boost::format;
+
+const string ModuleStatsLogger::stats_xml =
+    "<ExtentType name=\"DataSeries: ModuleStats\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\">\n"
+    "  <field type=\"double\" name=\"snapshot_time\" pack_relative=\"snapshot_time\""
+    " pack_scale=\"1e-6\" />\n"
+    "  <field type=\"variable32\" name=\"module\" pack_unique=\"yes\" />\n"
+    "  <field type=\"int64\" name=\"extents_in\" />\n"
+    "  <field type=\"int64\" name=\"rows_in\" />\n"
+    "  <field type=\"int64\" name=\"bytes_in\" />\n"
+    "  <field type=\"int64\" name=\"extents_out\" />\n"
+    "  <field type=\"int64\" name=\"rows_out\" />\n"
+    "  <field type=\"int64\" name=\"bytes_out\" />\n"
+    "  <field type=\"double\" name=\"get_seconds\" />\n"
+    "  <field type=\"double\" name=\"upstream_seconds\" />\n"
+    "  <field type=\"int64\" name=\"queue_samples\" />\n"
+    "  <field type=\"int64\" name=\"queue_sum\" />\n"
+    "  <field type=\"int64\" name=\"queue_max\" />\n"
+    "</ExtentType>\n";
+
+class ModuleStatsLogger::Thread : public PThread {
+  public:
+    Thread(ModuleStatsLogger &logger) : logger(logger) { }
+
+    virtual void *run() {
+        logger.loggerThread();
+        return NULL;
+    }
+
+    ModuleStatsLogger &logger;
+};
+
+ModuleStatsLogger::ModuleStatsLogger(ostream &to, double interval_seconds)
+    : to(&to), interval_seconds(interval_seconds)
+{
+    init();
+}
+
+ModuleStatsLogger::ModuleStatsLogger(const string &filename, double interval_seconds)
+    : to(NULL), interval_seconds(interval_seconds)
+{
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type(library.registerTypePtr(stats_xml));
+    sink.reset(new DataSeriesSink(filename));
+    sink->writeExtentLibrary(library);
+    output.reset(new OutputModule(*sink, series, type, 64*1024));
+    init();
+}
+
+void ModuleStatsLogger::init() {
+    INVARIANT(interval_seconds > 0, "need a positive interval");
+    stopping = stopped = false;
+}
+
+ModuleStatsLogger::~ModuleStatsLogger() {
+    if (!stopped) {
+        stop();
+    }
+}
+
+void ModuleStatsLogger::start() {
+    INVARIANT(thread == NULL && !stopped, "logger already started or stopped");
+    thread.reset(new Thread(*this));
+    thread->start();
+}
+
+void ModuleStatsLogger::snapshot() {
+    vector<pair<string, DataSeriesModule::ModuleStats> > all;
+    DataSeriesModule::getAllStats(all);
+    double now = Clock::tod();
+
+    PThreadScopedLock lock(mutex);
+    INVARIANT(!stopped, "snapshot after stop");
+    if (to != NULL) {
+        *to << format("module statistics at %.3f:\n") % now;
+        for (vector<pair<string, DataSeriesModule::ModuleStats> >::iterator i = all.begin();
+             i != all.end(); ++i) {
+            i->second.printText(*to, i->first);
+        }
+        to->flush();
+        return;
+    }
+
+    DoubleField snapshot_time(series, "snapshot_time");
+    Variable32Field module(series, "module");
+    Int64Field extents_in(series, "extents_in"), rows_in(series, "rows_in");
+    Int64Field bytes_in(series, "bytes_in");
+    Int64Field extents_out(series, "extents_out"), rows_out(series, "rows_out");
+    Int64Field bytes_out(series, "bytes_out");
+    DoubleField get_seconds(series, "get_seconds"), upstream_seconds(series, "upstream_seconds");
+    Int64Field queue_samples(series, "queue_samples"), queue_sum(series, "queue_sum");
+    Int64Field queue_max(series, "queue_max");
+    for (vector<pair<string, DataSeriesModule::ModuleStats> >::iterator i = all.begin();
+         i != all.end(); ++i) {
+        const DataSeriesModule::ModuleStats &s(i->second);
+        output->newRecord();
+        snapshot_time.set(now);
+        module.set(i->first);
+        extents_in.set(s.extents_in);
+        rows_in.set(s.rows_in);
+        bytes_in.set(s.bytes_in);
+        extents_out.set(s.extents_out);
+        rows_out.set(s.rows_out);
+        bytes_out.set(s.bytes_out);
+        get_seconds.set(s.get_seconds);
+        upstream_seconds.set(s.upstream_seconds);
+        queue_samples.set(s.queue_samples);
+        queue_sum.set(s.queue_sum);
+        queue_max.set(s.queue_max);
+    }
+    // so that a long running program's file has the snapshots so far
+    output->flushExtent();
+}
+
+void ModuleStatsLogger::stop() {
+    if (thread != NULL) {
+        {
+            PThreadScopedLock lock(mutex);
+            stopping = true;
+        }
+        thread->join();
+    }
+    snapshot();
+
+    PThreadScopedLock lock(mutex);
+    stopped = true;
+    if (output != NULL) {
+        output->close();
+        sink->close();
+    }
+}
+
+void ModuleStatsLogger::loggerThread() {
+    // Sleep in short steps so that stop() doesn't wait for a long interval to end
+    double next = Clock::tod() + interval_seconds;
+    while (true) {
+        {
+            PThreadScopedLock lock(mutex);
+            if (stopping) {
+                return;
+            }
+        }
+        double now = Clock::tod();
+        if (now >= next) {
+            snapshot();
+            next += interval_seconds;
+            if (next < now) { // slow snapshot; don't try to catch up
+                next = now + interval_seconds;
+            }
+        } else {
+            usleep(static_cast<useconds_t>(min(next - now, 0.1) * 1.0e6));
+        }
+    }
+}
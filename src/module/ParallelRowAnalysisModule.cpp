@@ -0,0 +1,207 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <algorithm>
+
+#include <Lintel/Clock.hpp>
+
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
+
+using namespace std;
+
+// Hands the worker's analysis the one extent the worker pulled from the real source
+class ParallelRowAnalysisModule::WorkerSource : public DataSeriesModule {
+  public:
+    virtual Extent::Ptr getSharedExtent() {
+        Extent::Ptr ret;
+        ret.swap(next);
+        return ret;
+    }
+
+    Extent::Ptr next;
+};
+
+class ParallelRowAnalysisModule::Worker : public PThread {
+  public:
+    Worker(ParallelRowAnalysisModule &module, unsigned worker_num)
+        : module(module), worker_num(worker_num), saw_extent(false) { }
+
+    virtual void *run() {
+        module.workerThread(worker_num);
+        return NULL;
+    }
+
+    ParallelRowAnalysisModule &module;
+    unsigned worker_num;
+    WorkerSource source;
+    bool saw_extent; // so the analysis has had firstExtent() and prepareForProcessing()
+};
+
+ParallelRowAnalysisModule::ParallelRowAnalysisModule
+(DataSeriesModule &source, const Factory &factory, const Merge &merge, int n_threads,
+ size_t max_queued_bytes)
+    : RowAnalysisModule(source), factory(factory), merge(merge), n_threads(n_threads),
+      max_queued_bytes(max_queued_bytes), queued_bytes(0), source_exhausted(false),
+      running_workers(0), started(false), stop_workers(false), finished(false), result(NULL)
+{
+    if (this->n_threads == -1) {
+        this->n_threads = min(PThreadMisc::getNCpus(), MAX_THREADS);
+    }
+    INVARIANT(this->n_threads > 0, "need at least one thread");
+    SINVARIANT(!!factory && !!merge);
+}
+
+ParallelRowAnalysisModule::~ParallelRowAnalysisModule() {
+    if (started && !finished) {
+        PThreadScopedLock lock(mutex);
+        stop_workers = true;
+        cond.broadcast();
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        if (started && !finished) {
+            (**i).join();
+        }
+    }
+    for (vector<RowAnalysisModule *>::iterator i = analyses.begin(); i != analyses.end(); ++i) {
+        delete *i;
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        delete *i;
+    }
+}
+
+Extent::Ptr ParallelRowAnalysisModule::getSharedExtent() {
+    if (finished) {
+        return Extent::Ptr();
+    }
+    if (!started) {
+        startWorkers();
+    }
+    {
+        PThreadScopedLock lock(mutex);
+        noteQueue(analyzed.size());
+        if (analyzed.empty() && running_workers > 0) {
+            Clock::Tdbl start = Clock::tod();
+            while (analyzed.empty() && running_workers > 0) {
+                cond.wait(mutex);
+            }
+            noteBlocked(Clock::tod() - start);
+        }
+        if (!analyzed.empty()) {
+            Extent::Ptr ret = analyzed.front();
+            analyzed.pop_front();
+            queued_bytes -= ret->size();
+            cond.broadcast();
+            return ret;
+        }
+    }
+    finish();
+    return Extent::Ptr();
+}
+
+void ParallelRowAnalysisModule::processRow() {
+    FATAL_ERROR("ParallelRowAnalysisModule's workers process the rows");
+}
+
+void ParallelRowAnalysisModule::printResult() {
+    getResult().printResult();
+}
+
+RowAnalysisModule &ParallelRowAnalysisModule::getResult() {
+    INVARIANT(finished, "no result until all the extents have been analyzed");
+    return *result;
+}
+
+void ParallelRowAnalysisModule::startWorkers() {
+    SINVARIANT(!started);
+    for (int i = 0; i < n_threads; ++i) {
+        workers.push_back(new Worker(*this, i));
+        analyses.push_back(factory(workers.back()->source));
+        SINVARIANT(analyses.back() != NULL);
+        if (!where_expr_str.empty()) {
+            analyses.back()->setWhereExpr(where_expr_str);
+        }
+    }
+    prepared = true; // too late for setWhereExpr() to reach the workers
+    started = true;
+    running_workers = n_threads;
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).start();
+    }
+}
+
+void ParallelRowAnalysisModule::workerThread(unsigned worker_num) {
+    RowAnalysisModule &analysis(*analyses[worker_num]);
+    WorkerSource &from(workers[worker_num]->source);
+    while (true) {
+        {
+            PThreadScopedLock lock(mutex);
+            while (queued_bytes >= max_queued_bytes && !stop_workers) {
+                cond.wait(mutex);
+            }
+            if (stop_workers) {
+                break;
+            }
+        }
+        Extent::Ptr e;
+        {
+            PThreadScopedLock lock(source_mutex);
+            if (!source_exhausted) {
+                e = getUpstreamExtent(source, false);
+                source_exhausted = e == NULL;
+            }
+        }
+        if (e == NULL) {
+            break;
+        }
+        from.next = e;
+        workers[worker_num]->saw_extent = true;
+        Extent::Ptr done = analysis.getSharedExtent();
+        SINVARIANT(done == e && from.next == NULL);
+
+        PThreadScopedLock lock(mutex);
+        queued_bytes += e->size();
+        analyzed.push_back(e);
+        cond.broadcast();
+    }
+    PThreadScopedLock lock(mutex);
+    --running_workers;
+    cond.broadcast();
+}
+
+void ParallelRowAnalysisModule::finish() {
+    SINVARIANT(!finished);
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).join();
+    }
+    // Merge into an analysis that has been prepared with an extent; the ones
+    // that never got an extent have nothing to merge.
+    result = analyses[0];
+    for (unsigned i = 0; i < workers.size(); ++i) {
+        if (workers[i]->saw_extent) {
+            result = analyses[i];
+            break;
+        }
+    }
+    processed_rows = ignored_rows = 0;
+    for (unsigned i = 0; i < analyses.size(); ++i) {
+        processed_rows += analyses[i]->processed_rows;
+        ignored_rows += analyses[i]->ignored_rows;
+        if (analyses[i] != result && workers[i]->saw_extent) {
+            merge(*result, *analyses[i]);
+        }
+    }
+    // the merged analysis prints counts for all of the rows
+    result->processed_rows = processed_rows;
+    result->ignored_rows = ignored_rows;
+    result->completeProcessing();
+    finished = true;
+}
@@ -0,0 +1,211 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    implementation
+*/
+
+#include <algorithm>
+
+#include <Lintel/Clock.hpp>
+
+#include <DataSeries/ParallelSequenceModule.hpp>
+
+using namespace std;
+
+// One extent from the source, and the extents a chain has made from it so far
+struct ParallelSequenceModule::Morsel {
+    Morsel() : done(false) { }
+
+    Deque<Extent::Ptr> extents; // not yet returned
+    bool done; // the chain has asked for another morsel, so extents is complete
+};
+
+// The head of each worker's chain; hands out the next morsel from the real source
+class ParallelSequenceModule::WorkerSource : public DataSeriesModule {
+  public:
+    WorkerSource(ParallelSequenceModule &module, Worker &worker)
+        : module(module), worker(worker) { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        return module.nextMorsel(worker);
+    }
+
+    ParallelSequenceModule &module;
+    Worker &worker;
+};
+
+class ParallelSequenceModule::Worker : public PThread {
+  public:
+    Worker(ParallelSequenceModule &module)
+        : module(module), chain(new WorkerSource(module, *this)), morsel(NULL) { }
+
+    virtual void *run() {
+        module.workerThread(*this);
+        return NULL;
+    }
+
+    ParallelSequenceModule &module;
+    SequenceModule chain;
+    Morsel *morsel; // in_order: the one the chain is working on
+};
+
+ParallelSequenceModule::ParallelSequenceModule
+(DataSeriesModule &source, const Factory &factory, bool in_order, int n_threads,
+ size_t max_queued_bytes)
+    : source(source), factory(factory), in_order(in_order), n_threads(n_threads),
+      max_queued_bytes(max_queued_bytes), queued_bytes(0), source_exhausted(false),
+      running_workers(0), started(false), stop(false)
+{
+    if (this->n_threads == -1) {
+        this->n_threads = min(PThreadMisc::getNCpus(), MAX_THREADS);
+    }
+    INVARIANT(this->n_threads > 0, "need at least one thread");
+    SINVARIANT(!!factory);
+}
+
+ParallelSequenceModule::~ParallelSequenceModule() {
+    stopWorkers();
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        delete *i;
+    }
+    while (!morsels.empty()) {
+        delete morsels.front();
+        morsels.pop_front();
+    }
+}
+
+Extent::Ptr ParallelSequenceModule::getSharedExtent() {
+    if (!started) {
+        startWorkers();
+    }
+    PThreadScopedLock lock(mutex);
+    noteQueue(in_order ? morsels.size() : finished.size());
+    Clock::Tdbl blocked_at = 0;
+    while (true) {
+        Extent::Ptr ret;
+        if (in_order) {
+            while (!morsels.empty() && morsels.front()->done
+                   && morsels.front()->extents.empty()) {
+                delete morsels.front();
+                morsels.pop_front();
+            }
+            // the first morsel's extents can go as soon as they are made
+            if (!morsels.empty() && !morsels.front()->extents.empty()) {
+                ret = morsels.front()->extents.front();
+                morsels.front()->extents.pop_front();
+            }
+        } else if (!finished.empty()) {
+            ret = finished.front();
+            finished.pop_front();
+        }
+        if (ret != NULL) {
+            queued_bytes -= ret->size();
+            cond.broadcast();
+        }
+        if (ret != NULL || (morsels.empty() && running_workers == 0)) {
+            if (blocked_at != 0) {
+                noteBlocked(Clock::tod() - blocked_at);
+            }
+            return ret;
+        }
+        if (blocked_at == 0) {
+            blocked_at = Clock::tod();
+        }
+        cond.wait(mutex);
+    }
+}
+
+void ParallelSequenceModule::startWorkers() {
+    SINVARIANT(!started);
+    // the factory runs here, so it needn't be thread safe
+    for (int i = 0; i < n_threads; ++i) {
+        workers.push_back(new Worker(*this));
+        factory(workers.back()->chain);
+    }
+    started = true;
+    running_workers = n_threads;
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).start();
+    }
+}
+
+void ParallelSequenceModule::stopWorkers() {
+    if (!started) {
+        return;
+    }
+    {
+        PThreadScopedLock lock(mutex);
+        stop = true;
+        cond.broadcast();
+    }
+    for (vector<Worker *>::iterator i = workers.begin(); i != workers.end(); ++i) {
+        (**i).join();
+    }
+    started = false;
+}
+
+void ParallelSequenceModule::workerThread(Worker &worker) {
+    while (true) {
+        Extent::Ptr e = worker.chain.getSharedExtent();
+        if (e == NULL) {
+            break;
+        }
+        PThreadScopedLock lock(mutex);
+        queued_bytes += e->size();
+        if (in_order) {
+            INVARIANT(worker.morsel != NULL,
+                      "chain returned an extent after it had been handed the end of the source");
+            worker.morsel->extents.push_back(e);
+        } else {
+            finished.push_back(e);
+        }
+        cond.broadcast();
+    }
+    finishMorsel(worker);
+    PThreadScopedLock lock(mutex);
+    --running_workers;
+    cond.broadcast();
+}
+
+Extent::Ptr ParallelSequenceModule::nextMorsel(Worker &worker) {
+    // asking for another extent means the chain has returned everything from the last one
+    finishMorsel(worker);
+    {
+        PThreadScopedLock lock(mutex);
+        while (queued_bytes >= max_queued_bytes && !stop) {
+            cond.wait(mutex);
+        }
+        if (stop) {
+            return Extent::Ptr();
+        }
+    }
+
+    PThreadScopedLock lock(source_mutex);
+    if (source_exhausted) {
+        return Extent::Ptr();
+    }
+    Extent::Ptr e = getUpstreamExtent(source, false);
+    if (e == NULL) {
+        source_exhausted = true;
+    } else if (in_order) {
+        // still under source_mutex, so morsels stays in source order
+        worker.morsel = new Morsel;
+        PThreadScopedLock morsels_lock(mutex);
+        morsels.push_back(worker.morsel);
+    }
+    return e;
+}
+
+void ParallelSequenceModule::finishMorsel(Worker &worker) {
+    if (worker.morsel != NULL) {
+        PThreadScopedLock lock(mutex);
+        worker.morsel->done = true;
+        worker.morsel = NULL;
+        cond.broadcast();
+    }
+}
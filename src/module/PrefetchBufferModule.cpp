@@ -9,6 +9,8 @@
     implementation
 */
 
+#include <Lintel/Clock.hpp>
+
 #include <DataSeries/PrefetchBufferModule.hpp>
 
 /** Note: we special case the code when we are compiling in profile mode because
@@ -52,10 +54,12 @@ PrefetchBufferModule::~PrefetchBufferModule() {
 
 Extent::Ptr PrefetchBufferModule::getSharedExtent() {
 #ifdef COMPILE_PROFILE
-    return source.getSharedExtent();
+    return getUpstreamExtent(source);
 #else
     Extent::Ptr ret;
     mutex.lock();
+    noteQueue(buffer.size());
+    Clock::Tdbl start = Clock::tod();
     while (true) {
         SINVARIANT(abort_prefetching == false);
         if (buffer.empty() == false) {
@@ -73,6 +77,7 @@ Extent::Ptr PrefetchBufferModule::getSharedExtent() {
         }
     }
     mutex.unlock();
+    noteBlocked(Clock::tod() - start);
     return ret;
 #endif
 }
@@ -101,7 +106,7 @@ void PrefetchBufferModule::prefetcherThread() {
     while (abort_prefetching == false) {
         if (cur_used_memory < max_used_memory) {
             mutex.unlock();
-            Extent::Ptr e = source.getSharedExtent();
+            Extent::Ptr e = getUpstreamExtent(source, false);
             mutex.lock();
             if (e == NULL) {
                 source_done = true;
@@ -33,7 +33,7 @@ void RowAnalysisModule::firstExtent(const Extent &e) { }
 void RowAnalysisModule::prepareForProcessing() { }
 
 Extent::Ptr RowAnalysisModule::getSharedExtent() {
-    Extent::Ptr e = source.getSharedExtent();
+    Extent::Ptr e = getUpstreamExtent(source);
     if (e == NULL) {
         completeProcessing();
         return e;
@@ -50,8 +50,11 @@ Extent::Ptr RowAnalysisModule::getSharedExtent() {
             where_expr = DSExpr::make(series, where_expr_str);
         }
     }
-    for (;series.morerecords();++series) {
-        if (!where_expr || where_expr->valBool()) {
+    if (where_expr) {
+        where_expr->selectRows(series, where_selected);
+    }
+    for (size_t row = 0; series.morerecords(); ++series, ++row) {
+        if (!where_expr || where_selected[row]) {
             ++processed_rows;
             processRow();
         } else {
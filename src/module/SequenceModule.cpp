@@ -48,5 +48,5 @@ Extent *SequenceModule::getExtent() {
 }
 
 Extent::Ptr SequenceModule::getSharedExtent() {
-    return tail().getSharedExtent();
+    return getUpstreamExtent(tail());
 }
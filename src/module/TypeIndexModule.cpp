@@ -16,7 +16,7 @@ TypeIndexModule::TypeIndexModule(const string &_type_match)
           indexSeries(ExtentSeries::typeExact),
           extentOffset(indexSeries,"offset"), 
           extentType(indexSeries,"extenttype"),
-          cur_file(0), cur_source(NULL),
+          cur_file(0), cur_source(),
           my_type()
 { }
 
@@ -54,7 +54,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
                 INVARIANT(!inputFiles.empty(), "type index module had no input files??");
                 return NULL;
             }
-            cur_source = new DataSeriesSource(inputFiles[cur_file]);
+            cur_source = openSource(inputFiles[cur_file]);
             INVARIANT(cur_source->index_extent != NULL,
                       "can't handle source with null index extent\n");
             if (type_match.empty()) {
@@ -86,8 +86,7 @@ TypeIndexModule::PrefetchExtent *TypeIndexModule::lockedGetCompressedExtent() {
         }
         if (indexSeries.morerecords() == false) {
             indexSeries.clearExtent();
-            delete cur_source;
-            cur_source = NULL;
+            cur_source.reset();
             ++cur_file;
         }
     }
@@ -10,6 +10,7 @@
 */
 
 #include <DataSeries/commonargs.hpp>
+#include <DataSeries/DataSeriesSink.hpp>
 #include <iostream>
 using boost::format;
 
@@ -124,6 +125,20 @@ void getPackingArgs(int *argc, char *argv[], commonPackingArgs *commonArgs) {
             INVARIANT(commonArgs->extent_size >= 1024,
                       format("extent size %d (%s), < 1024 doesn't make sense")
                       % commonArgs->extent_size % argv[cur_arg]);
+        } else if (strncmp(argv[cur_arg],"--adaptive-compression=",23) == 0) {
+            commonArgs->adaptive_sample_interval = atoi(argv[cur_arg]+23);
+            INVARIANT(commonArgs->adaptive_sample_interval >= 0,
+                      format("adaptive compression interval %d (%s) invalid, should be >= 0")
+                      % commonArgs->adaptive_sample_interval % argv[cur_arg]);
+        } else if (strncmp(argv[cur_arg],"--unpack-cost=",14) == 0) {
+            commonArgs->unpack_bytes_per_second = atof(argv[cur_arg]+14);
+            INVARIANT(commonArgs->unpack_bytes_per_second >= 0,
+                      format("unpack cost %g (%s) invalid, should be >= 0")
+                      % commonArgs->unpack_bytes_per_second % argv[cur_arg]);
+        } else if (strcmp(argv[cur_arg],"--columnar") == 0) {
+            commonArgs->columnar_fixed = true;
+        } else if (strcmp(argv[cur_arg],"--index-v1") == 0) {
+            commonArgs->index_v1 = true;
             // Check for arguments in the old format -- provided for backwards
             // compatability.
         } else if (oldStyle(argv, cur_arg, num_munged_args, commonArgs)) {
@@ -179,11 +194,26 @@ const std::string packingOptions() {
             "} (default enables all --- enable does little on its own)\n"
             "    --compress-level=[0-9] (default 9)\n"
             "    --extent-size=[>=1024] (default 16*1024*1024 if bz2 is "
-            "enabled, 64*1024 otherwise)\n";
+            "enabled, 64*1024 otherwise)\n"
+            "    --adaptive-compression=[N] (try all algorithms on only one in N "
+            "extents of each type; default 0, every extent)\n"
+            "    --unpack-cost=[bytes] (with adaptive compression, file bytes one "
+            "second of decompression is worth; default 0)\n"
+            "    --columnar (compress the fixed data a column at a time; "
+            "needs a reader that understands DSv2)\n"
+            "    --index-v1 (also write the extended index of extent sizes, "
+            "compression modes and checksums)\n";
 
     return returnStr;
 }
 
+void setSinkPackingArgs(DataSeriesSink &sink, const commonPackingArgs &commonArgs) {
+    sink.setAdaptiveCompression(commonArgs.adaptive_sample_interval,
+                                commonArgs.unpack_bytes_per_second);
+    sink.setColumnarFixed(commonArgs.columnar_fixed);
+    sink.setIndexV1(commonArgs.index_v1);
+}
+
 bool oldStyle(char* argv[], int& cur_arg,  int& num_munged_args, 
                    commonPackingArgs* commonArgs) {
     
@@ -19,8 +19,8 @@
 #include <Lintel/StringUtil.hpp>
 
 #include <DataSeries/commonargs.hpp>
+#include <DataSeries/CSVImporter.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
-#include <DataSeries/GeneralField.hpp>
 
 /*
 =pod
@@ -43,6 +43,9 @@ I<string-quote-characters> in a row as a single I<string-quote-character>.  A
 field stops when we reach a I<field-separator-string> or the end of the
 line, which can either be a newline or a a carriage return and a newline.
 
+A line with the wrong number of fields, or a value that doesn't fit its column, stops the
+conversion with an error naming the line; the output keeps the lines before it.
+
 =head1 EXAMPLES
 
 With the file test.xml containing:
@@ -94,6 +97,17 @@ nulls.
 Specifies that any variable32 fields (as indicated by the xml description) are hex encoded, and
 so should be decoded before being added to the dataseries file.
 
+=item --parse-threads=I<count>
+
+Specifies how many threads parse the input; defaults to one per CPU.  The input is split into
+chunks of whole lines that are parsed in parallel, and the records are written in the order of
+the input.
+
+=item --chunk-size-kb=I<size>
+
+Specifies how much of the input each thread parses at a time; defaults to 4096.  The last extent
+made from each chunk is usually smaller than the others.
+
 =back
 
 =head1 TODO
@@ -119,6 +133,8 @@ namespace {
     lintel::ProgramOption<string> po_field_separator("field-separator", "Specify the string that separates fields in the csv file", ",");
     lintel::ProgramOption<bool> po_hex_encoded_variable32("hex-encoded-variable32", "Specify that variable32 fields are hex encoded.");
     lintel::ProgramOption<string> po_null_string("null-string", "Specify the string that will be interpreted as a null field", "null");
+    lintel::ProgramOption<int32_t> po_parse_threads("parse-threads", "Specify the number of threads parsing the input; -1 for one per CPU", -1);
+    lintel::ProgramOption<int32_t> po_chunk_size_kb("chunk-size-kb", "Specify the size of the pieces of input each thread parses at a time", 4096);
 }
 
 const ExtentType::Ptr getXMLDescFromFile(const string &filename, ExtentTypeLibrary &lib) {
@@ -149,16 +165,6 @@ const ExtentType::Ptr getXMLDescFromFile(const string &filename, ExtentTypeLibra
     return lib.registerTypePtr(xml_desc);
 }
 
-void makeFields(const ExtentType::Ptr type, ExtentSeries &series,
-                vector<GeneralField *> &ret, vector<bool> &is_nullable) {
-    ret.reserve(type->getNFields());
-    is_nullable.reserve(type->getNFields());
-    for (uint32_t i = 0; i < type->getNFields(); ++i) {
-        ret.push_back(GeneralField::create(series, type->getFieldName(i)));
-        is_nullable.push_back(type->getNullable(type->getFieldName(i)));
-    }
-}
-
 const ExtentType::Ptr getType(ExtentTypeLibrary &lib) {
     if (po_xml_desc_file.used()) {
         return getXMLDescFromFile(po_xml_desc_file.get(), lib);
@@ -196,16 +202,11 @@ int main(int argc, char *argv[]) {
 
     DataSeriesSink outds(ds_output_filename, packing_args.compress_modes,
                          packing_args.compress_level);
+    setSinkPackingArgs(outds, packing_args);
 
     outds.writeExtentLibrary(lib);
-    ExtentSeries series(type);
-    OutputModule *outmodule = new OutputModule(outds, series, type, packing_args.extent_size);
 
-    vector<bool> is_nullable;
-    vector<GeneralField *> fields;
-    makeFields(type, series, fields, is_nullable);
     istream *csv_input;
-
     if (csv_input_filename == "-") {
         csv_input = &cin;
     } else {
@@ -213,115 +214,25 @@ int main(int argc, char *argv[]) {
     }
     INVARIANT(csv_input->good(), 
               format("error opening %s: %s") % csv_input_filename % strerror(errno));
-    string comment_prefix(po_comment_prefix.get());
-    char string_quote_character('"');
-    string field_separator(po_field_separator.get());
-    if (prefixequal(field_separator, "0x")) {
-        INVARIANT(field_separator.size() >= 4, 
-                  "--field-separator=0x.. needs to be at least 4 characters long");
-        field_separator = hex2raw(field_separator.c_str() + 2, field_separator.size() - 2);
+    INVARIANT(po_chunk_size_kb.get() > 0, "--chunk-size-kb must be positive");
+
+    CSVImporter importer(type, outds, packing_args.extent_size, po_parse_threads.get());
+    importer.setFieldSeparator(po_field_separator.get());
+    importer.setCommentPrefix(po_comment_prefix.get());
+    importer.setNullString(po_null_string.get());
+    importer.setHexEncodedVariable32(po_hex_encoded_variable32.get());
+    importer.setChunkSize(static_cast<size_t>(po_chunk_size_kb.get()) * 1024);
+
+    string error;
+    bool ok = importer.import(*csv_input, error);
+    if (csv_input != &cin) {
+        delete csv_input;
     }
-
-    uint64_t line_num = 0;
-    while (!csv_input->eof()) {
-        ++line_num;
-        string line;
-        
-        getline(*csv_input, line);
-        if (line.empty() || (line.size() == 1 && line[0] == '\r')) {
-            continue;
-        }
-        line.push_back('\n'); // pretend it was always there, could have been EOF :(
-
-        INVARIANT(csv_input->good() || csv_input->eof(),
-                  format("error reading %s: %s") % csv_input_filename % strerror(errno));
-        
-        LintelLogDebug("csv2ds::parse", format("line %d:") % line_num);
-        if (!comment_prefix.empty() && prefixequal(line, comment_prefix)) {
-            LintelLogDebug("csv2ds::parse", "  ... comment ...");
-            continue;
-        }
-        vector<string> str_fields;
-
-        size_t pos = 0;
-
-        while (true) {
-            INVARIANT(pos < line.size(), format("csv line %d does not end in newline") % line_num);
-
-            string field;
-            if (line[pos] == string_quote_character) {
-                for (++pos; true; ++pos) {
-                    INVARIANT(pos < line.size(), format("csv line %d ends in middle of string")
-                              % line_num);
-                    if (line[pos] == string_quote_character) {
-                        INVARIANT(pos + 1 < line.size(), 
-                                  format("csv line %d ends in middle of string") % line_num);
-                        if (line[pos + 1] == string_quote_character) {
-                            ++pos;
-                        } else {
-                            ++pos; // skip terminating string quote char
-                            break;
-                        }
-                    }
-                    field.push_back(line[pos]);
-                }
-            } else {
-                for (; true; ++pos) {
-                    INVARIANT(pos < line.size(), format("csv line %d ends in middle of field")
-                              % line_num);
-                    if (line[pos] == '\r' || line[pos] == '\n' 
-                        || line.compare(pos, field_separator.size(), field_separator) == 0) {
-                        break;
-                    }
-                    field.push_back(line[pos]);
-                }
-            }
-
-            LintelLogDebug("csv2ds::parse", format("  field %d: %s") % str_fields.size() % field);
-            str_fields.push_back(field);
-            
-            INVARIANT(pos < line.size(), format("csv line %d does not terminate properly")
-                      % line_num);
-            if (line[pos] == '\r') {
-                INVARIANT(pos + 1 < line.size() && line[pos + 1] == '\n',
-                          format("csv line %d has a carriage return not followed by a newline")
-                          % line_num);
-                SINVARIANT(pos + 2 == line.size());
-                break;
-            }
-            if (line[pos] == '\n') {
-                INVARIANT(pos + 1 == line.size(), format("csv line %d has stuff after newline")
-                          % line_num);
-                break;
-            }
-
-            INVARIANT(pos + field_separator.size() <= line.size() 
-                      && line.compare(pos, field_separator.size(), field_separator) == 0,
-                      format("csv line %d at pos %d is '%c', not a field separator")
-                      % line_num % pos % line[pos]);
-            pos += field_separator.size();
-        }
-
-        INVARIANT(fields.size() == str_fields.size(),
-                  format("csv line %d has %d fields, not %d as in type definition")
-                  % line_num % str_fields.size() % fields.size());
-        outmodule->newRecord();
-        for (size_t i = 0; i < str_fields.size(); ++i) {
-            SINVARIANT(fields[i] != NULL);
-            if (is_nullable[i] && str_fields[i] == po_null_string.get()) {
-                fields[i]->setNull();
-            } else {
-                if (fields[i]->getType() == ExtentType::ft_variable32 
-                    && po_hex_encoded_variable32.get()) {
-                    str_fields[i] = hex2raw(str_fields[i]);
-                }
-                fields[i]->set(str_fields[i]);
-            }
-        }
+    outds.close(); // after an error, keeps the lines before the bad one
+    if (!ok) {
+        cerr << format("csv2ds: %s\n") % error;
+        return 1;
     }
-    
-    delete outmodule;
-    GeneralField::deleteFields(fields);
     return 0;
 }
  
@@ -97,6 +97,11 @@ to some of the other options.
 Specify an expression to evaluate for each line.  If the expression returns true then print
 out the matching row/record.
 
+=item --threads=I<count>
+
+Format the text on I<count> threads; defaults to one per CPU.  The output is the same for any
+count.
+
 =back
 
 =cut
@@ -126,6 +131,7 @@ main(int argc, char *argv[])
 {
     TypeIndexModule source("");
     DStoTextModule toText(source);
+    toText.setThreads(-1);
 
     Extent::setReadChecksFromEnv(true); // ds2txt so slow, may as well check
     string select_extent_type, select_fields;
@@ -170,6 +176,8 @@ main(int argc, char *argv[])
             toText.skipExtentType();
             toText.skipExtentFieldnames();
             skip_types = true;
+        } else if (strncmp(argv[1],"--threads=",10)==0) {
+            toText.setThreads(stringToInteger<int32_t>(argv[1] + 10));
         } else if (strncmp(argv[1],"--type=",7)==0) {
             source.setMatch(argv[1]+7);
         } else if (strcmp(argv[1],"--select")==0) {
@@ -209,6 +217,7 @@ main(int argc, char *argv[])
                      "  [--skip-index] [--skip-types] [--skip-extent-type]\n"
                      "  [--skip-extent-fieldnames] [--skip-all]\n"
                      "  [--where '*'|extent-type-match bool-expr]\n"
+                     "  [--threads=count]\n"
                      "  <file...>\n"
                      "\n%s\n")
               % argv[0] % DSExpr::usage());
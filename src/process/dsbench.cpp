@@ -0,0 +1,581 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Reproducible pack, unpack, field access and scan throughput measurements
+*/
+
+/*
+=pod
+
+=head1 NAME
+
+dsbench - measure DataSeries pack, unpack, field access and scan throughput
+
+=head1 SYNOPSIS
+
+ % dsbench [options]
+
+=head1 DESCRIPTION
+
+dsbench generates synthetic extents with a single field for each field type and packing option
+(pack_relative, pack_scale, pack_unique, pack_null_compact), and measures the throughput of each
+stage of reading and writing them:
+
+=over 4
+
+=item pack
+
+Extent::packData with one compression algorithm.
+
+=item unpack
+
+Extent::unpackData of the extents packed with that algorithm.
+
+=item field
+
+Reading every value through the typed field.
+
+=item scan
+
+Reading a file of those extents through a TypeIndexModule with some number of unpack threads.
+The file is written to --tmp-dir and will usually be in the page cache, so this measures the
+CPU cost of scanning rather than the disk.
+
+=back
+
+Each measurement is repeated until it has run for at least --min-seconds.  The results are
+written as comma separated values with a header line, one line per case, stage, compression
+algorithm and thread count, so that runs before and after a change can be compared with a
+script.  Throughput is in MiB/s of unpacked extent data, and rows/s.  packed_bytes is the size
+of the packed extents, which gives the compression ratio.
+
+=head1 OPTIONS
+
+=over 4
+
+=item --rows=I<n>
+
+Rows per extent, default 16384.
+
+=item --extents=I<n>
+
+Extents per repetition, default 16.
+
+=item --min-seconds=I<secs>
+
+Minimum time to spend on each measurement, default 0.25.
+
+=item --cases=I<name,...>
+
+Cases to run, default all.  The cases are bool, byte, int32, int32-relative, int64,
+int64-relative, int64-null-compact, double, double-scale, double-relative, variable32,
+variable32-unique and fixedwidth.
+
+=item --stages=I<name,...>
+
+Stages to run, default pack,unpack,field,scan.
+
+=item --codecs=I<name,...>
+
+Compression algorithms to use, default all of the ones compiled in; see the
+compression_algs table in Extent.cpp for the names.
+
+=item --compress-level=I<n>
+
+Compression level, default 9.
+
+=item --threads=I<n,...>
+
+Unpack thread counts for the scan stage, default 1,2,4 and the number of CPUs.
+
+=item --tmp-dir=I<path>
+
+Directory for the scan files, default the current directory.
+
+=item --output=I<path>
+
+Write the results to path rather than standard output.
+
+=back
+
+=head1 EXAMPLES
+
+ % dsbench --cases=int64,variable32 --codecs=none,lzf --stages=pack,unpack > before.csv
+
+The benchmark target of the build runs dsbench with the defaults and writes dsbench.csv in the
+build directory.
+
+=cut
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include <boost/foreach.hpp>
+
+#include <Lintel/Clock.hpp>
+#include <Lintel/LintelLog.hpp>
+#include <Lintel/MersenneTwisterRandom.hpp>
+#include <Lintel/ProgramOptions.hpp>
+#include <Lintel/PThread.hpp>
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+namespace {
+    lintel::ProgramOption<int32_t> po_rows("rows", "rows per extent", 16384);
+    lintel::ProgramOption<int32_t> po_extents("extents", "extents per repetition", 16);
+    lintel::ProgramOption<double> po_min_seconds
+    ("min-seconds", "minimum time to spend on each measurement", 0.25);
+    lintel::ProgramOption<string> po_cases("cases", "comma separated cases to run, default all");
+    lintel::ProgramOption<string> po_stages
+    ("stages", "comma separated stages to run", "pack,unpack,field,scan");
+    lintel::ProgramOption<string> po_codecs
+    ("codecs", "comma separated compression algorithms, default all available");
+    lintel::ProgramOption<int32_t> po_compress_level("compress-level", "compression level", 9);
+    lintel::ProgramOption<string> po_threads
+    ("threads", "comma separated unpack thread counts for the scan stage, default 1,2,4,#cpus");
+    lintel::ProgramOption<string> po_tmp_dir("tmp-dir", "directory for scan files", ".");
+    lintel::ProgramOption<string> po_output("output", "write results here rather than stdout");
+}
+
+// ByteArray has no assignment
+void copyBytes(Extent::ByteArray &to, const Extent::ByteArray &from) {
+    to.resize(from.size(), false);
+    if (from.size() > 0) {
+        memcpy(to.begin(), from.begin(), from.size());
+    }
+}
+
+/// One synthetic column: the field, any type attributes, and how to generate its values
+struct Case {
+    enum Values { Random, Increasing, Scaled, FewDistinct, HalfNull };
+
+    Case(const string &name, const string &field_xml, Values values,
+         const string &type_attrs = "")
+        : name(name), field_xml(field_xml), type_attrs(type_attrs), values(values) { }
+
+    string typeXml() const {
+        return str(format("<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Bench::%s\""
+                          " version=\"1.0\" %s>\n  %s\n</ExtentType>\n")
+                   % name % type_attrs % field_xml);
+    }
+
+    string name, field_xml, type_attrs;
+    Values values;
+};
+
+vector<Case> allCases() {
+    vector<Case> ret;
+    ret.push_back(Case("bool", "<field type=\"bool\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("byte", "<field type=\"byte\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("int32", "<field type=\"int32\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("int32-relative", "<field type=\"int32\" name=\"v\" pack_relative=\"v\" />",
+                       Case::Increasing));
+    ret.push_back(Case("int64", "<field type=\"int64\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("int64-relative", "<field type=\"int64\" name=\"v\" pack_relative=\"v\" />",
+                       Case::Increasing));
+    ret.push_back(Case("int64-null-compact",
+                       "<field type=\"int64\" name=\"v\" opt_nullable=\"yes\" />",
+                       Case::HalfNull, "pack_null_compact=\"non_bool\""));
+    ret.push_back(Case("double", "<field type=\"double\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("double-scale", "<field type=\"double\" name=\"v\" pack_scale=\"0.001\" />",
+                       Case::Scaled));
+    ret.push_back(Case("double-relative", "<field type=\"double\" name=\"v\" pack_scale=\"0.001\""
+                       " pack_relative=\"v\" />", Case::Increasing));
+    ret.push_back(Case("variable32", "<field type=\"variable32\" name=\"v\" />", Case::Random));
+    ret.push_back(Case("variable32-unique",
+                       "<field type=\"variable32\" name=\"v\" pack_unique=\"yes\" />",
+                       Case::FewDistinct));
+    ret.push_back(Case("fixedwidth", "<field type=\"fixedwidth\" name=\"v\" size=\"16\" />",
+                       Case::Random));
+    return ret;
+}
+
+Extent::Ptr makeExtent(const ExtentType::Ptr &type, const Case &c, uint32_t nrows,
+                       MersenneTwisterRandom &rng) {
+    Extent::Ptr ret(new Extent(type));
+    ExtentSeries s(ret);
+    int flags = c.values == Case::HalfNull ? Field::flag_nullable : 0;
+    s.createRecords(nrows);
+    switch (type->getFieldType("v"))
+        {
+        case ExtentType::ft_bool: {
+            BoolField f(s, "v", flags);
+            for (; s.more(); s.next()) {
+                f.set(rng.randBool());
+            }
+            break;
+        }
+        case ExtentType::ft_byte: {
+            ByteField f(s, "v", flags);
+            for (; s.more(); s.next()) {
+                f.set(rng.randInt(256));
+            }
+            break;
+        }
+        case ExtentType::ft_int32: {
+            Int32Field f(s, "v", flags);
+            int32_t v = 0;
+            for (; s.more(); s.next()) {
+                v = c.values == Case::Increasing ? v + rng.randInt(100) : rng.randInt();
+                f.set(v);
+            }
+            break;
+        }
+        case ExtentType::ft_int64: {
+            Int64Field f(s, "v", flags);
+            int64_t v = 1000LL * 1000 * 1000 * 1000 * 1000;
+            for (; s.more(); s.next()) {
+                if (c.values == Case::HalfNull && rng.randBool()) {
+                    f.setNull();
+                    continue;
+                }
+                v = c.values == Case::Increasing ? v + rng.randInt(1000 * 1000)
+                    : static_cast<int64_t>(rng.randLongLong());
+                f.set(v);
+            }
+            break;
+        }
+        case ExtentType::ft_double: {
+            DoubleField f(s, "v", flags);
+            double v = 0;
+            for (; s.more(); s.next()) {
+                if (c.values == Case::Increasing) {
+                    v += rng.randInt(1000) * 0.001;
+                } else if (c.values == Case::Scaled) {
+                    v = rng.randInt(1000 * 1000) * 0.001;
+                } else {
+                    v = rng.randDouble() * 1.0e6;
+                }
+                f.set(v);
+            }
+            break;
+        }
+        case ExtentType::ft_variable32: {
+            Variable32Field f(s, "v", flags);
+            string v;
+            for (; s.more(); s.next()) {
+                if (c.values == Case::FewDistinct) {
+                    v = str(format("value-%d") % rng.randInt(100));
+                } else {
+                    v.resize(rng.randInt(33));
+                    for (size_t i = 0; i < v.size(); ++i) {
+                        v[i] = 'a' + rng.randInt(26);
+                    }
+                }
+                f.set(v);
+            }
+            break;
+        }
+        case ExtentType::ft_fixedwidth: {
+            FixedWidthField f(s, "v", flags);
+            uint8_t v[16];
+            for (; s.more(); s.next()) {
+                for (size_t i = 0; i < sizeof(v); ++i) {
+                    v[i] = rng.randInt(256);
+                }
+                f.set(v, sizeof(v));
+            }
+            break;
+        }
+        default:
+            FATAL_ERROR("internal error, unexpected type");
+        }
+    return ret;
+}
+
+/// Read every value of v; returns something that depends on all of them
+double readAll(Extent::Ptr &e) {
+    ExtentSeries s(e);
+    double ret = 0;
+    switch (e->getTypePtr()->getFieldType("v"))
+        {
+        case ExtentType::ft_bool: {
+            BoolField f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.val() ? 1 : 0; }
+            break;
+        }
+        case ExtentType::ft_byte: {
+            ByteField f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.val(); }
+            break;
+        }
+        case ExtentType::ft_int32: {
+            Int32Field f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.val(); }
+            break;
+        }
+        case ExtentType::ft_int64: {
+            Int64Field f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.isNull() ? 0 : f.val(); }
+            break;
+        }
+        case ExtentType::ft_double: {
+            DoubleField f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.val(); }
+            break;
+        }
+        case ExtentType::ft_variable32: {
+            Variable32Field f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.size() + f.val()[0]; }
+            break;
+        }
+        case ExtentType::ft_fixedwidth: {
+            FixedWidthField f(s, "v", Field::flag_nullable);
+            for (; s.more(); s.next()) { ret += f.val()[0]; }
+            break;
+        }
+        default:
+            FATAL_ERROR("internal error, unexpected type");
+        }
+    return ret;
+}
+
+/// Totals for one line of output
+struct Result {
+    Result() : rows(0), bytes(0), packed_bytes(0), seconds(0) { }
+    uint64_t rows, bytes, packed_bytes;
+    double seconds;
+};
+
+class Bench {
+  public:
+    Bench(ostream &out) : out(out), min_seconds(po_min_seconds.get()), sink(0) {
+        out << "stage,case,codec,threads,rows,bytes,packed_bytes,seconds,mib_per_sec,rows_per_sec\n";
+    }
+
+    void report(const string &stage, const Case &c, const string &codec, int threads,
+                const Result &r) {
+        double mib = r.bytes / (1024.0 * 1024.0);
+        out << format("%s,%s,%s,%d,%d,%d,%d,%.6f,%.2f,%.0f\n") % stage % c.name % codec
+            % threads % r.rows % r.bytes % r.packed_bytes % r.seconds % (mib / r.seconds)
+            % (r.rows / r.seconds);
+        out.flush();
+    }
+
+    Result pack(vector<Extent::Ptr> &extents, int codec, vector<Extent::ByteArray> &packed) {
+        Result ret;
+        uint32_t mode = Extent::compression_algs[codec].compress_flag;
+        double start = Clock::tod();
+        do {
+            for (size_t i = 0; i < extents.size(); ++i) {
+                packed[i].clear();
+                extents[i]->packData(packed[i], mode, po_compress_level.get());
+                ret.rows += extents[i]->nRecords();
+                ret.bytes += extents[i]->size();
+                ret.packed_bytes += packed[i].size();
+            }
+            ret.seconds = Clock::tod() - start;
+        } while (ret.seconds < min_seconds);
+        return ret;
+    }
+
+    // Unpacking may modify its input, so each repetition unpacks fresh copies, made untimed.
+    Result unpack(const ExtentType::Ptr &type, const vector<Extent::ByteArray> &packed) {
+        Result ret;
+        vector<Extent::ByteArray> copies(packed.size());
+        do {
+            for (size_t i = 0; i < packed.size(); ++i) {
+                copyBytes(copies[i], packed[i]);
+            }
+            double start = Clock::tod();
+            for (size_t i = 0; i < copies.size(); ++i) {
+                Extent e(type);
+                e.unpackData(copies[i], false);
+                ret.rows += e.nRecords();
+                ret.bytes += e.size();
+                ret.packed_bytes += packed[i].size();
+            }
+            ret.seconds += Clock::tod() - start;
+        } while (ret.seconds < min_seconds);
+        return ret;
+    }
+
+    Result field(vector<Extent::Ptr> &extents) {
+        Result ret;
+        double start = Clock::tod();
+        do {
+            for (size_t i = 0; i < extents.size(); ++i) {
+                sink += readAll(extents[i]);
+                ret.rows += extents[i]->nRecords();
+                ret.bytes += extents[i]->size();
+            }
+            ret.seconds = Clock::tod() - start;
+        } while (ret.seconds < min_seconds);
+        return ret;
+    }
+
+    Result scan(const string &filename, const Case &c, int threads) {
+        Result ret;
+        double start = Clock::tod();
+        do {
+            TypeIndexModule source("Bench::" + c.name);
+            source.addSource(filename);
+            source.startPrefetching(32 * 1024 * 1024, 4 * 32 * 1024 * 1024, threads);
+            for (Extent::Ptr e(source.getSharedExtent()); e != NULL;
+                 e = source.getSharedExtent()) {
+                ret.rows += e->nRecords();
+                ret.bytes += e->size();
+            }
+            ret.packed_bytes += source.total_compressed_bytes;
+            ret.seconds = Clock::tod() - start;
+        } while (ret.seconds < min_seconds);
+        return ret;
+    }
+
+    ostream &out;
+    double min_seconds;
+    double sink; // keeps the field reads from being optimized away
+};
+
+vector<string> optionList(lintel::ProgramOption<string> &option) {
+    vector<string> ret;
+    if (!option.get().empty()) {
+        split(option.get(), ",", ret);
+    }
+    return ret;
+}
+
+bool selected(const vector<string> &list, const string &name) {
+    return list.empty() || find(list.begin(), list.end(), name) != list.end();
+}
+
+/// Dies if an entry in list isn't one of the known names, rather than silently running nothing
+void checkNames(const vector<string> &list, const vector<string> &known, const string &what) {
+    BOOST_FOREACH(const string &name, list) {
+        INVARIANT(find(known.begin(), known.end(), name) != known.end(),
+                  format("unknown %s '%s'; expected one of %s") % what % name % join(",", known));
+    }
+}
+
+/// Compression algorithms compiled into the library, i.e. that can pack a trivial buffer
+vector<int> availableCodecs(const vector<string> &wanted) {
+    vector<int> ret;
+    for (int i = 0; i < Extent::num_comp_algs; ++i) {
+        const Extent::compression_alg &alg(Extent::compression_algs[i]);
+        if (!selected(wanted, alg.name)) {
+            continue;
+        }
+        bool available = alg.packFunc == NULL; // none
+        if (!available) {
+            vector<Extent::byte> data(4096, 'x');
+            Extent::ByteArray into;
+            available = alg.packFunc(&data[0], data.size(), into, 1);
+        }
+        if (available) {
+            ret.push_back(i);
+        } else if (!wanted.empty()) {
+            cerr << format("warning: %s compression is not available\n") % alg.name;
+        }
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    LintelLog::parseEnv();
+    lintel::programOptionsHelp("");
+    vector<string> remain = lintel::parseCommandLine(argc, argv, false);
+    if (!remain.empty()) {
+        lintel::programOptionsUsage(argv[0]);
+        exit(1);
+    }
+    INVARIANT(po_rows.get() > 0 && po_extents.get() > 0, "need at least one row and extent");
+
+    vector<string> cases(optionList(po_cases)), stages(optionList(po_stages));
+    vector<string> known;
+    BOOST_FOREACH(const Case &c, allCases()) {
+        known.push_back(c.name);
+    }
+    checkNames(cases, known, "case");
+    known.clear();
+    split("pack,unpack,field,scan", ",", known);
+    checkNames(stages, known, "stage");
+    known.clear();
+    for (int i = 0; i < Extent::num_comp_algs; ++i) {
+        known.push_back(Extent::compression_algs[i].name);
+    }
+    checkNames(optionList(po_codecs), known, "codec");
+    vector<int> codecs(availableCodecs(optionList(po_codecs)));
+    vector<int> threads;
+    if (po_threads.get().empty()) {
+        int ncpus = PThreadMisc::getNCpus();
+        for (int i = 1; i < ncpus && i <= 4; i *= 2) {
+            threads.push_back(i);
+        }
+        threads.push_back(ncpus);
+    } else {
+        BOOST_FOREACH(const string &t, optionList(po_threads)) {
+            threads.push_back(stringToInteger<int32_t>(t));
+        }
+    }
+
+    ofstream output_file;
+    if (po_output.used()) {
+        output_file.open(po_output.get().c_str());
+        INVARIANT(output_file.good(), format("unable to open %s for write") % po_output.get());
+    }
+    Bench bench(po_output.used() ? output_file : cout);
+
+    MersenneTwisterRandom rng(1776);
+    BOOST_FOREACH(const Case &c, allCases()) {
+        if (!selected(cases, c.name)) {
+            continue;
+        }
+        ExtentTypeLibrary library;
+        ExtentType::Ptr type(library.registerTypePtr(c.typeXml()));
+        vector<Extent::Ptr> extents;
+        for (int i = 0; i < po_extents.get(); ++i) {
+            extents.push_back(makeExtent(type, c, po_rows.get(), rng));
+        }
+
+        if (selected(stages, "field")) {
+            bench.report("field", c, "-", 1, bench.field(extents));
+        }
+        BOOST_FOREACH(int codec, codecs) {
+            const char *codec_name = Extent::compression_algs[codec].name;
+            vector<Extent::ByteArray> packed(extents.size());
+            Result packing(bench.pack(extents, codec, packed));
+            if (selected(stages, "pack")) {
+                bench.report("pack", c, codec_name, 1, packing);
+            }
+            if (selected(stages, "unpack")) {
+                bench.report("unpack", c, codec_name, 1, bench.unpack(type, packed));
+            }
+            if (selected(stages, "scan")) {
+                string filename(str(format("%s/dsbench-%d.ds") % po_tmp_dir.get() % getpid()));
+                {
+                    DataSeriesSink sink(filename, Extent::compression_algs[codec].compress_flag,
+                                        po_compress_level.get());
+                    sink.writeExtentLibrary(library);
+                    BOOST_FOREACH(Extent::Ptr &e, extents) {
+                        Extent copy(type);
+                        copyBytes(copy.fixeddata, e->fixeddata);
+                        copyBytes(copy.variabledata, e->variabledata);
+                        sink.writeExtent(copy, NULL); // writeExtent empties its argument
+                    }
+                }
+                BOOST_FOREACH(int n, threads) {
+                    bench.report("scan", c, codec_name, n, bench.scan(filename, c, n));
+                }
+                unlink(filename.c_str());
+            }
+        }
+    }
+    return 0;
+}
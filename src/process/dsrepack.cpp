@@ -272,6 +272,7 @@ void writeRepackInfo(DataSeriesSink &sink, const commonPackingArgs &cpa, int fil
 
 bool skipType(const ExtentType::Ptr type) {
     return type->getName() == "DataSeries: ExtentIndex"
+            || type->getName() == "DataSeries: ExtentIndexV1"
             || type->getName() == "DataSeries: XmlType"
             || (type->getName() == "Info::DSRepack"
                 && type->getNamespace() == "ssd.hpl.hp.com");
@@ -359,6 +360,7 @@ int main(int argc, char *argv[]) {
     DataSeriesSink *output = 
             new DataSeriesSink(output_path, packing_args.compress_modes,
                                packing_args.compress_level);
+    setSinkPackingArgs(*output, packing_args);
 
     uint32_t extent_count = 0;
     for (int i = 1; i < (argc-1); ++i) {
@@ -479,6 +481,7 @@ int main(int argc, char *argv[]) {
                             new DataSeriesSink(output_path, 
                                                packing_args.compress_modes,
                                                packing_args.compress_level);
+                    setSinkPackingArgs(*new_output, packing_args);
                     new_output->writeExtentLibrary(library);
                    
                     for (map<string, PerTypeWork *>::iterator i = per_type_work.begin();
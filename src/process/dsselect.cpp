@@ -117,7 +117,6 @@ int main(int argc, char *argv[]) {
     for (unsigned i=2; i < (extra_args.size()-1); ++i) {
         source.addSource(extra_args[i]);
     }
-    source.startPrefetching();
 
     ExtentSeries inputseries(ExtentSeries::typeLoose);
     ExtentSeries outputseries(ExtentSeries::typeLoose);
@@ -177,21 +176,33 @@ int main(int argc, char *argv[]) {
         outfields.push_back(GeneralField::create(NULL,outputseries,*i));
     }
     DSExpr *where = NULL;
+    vector<string> unpack_fields(fields);
     if (where_arg.used()) {
         string tmp = where_arg.get();
         where = DSExpr::make(inputseries, tmp);
+        vector<string> where_fields(DSExpr::fieldNames(inputseries, tmp));
+        unpack_fields.insert(unpack_fields.end(), where_fields.begin(), where_fields.end());
+    }
+    if (!get_all_fields) {
+        source.setUnpackFields(unpack_fields);
     }
+    source.startPrefetching();
 
     OutputModule outmodule(output,outputseries,outputtype,
                            packing_args.extent_size);
     uint64_t input_row_count = 0, output_row_count = 0;
+    vector<bool> selected;
     while (true) {
         Extent::Ptr inextent = source.getSharedExtent();
         if (inextent == NULL) 
             break;
-        for (inputseries.setExtent(inextent);inputseries.morerecords(); ++inputseries) {
+        inputseries.setExtent(inextent);
+        if (where) {
+            where->selectRows(inputseries, selected);
+        }
+        for (size_t row = 0; inputseries.morerecords(); ++inputseries, ++row) {
             ++input_row_count;
-            if (where && !where->valBool()) {
+            if (where && !selected[row]) {
                 continue;
             }
             ++output_row_count;
@@ -14,7 +14,7 @@ dsstatgroupby - Calculate some derived value from a dataseries and calculate a s
 
 =head1 SYNOPSIS
 
-% dsstatgroupby I<extent-type-match> I<statistic-description>... from file...
+% dsstatgroupby [--threads=I<n>] I<extent-type-match> I<statistic-description>... from file...
 
 =head1 STATISTIC DESCRIPTION
 
@@ -23,18 +23,27 @@ Two types of statistic types are currently implemented basic (mean, stddev, min,
 (percentile/100).  The expression implements the standard + - * / () and constants.  Two optional
 arguments can be added.  where I<expr> adds in a conditional expression so you could calculate
 separate statistics over large and small files.  group by <field> specifies a column that should be
-used for grouping the statistics.
+used for grouping the statistics; group by <field>,<field>... groups by several columns.
 
 =head1 DESCRIPTION
 
 dsstatgroupby processes one or more input files calculating multiple statistics in a single pass
 over that input file.
 
+--threads=I<n> calculates each basic statistic on I<n> threads, each over a share of the extents,
+and merges the results at the end.  Quantile statistics are always calculated on a single thread.
+
 */
 
+#include <boost/bind.hpp>
 #include <boost/format.hpp>
 
+#include <Lintel/StringUtil.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/DSExpr.hpp>
 #include <DataSeries/DSStatGroupByModule.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
 #include <DataSeries/TypeIndexModule.hpp>
 #include <DataSeries/PrefetchBufferModule.hpp>
 #include <DataSeries/SequenceModule.hpp>
@@ -48,7 +57,8 @@ usage(const std::string &program_name, const std::string &error)
     // TODO: should we make the usage ... from <prefix> in <file...>?
     cerr << error << "\n"
          << "Usage: " << program_name 
-         << " <extent-type-match> (<stat-type> <expr> [where <expr>] [group by <group-by>])+\n"
+         << " [--threads=<n>] <extent-type-match>\n"
+         << "  (<stat-type> <expr> [where <expr>] [group by <field>[,<field>...]])+\n"
          << "  from file...\n"
          << "\n"
          << "  stat-types include:\n\n"
@@ -57,6 +67,12 @@ usage(const std::string &program_name, const std::string &error)
     exit(0);
 }
 
+RowAnalysisModule *makeStatModule(DataSeriesModule &source, const string &expr,
+                                  const string &group_by, const string &stat_type,
+                                  const string &where_expr) {
+    return new DSStatGroupByModule(source, expr, group_by, stat_type, where_expr);
+}
+
 
 int 
 main(int argc, char *_argv[])
@@ -67,6 +83,13 @@ main(int argc, char *_argv[])
     for (int i=0; i<argc; ++i) {
         argv.push_back(string(_argv[i]));
     }
+    int n_threads = 1;
+    if (argc > 1 && argv[1].compare(0, 10, "--threads=") == 0) {
+        n_threads = stringToInteger<int32_t>(argv[1].substr(10));
+        if (n_threads < 1) usage(argv[0], "--threads needs at least one thread");
+        argv.erase(argv.begin() + 1);
+        --argc;
+    }
     if (argc <= 5) usage(argv[0], "insufficient arguments");
 
     string extent_type_match(argv[1]);
@@ -76,6 +99,7 @@ main(int argc, char *_argv[])
 
     SequenceModule seq(prefetch);
 
+    vector<string> exprs, unpack_fields;
     uint32_t argpos;
     for (argpos = 2; argpos < argv.size();) {
         if (argv[argpos] == "from") 
@@ -106,14 +130,43 @@ main(int argc, char *_argv[])
             argpos += 3;
         }
 
-        seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, 
-                                              stat_type, where_expr));
+        if (n_threads > 1 && stat_type == "basic") {
+            seq.addModule(new ParallelRowAnalysisModule
+                          (seq.tail(), boost::bind(makeStatModule, _1, expr, group_by,
+                                                   stat_type, where_expr),
+                           boost::bind(&DSStatGroupByModule::merge, _1, _2), n_threads));
+        } else {
+            seq.addModule(new DSStatGroupByModule(seq.tail(), expr, group_by, 
+                                                  stat_type, where_expr));
+        }
+        exprs.push_back(expr);
+        if (!where_expr.empty()) {
+            exprs.push_back(where_expr);
+        }
+        if (!group_by.empty()) {
+            vector<string> fields;
+            split(group_by, ",", fields);
+            unpack_fields.insert(unpack_fields.end(), fields.begin(), fields.end());
+        }
     }
 
     if (argpos >= argv.size() || argv[argpos] != "from") {
         usage(argv[0], "missing from in arguments");
     }
     ++argpos;
+    if (argpos < argv.size()) {
+        // only unpack the fields the expressions read
+        DataSeriesSource first_file(argv[argpos]);
+        ExtentType::Ptr type(first_file.getLibrary().getTypeMatchPtr(extent_type_match, true));
+        if (type != NULL) {
+            ExtentSeries series(type);
+            for (vector<string>::iterator i = exprs.begin(); i != exprs.end(); ++i) {
+                vector<string> fields(DSExpr::fieldNames(series, *i));
+                unpack_fields.insert(unpack_fields.end(), fields.begin(), fields.end());
+            }
+            source.setUnpackFields(unpack_fields);
+        }
+    }
     for (;argpos<argv.size(); ++argpos) {
         source.addSource(argv[argpos]);
     }
@@ -3100,6 +3100,7 @@ doConvert(NettraceReader *from, const char *ds_output_name,
     DataSeriesSink *nfsdsout = new DataSeriesSink(ds_output_name, 
                                                   packing_args.compress_modes, 
                                                   packing_args.compress_level);
+    setSinkPackingArgs(*nfsdsout, packing_args);
     ExtentTypeLibrary library;
 
     const ExtentType::Ptr nfs_convert_stats_type(library.registerTypePtr(nfs_convert_stats_xml));
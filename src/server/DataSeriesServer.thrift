@@ -85,7 +85,10 @@ service DataSeriesServer {
 
     TableData getTableData(string source_table, i32 max_rows = 1000000, string where_expr = '');
 
-    // Table a will be loaded into memory; join will be on all column pairs in eq_columns
+    // Up to max_a_rows of table a will be loaded into memory; a larger table a is hashed along
+    // with table b into on-disk partitions that are joined pairwise.  The rows of a join done in
+    // memory are in table b order; those of a partitioned join are grouped by partition, so sort
+    // the output if the order matters.  The join will be on all column pairs in eq_columns
     // keep columns sources a.<name> or b.<name> will be mapped to the dest name.
 
     // eq_columns contains the name of columns to be compared and keep_columns keys specfies the
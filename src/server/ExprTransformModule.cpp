@@ -76,7 +76,7 @@ class ExprTransformModule : public OutputSeriesModule {
     virtual Extent::Ptr getSharedExtent() {
         while (true) {
             if (!input_series.hasExtent()) {
-                Extent::Ptr in = source.getSharedExtent();
+                Extent::Ptr in = getUpstreamExtent(source);
                 if (in == NULL) {
                     return returnOutputSeries();
                 }
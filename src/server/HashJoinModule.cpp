@@ -1,20 +1,59 @@
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include <Lintel/Deque.hpp>
+#include <Lintel/HashFns.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+
 #include "ServerModules.hpp"
 #include "DSSModule.hpp"
 #include "JoinModule.hpp"
 
 // TODO: merge common code with StarJoinModule
 
-class HashJoinModule : public JoinModule { 
+/* Up to max_a_rows of the a table are loaded into a hash table that the b table is streamed past.
+   If the a table is bigger than that, both tables are hashed on the join columns into the
+   partitions of one temporary DataSeries file per table (a grace hash join), and the partitions
+   are joined pairwise, re-partitioning any a partition that is still too big.  Building and
+   probing the hash table both use n_threads threads: the table is sharded on the key hash so that
+   each thread can build one shard, and each thread probes whole b extents.  The unpartitioned join
+   returns its output in b order, with the matches for each b row in a order; the partitioned join
+   returns the output of each pair of partitions in turn, so its rows come out in a different
+   order. */
+
+class HashJoinModule : public JoinModule {
   public:
     typedef map<string, string> CMap; // column map
+    typedef HashMap< GVVec, vector<GVVec> > Table;
+
+    static const uint32_t npartitions = 64;
+    static const uint32_t max_partition_levels = 4;
+    static const size_t output_extent_size = 96*1024;
 
     HashJoinModule(DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
                    const map<string, string> &eq_columns, const map<string, string> &keep_columns,
-                   const string &output_table_name) 
-            : a_input(a_input), b_input(b_input), max_a_rows(max_a_rows), 
-              eq_columns(eq_columns), keep_columns(keep_columns), 
-              output_table_name(output_table_name)
-    { }
+                   const string &output_table_name, const string &spill_prefix, int n_threads)
+            : a_input(a_input), b_input(b_input), max_a_rows(max_a_rows),
+              eq_columns(eq_columns), keep_columns(keep_columns),
+              output_table_name(output_table_name), spill_prefix(spill_prefix),
+              n_threads(n_threads), build_extents(NULL), build_phase(0), build_phases(0),
+              build_running(0), stop_builders(false), spill_count(0), probe_from_input(false),
+              probe_exhausted(true), probe_partition(0), probe_extent(0), returned_any(false),
+              stop_probers(false)
+    {
+        if (this->n_threads == -1) {
+            this->n_threads = min(PThreadMisc::getNCpus(), MAX_THREADS);
+        }
+        INVARIANT(this->n_threads > 0, "need at least one thread");
+    }
+
+    virtual ~HashJoinModule() {
+        stopProbers();
+        stopBuilders();
+    }
 
     static const string mapDGet(const map<string, string> &a_map, const string &a_key) {
         map<string, string>::const_iterator i = a_map.find(a_key);
@@ -22,35 +61,258 @@ class HashJoinModule : public JoinModule {
         return i->second;
     }
 
-    void firstExtent(const Extent &b_e) {
-        ExtentSeries a_series;
+    struct ExtractSpec {
+        ExtractSpec(const string &into, int32_t a_pos, const string &b_field)
+            : into(into), a_pos(a_pos), b_field(b_field) { }
+
+        string into;
+        int32_t a_pos; // >= 0 ==> position in the a values, otherwise from b_field
+        string b_field;
+    };
+
+    struct KeyVal {
+        GVVec key, val;
+    };
+
+    static uint32_t partitionOf(const GVVec &key, uint32_t level) {
+        return lintel::BobJenkinsHashMix3(key.hash(), level, 0x9E3779B9) % npartitions;
+    }
+
+    uint32_t shardOf(const GVVec &key) const {
+        return lintel::BobJenkinsHashMix3(key.hash(), 0x5EED, 1972) % table.size();
+    }
 
-        a_series.setExtent(a_input.getSharedExtent());
-        b_series.setType(b_e.getTypePtr());
-        if (a_series.getSharedExtent() == NULL) {
+    vector<GVVec> *lookup(const GVVec &key) {
+        return table[shardOf(key)].lookup(key);
+    }
+
+    /** One side of the join, hashed on the join columns into the partitions of a temporary
+        DataSeries file.  Each partition is buffered in its own series, and the offsets of the
+        extents written for it are recorded so that it can be read back on its own. */
+    class PartitionFile {
+      public:
+        typedef boost::shared_ptr<PartitionFile> Ptr;
+
+        PartitionFile(const string &path, const ExtentType::Ptr &type,
+                      const vector<string> &key_names, uint32_t level)
+            : path(path), level(level), rows(npartitions, 0), offsets(npartitions),
+              input_series(type), written_series(type), key(), written_key(),
+              sink(path, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1)
+        {
+            BOOST_FOREACH(const string &name, key_names) {
+                key_fields.push_back(GeneralField::make(input_series, name));
+                written_key_fields.push_back(GeneralField::make(written_series, name));
+            }
+            key.resize(key_fields.size());
+            written_key.resize(key_fields.size());
+            for (uint32_t i = 0; i < npartitions; ++i) {
+                buffers.push_back(new ExtentSeries(type));
+                copiers.push_back(new ExtentRecordCopy(input_series, *buffers.back()));
+            }
+            ExtentTypeLibrary library;
+            library.registerType(type);
+            sink.writeExtentLibrary(library);
+            sink.setExtentWriteCallback(boost::bind(&PartitionFile::written, this, _1, _2));
+        }
+
+        ~PartitionFile() {
+            for (uint32_t i = 0; i < npartitions; ++i) {
+                delete copiers[i];
+                delete buffers[i];
+            }
+            source.reset();
+            unlink(path.c_str()); // ignore errors
+        }
+
+        void add(const Extent::Ptr &e) {
+            for (input_series.setExtent(e); input_series.more(); input_series.next()) {
+                key.extract(key_fields);
+                uint32_t p = partitionOf(key, level);
+                ExtentSeries &buffer(*buffers[p]);
+                if (!buffer.hasExtent()) {
+                    buffer.newExtent();
+                }
+                buffer.newRecord();
+                copiers[p]->copyRecord();
+                ++rows[p];
+                if (buffer.getExtentRef().size() > output_extent_size) {
+                    flush(p);
+                }
+            }
+            input_series.clearExtent();
+        }
+
+        /// Write out the partially full extents; no more adds after this
+        void close() {
+            for (uint32_t p = 0; p < npartitions; ++p) {
+                if (buffers[p]->hasExtent()) {
+                    flush(p);
+                }
+            }
+            sink.close();
+        }
+
+        /// Extent i of partition p, NULL past the end of the partition; only valid after close()
+        Extent::Ptr read(uint32_t p, size_t i) {
+            if (i >= offsets[p].size()) {
+                return Extent::Ptr();
+            }
+            if (source == NULL) {
+                source.reset(new DataSeriesSource(path));
+            }
+            off64_t offset = offsets[p][i];
+            return Extent::Ptr(source->preadExtent(offset));
+        }
+
+        const string path;
+        const uint32_t level;
+        vector<uint64_t> rows; // per partition
+
+      private:
+        void flush(uint32_t p) {
+            sink.writeExtent(buffers[p]->getExtentRef(), NULL);
+            buffers[p]->clearExtent();
+        }
+
+        // Called by the sink as each extent is written; every row of the extent is in the
+        // same partition as the first one.
+        void written(off64_t offset, Extent &e) {
+            if (e.getTypePtr() != written_series.getTypePtr()) {
+                return; // type library or index
+            }
+            PThreadScopedLock lock(mutex);
+            SEP_RowOffset first_row(0, &e);
+            for (size_t i = 0; i < written_key_fields.size(); ++i) {
+                written_key[i].set(*written_key_fields[i], e, first_row);
+            }
+            offsets[partitionOf(written_key, level)].push_back(offset);
+        }
+
+        vector< vector<off64_t> > offsets;
+        ExtentSeries input_series, written_series;
+        vector<GeneralField::Ptr> key_fields, written_key_fields;
+        GVVec key, written_key;
+        vector<ExtentSeries *> buffers;
+        vector<ExtentRecordCopy *> copiers;
+        scoped_ptr<DataSeriesSource> source;
+        PThreadMutex mutex;
+        DataSeriesSink sink; // last, so the callback's state outlives the sink
+    };
+
+    struct Task {
+        Task(PartitionFile::Ptr a, PartitionFile::Ptr b, uint32_t partition)
+            : a(a), b(b), partition(partition) { }
+
+        PartitionFile::Ptr a, b;
+        uint32_t partition;
+    };
+
+    struct ProbeJob {
+        typedef boost::shared_ptr<ProbeJob> Ptr;
+
+        ProbeJob(const Extent::Ptr &b_extent) : b_extent(b_extent), output(), done(false) { }
+
+        Extent::Ptr b_extent;
+        vector<Extent::Ptr> output;
+        bool done; // under HashJoinModule::mutex
+    };
+
+    /// Probe thread, with its own b fields, extractors and output series
+    class Prober : public PThread {
+      public:
+        Prober(HashJoinModule &hj) : hj(hj), b_series(hj.b_type), output_series(hj.output_type) {
+            BOOST_FOREACH(const string &name, hj.b_eq_names) {
+                b_eq_fields.push_back(GeneralField::make(b_series, name));
+            }
+            BOOST_FOREACH(const ExtractSpec &spec, hj.extract_specs) {
+                if (spec.a_pos >= 0) {
+                    extractors.push_back(ExtractorValue::make(spec.into, spec.a_pos));
+                } else {
+                    extractors.push_back(ExtractorField::make(b_series, spec.b_field, spec.into));
+                }
+            }
+            Extractor::makeInto(extractors, output_series);
+            key.resize(b_eq_fields.size());
+        }
+
+        virtual void *run() {
+            hj.probeThread(*this);
+            return NULL;
+        }
+
+        void probe(ProbeJob &job) {
+            for (b_series.setExtent(job.b_extent); b_series.more(); b_series.next()) {
+                key.extract(b_eq_fields);
+                vector<GVVec> *v = hj.lookup(key);
+                if (v == NULL) {
+                    continue;
+                }
+                LintelLogDebug("HashJoinModule", format("%d match on %s") % v->size() % key);
+                BOOST_FOREACH(const GVVec &a_vals, *v) {
+                    if (!output_series.hasExtent()) {
+                        output_series.newExtent();
+                    }
+                    output_series.newRecord();
+                    Extractor::extractAll(extractors, a_vals);
+                    if (output_series.getExtentRef().size() > output_extent_size) {
+                        job.output.push_back(output_series.getSharedExtent());
+                        output_series.clearExtent();
+                    }
+                }
+            }
+            b_series.clearExtent();
+            if (output_series.hasExtent()) {
+                job.output.push_back(output_series.getSharedExtent());
+                output_series.clearExtent();
+            }
+        }
+
+        HashJoinModule &hj;
+        ExtentSeries b_series, output_series;
+        vector<GeneralField::Ptr> b_eq_fields;
+        vector<Extractor::Ptr> extractors;
+        GVVec key;
+    };
+
+    /// Builds each hash table; phase 1 extracts rows, phase 2 fills in one shard
+    class Builder : public PThread {
+      public:
+        Builder(HashJoinModule &hj, uint32_t num) : hj(hj), num(num) { }
+
+        virtual void *run() {
+            hj.builderThread(num);
+            return NULL;
+        }
+
+        HashJoinModule &hj;
+        uint32_t num;
+    };
+
+    void firstExtent(const Extent::Ptr &b_e) {
+        Extent::Ptr a_e(getUpstreamExtent(a_input));
+        if (a_e == NULL) {
             requestError("a_table is empty?");
         }
+        a_type = a_e->getTypePtr();
+        b_type = b_e->getTypePtr();
 
         // Three possible sources for values in the output:
-        // 
+        //
         // 1) the a value fields, so from the hash-map
         // 2a) the b fields, as one of the a eq fields.
         // 2b) the b fields, as one of the b values or eq fields
-        // 
+        //
         // We do not try to optimize the extraction and just create a new general field for each
         // extraction so if the hash-map has duplicate columns, there will be duplicate fields.
-        vector<GeneralField::Ptr> a_eq_fields;
         HashUnique<string> known_a_eq_fields;
 
         BOOST_FOREACH(const CMap::value_type &vt, eq_columns) {
-            SINVARIANT(a_series.getTypePtr()->getFieldType(vt.first)
-                       == b_series.getTypePtr()->getFieldType(vt.second));
-            a_eq_fields.push_back(GeneralField::make(a_series, vt.first));
-            b_eq_fields.push_back(GeneralField::make(b_series, vt.second));
+            SINVARIANT(a_type->getFieldType(vt.first) == b_type->getFieldType(vt.second));
+            a_eq_names.push_back(vt.first);
+            b_eq_names.push_back(vt.second);
             known_a_eq_fields.add(vt.first);
         }
 
-        vector<GeneralField::Ptr> a_val_fields;
         HashMap<string, uint32_t> a_name_to_val_pos;
 
         BOOST_FOREACH(const CMap::value_type &vt, keep_columns) {
@@ -58,8 +320,8 @@ class HashJoinModule : public JoinModule {
                 string field_name(vt.first.substr(2));
                 if (!known_a_eq_fields.exists(field_name)) { // don't store eq fields we will
                     // access from the b eq fields
-                    a_name_to_val_pos[field_name] = a_val_fields.size();
-                    a_val_fields.push_back(GeneralField::make(a_series, field_name));
+                    a_name_to_val_pos[field_name] = a_val_names.size();
+                    a_val_names.push_back(field_name);
                 }
             }
         }
@@ -72,22 +334,18 @@ class HashJoinModule : public JoinModule {
             string output_field_xml;
 
             if (prefixequal(vt.first, "a.") && a_name_to_val_pos.exists(field_name)) { // case 1
-                TINVARIANT(a_series.getTypePtr()->hasColumn(field_name));
-                output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                extractors.push_back
-                        (ExtractorValue::make(vt.second, a_name_to_val_pos[field_name]));
-            } else if (prefixequal(vt.first, "a.") 
+                TINVARIANT(a_type->hasColumn(field_name));
+                output_field_xml = renameField(a_type, field_name, vt.second);
+                extract_specs.push_back(ExtractSpec(vt.second, a_name_to_val_pos[field_name], ""));
+            } else if (prefixequal(vt.first, "a.")
                        && eq_columns.find(field_name) != eq_columns.end()) { // case 2a
                 const string b_field_name(eq_columns.find(field_name)->second);
-                TINVARIANT(b_series.getTypePtr()->hasColumn(b_field_name));
-                output_field_xml = renameField(a_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, b_field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
-            } else if (prefixequal(vt.first, "b.")
-                       && b_series.getTypePtr()->hasColumn(field_name)) { // case 2b
-                output_field_xml = renameField(b_series.getTypePtr(), field_name, vt.second);
-                GeneralField::Ptr b_field(GeneralField::make(b_series, field_name));
-                extractors.push_back(ExtractorField::make(vt.second, b_field));
+                TINVARIANT(b_type->hasColumn(b_field_name));
+                output_field_xml = renameField(a_type, field_name, vt.second);
+                extract_specs.push_back(ExtractSpec(vt.second, -1, b_field_name));
+            } else if (prefixequal(vt.first, "b.") && b_type->hasColumn(field_name)) { // case 2b
+                output_field_xml = renameField(b_type, field_name, vt.second);
+                extract_specs.push_back(ExtractSpec(vt.second, -1, field_name));
             } else {
                 requestError("invalid extraction");
             }
@@ -95,71 +353,353 @@ class HashJoinModule : public JoinModule {
         }
 
         output_xml.append("</ExtentType>\n");
-                    
-        INVARIANT(!extractors.empty(), "must extract at least one field");
-        int32_t row_count = 0;
-        key.resize(a_eq_fields.size());
-        GVVec val;
-        val.resize(a_val_fields.size());
-        while (1) {
-            if (a_series.getSharedExtent() == NULL) {
+
+        INVARIANT(!extract_specs.empty(), "must extract at least one field");
+
+        ExtentTypeLibrary lib;
+        LintelLog::info(format("output xml: %s") % output_xml);
+        output_type = lib.registerTypePtr(output_xml);
+        output_series.setType(output_type);
+
+        // Hold on to the a extents until we know whether they fit
+        vector<Extent::Ptr> a_extents;
+        int64_t a_rows = 0;
+        for (; a_e != NULL; a_e = getUpstreamExtent(a_input)) {
+            a_rows += a_e->nRecords();
+            a_extents.push_back(a_e);
+            if (a_rows > max_a_rows) {
                 break;
             }
-            for (; a_series.more(); a_series.next()) {
-                ++row_count;
+        }
+
+        startProbers();
+        if (a_e == NULL) {
+            buildTable(a_extents);
+            pending_b = b_e;
+            probe_from_input = true;
+            probe_exhausted = false;
+        } else {
+            partition(a_extents, b_e);
+        }
+    }
+
+    string spillPath() {
+        return str(format("%s.%d") % spill_prefix % spill_count++);
+    }
 
-                if (row_count >= max_a_rows) {
-                    requestError("a table has too many rows");
+    void queuePartitions(const PartitionFile::Ptr &a_file, const PartitionFile::Ptr &b_file) {
+        for (uint32_t p = npartitions; p > 0; --p) { // so partition 0 is on top
+            tasks.push_back(Task(a_file, b_file, p - 1));
+        }
+    }
+
+    void partition(vector<Extent::Ptr> &a_extents, const Extent::Ptr &b_e) {
+        LintelLog::info(format("a table has more than %d rows, partitioning the join")
+                        % max_a_rows);
+        PartitionFile::Ptr a_file(new PartitionFile(spillPath(), a_type, a_eq_names, 0));
+        for (size_t i = 0; i < a_extents.size(); ++i) {
+            a_file->add(a_extents[i]);
+            a_extents[i].reset();
+        }
+        for (Extent::Ptr e = getUpstreamExtent(a_input); e != NULL;
+             e = getUpstreamExtent(a_input)) {
+            a_file->add(e);
+        }
+        a_file->close();
+
+        PartitionFile::Ptr b_file(new PartitionFile(spillPath(), b_type, b_eq_names, 0));
+        for (Extent::Ptr e = b_e; e != NULL; e = getUpstreamExtent(b_input)) {
+            b_file->add(e);
+        }
+        b_file->close();
+
+        queuePartitions(a_file, b_file);
+    }
+
+    void repartition(const Task &task) {
+        uint32_t level = task.a->level + 1;
+        LintelLogDebug("HashJoinModule", format("re-partitioning %d a rows at level %d")
+                       % task.a->rows[task.partition] % level);
+        PartitionFile::Ptr a_file(new PartitionFile(spillPath(), a_type, a_eq_names, level));
+        PartitionFile::Ptr b_file(new PartitionFile(spillPath(), b_type, b_eq_names, level));
+        for (size_t i = 0; ; ++i) {
+            Extent::Ptr e(task.a->read(task.partition, i));
+            if (e == NULL) {
+                break;
+            }
+            a_file->add(e);
+        }
+        a_file->close();
+        for (size_t i = 0; ; ++i) {
+            Extent::Ptr e(task.b->read(task.partition, i));
+            if (e == NULL) {
+                break;
+            }
+            b_file->add(e);
+        }
+        b_file->close();
+        queuePartitions(a_file, b_file);
+    }
+
+    /// Set up the join of the next pair of partitions; false if there are none left
+    bool nextPartition() {
+        probe_from_input = false;
+        while (!tasks.empty()) {
+            Task task(tasks.back());
+            tasks.pop_back();
+            PartitionFile &a(*task.a);
+            uint32_t p = task.partition;
+            if (a.rows[p] == 0 || task.b->rows[p] == 0) {
+                continue; // nothing can match
+            }
+            if (a.rows[p] > static_cast<uint64_t>(max_a_rows)) {
+                if (a.level + 1 < max_partition_levels) {
+                    repartition(task);
+                    continue;
+                }
+                LintelLog::warn(format("unable to split a partition of %d a rows, probably"
+                                       " a common key; joining it in memory") % a.rows[p]);
+            }
+            vector<Extent::Ptr> a_extents;
+            for (size_t i = 0; ; ++i) {
+                Extent::Ptr e(a.read(p, i));
+                if (e == NULL) {
+                    break;
                 }
-                key.extract(a_eq_fields);
-                val.extract(a_val_fields);
-                a_hashmap[key].push_back(val);
+                a_extents.push_back(e);
             }
-            a_series.setExtent(a_input.getSharedExtent());
+            buildTable(a_extents);
+            probe_file = task.b;
+            probe_partition = p;
+            probe_extent = 0;
+            probe_exhausted = false;
+            return true;
         }
+        probe_file.reset();
+        return false;
+    }
 
-        ExtentTypeLibrary lib;
-        LintelLog::info(format("output xml: %s") % output_xml);
-        output_series.setType(lib.registerTypePtr(output_xml));
-        
-        Extractor::makeInto(extractors, output_series);
+    Extent::Ptr nextProbeExtent() {
+        if (probe_from_input) {
+            if (pending_b != NULL) {
+                Extent::Ptr ret;
+                ret.swap(pending_b);
+                return ret;
+            }
+            return getUpstreamExtent(b_input);
+        } else if (probe_file != NULL) {
+            return probe_file->read(probe_partition, probe_extent++);
+        } else {
+            return Extent::Ptr();
+        }
     }
 
-    virtual Extent::Ptr getSharedExtent() {
+    /// Rebuild table from a_extents using all the threads; matches stay in a order
+    void buildTable(vector<Extent::Ptr> &a_extents) {
+        vector<Table>(n_threads).swap(table);
+        build_extents = &a_extents;
+        extracted.resize(n_threads * n_threads);
+        runBuilders(1);
+        a_extents.clear();
+        runBuilders(2);
+        build_extents = NULL;
+    }
+
+    /// Run phase on every builder, and wait for all of them to finish it
+    void runBuilders(int phase) {
+        if (builders.empty()) {
+            for (int i = 0; i < n_threads; ++i) {
+                builders.push_back(new Builder(*this, i));
+                builders.back()->start();
+            }
+        }
+        PThreadScopedLock lock(build_mutex);
+        build_phase = phase;
+        ++build_phases;
+        build_running = n_threads;
+        build_cond.broadcast();
+        while (build_running > 0) {
+            build_cond.wait(build_mutex);
+        }
+    }
+
+    void builderThread(uint32_t num) {
+        uint32_t phases_run = 0;
         while (true) {
-            Extent::Ptr e = b_input.getSharedExtent();
-            if (e == NULL) {
-                break;
+            int phase;
+            {
+                PThreadScopedLock lock(build_mutex);
+                while (phases_run == build_phases && !stop_builders) {
+                    build_cond.wait(build_mutex);
+                }
+                if (phases_run == build_phases) {
+                    return;
+                }
+                ++phases_run;
+                phase = build_phase;
+            }
+            if (phase == 1) {
+                extractRows(num);
+            } else {
+                buildShard(num);
             }
-            if (output_series.getTypePtr() == NULL) {
-                firstExtent(*e);
+            PThreadScopedLock lock(build_mutex);
+            --build_running;
+            build_cond.broadcast();
+        }
+    }
+
+    void stopBuilders() {
+        {
+            PThreadScopedLock lock(build_mutex);
+            stop_builders = true;
+            build_cond.broadcast();
+        }
+        BOOST_FOREACH(Builder *builder, builders) {
+            builder->join();
+            delete builder;
+        }
+        builders.clear();
+    }
+
+    /// Phase 1; thread num extracts the rows of its share of the extents, by shard
+    void extractRows(uint32_t num) {
+        ExtentSeries series(a_type);
+        vector<GeneralField::Ptr> eq_fields, val_fields;
+        BOOST_FOREACH(const string &name, a_eq_names) {
+            eq_fields.push_back(GeneralField::make(series, name));
+        }
+        BOOST_FOREACH(const string &name, a_val_names) {
+            val_fields.push_back(GeneralField::make(series, name));
+        }
+        KeyVal kv;
+        kv.key.resize(eq_fields.size());
+        kv.val.resize(val_fields.size());
+
+        // contiguous ranges, so that concatenating the threads' rows keeps them in a order
+        size_t nextents = build_extents->size();
+        size_t first = nextents * num / n_threads, last = nextents * (num + 1) / n_threads;
+        for (size_t i = first; i < last; ++i) {
+            for (series.setExtent((*build_extents)[i]); series.more(); series.next()) {
+                kv.key.extract(eq_fields);
+                kv.val.extract(val_fields);
+                extracted[num * n_threads + shardOf(kv.key)].push_back(kv);
             }
-        
-            if (output_series.getSharedExtent() == NULL) {
-                SINVARIANT(output_series.getTypePtr() != NULL);
-                output_series.newExtent();
+        }
+        series.clearExtent();
+    }
+
+    /// Phase 2; thread num fills in shard num
+    void buildShard(uint32_t num) {
+        Table &shard(table[num]);
+        for (int i = 0; i < n_threads; ++i) {
+            vector<KeyVal> &from(extracted[i * n_threads + num]);
+            BOOST_FOREACH(KeyVal &kv, from) {
+                vector<GVVec> &vals(shard[kv.key]);
+                vals.push_back(GVVec());
+                vals.back().vec.swap(kv.val.vec);
             }
-            for (b_series.setExtent(e); b_series.more(); b_series.next()) {
-                processRow();
+            vector<KeyVal>().swap(from);
+        }
+    }
+
+    void startProbers() {
+        SINVARIANT(probers.empty());
+        for (int i = 0; i < n_threads; ++i) {
+            probers.push_back(new Prober(*this));
+            probers.back()->start();
+        }
+    }
+
+    void stopProbers() {
+        {
+            PThreadScopedLock lock(mutex);
+            stop_probers = true;
+            cond.broadcast();
+        }
+        BOOST_FOREACH(Prober *prober, probers) {
+            prober->join();
+            delete prober;
+        }
+        probers.clear();
+    }
+
+    void probeThread(Prober &prober) {
+        while (true) {
+            ProbeJob::Ptr job;
+            {
+                PThreadScopedLock lock(mutex);
+                while (pending.empty() && !stop_probers) {
+                    cond.wait(mutex);
+                }
+                if (pending.empty()) {
+                    return;
+                }
+                job = pending.front();
+                pending.pop_front();
             }
+            prober.probe(*job);
+            PThreadScopedLock lock(mutex);
+            job->done = true;
+            cond.broadcast();
+        }
+    }
 
-            if (output_series.getSharedExtent()->size() > 96*1024) {
+    /// Keep up to two b extents per thread being probed
+    void queueProbes() {
+        while (!probe_exhausted && in_flight.size() < 2 * probers.size()) {
+            Extent::Ptr e(nextProbeExtent());
+            if (e == NULL) {
+                probe_exhausted = true;
                 break;
             }
+            ProbeJob::Ptr job(new ProbeJob(e));
+            in_flight.push_back(job);
+            PThreadScopedLock lock(mutex);
+            pending.push_back(job);
+            cond.broadcast();
         }
-        return returnOutputSeries();
     }
 
-    void processRow() {
-        key.extract(b_eq_fields);
-        vector<GVVec> *v = a_hashmap.lookup(key);
-        if (v != NULL) {
-            cout << format("%d match on %s\n") % v->size() % key;
-            BOOST_FOREACH(const GVVec &a_vals, *v) {
-                output_series.newRecord();
-                BOOST_FOREACH(Extractor::Ptr p, extractors) {
-                    p->extract(a_vals);
+    virtual Extent::Ptr getSharedExtent() {
+        if (output_series.getTypePtr() == NULL) {
+            Extent::Ptr e = getUpstreamExtent(b_input);
+            if (e == NULL) {
+                return Extent::Ptr();
+            }
+            firstExtent(e);
+        }
+        while (true) {
+            if (!ready.empty()) {
+                Extent::Ptr ret(ready.front());
+                ready.pop_front();
+                returned_any = true;
+                return ret;
+            }
+            queueProbes();
+            if (in_flight.empty()) {
+                if (nextPartition()) {
+                    continue;
+                }
+                stopProbers();
+                stopBuilders();
+                if (!returned_any) { // an empty extent, so the output table still gets its type
+                    returned_any = true;
+                    output_series.newExtent();
+                    return returnOutputSeries();
                 }
+                return Extent::Ptr();
+            }
+            ProbeJob::Ptr job(in_flight.front());
+            in_flight.pop_front();
+            {
+                PThreadScopedLock lock(mutex);
+                while (!job->done) {
+                    cond.wait(mutex);
+                }
+            }
+            BOOST_FOREACH(Extent::Ptr &e, job->output) {
+                ready.push_back(e);
             }
         }
     }
@@ -167,21 +707,48 @@ class HashJoinModule : public JoinModule {
     DataSeriesModule &a_input, &b_input;
     int32_t max_a_rows;
     const CMap eq_columns, keep_columns;
-    
-    HashMap< GVVec, vector<GVVec> > a_hashmap;
-    GVVec key;
-    ExtentSeries b_series;
-    vector<GeneralField::Ptr> b_eq_fields;
-    vector<Extractor::Ptr> extractors;
-    const string output_table_name;
-    
+    const string output_table_name, spill_prefix;
+    int n_threads;
+
+    ExtentType::Ptr a_type, b_type, output_type;
+    vector<string> a_eq_names, b_eq_names, a_val_names;
+    vector<ExtractSpec> extract_specs;
+
+    vector<Table> table; // sharded on shardOf(key)
+    vector<Extent::Ptr> *build_extents;
+    vector< vector<KeyVal> > extracted; // [thread * n_threads + shard] during buildTable
+
+    vector<Builder *> builders; // started by the first buildTable(), kept for the partitions
+    PThreadMutex build_mutex;
+    PThreadCond build_cond;
+    int build_phase;
+    uint32_t build_phases, build_running; // phases started, builders still running the last one
+    bool stop_builders;
+
+    uint32_t spill_count;
+    vector<Task> tasks; // stack of partition pairs still to join
+    Extent::Ptr pending_b; // first b extent, read before we knew how to join
+    bool probe_from_input, probe_exhausted;
+    PartitionFile::Ptr probe_file;
+    uint32_t probe_partition;
+    size_t probe_extent;
+
+    Deque<ProbeJob::Ptr> in_flight; // in b order
+    Deque<Extent::Ptr> ready;
+    bool returned_any;
+
+    vector<Prober *> probers;
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<ProbeJob::Ptr> pending; // waiting for a prober
+    bool stop_probers;
 };
 
 OutputSeriesModule::OSMPtr dataseries::makeHashJoinModule
 (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
  const map<string, string> &eq_columns, const map<string, string> &keep_columns,
- const string &output_table_name) {
+ const string &output_table_name, const string &spill_prefix, int n_threads) {
     return OutputSeriesModule::OSMPtr(new HashJoinModule(a_input, max_a_rows, b_input, eq_columns,
-                                                         keep_columns, output_table_name));
+                                                         keep_columns, output_table_name,
+                                                         spill_prefix, n_threads));
 }
-
@@ -19,10 +19,12 @@ class ProjectModule : public OutputSeriesModule {
         BOOST_FOREACH(const string &c, keep_columns) {
             kc.add(c);
         }
+        map<string, string> copy_columns;
         for (uint32_t i = 0; i < t->getNFields(); ++i) {
             const string &field_name(t->getFieldName(i));
             if (kc.exists(field_name)) {
                 output_xml.append(t->xmlFieldDesc(field_name));
+                copy_columns[field_name] = field_name;
             }
         }
         output_xml.append("</ExtentType>\n");
@@ -31,12 +33,12 @@ class ProjectModule : public OutputSeriesModule {
             
         output_series.setType(output_type);
 
-        copier.prep();
+        copier.prep(copy_columns);
     }
 
     virtual Extent::Ptr getSharedExtent() {
         while (true) {
-            Extent::Ptr in = source.getSharedExtent();
+            Extent::Ptr in = getUpstreamExtent(source);
             if (in == NULL) {
                 return returnOutputSeries();
             }
@@ -48,10 +50,8 @@ class ProjectModule : public OutputSeriesModule {
                 output_series.newExtent();
             }
         
-            for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-                output_series.newRecord();
-                copier.copyRecord();
-            }
+            input_series.setExtent(in);
+            copier.copyRecords(in->nRecords());
             if (output_series.getExtentRef().size() > 96*1024) {
                 return returnOutputSeries();
             }
@@ -61,7 +61,7 @@ class ProjectModule : public OutputSeriesModule {
     DataSeriesModule &source;
     ExtentSeries input_series;
     vector<string> keep_columns;
-    ExtentRecordCopy copier;
+    RenameCopier copier;
 };
 
 OutputSeriesModule::OSMPtr 
@@ -1,5 +1,10 @@
+#include <string.h>
+
+#include <algorithm>
+
 #include "DSSModule.hpp"
 
+
 string dataseries::renameField(const ExtentType::Ptr type, const string &old_name,
                                const string &new_name) {
     string ret(str(format("  <field name=\"%s\"") % new_name));
@@ -20,3 +25,191 @@ string dataseries::renameField(const ExtentType::Ptr type, const string &old_nam
     return ret;
 }
 
+void RenameCopier::prep(const map<string, string> &copy_columns) {
+    SINVARIANT(!copy_columns.empty());
+    this->copy_columns = copy_columns;
+    compile();
+}
+
+// Copies the bit for the bool field from to the one for to; true if they are in the same place
+bool RenameCopier::addBit(const string &from, const string &to) {
+    int32_t from_offset = source_type->getOffset(from), to_offset = dest_type->getOffset(to);
+    int from_bit = source_type->getBitPos(from), to_bit = dest_type->getBitPos(to);
+    bits.push_back(BitCopy(from_offset, 1 << from_bit, to_offset, 1 << to_bit));
+    return from_offset == to_offset && from_bit == to_bit;
+}
+
+void RenameCopier::compile() {
+    SINVARIANT(source.getTypePtr() != NULL && dest.getTypePtr() != NULL);
+    source_type = source.getTypePtr();
+    dest_type = dest.getTypePtr();
+    source_size = source_type->fixedrecordsize();
+    dest_size = dest_type->fixedrecordsize();
+    spans.clear();
+    bits.clear();
+    var_from.clear();
+    dest_vars.clear();
+    source_fields.clear();
+    dest_fields.clear();
+
+    // whole rows only if every field of both types is in the same place in the other
+    whole_rows = source_size == dest_size && copy_columns.size() == dest_type->getNFields()
+        && copy_columns.size() == source_type->getNFields();
+    vector<Span> fixed;
+    vector<BitCopy> var_null_bits;
+    typedef map<string, string>::value_type vt;
+    BOOST_FOREACH(const vt &c, copy_columns) {
+        const string &from(c.first), &to(c.second);
+        ExtentType::fieldType type = source_type->getFieldType(from);
+        bool from_nullable = source_type->getNullable(from);
+        bool to_nullable = dest_type->getNullable(to);
+        if (type != dest_type->getFieldType(to) || (from_nullable && !to_nullable)
+            || (type == ExtentType::ft_fixedwidth
+                && source_type->getSize(from) != dest_type->getSize(to))) {
+            // conversions, or an error if a null turns up, are up to GeneralField
+            source_fields.push_back(GeneralField::make(source, from));
+            dest_fields.push_back(GeneralField::make(dest, to));
+            whole_rows = false;
+            continue;
+        }
+
+        int32_t from_offset = source_type->getOffset(from), to_offset = dest_type->getOffset(to);
+        whole_rows = whole_rows && from_offset == to_offset && from_nullable == to_nullable;
+        if (type == ExtentType::ft_bool) {
+            whole_rows = addBit(from, to) && whole_rows;
+        } else if (type == ExtentType::ft_variable32) {
+            var_from.push_back(from_offset);
+            dest_vars.push_back(Var32Ptr(new Variable32Field(dest, to, Field::flag_nullable)));
+        } else {
+            fixed.push_back(Span(from_offset, to_offset, source_type->getSize(from)));
+        }
+
+        string to_null(ExtentType::nullableFieldname(to));
+        if (from_nullable) {
+            whole_rows = addBit(ExtentType::nullableFieldname(from), to_null) && whole_rows;
+            if (type == ExtentType::ft_variable32) {
+                var_null_bits.push_back(bits.back());
+            }
+        } else if (to_nullable) {
+            bits.push_back(BitCopy(-1, 0, dest_type->getOffset(to_null),
+                                   1 << dest_type->getBitPos(to_null)));
+        }
+    }
+
+    if (whole_rows) {
+        // the rows have the bits, except for the null bits that setting variable32s clears
+        bits.swap(var_null_bits);
+        return;
+    }
+    sort(fixed.begin(), fixed.end());
+    BOOST_FOREACH(const Span &s, fixed) {
+        if (!spans.empty() && spans.back().from + spans.back().size == s.from
+            && spans.back().to + spans.back().size == s.to) {
+            spans.back().size += s.size;
+        } else {
+            spans.push_back(s);
+        }
+    }
+    LintelLogDebug("RenameCopier", format("%d columns: %d spans, %d bits, %d variable32,"
+                                          " %d general") % copy_columns.size() % spans.size()
+                   % bits.size() % dest_vars.size() % dest_fields.size());
+}
+
+void RenameCopier::copyRows(const uint8_t *from, uint8_t *to, uint32_t n) {
+    if (whole_rows) {
+        memcpy(to, from, static_cast<size_t>(n) * dest_size);
+    } else if (!spans.empty()) {
+        const uint8_t *f = from;
+        uint8_t *t = to;
+        for (uint32_t i = 0; i < n; ++i, f += source_size, t += dest_size) {
+            BOOST_FOREACH(const Span &s, spans) {
+                switch (s.size) // common sizes as fixed size copies
+                    {
+                    case 4: memcpy(t + s.to, f + s.from, 4); break;
+                    case 8: memcpy(t + s.to, f + s.from, 8); break;
+                    default: memcpy(t + s.to, f + s.from, s.size); break;
+                    }
+            }
+        }
+    }
+
+    // Variable32 values are appended a column at a time after making room for all of them;
+    // setting them also clears their null bits, so bits are copied after.
+    if (!dest_vars.empty()) {
+        const Extent::ByteArray &from_var(source.getExtentRef().variabledata);
+        Extent &to_extent(dest.getExtentRef());
+        size_t var_bytes = 0;
+        for (size_t v = 0; v < var_from.size(); ++v) {
+            const uint8_t *f = from + var_from[v];
+            for (uint32_t i = 0; i < n; ++i, f += source_size) {
+                int32_t size = *reinterpret_cast<const int32_t *>
+                    (from_var.begin() + *reinterpret_cast<const int32_t *>(f));
+                var_bytes += (4 + size + 7) & ~7; // size, value, padding to 8 bytes
+            }
+        }
+        to_extent.variabledata.reserve(to_extent.variabledata.size() + var_bytes);
+
+        SEP_RowOffset first_row(to - to_extent.fixeddata.begin(), &to_extent);
+        for (size_t v = 0; v < var_from.size(); ++v) {
+            Variable32Field &to_field(*dest_vars[v]);
+            const uint8_t *f = from + var_from[v];
+            for (uint32_t i = 0; i < n; ++i, f += source_size) {
+                // a null value has offset 0 which is an empty value
+                const uint8_t *value = from_var.begin() + *reinterpret_cast<const int32_t *>(f);
+                to_field.set(to_extent, SEP_RowOffset(first_row, i, to_extent), value + 4,
+                             *reinterpret_cast<const int32_t *>(value));
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; ++i, from += source_size, to += dest_size) {
+        BOOST_FOREACH(const BitCopy &b, bits) {
+            if (b.from >= 0 && (from[b.from] & b.from_mask)) {
+                to[b.to] |= b.to_mask;
+            } else {
+                to[b.to] &= ~b.to_mask;
+            }
+        }
+    }
+}
+
+void RenameCopier::copyRecord() {
+    checkPlan();
+    INVARIANT(dest.morerecords(), "you forgot to create the destination record");
+    INVARIANT(source.morerecords(), "you forgot to set the source record");
+    copyRows(static_cast<const uint8_t *>(source.getCurPos()),
+             static_cast<uint8_t *>(const_cast<void *>(dest.getCurPos())), 1);
+    for (size_t i = 0; i < source_fields.size(); ++i) {
+        dest_fields[i]->set(source_fields[i]);
+    }
+}
+
+void RenameCopier::copyRecords(uint32_t n) {
+    if (n == 0) {
+        return;
+    }
+    checkPlan();
+    const Extent &from_extent(source.getExtentRef());
+    const uint8_t *from = static_cast<const uint8_t *>(source.getCurPos());
+    INVARIANT(from + static_cast<size_t>(n) * source_size <= from_extent.fixeddata.end(),
+              format("copying %d rows, past the end of the source extent") % n);
+    dest.newRecord();
+    dest.createRecords(n - 1);
+    uint8_t *to = static_cast<uint8_t *>(const_cast<void *>(dest.getCurPos()));
+    copyRows(from, to, n);
+
+    if (source_fields.empty()) {
+        source.setCurPos(from + static_cast<size_t>(n) * source_size);
+        dest.setCurPos(to + static_cast<size_t>(n - 1) * dest_size);
+    } else {
+        for (uint32_t i = 0; i < n; ++i) {
+            if (i > 0) {
+                ++dest;
+            }
+            for (size_t j = 0; j < source_fields.size(); ++j) {
+                dest_fields[j]->set(source_fields[j]);
+            }
+            ++source;
+        }
+    }
+}
@@ -5,31 +5,67 @@
 
 #include <DataSeries/GeneralField.hpp>
 
+/** Copies columns, possibly renamed, from rows of source to rows of dest.
+
+    prep() compiles the columns into a copy plan for the current types of the two series.  If
+    every field of dest is at the same place as the field it is copied from, rows are copied
+    whole; otherwise fixed columns become memcpy spans, merged where they are adjacent in both
+    types, and bool and null flags are copied bit by bit.  Variable32 values are appended a
+    column at a time.  Columns whose types differ between source and dest, or that are
+    nullable only in the source, go through GeneralField::set.  The plan is remade if either
+    series changes type. */
 class RenameCopier {
   public:
     typedef boost::shared_ptr<RenameCopier> Ptr;
 
     RenameCopier(ExtentSeries &source, ExtentSeries &dest)
-            : source(source), dest(dest) { }
+            : source(source), dest(dest), whole_rows(false) { }
 
-    void prep(const std::map<std::string, std::string> &copy_columns) {
-        typedef std::map<std::string, std::string>::value_type vt;
-        BOOST_FOREACH(const vt &copy_column, copy_columns) {
-            source_fields.push_back(GeneralField::make(source, copy_column.first));
-            dest_fields.push_back(GeneralField::make(dest, copy_column.second));
-        }
-    }
+    /** Copy each source column copy_column.first to the dest column copy_column.second */
+    void prep(const std::map<std::string, std::string> &copy_columns);
+
+    /** Copies the current source row into the current dest row. */
+    void copyRecord();
+
+    /** Copies the n rows starting at the current source row into n new rows at the end of
+        dest; leaves source on the row after the last one copied, and dest on the last new
+        row. */
+    void copyRecords(uint32_t n);
 
-    void copyRecord() {
-        SINVARIANT(!source_fields.empty() && source_fields.size() == dest_fields.size());
-        for (size_t i = 0; i < source_fields.size(); ++i) {
-            dest_fields[i]->set(source_fields[i]);
+    ExtentSeries &source, &dest;
+
+  private:
+    struct Span { // bytes copied from the same place in each row
+        Span(int32_t from, int32_t to, int32_t size) : from(from), to(to), size(size) { }
+        bool operator <(const Span &that) const { return from < that.from; }
+        int32_t from, to, size;
+    };
+    struct BitCopy { // from < 0 ==> clear the to bit
+        BitCopy(int32_t from, uint8_t from_mask, int32_t to, uint8_t to_mask)
+                : from(from), to(to), from_mask(from_mask), to_mask(to_mask) { }
+        int32_t from, to;
+        uint8_t from_mask, to_mask;
+    };
+    typedef boost::shared_ptr<Variable32Field> Var32Ptr;
+
+    void compile();
+    void checkPlan() {
+        if (source.getTypePtr() != source_type || dest.getTypePtr() != dest_type) {
+            compile();
         }
     }
+    void copyRows(const uint8_t *from, uint8_t *to, uint32_t n);
+    bool addBit(const std::string &from, const std::string &to);
 
-    ExtentSeries &source, &dest;
-    std::vector<GeneralField::Ptr> source_fields;
-    std::vector<GeneralField::Ptr> dest_fields;
+    std::map<std::string, std::string> copy_columns;
+    ExtentType::Ptr source_type, dest_type;
+    int32_t source_size, dest_size;
+    bool whole_rows;
+    std::vector<Span> spans;
+    std::vector<BitCopy> bits;
+    std::vector<int32_t> var_from; // offsets in source of the dest_vars
+    std::vector<Var32Ptr> dest_vars;
+    std::vector<GeneralField::Ptr> source_fields, dest_fields; // columns copied one at a time
 };
 
 namespace dataseries {
@@ -12,7 +12,7 @@ class SelectModule : public OutputSeriesModule {
 
     virtual Extent::Ptr getSharedExtent() {
         while (true) {
-            Extent::Ptr in = source.getSharedExtent();
+            Extent::Ptr in = getUpstreamExtent(source);
             if (in == NULL) {
                 return returnOutputSeries();
             }
@@ -20,7 +20,12 @@ class SelectModule : public OutputSeriesModule {
                 input_series.setType(in->getTypePtr());
                 output_series.setType(in->getTypePtr());
 
-                copier.prep();
+                map<string, string> all_columns;
+                for (uint32_t i = 0; i < in->getTypePtr()->getNFields(); ++i) {
+                    const string &name(in->getTypePtr()->getFieldName(i));
+                    all_columns[name] = name;
+                }
+                copier.prep(all_columns);
                 where_expr.reset(DSExpr::make(input_series, where_expr_str));
             }
 
@@ -28,11 +33,21 @@ class SelectModule : public OutputSeriesModule {
                 output_series.newExtent();
             }
         
-            for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-                if (where_expr->valBool()) {
-                    output_series.newRecord();
-                    copier.copyRecord();
+            input_series.setExtent(in);
+            where_expr->selectRows(input_series, selected);
+            // copy runs of selected rows at once
+            for (size_t row = 0; row < selected.size(); ) {
+                if (!selected[row]) {
+                    input_series.next();
+                    ++row;
+                    continue;
+                }
+                size_t end = row + 1;
+                while (end < selected.size() && selected[end]) {
+                    ++end;
                 }
+                copier.copyRecords(end - row);
+                row = end;
             }
             if (output_series.getExtentRef().size() > 96*1024) {
                 return returnOutputSeries();
@@ -43,8 +58,9 @@ class SelectModule : public OutputSeriesModule {
     DataSeriesModule &source;
     string where_expr_str;
     ExtentSeries input_series;
-    ExtentRecordCopy copier;
+    RenameCopier copier;
     boost::shared_ptr<DSExpr> where_expr;
+    vector<bool> selected;
 };
 
 DataSeriesModule::Ptr 
@@ -41,11 +41,15 @@ namespace dataseries {
                                         const std::string &output_path);
     DataSeriesModule::Ptr makeTableDataModule(DataSeriesModule &source_module,
                                               TableData &into, uint32_t max_rows);
+    /** Joins up to max_a_rows of a in memory; bigger a tables are partitioned, along with b,
+        into files named spill_prefix.<n>, and the output of a partitioned join is in partition
+        order rather than b order.  n_threads == -1 ==> one thread per CPU. */
     OutputSeriesModule::OSMPtr makeHashJoinModule
     (DataSeriesModule &a_input, int32_t max_a_rows, DataSeriesModule &b_input,
      const std::map<std::string, std::string> &eq_columns,
      const std::map<std::string, std::string> &keep_columns,
-     const std::string &output_table_name);
+     const std::string &output_table_name, const std::string &spill_prefix = "join-tmp",
+     int n_threads = -1);
 
     OutputSeriesModule::OSMPtr makeStarJoinModule
     (DataSeriesModule &fact_input, const std::vector<Dimension> &dimensions,
@@ -67,8 +71,12 @@ namespace dataseries {
      const std::vector<SortColumn> &order_columns,
      const std::string &output_table_name);
 
+    /** Sort using at most about memory_limit bytes; sorted runs that don't fit are spilled to
+        files named spill_prefix.<n>.  n_threads == -1 ==> one sorting thread per CPU. */
     OutputSeriesModule::OSMPtr makeSortModule
-    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by);
+    (DataSeriesModule &source, const std::vector<SortColumn> &sort_by,
+     size_t memory_limit = 1024*1024*1024, const std::string &spill_prefix = "sort-tmp",
+     int n_threads = -1);
 
     OutputSeriesModule::OSMPtr makeExprTransformModule
     (DataSeriesModule &source, const std::vector<ExprColumn> &expr_columns,
@@ -1,8 +1,17 @@
 #include "DSSModule.hpp"
 
+#include <string.h>
+#include <unistd.h>
+
+#include <limits>
 #include <new> // losertree.h needs this and forgot to include it.
 #include <parallel/losertree.h>
 
+#include <Lintel/Deque.hpp>
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+
 /* Note: there are several versions of sort modules on the tomer sub-branch.  There is an in-memory
    sort, a radix in memory sort, a spilling to disk sort and a parallel sort.  The latter versions
    are somewhat specific to the sorting rules needed for the sort benchmark.  The former is a
@@ -11,6 +20,14 @@
    generate C++ source code for specific operations, we don't need the complication of the
    template, and so we create yet another module to be more in the style of the server */
 
+/* The sort is an external merge sort.  Extents are gathered into runs of about
+   memory_limit / (n_threads + 1) bytes, and worker threads sort the rows of each run.  Sorted runs
+   stay in memory while they fit in memory_limit; once they don't, the oldest runs are written out
+   to temporary DataSeries files.  All of the runs, in memory or spilled, are then merged with a
+   loser tree, going through intermediate merge passes if there are more than max_merge_runs of
+   them.  Each row carries a normalized 64 bit prefix of its first sort column, so that most
+   comparisons are a single integer compare rather than a GeneralValue comparison per column. */
+
 #if 0
 #include <algorithm>
 #include <vector>
@@ -46,25 +63,34 @@ int main() {
 
 class SortModule : public OutputSeriesModule {
   public:
-    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by)
-            : source(source), sort_by(sort_by), copier(input_series, output_series), ercs(),
-              sorted_extents(), merge()
-    { }
-
-    virtual ~SortModule() { }
+    static const size_t max_merge_runs = 64;
+    static const size_t output_extent_size = 96*1024;
+
+    SortModule(DataSeriesModule &source, const vector<SortColumn> &sort_by,
+               size_t memory_limit, const string &spill_prefix, int n_threads)
+            : source(source), sort_by(sort_by), memory_limit(memory_limit),
+              spill_prefix(spill_prefix), n_threads(n_threads), run_bytes(0),
+              copier(input_series, output_series), columns(), key(), runs(), merge(),
+              sorters(), pending(), first_kept(0), kept_bytes(0), resident_bytes(0),
+              spill_count(0), no_more_runs(false), finished(false)
+    {
+        if (this->n_threads == -1) {
+            this->n_threads = min(PThreadMisc::getNCpus(), MAX_THREADS);
+        }
+        INVARIANT(this->n_threads > 0, "need at least one thread");
+        run_bytes = max(memory_limit / (this->n_threads + 1), static_cast<size_t>(1));
+    }
 
-    struct ExtentRowCompareState {
-        ExtentRowCompareState() : extent(), columns() { }
-        Extent::Ptr extent;
-        vector<SortColumnImpl> columns;
-    };
+    virtual ~SortModule() {
+        stopSorters();
+    }
 
-    static bool strictlyLessThan(const Extent::Ptr &ea, const SEP_RowOffset &oa,
-                                 const Extent::Ptr &eb, const SEP_RowOffset &ob,
+    static bool strictlyLessThan(const Extent &ea, const SEP_RowOffset &oa,
+                                 const Extent &eb, const SEP_RowOffset &ob,
                                  const vector<SortColumnImpl> &columns) {
         BOOST_FOREACH(const SortColumnImpl &c, columns) {
-            bool a_null = c.field->isNull(*ea, oa);
-            bool b_null = c.field->isNull(*eb, ob);
+            bool a_null = c.field->isNull(ea, oa);
+            bool b_null = c.field->isNull(eb, ob);
 
             if (a_null || b_null) {
                 if (a_null && !b_null) { //         a < b : a > b
@@ -75,8 +101,8 @@ class SortModule : public OutputSeriesModule {
                     // ==; keep going
                 }
             } else {
-                GeneralValue va(c.field->val(*ea, oa));
-                GeneralValue vb(c.field->val(*eb, ob));
+                GeneralValue va(c.field->val(ea, oa));
+                GeneralValue vb(c.field->val(eb, ob));
                 if (va < vb) {
                     return c.sort_less;
                 } else if (vb < va) {
@@ -89,44 +115,321 @@ class SortModule : public OutputSeriesModule {
         return false; // all == so not <
     }
 
-    class ExtentRowCompare {
+    /** Normalized prefix of the first sort column.  Prefixes are ordered so that prefix(a) <
+        prefix(b) implies a sorts before b; rows with equal prefixes need the full comparison.
+        Only reads the field, so the sorting threads can share one. */
+    class KeyPrefix {
       public:
-        ExtentRowCompare(ExtentRowCompareState *state) : state(state) { }
-        ExtentRowCompare(const ExtentRowCompare &from) : state(from.state) { }
-        ExtentRowCompare &operator =(const ExtentRowCompare &rhs) {
-            state = rhs.state;
-            return *this;
+        KeyPrefix() : field(NULL), sort_less(true), null_mode(NM_First) { }
+        KeyPrefix(const SortColumnImpl &column)
+            : field(column.field.get()), sort_less(column.sort_less),
+              null_mode(column.null_mode) { }
+
+        uint64_t operator ()(const Extent &e, const SEP_RowOffset &offset) const {
+            if (field->isNull(e, offset)) {
+                return null_mode == NM_First ? 0 : numeric_limits<uint64_t>::max();
+            }
+            uint64_t ret = normalized(e, offset);
+            return sort_less ? ret : ~ret;
         }
 
-        bool operator ()(const SEP_RowOffset &a, const SEP_RowOffset &b) const {
-            return strictlyLessThan(state->extent, a, state->extent, b, state->columns);
+      private:
+        uint64_t normalized(const Extent &e, const SEP_RowOffset &offset) const {
+            static const uint64_t sign_bit = static_cast<uint64_t>(1) << 63;
+            switch (field->getType())
+                {
+                case ExtentType::ft_bool:
+                    return static_cast<const GF_Bool *>(field)->myfield.val(e, offset) ? 1 : 0;
+                case ExtentType::ft_byte:
+                    return static_cast<const GF_Byte *>(field)->myfield.val(e, offset);
+                case ExtentType::ft_int32: {
+                    int64_t v = static_cast<const GF_Int32 *>(field)->myfield.val(e, offset);
+                    return static_cast<uint64_t>(v) ^ sign_bit;
+                }
+                case ExtentType::ft_int64: {
+                    int64_t v = static_cast<const GF_Int64 *>(field)->myfield.val(e, offset);
+                    return static_cast<uint64_t>(v) ^ sign_bit;
+                }
+                case ExtentType::ft_double: {
+                    double v = static_cast<const GF_Double *>(field)->myfield.val(e, offset);
+                    if (v == 0) {
+                        v = 0; // -0.0 == 0.0
+                    }
+                    uint64_t bits;
+                    memcpy(&bits, &v, sizeof(bits));
+                    return (bits & sign_bit) ? ~bits : bits | sign_bit;
+                }
+                case ExtentType::ft_variable32: {
+                    const Variable32Field &f(static_cast<const GF_Variable32 *>(field)->myfield);
+                    return bytesPrefix(f.val(e, offset), f.size(e, offset));
+                }
+                case ExtentType::ft_fixedwidth: {
+                    const GF_FixedWidth *f = static_cast<const GF_FixedWidth *>(field);
+                    return bytesPrefix(f->myfield.val(e, offset), f->size());
+                }
+                default:
+                    FATAL_ERROR("internal error, unexpected type");
+                    return 0;
+                }
         }
 
-        const ExtentRowCompareState *state;
+        // strings compare as unsigned bytes, so the first 8 bytes big-endian, padded with 0
+        static uint64_t bytesPrefix(const uint8_t *bytes, int32_t size) {
+            uint64_t ret = 0;
+            for (int32_t i = 0; i < 8; ++i) {
+                ret = (ret << 8) | (i < size ? bytes[i] : 0);
+            }
+            return ret;
+        }
+
+        const GeneralField *field;
+        bool sort_less;
+        NullMode null_mode;
     };
-        
-    struct SortedExtent {
-        SortedExtent(Extent::Ptr e) : e(e), offsets(), pos() { }
-        typedef boost::shared_ptr<SortedExtent> Ptr;
-
-        Extent::Ptr e;
-        vector<SEP_RowOffset> offsets;
-        vector<SEP_RowOffset>::iterator pos;
+
+    bool lessThan(uint64_t prefix_a, const Extent &ea, const SEP_RowOffset &oa,
+                  uint64_t prefix_b, const Extent &eb, const SEP_RowOffset &ob) const {
+        if (prefix_a != prefix_b) {
+            return prefix_a < prefix_b;
+        } else {
+            return strictlyLessThan(ea, oa, eb, ob, columns);
+        }
+    }
+
+    struct RowRef {
+        RowRef(uint64_t prefix, uint32_t extent, const SEP_RowOffset &offset)
+            : prefix(prefix), extent(extent), offset(offset) { }
+
+        uint64_t prefix;
+        uint32_t extent; // index into Run::extents
+        SEP_RowOffset offset;
     };
-    
+
+    /** A sorted run of rows, held in memory or spilled to a temporary file, with a cursor over
+        the rows for the merge. */
+    struct Run {
+        typedef boost::shared_ptr<Run> Ptr;
+
+        Run() : bytes(0), spill(false), busy(false), extents(), rows(), path(), file(),
+                file_extent(), file_series(), pos(0), cur_extent(NULL),
+                cur_offset(0, cur_extent), cur_prefix(0) { }
+
+        ~Run() {
+            closeFile();
+        }
+
+        /// position the cursor on the first row
+        void start(const ExtentType::Ptr &type, const KeyPrefix &key) {
+            if (path.empty()) {
+                pos = 0;
+                setRow();
+            } else {
+                file.reset(new DataSeriesSource(path));
+                file_series.setType(type);
+                nextFileExtent(key);
+            }
+        }
+
+        void next(const KeyPrefix &key) {
+            if (file == NULL) {
+                ++pos;
+                setRow();
+            } else {
+                file_series.next();
+                if (file_series.more()) {
+                    setFileRow(key);
+                } else {
+                    nextFileExtent(key);
+                }
+            }
+        }
+
+        bool done() const {
+            return cur_extent == NULL;
+        }
+
+        void release() {
+            vector<Extent::Ptr>().swap(extents);
+            vector<RowRef>().swap(rows);
+        }
+
+        void closeFile() {
+            file.reset();
+            if (!path.empty()) {
+                unlink(path.c_str()); // ignore errors
+                path.clear();
+            }
+        }
+
+        size_t bytes;
+        bool spill, busy; // under SortModule::mutex once the run is queued
+
+        vector<Extent::Ptr> extents;
+        vector<RowRef> rows;
+
+        string path; // non-empty once spilled
+        scoped_ptr<DataSeriesSource> file;
+        Extent::Ptr file_extent;
+        ExtentSeries file_series;
+
+        size_t pos;
+        const Extent *cur_extent; // NULL once the run is done
+        SEP_RowOffset cur_offset;
+        uint64_t cur_prefix;
+
+      private:
+        void setRow() {
+            if (pos == rows.size()) {
+                cur_extent = NULL;
+                release();
+            } else {
+                const RowRef &r(rows[pos]);
+                cur_extent = extents[r.extent].get();
+                cur_offset = r.offset;
+                cur_prefix = r.prefix;
+            }
+        }
+
+        void nextFileExtent(const KeyPrefix &key) {
+            while (true) {
+                file_extent.reset(file->readExtent());
+                if (file_extent == NULL) {
+                    file_series.clearExtent();
+                    cur_extent = NULL;
+                    closeFile();
+                    return;
+                }
+                // skip the index extent
+                if (file_extent->getTypePtr() == file_series.getTypePtr()
+                    && file_extent->nRecords() > 0) {
+                    break;
+                }
+            }
+            file_series.setExtent(file_extent);
+            setFileRow(key);
+        }
+
+        void setFileRow(const KeyPrefix &key) {
+            cur_extent = file_extent.get();
+            cur_offset = file_series.getRowOffset();
+            cur_prefix = key(*cur_extent, cur_offset);
+        }
+    };
+
+    // See the #if 0 code above for why the state is held by pointer
+    class RowRefCompare {
+      public:
+        RowRefCompare(const SortModule &sm, const Run &run) : sm(&sm), run(&run) { }
+
+        bool operator ()(const RowRef &a, const RowRef &b) const {
+            return sm->lessThan(a.prefix, *run->extents[a.extent], a.offset,
+                                b.prefix, *run->extents[b.extent], b.offset);
+        }
+
+        const SortModule *sm;
+        const Run *run;
+    };
+
     struct LoserTreeCompare {
-        LoserTreeCompare(SortModule *sm) : sm(sm) { }
+        LoserTreeCompare(const SortModule &sm, const vector<Run::Ptr> &runs)
+            : sm(&sm), runs(&runs) { }
+
         bool operator()(uint32_t ia, uint32_t ib) const {
-            const SortedExtent &sea(*sm->sorted_extents[ia]);
-            const SortedExtent &seb(*sm->sorted_extents[ib]);
-            return strictlyLessThan(sea.e, *sea.pos, seb.e, *seb.pos, sm->ercs.columns);
+            const Run &a(*(*runs)[ia]), &b(*(*runs)[ib]);
+            return sm->lessThan(a.cur_prefix, *a.cur_extent, a.cur_offset,
+                                b.cur_prefix, *b.cur_extent, b.cur_offset);
         }
 
         const SortModule *sm;
-    };        
+        const vector<Run::Ptr> *runs;
+    };
 
     typedef __gnu_parallel::LoserTree<true, uint32_t, LoserTreeCompare> LoserTree;
 
+    /** Merges started runs; ties go to the earlier run, so the merge is stable if the runs are
+        in input order. */
+    class Merger {
+      public:
+        Merger(const SortModule &sm, const vector<Run::Ptr> &runs) : runs(runs), tree() {
+            SINVARIANT(!runs.empty());
+            // loser tree gets the single run case wrong, and goes into an infinite loop
+            // (log_2(0) is a bad idea with a check 0 * 2^n > 0.
+            if (runs.size() > 1) {
+                tree.reset(new LoserTree(runs.size(), LoserTreeCompare(sm, this->runs)));
+                for (uint32_t i = 0; i < runs.size(); ++i) {
+                    tree->insert_start(i, i, runs[i]->done());
+                }
+                tree->init();
+            }
+        }
+
+        /// index of the run with the smallest row, -1 once all the runs are done
+        int32_t min() {
+            int32_t ret = 0;
+            if (tree != NULL) {
+                ret = tree->get_min_source();
+                if (ret < 0 || static_cast<size_t>(ret) >= runs.size()) {
+                    return -1; // loser tree exit path 1
+                }
+            }
+            return runs[ret]->done() ? -1 : ret; // loser tree exit path 2
+        }
+
+        /// move past the current row of run i, which has to be min()
+        void pop(int32_t i, const KeyPrefix &key) {
+            runs[i]->next(key);
+            if (tree != NULL) {
+                tree->delete_min_insert(i, runs[i]->done());
+            }
+        }
+
+        vector<Run::Ptr> runs;
+        scoped_ptr<LoserTree> tree;
+    };
+
+    /** Writes rows, in order, to a temporary DataSeries file */
+    class SpillWriter {
+      public:
+        SpillWriter(const string &path, const ExtentType::Ptr &type)
+            : input_series(type), output_series(type),
+              sink(path, Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1),
+              output(sink, output_series, type, output_extent_size),
+              copier(input_series, output_series)
+        {
+            ExtentTypeLibrary library;
+            library.registerType(type);
+            sink.writeExtentLibrary(library);
+            copier.prep();
+        }
+
+        void write(const Extent &e, const SEP_RowOffset &offset) {
+            output.newRecord();
+            copier.copyRecord(e, offset);
+        }
+
+        void close() {
+            output.close();
+            sink.close();
+        }
+
+        ExtentSeries input_series, output_series;
+        DataSeriesSink sink;
+        OutputModule output;
+        ExtentRecordCopy copier;
+    };
+
+    class RunSorter : public PThread {
+      public:
+        RunSorter(SortModule &sm) : sm(sm) { }
+
+        virtual void *run() {
+            sm.sortRuns();
+            return NULL;
+        }
+
+        SortModule &sm;
+    };
+
     void firstExtent(Extent &in) {
         const ExtentType::Ptr t(in.getTypePtr());
         input_series.setType(t);
@@ -137,116 +440,267 @@ class SortModule : public OutputSeriesModule {
         BOOST_FOREACH(SortColumn &by, sort_by) {
             TINVARIANT(by.sort_mode == SM_Ascending || by.sort_mode == SM_Decending);
             TINVARIANT(by.null_mode == NM_First || by.null_mode == NM_Last);
-            ercs.columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
-                                                  by.sort_mode == SM_Ascending ? true : false,
-                                                  by.null_mode));
+            columns.push_back(SortColumnImpl(GeneralField::make(input_series, by.column),
+                                             by.sort_mode == SM_Ascending ? true : false,
+                                             by.null_mode));
         }
+        TINVARIANT(!columns.empty());
+        key = KeyPrefix(columns[0]);
+    }
+
+    string spillPath() {
+        PThreadScopedLock lock(mutex);
+        return str(format("%s.%d") % spill_prefix % spill_count++);
     }
 
-    void sortExtent(Extent::Ptr in) {
-        ercs.extent = in;
-        SortedExtent::Ptr se(new SortedExtent(in));
-        se->offsets.reserve(in->nRecords());
-        for (input_series.setExtent(in); input_series.more(); input_series.next()) {
-            se->offsets.push_back(input_series.getRowOffset());
+    void sortRun(Run &run) {
+        size_t nrows = 0;
+        BOOST_FOREACH(Extent::Ptr &e, run.extents) {
+            nrows += e->nRecords();
         }
+        run.rows.reserve(nrows);
+        ExtentSeries series;
+        for (uint32_t i = 0; i < run.extents.size(); ++i) {
+            const Extent &e(*run.extents[i]);
+            for (series.setExtent(run.extents[i]); series.more(); series.next()) {
+                SEP_RowOffset offset(series.getRowOffset());
+                run.rows.push_back(RowRef(key(e, offset), i, offset));
+            }
+        }
+        series.clearExtent();
 
-        stable_sort(se->offsets.begin(), se->offsets.end(), ExtentRowCompare(&ercs));
+        stable_sort(run.rows.begin(), run.rows.end(), RowRefCompare(*this, run));
+    }
 
-        ercs.extent.reset();
-        sorted_extents.push_back(se);
+    void spillRun(Run &run) {
+        string path(spillPath());
+        LintelLogDebug("SortModule", format("spilling %d rows to %s") % run.rows.size() % path);
+        run.path = path;
+        SpillWriter writer(path, input_series.getTypePtr());
+        BOOST_FOREACH(const RowRef &r, run.rows) {
+            writer.write(*run.extents[r.extent], r.offset);
+        }
+        writer.close();
+        run.release();
     }
 
-    Extent::Ptr processSingleMerge() {
-        output_series.newExtent();
-        // loser tree gets this case wrong, and goes into an infinite loop (log_2(0) is a bad
-        // idea with a check 0 * 2^n > 0.
-        SortedExtent &se(*sorted_extents[0]);
-        for (se.pos = se.offsets.begin(); se.pos != se.offsets.end(); ++se.pos) {
-            output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
+    /// body of the RunSorter threads; sorts queued runs, and spills the ones marked to spill
+    void sortRuns() {
+        while (true) {
+            Run::Ptr run;
+            {
+                PThreadScopedLock lock(mutex);
+                while (pending.empty() && !no_more_runs) {
+                    cond.wait(mutex);
+                }
+                if (pending.empty()) {
+                    return;
+                }
+                run = pending.front();
+                pending.pop_front();
+            }
+            if (run->rows.empty()) { // runs are never empty, so this is the first time through
+                sortRun(*run);
+            }
+            bool spill;
+            {
+                PThreadScopedLock lock(mutex);
+                spill = run->spill;
+                if (!spill) {
+                    run->busy = false;
+                }
+            }
+            if (spill) {
+                spillRun(*run);
+                PThreadScopedLock lock(mutex);
+                resident_bytes -= run->bytes;
+                run->busy = false;
+                cond.broadcast();
+            }
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
     }
 
-    Extent::Ptr cleanupMultiMerge() {
-        BOOST_FOREACH(SortedExtent::Ptr p, sorted_extents) {
-            SINVARIANT(p->pos == p->offsets.end());
+    void startSorters() {
+        SINVARIANT(sorters.empty());
+        for (int i = 0; i < n_threads; ++i) {
+            sorters.push_back(new RunSorter(*this));
+            sorters.back()->start();
         }
-        sorted_extents.clear();
-        return returnOutputSeries();
     }
 
-    Extent::Ptr processMerge() {
-        LintelLogDebug("SortModule", "doing multi-extent-merge");
-        output_series.newExtent();
-        while (true) {
-            int min = merge->get_min_source();
-            if (min < 0 || static_cast<size_t>(min) >= sorted_extents.size()) {
-                // loser tree exit path 1
-                return cleanupMultiMerge();
-            }
-            SortedExtent &se(*sorted_extents[min]);
-            if (se.pos == se.offsets.end()) {
-                // loser tree exit path 2
-                return cleanupMultiMerge();
+    void stopSorters() {
+        {
+            PThreadScopedLock lock(mutex);
+            no_more_runs = true;
+            cond.broadcast();
+        }
+        BOOST_FOREACH(RunSorter *sorter, sorters) {
+            sorter->join();
+            delete sorter;
+        }
+        sorters.clear();
+    }
+
+    /** Marks the oldest kept runs for spilling until there is room in memory for another run,
+        and then waits for the spills to free up that room */
+    void makeRoom() {
+        PThreadScopedLock lock(mutex);
+        for (; first_kept < runs.size() && kept_bytes + run_bytes > memory_limit; ++first_kept) {
+            Run::Ptr &run(runs[first_kept]);
+            SINVARIANT(!run->spill);
+            run->spill = true;
+            kept_bytes -= run->bytes;
+            if (!run->busy) { // already sorted; only needs the spill
+                run->busy = true;
+                pending.push_back(run);
+                cond.broadcast();
             }
+        }
+        while (resident_bytes > kept_bytes && resident_bytes + run_bytes > memory_limit) {
+            cond.wait(mutex);
+        }
+    }
 
-            output_series.newRecord();
-            copier.copyRecord(*se.e, *se.pos);
-            ++se.pos;
-            merge->delete_min_insert(min, se.pos == se.offsets.end());
-            if (output_series.getExtentRef().size() > 96*1024) {
+    void queueRun(const Run::Ptr &run) {
+        PThreadScopedLock lock(mutex);
+        run->busy = true;
+        runs.push_back(run);
+        pending.push_back(run);
+        kept_bytes += run->bytes;
+        resident_bytes += run->bytes;
+        cond.broadcast();
+    }
+
+    /// read all of the input into sorted runs; returns false if there are no rows
+    bool makeRuns() {
+        Run::Ptr filling;
+        while (true) {
+            Extent::Ptr in = getUpstreamExtent(source);
+            if (in == NULL) {
                 break;
             }
+            if (input_series.getTypePtr() == NULL) {
+                firstExtent(*in);
+                startSorters();
+            }
+            if (in->nRecords() == 0) {
+                continue;
+            }
+            if (filling == NULL) {
+                makeRoom();
+                filling.reset(new Run());
+            }
+            filling->extents.push_back(in);
+            filling->bytes += in->size() + in->nRecords() * sizeof(RowRef);
+            if (filling->bytes >= run_bytes) {
+                queueRun(filling);
+                filling.reset();
+            }
         }
-        return returnOutputSeries();
+        if (filling != NULL) {
+            queueRun(filling);
+        }
+        stopSorters();
+        LintelLogDebug("SortModule", format("%d runs, %d spilled") % runs.size() % first_kept);
+        return !runs.empty();
     }
 
-    virtual Extent::Ptr getSharedExtent() {
-        if (sorted_extents.empty()) {
-            while (true) {
-                Extent::Ptr in = source.getSharedExtent();
-                if (in == NULL) {
-                    break;
+    /// merge groups of max_merge_runs runs into spilled runs until one merge can do the rest
+    void reduceRuns() {
+        while (runs.size() > max_merge_runs) {
+            LintelLogDebug("SortModule", format("intermediate merge of %d runs") % runs.size());
+            vector<Run::Ptr> reduced;
+            for (size_t first = 0; first < runs.size(); first += max_merge_runs) {
+                vector<Run::Ptr> group(runs.begin() + first,
+                                       runs.begin() + min(first + max_merge_runs, runs.size()));
+                if (group.size() == 1) {
+                    reduced.push_back(group[0]);
+                    continue;
                 }
-                if (input_series.getTypePtr() == NULL) {
-                    firstExtent(*in);
+                BOOST_FOREACH(Run::Ptr &run, group) {
+                    run->start(input_series.getTypePtr(), key);
                 }
-                
-                sortExtent(in);
+                Run::Ptr merged(new Run());
+                merged->path = spillPath();
+                SpillWriter writer(merged->path, input_series.getTypePtr());
+                Merger group_merge(*this, group);
+                for (int32_t i = group_merge.min(); i >= 0; i = group_merge.min()) {
+                    writer.write(*group[i]->cur_extent, group[i]->cur_offset);
+                    group_merge.pop(i, key);
+                }
+                writer.close();
+                reduced.push_back(merged);
             }
+            runs.swap(reduced);
+        }
+    }
 
-            if (sorted_extents.empty()) {
-                return Extent::Ptr();
-            } else if (sorted_extents.size() == 1) {
-                return processSingleMerge();
-            } else {
-                merge = new LoserTree(sorted_extents.size(), LoserTreeCompare(this));
-
-                for (uint32_t i = 0; i < sorted_extents.size(); ++i) {
-                    merge->insert_start(i, i, false);
-                    sorted_extents[i]->pos = sorted_extents[i]->offsets.begin();
-                }
-                merge->init();
+    Extent::Ptr processMerge() {
+        output_series.newExtent();
+        for (int32_t i = merge->min(); i >= 0; i = merge->min()) {
+            const Run &run(*runs[i]);
+            output_series.newRecord();
+            copier.copyRecord(*run.cur_extent, run.cur_offset);
+            merge->pop(i, key);
+            if (output_series.getExtentRef().size() > output_extent_size) {
+                return returnOutputSeries();
             }
-        } 
+        }
+        merge.reset();
+        runs.clear();
+        finished = true;
+        if (output_series.getExtentRef().nRecords() == 0) {
+            output_series.clearExtent();
+            return Extent::Ptr();
+        }
+        return returnOutputSeries();
+    }
 
+    virtual Extent::Ptr getSharedExtent() {
+        if (finished) {
+            return Extent::Ptr();
+        }
+        if (merge == NULL) {
+            if (!makeRuns()) {
+                finished = true;
+                return Extent::Ptr();
+            }
+            reduceRuns();
+            BOOST_FOREACH(Run::Ptr &run, runs) {
+                run->start(input_series.getTypePtr(), key);
+            }
+            merge.reset(new Merger(*this, runs));
+        }
         return processMerge();
     }
-        
+
     DataSeriesModule &source;
     vector<SortColumn> sort_by;
+    size_t memory_limit;
+    string spill_prefix;
+    int n_threads;
+    size_t run_bytes;
     ExtentSeries input_series;
     ExtentRecordCopy copier;
-    ExtentRowCompareState ercs;
-    vector<SortedExtent::Ptr> sorted_extents;
-    LoserTree *merge;
+    vector<SortColumnImpl> columns;
+    KeyPrefix key;
+    vector<Run::Ptr> runs; // in input order
+    scoped_ptr<Merger> merge;
+    vector<RunSorter *> sorters;
+
+    PThreadMutex mutex;
+    PThreadCond cond;
+    Deque<Run::Ptr> pending; // runs waiting for a sorter
+    size_t first_kept; // runs before this one are spilled or being spilled
+    size_t kept_bytes; // bytes in the runs that will stay in memory
+    size_t resident_bytes; // bytes in the runs that haven't been spilled yet
+    uint32_t spill_count;
+    bool no_more_runs, finished;
 };
 
 OutputSeriesModule::OSMPtr dataseries::makeSortModule
-(DataSeriesModule &source, const vector<SortColumn> &sort_by) {
-    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by));
+(DataSeriesModule &source, const vector<SortColumn> &sort_by, size_t memory_limit,
+ const string &spill_prefix, int n_threads) {
+    return OutputSeriesModule::OSMPtr(new SortModule(source, sort_by, memory_limit,
+                                                     spill_prefix, n_threads));
 }
-
@@ -86,10 +86,10 @@ class SortedUpdateModule : public OutputSeriesModule, public ThrowError {
     void processMergeExtents() {
         while (true) {
             if (!base_series.hasExtent()) {
-                base_series.setExtent(base_input.getSharedExtent());
+                base_series.setExtent(getUpstreamExtent(base_input));
             }
             if (!update_series.hasExtent()) {
-                update_series.setExtent(update_input.getSharedExtent());
+                update_series.setExtent(getUpstreamExtent(update_input));
             }
 
             if (!base_series.hasExtent() || !update_series.hasExtent()) {
@@ -135,11 +135,11 @@ class SortedUpdateModule : public OutputSeriesModule, public ThrowError {
     }
 
     void processBaseExtents() {
-        SINVARIANT(update_input.getSharedExtent() == NULL);
+        SINVARIANT(getUpstreamExtent(update_input) == NULL);
         LintelLogDebug("SortedUpdate", "process base only...");
         while (true) {
             if (!base_series.hasExtent()) {
-                base_series.setExtent(base_input.getSharedExtent());
+                base_series.setExtent(getUpstreamExtent(base_input));
             }
 
             if (!base_series.hasExtent()) {
@@ -163,11 +163,11 @@ class SortedUpdateModule : public OutputSeriesModule, public ThrowError {
     }
 
     void processUpdateExtents() {
-        SINVARIANT(base_input.getSharedExtent() == NULL);
+        SINVARIANT(getUpstreamExtent(base_input) == NULL);
         LintelLogDebug("SortedUpdate", "process update only...");
         while (true) {
             if (!update_series.hasExtent()) {
-                update_series.setExtent(update_input.getSharedExtent());
+                update_series.setExtent(getUpstreamExtent(update_input));
             }
 
             if (!update_series.hasExtent()) {
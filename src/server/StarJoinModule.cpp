@@ -195,7 +195,7 @@ class StarJoinModule : public JoinModule {
     }
 
     virtual Extent::Ptr getSharedExtent() {
-        Extent::Ptr e(fact_input.getSharedExtent());
+        Extent::Ptr e(getUpstreamExtent(fact_input));
         if (e == NULL) {
             return e;
         }
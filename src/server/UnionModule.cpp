@@ -1,60 +1,139 @@
+#include <string.h>
+
 #include <Lintel/PriorityQueue.hpp>
 
 #include "DSSModule.hpp"
 
+/* The union is a merge of sorted inputs.  Rather than moving one row at a time through the
+   priority queue, the best source's run of rows that sort before the head of the next best source
+   is found by galloping forward through its current extent, and the whole run is copied at once.
+   When the inputs are mostly disjoint, e.g. time-partitioned trace tables, almost all of the rows
+   are moved in long runs.  The order columns have the same type in every source, so the key
+   comparison is picked once per column from the field type rather than going through
+   GeneralValue. */
+
 class UnionModule : public OutputSeriesModule {
   public:
-    struct Compare {
-        Compare(const vector<UM_UnionTable> &sources) : sources(sources) { }
-        // Below has almost the same logic as sorting, but not quite.
-        // 1) comparison order is reversed (that's the priority queue rules)
-        // 2) sort has identical extent types and uses random offsets
-        //    union has different extent types but uses sequential access
-        // Seems like there should be some way to have this code once, but the
-        // above two differences make that goal difficult.
-        bool operator()(uint32_t ia, uint32_t ib) {
+    static const size_t output_extent_size = 96*1024;
+
+    /// < 0, 0, > 0 as the non-null value in a is <, ==, > the one in b
+    typedef int (*ValueCompare)(const GeneralField &a, const Extent &ea, const SEP_RowOffset &oa,
+                                const GeneralField &b, const Extent &eb, const SEP_RowOffset &ob);
+
+    template<typename GF>
+    static int compareValues(const GeneralField &a, const Extent &ea, const SEP_RowOffset &oa,
+                             const GeneralField &b, const Extent &eb, const SEP_RowOffset &ob) {
+        const GF &fa(static_cast<const GF &>(a)), &fb(static_cast<const GF &>(b));
+        if (fa.myfield.val(ea, oa) < fb.myfield.val(eb, ob)) {
+            return -1;
+        } else if (fb.myfield.val(eb, ob) < fa.myfield.val(ea, oa)) {
+            return 1;
+        } else {
+            return 0;
+        }
+    }
+
+    // strings compare as unsigned bytes, shorter first if one is a prefix of the other
+    static int compareBytes(const uint8_t *a, int32_t a_size, const uint8_t *b, int32_t b_size) {
+        int ret = memcmp(a, b, min(a_size, b_size));
+        return ret != 0 ? ret : a_size - b_size;
+    }
+
+    static int compareVariable32(const GeneralField &a, const Extent &ea, const SEP_RowOffset &oa,
+                                 const GeneralField &b, const Extent &eb,
+                                 const SEP_RowOffset &ob) {
+        const Variable32Field &fa(static_cast<const GF_Variable32 &>(a).myfield);
+        const Variable32Field &fb(static_cast<const GF_Variable32 &>(b).myfield);
+        return compareBytes(fa.val(ea, oa), fa.size(ea, oa), fb.val(eb, ob), fb.size(eb, ob));
+    }
+
+    static int compareFixedWidth(const GeneralField &a, const Extent &ea, const SEP_RowOffset &oa,
+                                 const GeneralField &b, const Extent &eb,
+                                 const SEP_RowOffset &ob) {
+        const GF_FixedWidth &fa(static_cast<const GF_FixedWidth &>(a));
+        const GF_FixedWidth &fb(static_cast<const GF_FixedWidth &>(b));
+        return compareBytes(fa.myfield.val(ea, oa), fa.size(), fb.myfield.val(eb, ob), fb.size());
+    }
+
+    static ValueCompare valueCompare(ExtentType::fieldType type) {
+        switch (type)
+            {
+            case ExtentType::ft_bool: return &compareValues<GF_Bool>;
+            case ExtentType::ft_byte: return &compareValues<GF_Byte>;
+            case ExtentType::ft_int32: return &compareValues<GF_Int32>;
+            case ExtentType::ft_int64: return &compareValues<GF_Int64>;
+            case ExtentType::ft_double: return &compareValues<GF_Double>;
+            case ExtentType::ft_variable32: return &compareVariable32;
+            case ExtentType::ft_fixedwidth: return &compareFixedWidth;
+            default:
+                FATAL_ERROR("internal error, unexpected type");
+                return NULL;
+            }
+    }
+
+    /// The order of rows in the output
+    class RowOrder {
+      public:
+        RowOrder(const vector<UM_UnionTable> &sources) : sources(sources), compares() { }
+
+        /// true iff row oa of source ia goes before row ob of source ib
+        bool before(uint32_t ia, const SEP_RowOffset &oa, uint32_t ib,
+                    const SEP_RowOffset &ob) const {
             const UM_UnionTable &a(sources[ia]);
             const UM_UnionTable &b(sources[ib]);
-            SINVARIANT(a.series.hasExtent());
-            SINVARIANT(b.series.hasExtent());
-            SINVARIANT(a.order_fields.size() == b.order_fields.size());
-            for (size_t i = 0; i < a.order_fields.size(); ++i)  {
+            const Extent &ea(a.series.getExtentRef()), &eb(b.series.getExtentRef());
+            DEBUG_SINVARIANT(a.order_fields.size() == compares.size()
+                             && b.order_fields.size() == compares.size());
+            for (size_t i = 0; i < compares.size(); ++i) {
                 const SortColumnImpl &sc_a(a.order_fields[i]), &sc_b(b.order_fields[i]);
-                
-                DEBUG_SINVARIANT(sc_a.sort_less == sc_b.sort_less);
-                DEBUG_SINVARIANT(sc_a.null_mode == sc_b.null_mode);
 
-                bool a_null = sc_a.field->isNull();
-                bool b_null = sc_b.field->isNull();
+                bool a_null = sc_a.field->isNull(ea, oa);
+                bool b_null = sc_b.field->isNull(eb, ob);
                 if (a_null || b_null) {
-                    if (a_null && !b_null) { 
-                        return sc_a.null_mode == NM_First ? false : true;
-                    } else if (!a_null && b_null) { 
-                        return sc_a.null_mode == NM_First ? true : false;
+                    if (a_null && !b_null) {
+                        return sc_a.null_mode == NM_First;
+                    } else if (!a_null && b_null) {
+                        return sc_a.null_mode != NM_First;
                     } else {
                         // ==; keep going
                     }
-                } else {                    
-                    if (*a.order_fields[i].field < *b.order_fields[i].field) {
-                        return sc_a.sort_less;
-                    } else if (*b.order_fields[i].field < *a.order_fields[i].field) {
-                        return !sc_a.sort_less;
-                    } else {
-                        // ==; keep going
+                } else {
+                    int cmp = compares[i](*sc_a.field, ea, oa, *sc_b.field, eb, ob);
+                    if (cmp != 0) {
+                        return (cmp < 0) == sc_a.sort_less;
                     }
                 }
             }
             // They are equal, order by union position
-            return ia >= ib;
+            return ia < ib;
         }
-      private:
+
         const vector<UM_UnionTable> &sources;
+        vector<ValueCompare> compares;
+    };
+
+    /// Priority queue order; the top is the source whose current row goes first
+    struct Compare {
+        Compare(vector<UM_UnionTable> &sources, const RowOrder &order)
+            : sources(sources), order(order) { }
+
+        bool operator()(uint32_t ia, uint32_t ib) const {
+            UM_UnionTable &a(sources[ia]);
+            UM_UnionTable &b(sources[ib]);
+            SINVARIANT(a.series.hasExtent());
+            SINVARIANT(b.series.hasExtent());
+            return order.before(ib, b.series.getRowOffset(), ia, a.series.getRowOffset());
+        }
+      private:
+        vector<UM_UnionTable> &sources;
+        const RowOrder &order;
     };
 
     UnionModule(const vector<UM_UnionTable> &in_sources, const vector<SortColumn> &order_columns,
-                const string &output_table_name) 
-            : sources(in_sources), compare(sources), queue(compare, sources.size()),
-              order_columns(order_columns), output_table_name(output_table_name)
+                const string &output_table_name)
+            : sources(in_sources), order(sources), compare(sources, order),
+              queue(compare, sources.size()), order_columns(order_columns),
+              output_table_name(output_table_name)
     {
         SINVARIANT(!sources.empty());
     }
@@ -70,11 +149,11 @@ class UnionModule : public OutputSeriesModule {
             ut.copier.reset(new RenameCopier(ut.series, output_series));
 
             SINVARIANT(ut.source != NULL);
-            ut.series.setExtent(ut.source->getSharedExtent());
+            ut.series.setExtent(getUpstreamExtent(*ut.source));
             if (!ut.series.hasExtent()) {
                 continue; // no point in making the other bits
             }
-            
+
             map<string, string> out_to_in;
             BOOST_FOREACH(const ss_vt &v, ut.extract_values) {
                 out_to_in[v.second] = v.first;
@@ -94,9 +173,20 @@ class UnionModule : public OutputSeriesModule {
                 TINVARIANT(sc.null_mode == NM_First || sc.null_mode == NM_Last);
                 ut.order_fields.push_back(SortColumnImpl
                                           (GeneralField::make(ut.series, i->second),
-                                           sc.sort_mode == SM_Ascending ? false : true,
+                                           sc.sort_mode == SM_Ascending,
                                            sc.null_mode));
             }
+            if (order.compares.empty()) {
+                BOOST_FOREACH(const SortColumnImpl &sc, ut.order_fields) {
+                    order.compares.push_back(valueCompare(sc.field->getType()));
+                }
+            } else {
+                // the renamed types match, so the order columns have the same types everywhere
+                for (size_t i = 0; i < ut.order_fields.size(); ++i) {
+                    SINVARIANT(order.compares[i]
+                               == valueCompare(ut.order_fields[i].field->getType()));
+                }
+            }
             LintelLogDebug("UnionModule", format("made union stuff on %s") % ut.table_name);
         }
 
@@ -120,35 +210,78 @@ class UnionModule : public OutputSeriesModule {
         }
     }
 
+    /** Number of rows, starting with the current one, in the current extent of source best that
+        go before the current row of source next, searching at most max_rows rows.  Gallops
+        forward to bracket the end of the run, then binary searches the bracket; the current
+        row is known to be in the run. */
+    uint32_t runLength(uint32_t best, uint32_t next, uint32_t max_rows) {
+        UM_UnionTable &ut(sources[best]);
+        const Extent &e(ut.series.getExtentRef());
+        SEP_RowOffset start(ut.series.getRowOffset());
+        SEP_RowOffset next_row(sources[next].series.getRowOffset());
+
+        uint32_t in_run = 1; // rows [0, in_run) are in the run
+        uint32_t limit = max_rows; // rows [limit, ...) are not, or are beyond the search
+        for (uint32_t step = 1; in_run < limit; step *= 2) {
+            uint32_t probe = in_run + step - 1;
+            if (probe >= limit) {
+                break;
+            }
+            if (order.before(best, SEP_RowOffset(start, probe, e), next, next_row)) {
+                in_run = probe + 1;
+            } else {
+                limit = probe;
+                break;
+            }
+        }
+        while (in_run < limit) {
+            uint32_t mid = in_run + (limit - in_run) / 2;
+            if (order.before(best, SEP_RowOffset(start, mid, e), next, next_row)) {
+                in_run = mid + 1;
+            } else {
+                limit = mid;
+            }
+        }
+        return in_run;
+    }
+
     virtual Extent::Ptr getSharedExtent() {
         if (sources[0].copier == NULL) {
             firstExtent();
         }
 
-        while (true) {
-            if (queue.empty()) {
-                break;
-            }
+        while (!queue.empty()) {
             uint32_t best = queue.top();
-
-            LintelLogDebug("UnionModule/process", format("best was %d") % best);
+            queue.pop();
+            UM_UnionTable &ut(sources[best]);
 
             if (output_series.getSharedExtent() == NULL) {
                 output_series.newExtent();
             }
 
-            output_series.newRecord();
-            sources[best].copier->copyRecord();
-            ++sources[best].series;
-            if (!sources[best].series.more()) {
-                sources[best].series.setExtent(sources[best].source->getSharedExtent());
+            // Bound the run by the rows left in the extent, and by about the rows left before
+            // the output extent is full.
+            Extent &in(ut.series.getExtentRef());
+            uint32_t rows_left = SEP_RowOffset::distance
+                (ut.series.getRowOffset(), SEP_RowOffset(in.fixeddata.size(), &in), &in);
+            size_t out_size = output_series.getSharedExtent()->size();
+            size_t out_rows = out_size >= output_extent_size ? 1
+                : (output_extent_size - out_size) / output_series.getTypePtr()->fixedrecordsize();
+            uint32_t max_rows = min(rows_left, static_cast<uint32_t>(max(out_rows,
+                                                                         static_cast<size_t>(1))));
+
+            uint32_t nrows = queue.empty() ? max_rows : runLength(best, queue.top(), max_rows);
+            LintelLogDebug("UnionModule/process", format("best was %d for %d rows")
+                           % best % nrows);
+
+            ut.copier->copyRecords(nrows);
+            if (!ut.series.more()) {
+                ut.series.setExtent(getUpstreamExtent(*ut.source));
             }
-            if (!sources[best].series.hasExtent()) {
-                queue.pop();
-            } else {
-                queue.replaceTop(best); // it's position may have changed, re-add
+            if (ut.series.hasExtent()) {
+                queue.push(best);
             }
-            if (output_series.getSharedExtent()->size() > 96*1024) {
+            if (output_series.getSharedExtent()->size() > output_extent_size) {
                 break;
             }
         }
@@ -156,7 +289,8 @@ class UnionModule : public OutputSeriesModule {
         return returnOutputSeries();
     }
 
-    vector<UM_UnionTable> sources; 
+    vector<UM_UnionTable> sources;
+    RowOrder order;
     Compare compare;
     PriorityQueue<uint32_t, Compare> queue;
     vector<SortColumn> order_columns;
@@ -169,4 +303,3 @@ OutputSeriesModule::OSMPtr dataseries::makeUnionModule
     return OutputSeriesModule::OSMPtr(new UnionModule(in_sources, order_columns,
                                                       output_table_name));
 }
-
@@ -10,20 +10,25 @@
 #include <concurrency/ThreadManager.h>
 #include <concurrency/PosixThreadFactory.h>
 #include <protocol/TBinaryProtocol.h>
-#include <server/TSimpleServer.h>
+#include <server/TThreadPoolServer.h>
 #include <transport/TServerSocket.h>
 #include <transport/TTransportUtils.h>
 
+#include <set>
+
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
 
 #include <Lintel/HashUnique.hpp>
 #include <Lintel/LintelLog.hpp>
 #include <Lintel/PriorityQueue.hpp>
 #include <Lintel/ProgramOptions.hpp>
+#include <Lintel/PThread.hpp>
 #include <Lintel/STLUtility.hpp>
 
+#include <DataSeries/CSVImporter.hpp>
 #include <DataSeries/DSExpr.hpp>
 #include <DataSeries/GeneralField.hpp>
 #include <DataSeries/RowAnalysisModule.hpp>
@@ -37,6 +42,7 @@
 
 using namespace std;
 using namespace facebook::thrift;
+using namespace facebook::thrift::concurrency;
 using namespace facebook::thrift::protocol;
 using namespace facebook::thrift::transport;
 using namespace facebook::thrift::server;
@@ -57,6 +63,200 @@ namespace std {
     }
 }
 
+// a double so that tests can make sortTable spill and merge many runs with little data
+lintel::ProgramOption<double> po_sort_memory_mb
+("sort-memory-mb", "Memory sortTable may use before spilling sorted runs to disk", 1024);
+lintel::ProgramOption<uint32_t> po_port
+("port", "Port to serve clients on", 49476);
+lintel::ProgramOption<uint32_t> po_server_threads
+("server-threads", "Number of client connections served at once", 8);
+lintel::ProgramOption<uint32_t> po_request_threads
+("request-threads", "Threads each sortTable, hashJoin or importCSVFiles may use;"
+ " 0 ==> an even share of the CPUs among the server threads", 0);
+lintel::ProgramOption<uint32_t> po_memory_budget_mb
+("memory-budget-mb", "Memory all the sortTable requests running at once may use together", 4096);
+
+/** Reader/writer locks on tables by name.  A request lists the tables it reads and writes in a
+    Holder and takes all of the locks at once, waiting until none of them conflict with locks
+    other requests hold, so requests can't deadlock each other.  Any number of requests can
+    read a table together; a request writing a table has it to itself.  Writers are preferred:
+    a request can't start reading a table that an earlier request is waiting to write, so a
+    stream of readers can't starve a writer.  Requests are ordered by when they asked, so two
+    requests can't both be held back by the other's waiting writes. */
+class TableLocks : boost::noncopyable {
+  public:
+    TableLocks() : next_ticket(0) { }
+
+    class Holder : boost::noncopyable {
+      public:
+        Holder(TableLocks &locks) : locks(locks), ticket(0), acquired(false) { }
+        ~Holder() {
+            if (acquired) {
+                locks.release(*this);
+            }
+        }
+
+        Holder &read(const string &table) {
+            SINVARIANT(!acquired);
+            tables.insert(make_pair(table, false)); // leaves a write alone
+            return *this;
+        }
+
+        Holder &write(const string &table) {
+            SINVARIANT(!acquired);
+            tables[table] = true;
+            return *this;
+        }
+
+        void acquire() {
+            SINVARIANT(!acquired);
+            locks.acquire(*this);
+            acquired = true;
+        }
+
+      private:
+        friend class TableLocks;
+        TableLocks &locks;
+        map<string, bool> tables; // table -> locked for writing
+        uint64_t ticket; // order in which the holders asked for their locks
+        bool acquired;
+    };
+
+  private:
+    struct State {
+        State() : readers(0), writing(false) { }
+        uint32_t readers;
+        bool writing;
+        set<uint64_t> waiting_writers; // tickets
+    };
+    typedef map<string, bool>::value_type TableMode;
+
+    bool available(const Holder &holder) {
+        BOOST_FOREACH(const TableMode &t, holder.tables) {
+            State *state = states.lookup(t.first);
+            if (state == NULL) {
+                continue;
+            }
+            if (state->writing || (t.second && state->readers > 0)) {
+                return false;
+            }
+            if (!t.second && !state->waiting_writers.empty()
+                && *state->waiting_writers.begin() < holder.ticket) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void acquire(Holder &holder) {
+        PThreadScopedLock lock(mutex);
+        holder.ticket = next_ticket++;
+        bool waited = false;
+        while (!available(holder)) {
+            if (!waited) {
+                BOOST_FOREACH(const TableMode &t, holder.tables) {
+                    if (t.second) {
+                        states[t.first].waiting_writers.insert(holder.ticket);
+                    }
+                }
+                waited = true;
+            }
+            LintelLogDebug("TableLocks", format("waiting for %d tables") % holder.tables.size());
+            changed.wait(mutex);
+        }
+        BOOST_FOREACH(const TableMode &t, holder.tables) {
+            State &state(states[t.first]);
+            if (waited && t.second) {
+                state.waiting_writers.erase(holder.ticket);
+            }
+            if (t.second) {
+                state.writing = true;
+            } else {
+                ++state.readers;
+            }
+        }
+    }
+
+    void release(const Holder &holder) {
+        PThreadScopedLock lock(mutex);
+        BOOST_FOREACH(const TableMode &t, holder.tables) {
+            State &state(states[t.first]);
+            if (t.second) {
+                SINVARIANT(state.writing);
+                state.writing = false;
+            } else {
+                SINVARIANT(state.readers > 0);
+                --state.readers;
+            }
+            if (state.readers == 0 && !state.writing && state.waiting_writers.empty()) {
+                states.remove(t.first);
+            }
+        }
+        changed.broadcast();
+    }
+
+    PThreadMutex mutex;
+    PThreadCond changed;
+    HashMap<string, State> states;
+    uint64_t next_ticket;
+};
+
+/** Threads and memory shared by the requests running at once.  A Reservation takes its share,
+    waiting for other requests to release theirs if there isn't enough left.  Reservations are
+    clamped to the total so that a large request waits for an idle server rather than
+    forever. */
+class ResourceBudget : boost::noncopyable {
+  public:
+    ResourceBudget(uint32_t threads, size_t memory)
+        : total_threads(max(threads, 1U)), total_memory(memory),
+          free_threads(total_threads), free_memory(total_memory) { }
+
+    class Reservation : boost::noncopyable {
+      public:
+        Reservation(ResourceBudget &budget, uint32_t threads, size_t memory)
+            : budget(budget), threads(min(max(threads, 1U), budget.total_threads)),
+              memory(min(memory, budget.total_memory))
+        {
+            budget.reserve(this->threads, this->memory);
+        }
+
+        ~Reservation() {
+            budget.release(threads, memory);
+        }
+
+        ResourceBudget &budget;
+        const uint32_t threads;
+        const size_t memory;
+    };
+
+  private:
+    void reserve(uint32_t threads, size_t memory) {
+        PThreadScopedLock lock(mutex);
+        while (threads > free_threads || memory > free_memory) {
+            LintelLogDebug("ResourceBudget", format("waiting for %d threads, %d bytes")
+                           % threads % memory);
+            changed.wait(mutex);
+        }
+        free_threads -= threads;
+        free_memory -= memory;
+    }
+
+    void release(uint32_t threads, size_t memory) {
+        PThreadScopedLock lock(mutex);
+        free_threads += threads;
+        free_memory += memory;
+        SINVARIANT(free_threads <= total_threads && free_memory <= total_memory);
+        changed.broadcast();
+    }
+
+    const uint32_t total_threads;
+    const size_t total_memory;
+    uint32_t free_threads;
+    size_t free_memory;
+    PThreadMutex mutex;
+    PThreadCond changed;
+};
+
 class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
   public:
     struct TableInfo {
@@ -68,7 +268,12 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
     typedef HashMap<string, TableInfo> NameToInfo;
 
-    DataSeriesServerHandler() { };
+    /** Requests may run in parallel, one per server thread.  Each takes locks on the tables
+        it reads and writes, and sortTable and hashJoin also reserve threads and memory from
+        budget, before starting; table_info is only touched under info_mutex. */
+    DataSeriesServerHandler()
+        : budget(PThreadMisc::getNCpus(),
+                 static_cast<size_t>(po_memory_budget_mb.get()) * 1024 * 1024) { }
 
     void ping() {
         LintelLog::info("ping()");
@@ -80,30 +285,16 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     }
 
     bool hasTable(const string &table_name) {
-        try {
-            getTableInfo(table_name);
-            return true;
-        } catch (TException &e) {
-            return false;
-        }
+        PThreadScopedLock lock(info_mutex);
+        return table_info.exists(table_name);
     }
 
     void importDataSeriesFiles(const vector<string> &source_paths, const string &extent_type, 
                                const string &dest_table) {
         verifyTableName(dest_table);
-        if (extent_type.empty()) {
-            requestError("extent type empty");
-        }
-
-        TypeIndexModule input(extent_type);
-        DataSeriesModule::Ptr output_module = makeTeeModule(input, tableToPath(dest_table));
-        BOOST_FOREACH(const string &path, source_paths) {
-            input.addSource(path);
-        }
-        output_module->getAndDeleteShared();
-        TableInfo &ti(table_info[dest_table]);
-        ti.extent_type = input.getTypePtr();
-        ti.last_update = Clock::todTfrac();
+        TableLocks::Holder locks(table_locks);
+        locks.write(dest_table).acquire();
+        doImportDataSeriesFiles(source_paths, extent_type, dest_table);
     }
 
     void importCSVFiles(const vector<string> &source_paths, const string &xml_desc, 
@@ -116,39 +307,51 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             requestError("only supporting single insert");
         }
         verifyTableName(dest_table);
-        pid_t pid = fork();
-        if (pid < 0) {
-            requestError("fork failed");
-        } else if (pid == 0) {
-            string xml_desc_path(str(format("xmldesc.%s") % dest_table));
-            ofstream xml_desc_output(xml_desc_path.c_str());
-            xml_desc_output << xml_desc;
-            xml_desc_output.close();
-            SINVARIANT(xml_desc_output.good());
-
-            vector<string> args;
-            args.push_back("csv2ds");
-            args.push_back(str(format("--xml-desc-file=%s") % xml_desc_path));
-            args.push_back(str(format("--field-separator=%s") % field_separator));
-            args.push_back(str(format("--comment-prefix=%s") % comment_prefix));
-            SINVARIANT(source_paths.size() == 1);
-            copy(source_paths.begin(), source_paths.end(), back_inserter(args));
-            args.push_back(tableToPath(dest_table));
-            unlink(tableToPath(dest_table).c_str()); // ignore errors
-
-            LintelLogDebug("child", format("pid %d running: %s") % getpid() % args);
-            exec(args);
-        } else {
-            waitForSuccessfulChild(pid);
+        if (field_separator.empty() || field_separator == "0x" || field_separator == "0x0") {
+            requestError("invalid field separator");
+        }
+        TableLocks::Holder locks(table_locks);
+        locks.write(dest_table).acquire();
+
+        ifstream input(source_paths[0].c_str());
+        if (!input.good()) {
+            requestError(str(format("unable to open %s: %s") % source_paths[0] % strerror(errno)));
+        }
+        ExtentTypeLibrary lib;
+        const ExtentType::Ptr type(lib.registerTypePtr(xml_desc));
 
-            ExtentTypeLibrary lib;
-            const ExtentType::Ptr type(lib.registerTypePtr(xml_desc));
-            updateTableInfo(dest_table, type);
+        ResourceBudget::Reservation reserved(budget, requestThreads(), 0);
+        string error;
+        bool ok;
+        {
+            DataSeriesSink output_sink(tableToPath(dest_table), 
+                                       Extent::compression_algs[Extent::compress_mode_lzf].compress_flag, 1);
+            output_sink.writeExtentLibrary(lib);
+            CSVImporter importer(type, output_sink, 96*1024, reserved.threads);
+            importer.setFieldSeparator(field_separator);
+            importer.setCommentPrefix(comment_prefix);
+            ok = importer.import(input, error);
+            output_sink.close();
+        }
+        if (!ok) {
+            requestError(error);
         }
+        updateTableInfo(dest_table, type);
     }
 
     void importSQLTable(const string &dsn, const string &src_table, const string &dest_table) {
         verifyTableName(dest_table);
+        TableLocks::Holder locks(table_locks);
+        locks.write(dest_table).acquire();
+
+        vector<string> args;
+        args.push_back("sql2ds");
+        if (!dsn.empty()) {
+            args.push_back(str(format("--dsn=%s") % dsn));
+        }
+        args.push_back(src_table);
+        args.push_back(tableToPath(dest_table));
+        vector<char *> argv(execArgv(args));
 
         pid_t pid = fork();
         if (pid < 0) {
@@ -157,15 +360,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             for (int i = 3; i < 100; ++i) {
                 close(i);
             }
-            vector<string> args;
-
-            args.push_back("sql2ds");
-            if (!dsn.empty()) {
-                args.push_back(str(format("--dsn=%s") % dsn));
-            }
-            args.push_back(src_table);
-            args.push_back(tableToPath(dest_table));
-            exec(args);
+            exec(argv);
         } else {
             waitForSuccessfulChild(pid);
             DataSeriesSource source(tableToPath(dest_table));
@@ -177,6 +372,8 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         
     void importData(const string &dest_table, const string &xml_desc, const TableData &data) {
         verifyTableName(dest_table);
+        TableLocks::Holder locks(table_locks);
+        locks.write(dest_table).acquire();
 
         if (data.more_rows) {
             requestError("can not handle more rows");
@@ -219,6 +416,12 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             requestError("missing source tables");
         }
         verifyTableName(dest_table);
+        TableLocks::Holder locks(table_locks);
+        BOOST_FOREACH(const string &table, source_tables) {
+            locks.read(table);
+        }
+        locks.write(dest_table).acquire();
+
         vector<string> input_paths;
         input_paths.reserve(source_tables.size());
         string source_extent_type;
@@ -226,17 +429,17 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
             if (table == dest_table) {
                 invalidTableName(table, "duplicated with destination table");
             }
-            TableInfo *ti = table_info.lookup(table);
-            if (ti == NULL) {
+            TableInfo ti;
+            if (!lookupTableInfo(table, ti)) {
                 invalidTableName(table, "table not present");
             }
             if (source_extent_type.empty()) {
-                source_extent_type = ti->extent_type->getName();
+                source_extent_type = ti.extent_type->getName();
             }
-            if (source_extent_type != ti->extent_type->getName()) {
+            if (source_extent_type != ti.extent_type->getName()) {
                 invalidTableName(table, str(format("extent type '%s' does not match earlier table"
                                                    " types of '%s'")
-                                            % ti->extent_type % source_extent_type));
+                                            % ti.extent_type % source_extent_type));
             }
                                        
             input_paths.push_back(tableToPath(table));
@@ -244,7 +447,7 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         if (source_extent_type.empty()) {
             requestError("internal: extent type is missing?");
         }
-        importDataSeriesFiles(input_paths, source_extent_type, dest_table);
+        doImportDataSeriesFiles(input_paths, source_extent_type, dest_table);
     }
 
     void getTableData(TableData &ret, const string &source_table, int32_t max_rows, 
@@ -253,9 +456,11 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         if (max_rows <= 0) {
             requestError("max_rows must be > 0");
         }
-        NameToInfo::iterator i = getTableInfo(source_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(source_table).acquire();
+        TableInfo info(getTableInfo(source_table));
 
-        TypeIndexModule input(i->second.extent_type->getName());
+        TypeIndexModule input(info.extent_type->getName());
         input.addSource(tableToPath(source_table));
         DataSeriesModule *mod = &input;
         DataSeriesModule::Ptr select_module;
@@ -272,19 +477,23 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     void hashJoin(const string &a_table, const string &b_table, const string &out_table,
                   const map<string, string> &eq_columns, 
                   const map<string, string> &keep_columns, int32_t max_a_rows) { 
-        NameToInfo::iterator a_info = getTableInfo(a_table);
-        NameToInfo::iterator b_info = getTableInfo(b_table);
-
         verifyTableName(out_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(a_table).read(b_table).write(out_table).acquire();
+        TableInfo a_info(getTableInfo(a_table));
+        TableInfo b_info(getTableInfo(b_table));
 
-        TypeIndexModule a_input(a_info->second.extent_type->getName());
+        TypeIndexModule a_input(a_info.extent_type->getName());
         a_input.addSource(tableToPath(a_table));
-        TypeIndexModule b_input(b_info->second.extent_type->getName());
+        TypeIndexModule b_input(b_info.extent_type->getName());
         b_input.addSource(tableToPath(b_table));
 
+        ResourceBudget::Reservation reserved(budget, requestThreads(), 0);
         OutputSeriesModule::OSMPtr 
                 hj_module(makeHashJoinModule(a_input, max_a_rows, b_input,
-                                             eq_columns, keep_columns, out_table));
+                                             eq_columns, keep_columns, out_table,
+                                             tableToPath(out_table, "join-tmp."),
+                                             reserved.threads));
 
         DataSeriesModule::Ptr output_module = makeTeeModule(*hj_module, tableToPath(out_table));
         
@@ -295,22 +504,28 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     void starJoin(const string &fact_table, const vector<Dimension> &dimensions, 
                   const string &out_table, const map<string, string> &fact_columns,
                   const vector<DimensionFactJoin> &dimension_columns, int32_t max_dimension_rows) {
-        NameToInfo::iterator fact_info = getTableInfo(fact_table);
         verifyTableName(out_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(fact_table);
+        BOOST_FOREACH(const Dimension &dim, dimensions) {
+            locks.read(dim.source_table);
+        }
+        locks.write(out_table).acquire();
+        TableInfo fact_info(getTableInfo(fact_table));
         
         HashMap< string, shared_ptr<DataSeriesModule> > dimension_modules;
         
         BOOST_FOREACH(const Dimension &dim, dimensions) {
             if (!dimension_modules.exists(dim.source_table)) {
-                NameToInfo::iterator dim_info = getTableInfo(dim.source_table);
+                TableInfo dim_info(getTableInfo(dim.source_table));
                 shared_ptr<TypeIndexModule> 
-                        ptr(new TypeIndexModule(dim_info->second.extent_type->getName()));
+                        ptr(new TypeIndexModule(dim_info.extent_type->getName()));
                 ptr->addSource(tableToPath(dim.source_table));
                 dimension_modules[dim.source_table] = ptr;
             }
         }
         
-        TypeIndexModule fact_input(fact_info->second.extent_type->getName());
+        TypeIndexModule fact_input(fact_info.extent_type->getName());
         fact_input.addSource(tableToPath(fact_table));
 
         // TODO: use and check max_dimension_rows
@@ -327,23 +542,27 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     void selectRows(const string &in_table, const string &out_table, const string &where_expr) {
         verifyTableName(in_table);
         verifyTableName(out_table);
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
+        TableLocks::Holder locks(table_locks);
+        locks.read(in_table).write(out_table).acquire();
+        TableInfo info(getTableInfo(in_table));
+        TypeIndexModule input(info.extent_type->getName());
         input.addSource(tableToPath(in_table));
         DataSeriesModule::Ptr select(makeSelectModule(input, where_expr));
         DataSeriesModule::Ptr output_module = makeTeeModule(*select, tableToPath(out_table));
 
         output_module->getAndDeleteShared();
-        updateTableInfo(out_table, info->second.extent_type);
+        updateTableInfo(out_table, info.extent_type);
     }
 
     void projectTable(const string &in_table, const string &out_table, 
                       const vector<string> &keep_columns) {
         verifyTableName(in_table);
         verifyTableName(out_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(in_table).write(out_table).acquire();
 
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
+        TableInfo info(getTableInfo(in_table));
+        TypeIndexModule input(info.extent_type->getName());
         input.addSource(tableToPath(in_table));
         OutputSeriesModule::OSMPtr project(makeProjectModule(input, keep_columns));
         DataSeriesModule::Ptr output_module = makeTeeModule(*project, tableToPath(out_table));
@@ -355,9 +574,11 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
                         const vector<ExprColumn> &expr_columns) {
         verifyTableName(in_table);
         verifyTableName(out_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(in_table).write(out_table).acquire();
 
-        NameToInfo::iterator info = getTableInfo(in_table);
-        TypeIndexModule input(info->second.extent_type->getName());
+        TableInfo info(getTableInfo(in_table));
+        TypeIndexModule input(info.extent_type->getName());
         input.addSource(tableToPath(in_table));
         OutputSeriesModule::OSMPtr transform
                 (makeExprTransformModule(input, expr_columns, out_table));
@@ -370,17 +591,19 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
                            const string &update_column, const vector<string> &primary_key) {
         verifyTableName(base_table);
         verifyTableName(update_from);
+        TableLocks::Holder locks(table_locks);
+        locks.read(update_from).write(base_table).acquire();
 
-        NameToInfo::iterator update_info(getTableInfo(update_from));
-        NameToInfo::iterator base_info = table_info.find(base_table);
-        if (base_info == table_info.end()) {
+        TableInfo update_info(getTableInfo(update_from));
+        TableInfo base_info;
+        if (!lookupTableInfo(base_table, base_info)) {
             base_info = createTable(base_table, update_info, update_column);
         }
 
-        TypeIndexModule base_input(base_info->second.extent_type->getName());
+        TypeIndexModule base_input(base_info.extent_type->getName());
         base_input.addSource(tableToPath(base_table));
 
-        TypeIndexModule update_input(update_info->second.extent_type->getName());
+        TypeIndexModule update_input(update_info.extent_type->getName());
         update_input.addSource(tableToPath(update_from));
 
         DataSeriesModule::Ptr updater(makeSortedUpdateModule(base_input, update_input, 
@@ -397,14 +620,20 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
 
     void unionTables(const vector<UnionTable> &in_tables, const vector<SortColumn> &order_columns,
                      const string &out_table) {
-        vector<UM_UnionTable> tables;
+        TableLocks::Holder locks(table_locks);
         BOOST_FOREACH(const UnionTable &table, in_tables) {
             verifyTableName(table.table_name);
-            NameToInfo::iterator table_info(getTableInfo(table.table_name));
+            locks.read(table.table_name);
+        }
+        verifyTableName(out_table);
+        locks.write(out_table).acquire();
+
+        vector<UM_UnionTable> tables;
+        BOOST_FOREACH(const UnionTable &table, in_tables) {
+            TableInfo info(getTableInfo(table.table_name));
 
-            TypeIndexModule::Ptr p =
-                    TypeIndexModule::make(table_info->second.extent_type->getName());
-            p->addSource(tableToPath(table_info->first));
+            TypeIndexModule::Ptr p = TypeIndexModule::make(info.extent_type->getName());
+            p->addSource(tableToPath(table.table_name));
             tables.push_back(UM_UnionTable(table, p));
         }
         
@@ -416,12 +645,20 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
     }
 
     void sortTable(const string &in_table, const string &out_table, const vector<SortColumn> &by) {
-        NameToInfo::iterator table_info(getTableInfo(in_table));
+        verifyTableName(in_table);
+        verifyTableName(out_table);
+        TableLocks::Holder locks(table_locks);
+        locks.read(in_table).write(out_table).acquire();
+        TableInfo info(getTableInfo(in_table));
         
-        TypeIndexModule::Ptr p(TypeIndexModule::make(table_info->second.extent_type->getName()));
-        p->addSource(tableToPath(table_info->first));
-
-        OutputSeriesModule::OSMPtr sorter(makeSortModule(*p, by));
+        TypeIndexModule::Ptr p(TypeIndexModule::make(info.extent_type->getName()));
+        p->addSource(tableToPath(in_table));
+
+        ResourceBudget::Reservation reserved
+            (budget, requestThreads(), static_cast<size_t>(po_sort_memory_mb.get() * 1024 * 1024));
+        OutputSeriesModule::OSMPtr sorter
+            (makeSortModule(*p, by, reserved.memory, tableToPath(out_table, "sort-tmp."),
+                            reserved.threads));
         
         DataSeriesModule::Ptr output_module = makeTeeModule(*sorter, tableToPath(out_table));
         output_module->getAndDeleteShared();
@@ -443,7 +680,37 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         return prefix + table_name;
     }
 
+    void doImportDataSeriesFiles(const vector<string> &source_paths, const string &extent_type, 
+                                 const string &dest_table) {
+        if (extent_type.empty()) {
+            requestError("extent type empty");
+        }
+
+        TypeIndexModule input(extent_type);
+        DataSeriesModule::Ptr output_module = makeTeeModule(input, tableToPath(dest_table));
+        BOOST_FOREACH(const string &path, source_paths) {
+            input.addSource(path);
+        }
+        output_module->getAndDeleteShared();
+        PThreadScopedLock lock(info_mutex);
+        TableInfo &ti(table_info[dest_table]);
+        ti.extent_type = input.getTypePtr();
+        ti.last_update = Clock::todTfrac();
+    }
+
+    /** By default each request gets an even share of the CPUs, so that requests on different
+        connections run at once rather than each reserving every CPU and waiting for the
+        others. */
+    uint32_t requestThreads() {
+        if (po_request_threads.get() > 0) {
+            return po_request_threads.get();
+        }
+        return max(1U, static_cast<uint32_t>(PThreadMisc::getNCpus())
+                   / po_server_threads.get());
+    }
+
     void updateTableInfo(const string &table, const ExtentType::Ptr extent_type) {
+        PThreadScopedLock lock(info_mutex);
         TableInfo &info(table_info[table]);
         info.extent_type = extent_type;
     }
@@ -455,14 +722,13 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         }
         LintelLogDebug("child", format("child %d returned %d") % pid % status);
         if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-            requestError("csv2ds failed");
+            requestError("child process failed");
         }
     }
 
-    NameToInfo::iterator 
-    createTable(const string &table_name, NameToInfo::iterator update_table, 
-                const std::string &update_column) {
-        const ExtentType::Ptr from_type = update_table->second.extent_type;
+    TableInfo createTable(const string &table_name, const TableInfo &update_table, 
+                          const std::string &update_column) {
+        const ExtentType::Ptr from_type = update_table.extent_type;
         string extent_type = str(format("<ExtentType name=\"%s\" namespace=\"%s\""
                                         " version=\"%d.%d\">") % table_name 
                                  % from_type->getNamespace() % from_type->majorVersion()
@@ -489,27 +755,50 @@ class DataSeriesServerHandler : public DataSeriesServerIf, public ThrowError {
         return getTableInfo(table_name);
     }
 
-    void exec(vector<string> &args) {
-        char **argv = new char *[args.size() + 1];
-        const char *tmp;
+    /** The argv for exec(); refers to args, so args has to outlive it */
+    vector<char *> execArgv(vector<string> &args) {
+        vector<char *> argv;
         for (uint32_t i = 0; i < args.size(); ++i) {
-            tmp = args[i].c_str(); // force null termination
-            argv[i] = &args[i][0]; // couldn't figure out how to directly use c_str()
+            args[i].c_str(); // force null termination
+            argv.push_back(&args[i][0]); // couldn't figure out how to directly use c_str()
         }
-        argv[args.size()] = NULL;
-        execvp(args[0].c_str(), argv);
-        FATAL_ERROR(format("exec of %s failed: %s") % args[0] % strerror(errno));
+        argv.push_back(NULL);
+        return argv;
     }
 
-    NameToInfo::iterator getTableInfo(const string &table_name) {
-        NameToInfo::iterator ret = table_info.find(table_name);
-        if (ret == table_info.end()) {
+    // Only called in a forked child, so it can't allocate; other threads may have held locks
+    // in the allocator when the parent forked.
+    void exec(vector<char *> &argv) {
+        execvp(argv[0], &argv[0]);
+        const char *msg = "exec failed\n";
+        ssize_t ignore = write(2, msg, strlen(msg));
+        (void)ignore;
+        _exit(1);
+    }
+
+    bool lookupTableInfo(const string &table_name, TableInfo &into) {
+        PThreadScopedLock lock(info_mutex);
+        TableInfo *info = table_info.lookup(table_name);
+        if (info == NULL) {
+            return false;
+        }
+        into = *info;
+        return true;
+    }
+
+    /** A copy, since other requests may change table_info while this one runs */
+    TableInfo getTableInfo(const string &table_name) {
+        TableInfo ret;
+        if (!lookupTableInfo(table_name, ret)) {
             invalidTableName(table_name, "table missing");
         }
         return ret;
     }
 
+    PThreadMutex info_mutex;
     NameToInfo table_info;
+    TableLocks table_locks;
+    ResourceBudget budget;
 };
 
 lintel::ProgramOption<string> po_working_directory
@@ -539,13 +828,27 @@ void setupWorkingDirectory() {
 
 int main(int argc, char *argv[]) {
     LintelLog::parseEnv();
+    vector<string> extra_args = lintel::parseCommandLine(argc, argv, false);
+    if (!extra_args.empty()) {
+        lintel::programOptionsUsage(argv[0]);
+        exit(1);
+    }
+    INVARIANT(po_server_threads.get() > 0, "need at least one server thread");
+    INVARIANT(po_sort_memory_mb.get() > 0, "sortTable needs some memory");
+
     shared_ptr<TProtocolFactory> protocolFactory(new TBinaryProtocolFactory());
     shared_ptr<DataSeriesServerHandler> handler(new DataSeriesServerHandler());
     shared_ptr<TProcessor> processor(new DataSeriesServerProcessor(handler));
-    shared_ptr<TServerTransport> serverTransport(new TServerSocket(49476));
+    shared_ptr<TServerTransport> serverTransport(new TServerSocket(po_port.get()));
     shared_ptr<TTransportFactory> transportFactory(new TBufferedTransportFactory());
 
-    TSimpleServer server(processor, serverTransport, transportFactory, protocolFactory);
+    // Each connection is served by one of the threads; their requests run in parallel
+    shared_ptr<ThreadManager> threadManager
+        (ThreadManager::newSimpleThreadManager(po_server_threads.get()));
+    threadManager->threadFactory(shared_ptr<PosixThreadFactory>(new PosixThreadFactory()));
+    threadManager->start();
+    TThreadPoolServer server(processor, serverTransport, transportFactory, protocolFactory,
+                             threadManager);
 
     setupWorkingDirectory();
 
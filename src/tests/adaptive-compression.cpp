@@ -0,0 +1,123 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that adaptive compression only samples every so often, reuses the
+    winners in between, and writes files that read back identically.
+*/
+
+#include <iostream>
+
+#include <sys/stat.h>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Adaptive\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"int32\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 40, nrecords = 2000, sample_interval = 8;
+
+void fill(const Extent::Ptr &e, unsigned extent_num) {
+    ExtentSeries s(e);
+    Int64Field time(s, "time");
+    Int32Field value(s, "value");
+    Variable32Field name(s, "name");
+    for (unsigned j = 0; j < nrecords; ++j) {
+        s.newRecord();
+        time.set(extent_num * nrecords + j * 3);
+        value.set((j * 7919) % 1000);
+        name.set(str(format("name-%d-%d") % (j % 97) % (extent_num % 3)));
+    }
+}
+
+off64_t writeFile(const string &filename, uint32_t sample_interval, double unpack_cost) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename);
+    sink.setAdaptiveCompression(sample_interval, unpack_cost);
+    sink.setIndexV1();
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        fill(e, i);
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+
+    struct stat buf;
+    SINVARIANT(stat(filename.c_str(), &buf) == 0);
+    return buf.st_size;
+}
+
+void checkFile(const string &filename, bool check_modes) {
+    DataSeriesSource source(filename);
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    ExtentSeries index(source.getIndexV1());
+    Int64Field offset(index, "offset");
+    Variable32Field extent_type(index, "extenttype");
+    ByteField fixed_mode(index, "fixed_compress_mode"), variable_mode(index, "variable_compress_mode");
+
+    unsigned extent_num = 0;
+    ExtentType::byte sampled_fixed = 0, sampled_variable = 0;
+    for (; index.morerecords(); ++index) {
+        if (extent_type.stringval() != "Test::Adaptive") {
+            continue;
+        }
+        if (extent_num % sample_interval == 0) {
+            sampled_fixed = fixed_mode.val();
+            sampled_variable = variable_mode.val();
+        } else if (check_modes) {
+            // with only size to consider, the winner is what the sample picked
+            SINVARIANT(fixed_mode.val() == sampled_fixed);
+            SINVARIANT(variable_mode.val() == sampled_variable);
+        }
+
+        off64_t tmp = offset.val();
+        Extent::Ptr e(source.preadExtent(tmp));
+        Extent::Ptr expect(new Extent(type));
+        fill(expect, extent_num);
+        SINVARIANT(e->fixeddata.size() == expect->fixeddata.size()
+                   && e->variabledata.size() == expect->variabledata.size());
+        SINVARIANT(memcmp(e->fixeddata.begin(), expect->fixeddata.begin(),
+                          expect->fixeddata.size()) == 0);
+        SINVARIANT(memcmp(e->variabledata.begin(), expect->variabledata.begin(),
+                          expect->variabledata.size()) == 0);
+        ++extent_num;
+    }
+    SINVARIANT(extent_num == nextents);
+}
+
+int main() {
+    // keep the sampling order deterministic
+    DataSeriesSink::setCompressorCount(0);
+
+    off64_t all_size = writeFile("adaptive-compression.ds", 0, 0);
+    checkFile("adaptive-compression.ds", false);
+
+    off64_t adaptive_size = writeFile("adaptive-compression.ds", sample_interval, 0);
+    checkFile("adaptive-compression.ds", true);
+    INVARIANT(adaptive_size < all_size * 1.05, format("%d vs %d") % adaptive_size % all_size);
+
+    // heavily weight decompression time; must still read back
+    writeFile("adaptive-compression.ds", sample_interval, 1.0e12);
+    checkFile("adaptive-compression.ds", false);
+
+    cout << format("adaptive compression tests passed (%d vs %d bytes).\n")
+        % adaptive_size % all_size;
+    return 0;
+}
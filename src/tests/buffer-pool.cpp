@@ -0,0 +1,149 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that large ByteArrays recycle their storage through the buffer
+    pool, that recycled buffers hold the right data, and that the pool
+    limit is respected.
+*/
+
+#include <iostream>
+
+#include <Lintel/PThread.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::BufferPool\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"number\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 20, nrecords = 20000;
+
+ExtentTypeLibrary library;
+ExtentType::Ptr type(library.registerTypePtr(test_xml));
+
+void checkSizeClasses() {
+    Extent::ByteArray::PoolStats before = Extent::ByteArray::getPoolStats();
+    {
+        Extent::ByteArray a;
+        a.resize(1000000);
+        SINVARIANT(a.size() == 1000000);
+    }
+    Extent::ByteArray::PoolStats middle = Extent::ByteArray::getPoolStats();
+    SINVARIANT(middle.misses == before.misses + 1 && middle.returned == before.returned + 1);
+    {
+        // rounds to the same size class as above
+        Extent::ByteArray a;
+        a.resize(1000001);
+        for (size_t i = 0; i < a.size(); ++i) { // recycled memory has to be fully usable
+            a[i] = i & 0xFF;
+        }
+    }
+    Extent::ByteArray::PoolStats after = Extent::ByteArray::getPoolStats();
+    SINVARIANT(after.hits == middle.hits + 1 && after.misses == middle.misses);
+
+    {
+        // small arrays bypass the pool
+        Extent::ByteArray a;
+        a.resize(1000);
+    }
+    Extent::ByteArray::PoolStats small = Extent::ByteArray::getPoolStats();
+    SINVARIANT(small.hits == after.hits && small.misses == after.misses
+               && small.returned == after.returned);
+}
+
+void fill(const Extent::Ptr &e, unsigned extent_num) {
+    ExtentSeries s(e);
+    Int64Field number(s, "number");
+    Variable32Field name(s, "name");
+    for (unsigned j = 0; j < nrecords; ++j) {
+        s.newRecord();
+        number.set(extent_num * nrecords + j);
+        name.set(str(format("name-%d") % (j % 1000)));
+    }
+}
+
+void writeFile(const string &filename) {
+    DataSeriesSink sink(filename);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        fill(e, i);
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+// read the file a few times at once so buffers move between threads
+class Reader : public PThread {
+  public:
+    Reader(const string &filename) : filename(filename) { }
+
+    virtual void *run() {
+        TypeIndexModule source("Test::BufferPool");
+        source.addSource(filename);
+        ExtentSeries s;
+        Int64Field number(s, "number");
+        Variable32Field name(s, "name");
+        unsigned extent_num = 0;
+        for (Extent::Ptr e(source.getSharedExtent()); e != NULL; e = source.getSharedExtent()) {
+            unsigned j = 0;
+            for (s.setExtent(e); s.morerecords(); ++s, ++j) {
+                SINVARIANT(number.val() == extent_num * nrecords + j);
+                SINVARIANT(name.stringval() == str(format("name-%d") % (j % 1000)));
+            }
+            SINVARIANT(j == nrecords);
+            ++extent_num;
+        }
+        SINVARIANT(extent_num == nextents);
+        return NULL;
+    }
+
+    string filename;
+};
+
+void checkReaders(const string &filename) {
+    vector<Reader *> readers;
+    for (unsigned i = 0; i < 4; ++i) {
+        readers.push_back(new Reader(filename));
+        readers.back()->start();
+    }
+    for (vector<Reader *>::iterator i = readers.begin(); i != readers.end(); ++i) {
+        (**i).join();
+        delete *i;
+    }
+}
+
+int main() {
+    checkSizeClasses();
+
+    writeFile("buffer-pool.ds");
+    Extent::ByteArray::PoolStats before = Extent::ByteArray::getPoolStats();
+    checkReaders("buffer-pool.ds");
+    Extent::ByteArray::PoolStats after = Extent::ByteArray::getPoolStats();
+    uint64_t hits = after.hits - before.hits, misses = after.misses - before.misses;
+    cout << format("%d pool hits, %d misses, %d bytes pooled\n")
+        % hits % misses % after.pooled_bytes;
+    SINVARIANT(hits > misses);
+
+    Extent::ByteArray::setPoolLimit(0);
+    SINVARIANT(Extent::ByteArray::getPoolStats().pooled_bytes == 0);
+    checkReaders("buffer-pool.ds");
+    Extent::ByteArray::PoolStats disabled = Extent::ByteArray::getPoolStats();
+    SINVARIANT(disabled.pooled_bytes == 0 && disabled.hits == after.hits
+               && disabled.returned == after.returned);
+
+    cout << "buffer pool tests passed.\n";
+    return 0;
+}
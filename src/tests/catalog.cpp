@@ -0,0 +1,207 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that sources opened through a DataSeriesCatalog read the same data
+    as ones opened directly, that unchanged files are opened from the
+    catalog, and that changed files are refreshed.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <Lintel/TestUtil.hpp>
+
+#include <DataSeries/DataSeriesCatalog.hpp>
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Catalog\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"number\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const string other_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::CatalogOther\" version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"value\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nfiles = 25;
+
+string fileName(unsigned i) {
+    return str(format("catalog-%d.ds") % i);
+}
+
+void writeFile(const string &filename, unsigned nextents, int64_t base) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+    ExtentType::Ptr other = library.registerTypePtr(other_xml);
+
+    DataSeriesSink sink(filename);
+    sink.setIndexV1();
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field number(s, "number");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < 100; ++j) {
+            s.newRecord();
+            number.set(base + i * 100 + j);
+            name.set(string(j % 7, 'a' + j % 26));
+        }
+        sink.writeExtent(*e, NULL);
+
+        Extent::Ptr o(new Extent(other));
+        ExtentSeries os(o);
+        Int32Field value(os, "value");
+        os.newRecord();
+        value.set(i);
+        sink.writeExtent(*o, NULL);
+    }
+    sink.close();
+}
+
+int64_t sumNumbers(const DataSeriesCatalog::Ptr &catalog) {
+    TypeIndexModule source("Test::Catalog");
+    if (catalog != NULL) {
+        source.setCatalog(catalog);
+    }
+    for (unsigned i = 0; i < nfiles; ++i) {
+        source.addSource(fileName(i));
+    }
+    ExtentSeries s;
+    Int64Field number(s, "number");
+    int64_t ret = 0;
+    for (Extent::Ptr e(source.getSharedExtent()); e != NULL; e = source.getSharedExtent()) {
+        for (s.setExtent(e); s.more(); s.next()) {
+            ret += number.val();
+        }
+    }
+    return ret;
+}
+
+// A source opened from the catalog has to look just like one opened directly
+void checkSameSource(DataSeriesSource &a, DataSeriesSource &b) {
+    SINVARIANT(a.getLibrary().name_to_type == b.getLibrary().name_to_type);
+    SINVARIANT(a.needBitflip() == b.needBitflip());
+    SINVARIANT(a.index_extent->extent_source_offset == b.index_extent->extent_source_offset);
+
+    ExtentSeries sa(a.index_extent), sb(b.index_extent);
+    Int64Field offset_a(sa, "offset"), offset_b(sb, "offset");
+    Variable32Field type_a(sa, "extenttype"), type_b(sb, "extenttype");
+    for (; sa.more(); sa.next(), sb.next()) {
+        SINVARIANT(sb.more());
+        SINVARIANT(offset_a.val() == offset_b.val() && type_a.stringval() == type_b.stringval());
+    }
+    SINVARIANT(!sb.more());
+
+    SINVARIANT(a.getIndexV1() != NULL && b.getIndexV1() != NULL);
+    SINVARIANT(a.getIndexV1()->extent_source_offset == b.getIndexV1()->extent_source_offset);
+
+    // sequential reads start after the type extent
+    while (true) {
+        boost::scoped_ptr<Extent> ea(a.readExtent()), eb(b.readExtent());
+        SINVARIANT((ea == NULL) == (eb == NULL));
+        if (ea == NULL) {
+            break;
+        }
+        SINVARIANT(ea->getTypePtr() == eb->getTypePtr()
+                   && ea->extent_source_offset == eb->extent_source_offset
+                   && ea->fixeddata.size() == eb->fixeddata.size()
+                   && memcmp(ea->fixeddata.begin(), eb->fixeddata.begin(),
+                             ea->fixeddata.size()) == 0);
+    }
+}
+
+// Overwrite the header of the file without changing its modify time or size, so that only a
+// source that doesn't read the header can open it.
+void corruptHeader(const string &filename) {
+    struct stat before;
+    SINVARIANT(stat(filename.c_str(), &before) == 0);
+    int fd = open(filename.c_str(), O_WRONLY);
+    SINVARIANT(fd >= 0);
+    SINVARIANT(pwrite(fd, "XXXX", 4, 0) == 4);
+    SINVARIANT(close(fd) == 0);
+    struct timespec times[2] = { before.st_atim, before.st_mtim };
+    SINVARIANT(utimensat(AT_FDCWD, filename.c_str(), times, 0) == 0);
+}
+
+int main() {
+    const string catalog_path("catalog.dscat");
+    unlink(catalog_path.c_str());
+    for (unsigned i = 0; i < nfiles; ++i) {
+        writeFile(fileName(i), 1 + i % 4, i * 1000000);
+    }
+    int64_t expect = sumNumbers(DataSeriesCatalog::Ptr());
+
+    // an empty catalog fills in as it is used
+    {
+        DataSeriesCatalog::Ptr catalog(DataSeriesCatalog::make(catalog_path));
+        SINVARIANT(catalog->size() == 0 && !catalog->changed());
+        SINVARIANT(sumNumbers(catalog) == expect);
+        SINVARIANT(catalog->size() == nfiles && catalog->changed());
+        catalog->save();
+        SINVARIANT(!catalog->changed());
+    }
+
+    // a saved catalog opens the same files without changes
+    {
+        DataSeriesCatalog::Ptr catalog(DataSeriesCatalog::make(catalog_path));
+        SINVARIANT(catalog->size() == nfiles && !catalog->changed());
+        SINVARIANT(sumNumbers(catalog) == expect);
+        SINVARIANT(!catalog->changed());
+        for (unsigned i = 0; i < nfiles; ++i) {
+            boost::shared_ptr<DataSeriesSource> cached(catalog->openSource(fileName(i)));
+            DataSeriesSource direct(fileName(i));
+            checkSameSource(*cached, direct);
+        }
+    }
+
+    // unchanged files are not re-read; the catalog doesn't notice the corruption
+    corruptHeader(fileName(3));
+    {
+        TEST_INVARIANT_MSG1(DataSeriesSource direct(fileName(3)),
+                            "Invalid data series source, not DSv1 or DSv2");
+        DataSeriesCatalog::Ptr catalog(DataSeriesCatalog::make(catalog_path));
+        SINVARIANT(sumNumbers(catalog) == expect);
+        SINVARIANT(!catalog->changed());
+    }
+
+    // changed files are refreshed
+    writeFile(fileName(3), 7, 42);
+    writeFile(fileName(5), 2, 17);
+    expect = sumNumbers(DataSeriesCatalog::Ptr());
+    {
+        DataSeriesCatalog::Ptr catalog(DataSeriesCatalog::make(catalog_path));
+        SINVARIANT(sumNumbers(catalog) == expect);
+        SINVARIANT(catalog->changed() && catalog->size() == nfiles);
+        catalog->save();
+    }
+    {
+        DataSeriesCatalog::Ptr catalog(DataSeriesCatalog::make(catalog_path));
+        SINVARIANT(sumNumbers(catalog) == expect);
+        SINVARIANT(!catalog->changed());
+        boost::shared_ptr<DataSeriesSource> cached(catalog->openSource(fileName(3)));
+        DataSeriesSource direct(fileName(3));
+        checkSameSource(*cached, direct);
+    }
+
+    cout << "catalog tests passed.\n";
+    return 0;
+}
@@ -0,0 +1,180 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2012, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that min/max indices embedded by DataSeriesSink match the extents,
+    and that MinMaxIndexModule and SortedIndexModule can select with them.
+*/
+
+#include <iostream>
+#include <limits>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/MinMaxIndexModule.hpp>
+#include <DataSeries/SortedIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::EmbeddedMinMax\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"time\" />\n"
+        "  <field type=\"int32\" name=\"value\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 10, nrecords = 100;
+
+// time is sorted across extents; value wraps within each extent
+void writeFile(const string &filename, int64_t base) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename);
+    vector<string> fields;
+    fields.push_back("time");
+    fields.push_back("value");
+    fields.push_back("name");
+    sink.addMinMaxIndex(type, fields);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field time(s, "time");
+        Int32Field value(s, "value", Field::flag_nullable);
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            time.set(base + i * nrecords + j);
+            if (j % 7 == 3) {
+                value.setNull();
+            } else {
+                value.set((i * 37 + j) % 50);
+            }
+            name.set(str(format("name-%03d") % ((i * 13 + j * 7) % 200)));
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    Extent empty(type);
+    sink.writeExtent(empty, NULL); // not indexed
+    sink.close();
+}
+
+void checkIndex(const string &filename, int64_t base) {
+    DataSeriesSource source(filename);
+    ExtentSeries index, data;
+    Variable32Field index_filename(index, "filename");
+    Int64Field extent_offset(index, "extent_offset");
+    Int32Field rowcount(index, "rowcount");
+    Int64Field min_time(index, "min:time"), max_time(index, "max:time");
+    Int32Field min_value(index, "min:value"), max_value(index, "max:value");
+    BoolField hasnull_value(index, "hasnull:value"), hasnull_time(index, "hasnull:time");
+    Int32Field nullcount_value(index, "nullcount:value");
+    Variable32Field min_name(index, "min:name"), max_name(index, "max:name");
+
+    Int64Field time(data, "time");
+    Int32Field value(data, "value", Field::flag_nullable);
+    Variable32Field name(data, "name");
+
+    unsigned nindex = 0;
+    TypeIndexModule tim(DataSeriesSink::minMaxIndexTypeName("Test::EmbeddedMinMax"));
+    tim.addSource(filename);
+    for (Extent::Ptr e(tim.getSharedExtent()); e != NULL; e = tim.getSharedExtent()) {
+        for (index.setExtent(e); index.morerecords(); ++index, ++nindex) {
+            SINVARIANT(index_filename.size() == 0);
+            off64_t offset = extent_offset.val();
+            data.setExtent(source.preadExtent(offset));
+            SINVARIANT(data.getTypePtr()->getName() == "Test::EmbeddedMinMax");
+            SINVARIANT(data.getExtentRef().nRecords() == static_cast<size_t>(rowcount.val()));
+
+            int32_t vmin = numeric_limits<int32_t>::max(), vmax = numeric_limits<int32_t>::min();
+            int32_t nnull = 0;
+            string nmin(data.morerecords() ? name.stringval() : ""), nmax(nmin);
+            SINVARIANT(min_time.val() == time.val());
+            for (; data.morerecords(); ++data) {
+                if (value.isNull()) {
+                    ++nnull;
+                } else {
+                    vmin = min(vmin, value.val());
+                    vmax = max(vmax, value.val());
+                }
+                nmin = min(nmin, name.stringval());
+                nmax = max(nmax, name.stringval());
+                SINVARIANT(time.val() <= max_time.val());
+            }
+            SINVARIANT(min_time.val() == base + static_cast<int64_t>(nindex * nrecords));
+            SINVARIANT(min_value.val() == vmin && max_value.val() == vmax);
+            SINVARIANT(nullcount_value.val() == nnull && hasnull_value.val() == (nnull > 0));
+            SINVARIANT(!hasnull_time.val());
+            SINVARIANT(min_name.stringval() == nmin && max_name.stringval() == nmax);
+        }
+    }
+    SINVARIANT(nindex == nextents);
+}
+
+// returns the number of extents read; every row with a time in [time_min, time_max] must be found
+unsigned countExtents(DataSeriesModule &module, int64_t time_min, int64_t time_max,
+                      unsigned expected_rows) {
+    ExtentSeries s;
+    Int64Field time(s, "time");
+    unsigned nextent = 0, nmatch = 0;
+    for (Extent::Ptr e(module.getSharedExtent()); e != NULL; e = module.getSharedExtent()) {
+        ++nextent;
+        for (s.setExtent(e); s.morerecords(); ++s) {
+            if (time.val() >= time_min && time.val() <= time_max) {
+                ++nmatch;
+            }
+        }
+    }
+    SINVARIANT(nmatch == expected_rows);
+    return nextent;
+}
+
+void checkMinMaxIndexModule(const vector<string> &files) {
+    // spans extents 2-3 of the first file
+    GeneralValue minv, maxv;
+    minv.setInt64(250);
+    maxv.setInt64(349);
+    vector<MinMaxIndexModule::selector> selectors;
+    selectors.push_back(MinMaxIndexModule::selector(minv, maxv, "time", "time"));
+    MinMaxIndexModule first(files, "Test::EmbeddedMinMax", selectors, "min:time");
+    SINVARIANT(countExtents(first, 250, 349, 100) == 2);
+
+    // spans the end of the first file and the start of the second
+    selectors[0].minv.setInt64(950);
+    selectors[0].maxv.setInt64(10049);
+    MinMaxIndexModule both(files, "Test::EmbeddedMinMax", selectors, "min:time");
+    SINVARIANT(countExtents(both, 950, 10049, 100) == 2);
+}
+
+void checkSortedIndexModule(const vector<string> &files) {
+    typedef SortedIndexModule<int64_t, Int64Field> Module;
+    Module::Index index(files, "Test::EmbeddedMinMax", "time");
+    Module one(index, 10512);
+    SINVARIANT(countExtents(one, 10512, 10512, 1) == 1);
+
+    vector<int64_t> values;
+    values.push_back(5);
+    values.push_back(7);
+    values.push_back(10999);
+    Module several(index, values);
+    SINVARIANT(countExtents(several, 0, 9, 10) == 2); // 10999 is in the last extent
+}
+
+int main(int argc, char *argv[]) {
+    vector<string> files;
+    files.push_back("embedded-minmax-0.ds");
+    files.push_back("embedded-minmax-1.ds");
+    writeFile(files[0], 0);
+    writeFile(files[1], 10000);
+    checkIndex(files[0], 0);
+    checkIndex(files[1], 10000);
+    checkMinMaxIndexModule(files);
+    checkSortedIndexModule(files);
+    cout << "embedded min/max index tests passed.\n";
+    return 0;
+}
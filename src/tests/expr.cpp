@@ -1,16 +1,27 @@
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include <string>
 
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
 
+#include <Lintel/Double.hpp>
 #include <Lintel/StringUtil.hpp>
 
 #include <DataSeries/commonargs.hpp>
 #include <DataSeries/DataSeriesModule.hpp>
 #include <DataSeries/DSExpr.hpp>
 
+#include <module/DSExprImpl.hpp>
+
 using namespace std;
 
+bool isCompiled(DSExpr *expr) {
+    return dynamic_cast<DSExprImpl::ExprCompiled *>(expr) != NULL;
+}
+
 
 void makeFile() {
     static string extent_type_xml(
@@ -155,9 +166,186 @@ void testNullExpr() {
     cout << "Null Expr passed.\n";
 }
 
+// (flag > 1) + 1, -(flag > small), !(count + small), (latency < 1) && (small + count),
+// count == (small > latency)
+vector<DSExpr *> illTypedExprs(ExtentSeries &series) {
+    using namespace DSExprImpl;
+    vector<DSExpr *> ret;
+    ret.push_back(new ExprAdd(new ExprGt(new ExprField(series, "flag"),
+                                         new ExprNumericConstant(1)),
+                              new ExprNumericConstant(1)));
+    ret.push_back(new ExprMinus(new ExprGt(new ExprField(series, "flag"),
+                                           new ExprField(series, "small"))));
+    ret.push_back(new ExprLnot(new ExprAdd(new ExprField(series, "count"),
+                                           new ExprField(series, "small"))));
+    ret.push_back(new ExprLand(new ExprLt(new ExprField(series, "latency"),
+                                          new ExprNumericConstant(1)),
+                               new ExprAdd(new ExprField(series, "small"),
+                                           new ExprField(series, "count"))));
+    ret.push_back(new ExprEq(new ExprField(series, "count"),
+                             new ExprGt(new ExprField(series, "small"),
+                                        new ExprField(series, "latency"))));
+    return ret;
+}
+
+// Numeric and boolean expressions are evaluated by a compiled program;
+// check it against the values calculated directly for every field type.
+void testCompiled() {
+    static string extent_type_xml(
+        "<ExtentType name=\"Test1\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\" >"
+        "  <field type=\"bool\" name=\"flag\" />"
+        "  <field type=\"byte\" name=\"small\" />"
+        "  <field type=\"int32\" name=\"count\" opt_nullable=\"yes\" />"
+        "  <field type=\"int64\" name=\"time\" />"
+        "  <field type=\"double\" name=\"latency\" />"
+        "</ExtentType>");
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr extent_type(library.registerTypePtr(extent_type_xml));
+
+    ExtentSeries series(extent_type);
+    series.newExtent();
+    BoolField flag(series, "flag");
+    ByteField small(series, "small");
+    Int32Field count(series, "count", Field::flag_nullable);
+    Int64Field time(series, "time");
+    DoubleField latency(series, "latency");
+
+    boost::scoped_ptr<DSExpr> arith(DSExpr::make(series, "(count + small) * 2 - latency / 4"));
+    boost::scoped_ptr<DSExpr> half(DSExpr::make(series, "time / 4294967296"));
+    boost::scoped_ptr<DSExpr> field(DSExpr::make(series, "flag"));
+    boost::scoped_ptr<DSExpr> compare(DSExpr::make(series, "count > 10 && !(small == 3) || "
+                                                   "latency <= 0.5 && flag != 0"));
+
+    series.newRecord();
+    for (int i = 0; i < 100; ++i) {
+        flag.set(i % 3 == 0);
+        small.set(i % 7);
+        if (i % 5 == 0) {
+            count.setNull(); // reads as 0
+        } else {
+            count.set(i * 3);
+        }
+        time.set(static_cast<int64_t>(i) << 31);
+        latency.set(i * 0.01);
+
+        double c = count.isNull() ? 0 : count.val();
+        SINVARIANT(Double::eq(arith->valDouble(), (c + small.val()) * 2 - latency.val() / 4));
+        SINVARIANT(half->valDouble() == i * 0.5);
+        SINVARIANT(field->valBool() == flag.val() && field->valDouble() == (flag.val() ? 1 : 0));
+        bool expect = (c > 10 && small.val() != 3) || (latency.val() <= 0.5 && flag.val());
+        SINVARIANT(compare->valBool() == expect);
+        SINVARIANT(arith->isNull() == count.isNull());
+    }
+    SINVARIANT(isCompiled(arith.get()) && isCompiled(half.get()) && isCompiled(field.get())
+               && isCompiled(compare.get()));
+
+    // The grammar keeps booleans and numbers apart, but trees built some other way could
+    // have nested operands of the wrong type.  Those are errors the tree reports, so they
+    // mustn't be compiled.
+    vector<DSExpr *> ill_typed(illTypedExprs(series));
+    for (vector<DSExpr *>::iterator e = ill_typed.begin(); e != ill_typed.end(); ++e) {
+        SINVARIANT(DSExprImpl::ExprCompiled::make(*e) == *e);
+        delete *e;
+    }
+    cout << "Compiled Expr passed.\n";
+}
+
+// selectRows must match valBool() on every row whether or not the expression is compiled
+void testSelectRows() {
+    static string extent_type_xml(
+        "<ExtentType name=\"Test2\" namespace=\"ssd.hpl.hp.com\" version=\"1.0\" >"
+        "  <field type=\"bool\" name=\"flag\" opt_nullable=\"yes\" />"
+        "  <field type=\"int32\" name=\"count\" opt_nullable=\"yes\" />"
+        "  <field type=\"int64\" name=\"time\" />"
+        "  <field type=\"double\" name=\"latency\" />"
+        "  <field type=\"variable32\" name=\"name\" />"
+        "</ExtentType>");
+
+    ExtentTypeLibrary library;
+    const ExtentType::Ptr extent_type(library.registerTypePtr(extent_type_xml));
+
+    ExtentSeries series(extent_type);
+    series.newExtent();
+    BoolField flag(series, "flag", Field::flag_nullable);
+    Int32Field count(series, "count", Field::flag_nullable);
+    Int64Field time(series, "time");
+    DoubleField latency(series, "latency");
+    Variable32Field name(series, "name");
+
+    const int nrows = 1000; // several batches and a partial one
+    for (int i = 0; i < nrows; ++i) {
+        series.newRecord();
+        if (i % 13 == 0) {
+            flag.setNull();
+        } else {
+            flag.set(i % 4 == 0);
+        }
+        if (i % 5 == 0) {
+            count.setNull();
+        } else {
+            count.set(i % 17);
+        }
+        time.set(static_cast<int64_t>(i) * 1000000007LL);
+        latency.set(i * 0.25);
+        name.set(i % 2 == 0 ? "even" : "odd");
+    }
+
+    vector<string> exprs;
+    exprs.push_back("flag");
+    exprs.push_back("count > 8 || latency < 10");
+    exprs.push_back("time > 500000003500 && !(flag == 1)");
+    exprs.push_back("name == \"even\" && count == 3"); // not compiled
+    for (vector<string>::iterator e = exprs.begin(); e != exprs.end(); ++e) {
+        boost::scoped_ptr<DSExpr> expr(DSExpr::make(series, *e));
+        vector<bool> selected;
+        series.setCurPos(series.getExtentRef().fixeddata.begin());
+        ++series;
+        const void *pos = series.getCurPos();
+        expr->selectRows(series, selected);
+        SINVARIANT(series.getCurPos() == pos);
+        SINVARIANT(selected.size() == static_cast<size_t>(nrows));
+
+        int nselected = 0, row = 0;
+        series.setCurPos(series.getExtentRef().fixeddata.begin());
+        for (; series.more(); series.next(), ++row) {
+            SINVARIANT(selected[row] == expr->valBool());
+            nselected += selected[row] ? 1 : 0;
+        }
+        SINVARIANT(nselected > 0 && nselected < nrows);
+    }
+
+    // An ill-typed where clause, count > 8 && (latency + count), isn't compiled, so
+    // selectRows() goes through the tree, which reports the error as it always has.
+    using namespace DSExprImpl;
+    DSExpr *tree = new ExprLand(new ExprGt(new ExprField(series, "count"),
+                                           new ExprNumericConstant(8)),
+                                new ExprAdd(new ExprField(series, "latency"),
+                                            new ExprField(series, "count")));
+    boost::scoped_ptr<DSExpr> ill_typed(ExprCompiled::make(tree));
+    SINVARIANT(ill_typed.get() == tree);
+    cout.flush();
+    pid_t pid = fork();
+    SINVARIANT(pid >= 0);
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, 2); // the expected error
+        vector<bool> selected;
+        ill_typed->selectRows(series, selected);
+        _exit(0);
+    }
+    int status = 0;
+    SINVARIANT(waitpid(pid, &status, 0) == pid);
+    INVARIANT(!WIFEXITED(status) || WEXITSTATUS(status) != 0,
+              "ill-typed where clause was evaluated");
+    cout << "Select rows passed.\n";
+}
+
 int main(int argc, char **argv) {
     testSeriesSelect();
     testNullExpr();
+    testCompiled();
+    testSelectRows();
     makeFile();
 
     return 0;
@@ -0,0 +1,112 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2012, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that reading with multiple reader threads, or with the shared unpack
+    pool, returns the same extents in the same order as reading with a single
+    reader thread and private unpack threads.
+*/
+
+#include <iostream>
+#include <vector>
+
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+
+struct ExtentInfo {
+    string source, type;
+    int64_t offset;
+    size_t size;
+};
+
+void checkSame(const vector<ExtentInfo> &a, const vector<ExtentInfo> &b) {
+    SINVARIANT(a.size() == b.size());
+    for (size_t i = 0; i < a.size(); ++i) {
+        INVARIANT(a[i].source == b[i].source && a[i].type == b[i].type
+                  && a[i].offset == b[i].offset && a[i].size == b[i].size,
+                  boost::format("mismatch on extent %d: %s:%d vs %s:%d")
+                  % i % a[i].source % a[i].offset % b[i].source % b[i].offset);
+    }
+}
+
+void addSources(TypeIndexModule &source, const vector<string> &files) {
+    for (vector<string>::const_iterator i = files.begin(); i != files.end(); ++i) {
+        source.addSource(*i);
+    }
+}
+
+bool readOne(TypeIndexModule &source, vector<ExtentInfo> &into) {
+    Extent::Ptr e = source.getSharedExtent();
+    if (e == NULL) {
+        SINVARIANT(source.isClosed());
+        return false;
+    }
+    ExtentInfo info;
+    info.source = e->extent_source;
+    info.type = e->getTypePtr()->getName();
+    info.offset = e->extent_source_offset;
+    info.size = e->size();
+    into.push_back(info);
+    return true;
+}
+
+vector<ExtentInfo> readAll(const vector<string> &files, unsigned max_compressed,
+                           int n_reader_threads, int n_unpack_threads = 2) {
+    TypeIndexModule source("");
+    addSources(source, files);
+    source.startPrefetching(max_compressed, 4 * max_compressed, n_unpack_threads,
+                            n_reader_threads);
+
+    vector<ExtentInfo> ret;
+    while (readOne(source, ret)) { }
+    return ret;
+}
+
+// Several modules sharing the unpack pool, consumed in lock step the way a
+// join would; with a tiny budget this only completes if a module with nothing
+// unpacked can always make progress.
+void checkSharedPool(const vector<string> &files, const vector<ExtentInfo> &base) {
+    IndexSourceModule::setSharedUnpackLimits(3, 1);
+    vector<TypeIndexModule *> sources;
+    vector< vector<ExtentInfo> > results(3);
+    for (unsigned i = 0; i < results.size(); ++i) {
+        sources.push_back(new TypeIndexModule(""));
+        addSources(*sources.back(), files);
+        sources.back()->startPrefetching(8 * 1024 * 1024, 32 * 1024 * 1024, -1, 2);
+    }
+    for (bool any = true; any; ) {
+        any = false;
+        for (unsigned i = 0; i < sources.size(); ++i) {
+            if (readOne(*sources[i], results[i])) {
+                any = true;
+            }
+        }
+    }
+    for (unsigned i = 0; i < sources.size(); ++i) {
+        checkSame(base, results[i]);
+        delete sources[i];
+    }
+    IndexSourceModule::setSharedUnpackLimits();
+}
+
+int main(int argc, char *argv[]) {
+    SINVARIANT(argc > 1);
+    vector<string> files(argv + 1, argv + argc);
+
+    vector<ExtentInfo> base = readAll(files, 8 * 1024 * 1024, 1);
+    SINVARIANT(!base.empty());
+    for (int readers = 2; readers <= 8; readers *= 2) {
+        checkSame(base, readAll(files, 8 * 1024 * 1024, readers));
+        // small compressed limit so the readers have to throttle
+        checkSame(base, readAll(files, 16 * 1024, readers));
+    }
+    checkSame(base, readAll(files, 8 * 1024 * 1024, 1, -1));
+    checkSharedPool(files, base);
+    cout << "index source reader threads passed.\n";
+    return 0;
+}
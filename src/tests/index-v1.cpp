@@ -0,0 +1,123 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2012, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that the extended extent index matches the extents in the file,
+    and that files written without it are still readable.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::IndexV1\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"number\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 20;
+
+void writeFile(const string &filename, int compression_modes) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename, compression_modes);
+    sink.setIndexV1();
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field number(s, "number");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < 50 * i; ++j) {
+            s.newRecord();
+            number.set(j);
+            name.set(string(j % 13, 'a' + j % 26));
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+void checkFile(const string &filename) {
+    DataSeriesSource source(filename);
+    Extent::Ptr index_v1 = source.getIndexV1();
+    SINVARIANT(index_v1 != NULL);
+    SINVARIANT(source.getIndexV1() == index_v1);
+
+    ExtentSeries v0(source.index_extent), v1(index_v1);
+    Int64Field v0_offset(v0, "offset"), v1_offset(v1, "offset");
+    Variable32Field v0_type(v0, "extenttype"), v1_type(v1, "extenttype");
+    Int32Field size(v1, "size"), nrecords(v1, "nrecords");
+    ByteField fixed_mode(v1, "fixed_compress_mode"), variable_mode(v1, "variable_compress_mode");
+    Int32Field fixed_uncompressed(v1, "fixed_uncompressed_size");
+    Int32Field fixed_compressed(v1, "fixed_compressed_size");
+    Int32Field variable_uncompressed(v1, "variable_uncompressed_size");
+    Int32Field variable_compressed(v1, "variable_compressed_size");
+    Int32Field adler32(v1, "compressed_adler32"), bjhash(v1, "uncompressed_bjhash");
+
+    unsigned nrows = 0;
+    for (; v1.morerecords(); ++v0, ++v1, ++nrows) {
+        SINVARIANT(v0.morerecords());
+        SINVARIANT(v0_offset.val() == v1_offset.val());
+        SINVARIANT(v0_type.stringval() == v1_type.stringval());
+
+        off64_t offset = v1_offset.val();
+        Extent::ByteArray packed;
+        SINVARIANT(source.preadCompressed(offset, packed));
+        SINVARIANT(static_cast<size_t>(size.val()) == packed.size());
+        SINVARIANT(offset == v1_offset.val() + size.val());
+
+        const int32_t *header = reinterpret_cast<const int32_t *>(packed.begin());
+        SINVARIANT(fixed_compressed.val() == header[0]
+                   && variable_compressed.val() == header[1]
+                   && nrecords.val() == header[2]
+                   && variable_uncompressed.val() == header[3]
+                   && adler32.val() == header[4] && bjhash.val() == header[5]);
+        SINVARIANT(fixed_mode.val() == packed[6*4] && variable_mode.val() == packed[6*4+1]);
+
+        Extent::Ptr e(new Extent(source.getLibrary(), packed, source.needBitflip()));
+        SINVARIANT(e->nRecords() == static_cast<size_t>(nrecords.val()));
+        SINVARIANT(e->fixeddata.size() == static_cast<size_t>(fixed_uncompressed.val()));
+    }
+    // The V0 index also lists itself
+    SINVARIANT(v0.morerecords() && v0_type.stringval() == "DataSeries: ExtentIndex");
+    ++v0;
+    SINVARIANT(!v0.morerecords());
+    SINVARIANT(nrows == nextents + 1); // + the type extent
+
+    // Sequential reading sees the extended index, but nothing else changes
+    unsigned nindex = 0, ndata = 0;
+    for (Extent::Ptr e(source.readExtent()); e != NULL; e.reset(source.readExtent())) {
+        if (e->getTypePtr() == ExtentType::getDataSeriesIndexTypeV1Ptr()
+            || e->getTypePtr() == ExtentType::getDataSeriesIndexTypeV0Ptr()) {
+            ++nindex;
+        } else {
+            ++ndata;
+        }
+    }
+    SINVARIANT(nindex == 2 && ndata == nextents);
+}
+
+int main(int argc, char *argv[]) {
+    SINVARIANT(argc == 2);
+    writeFile("index-v1.ds", Extent::compress_all);
+    checkFile("index-v1.ds");
+    writeFile("index-v1.ds", 0); // no compression
+    checkFile("index-v1.ds");
+
+    // written before the extended index existed
+    DataSeriesSource old(argv[1]);
+    SINVARIANT(old.getIndexV1() == NULL);
+    cout << "extended index tests passed.\n";
+    return 0;
+}
@@ -0,0 +1,139 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2012, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that reading uncompressed extents through mmap gives the same data as
+    reading them with pread, and that the fixed data is used in place when it
+    can be.
+*/
+
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+
+using namespace std;
+using boost::format;
+
+const string plain_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Mmap::Plain\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"number\" />\n"
+        "  <field type=\"double\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const string relative_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::Mmap::Relative\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"number\" pack_relative=\"number\" />\n"
+        "  <field type=\"double\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 16;
+
+string nameFor(unsigned extent, unsigned record) {
+    return string(extent + record % 7, 'a' + record % 26);
+}
+
+void fill(const ExtentType::Ptr type, unsigned extent_num, DataSeriesSink &sink) {
+    Extent::Ptr e(new Extent(type));
+    ExtentSeries s(e);
+    Int64Field number(s, "number");
+    DoubleField value(s, "value");
+    Variable32Field name(s, "name");
+
+    // varying sizes so that the extents land at different alignments
+    for (unsigned i = 0; i < 100 + 37 * extent_num; ++i) {
+        s.newRecord();
+        number.set(1000 * extent_num + i);
+        value.set(i * 0.5);
+        name.set(nameFor(extent_num, i));
+    }
+    sink.writeExtent(*e, NULL);
+}
+
+void writeFile(const string &filename) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr plain = library.registerTypePtr(plain_xml);
+    ExtentType::Ptr relative = library.registerTypePtr(relative_xml);
+
+    DataSeriesSink sink(filename, 0); // no compression
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        fill(plain, i, sink);
+        fill(relative, i, sink);
+    }
+    sink.close();
+}
+
+void check(Extent::Ptr e, unsigned extent_num) {
+    ExtentSeries s(e);
+    Int64Field number(s, "number");
+    DoubleField value(s, "value");
+    Variable32Field name(s, "name");
+
+    unsigned i = 0;
+    for (; s.morerecords(); ++s, ++i) {
+        SINVARIANT(number.val() == 1000 * extent_num + i);
+        SINVARIANT(value.val() == i * 0.5);
+        SINVARIANT(name.stringval() == nameFor(extent_num, i));
+    }
+    SINVARIANT(i == 100 + 37 * extent_num);
+}
+
+void readFile(const string &filename, bool use_mmap) {
+    DataSeriesSource source(filename);
+    source.setUseMmap(use_mmap);
+
+    unsigned nplain = 0, nrelative = 0, nmapped = 0;
+    while (true) {
+        Extent::Ptr e(source.readExtent());
+        if (e == NULL) {
+            break;
+        }
+        if (e->getTypePtr()->getName() == "Test::Mmap::Plain") {
+            check(e, nplain);
+            ++nplain;
+        } else if (e->getTypePtr()->getName() == "Test::Mmap::Relative") {
+            SINVARIANT(!e->fixeddata.isMapped()); // relative packing has to be undone
+            check(e, nrelative);
+            ++nrelative;
+        } else {
+            SINVARIANT(e->getTypePtr()->getName().compare(0, 12, "DataSeries: ") == 0);
+            continue;
+        }
+        if (e->fixeddata.isMapped()) {
+            SINVARIANT(use_mmap);
+            ++nmapped;
+        }
+
+        // writing to a mapped extent is private to this process
+        ExtentSeries s(e);
+        Int64Field number(s, "number");
+        number.set(-1);
+        SINVARIANT(number.val() == -1);
+        // and growing it moves it onto the heap
+        s.newRecord();
+        SINVARIANT(!e->fixeddata.isMapped());
+    }
+    SINVARIANT(nplain == nextents && nrelative == nextents);
+    // extents are only 4 byte aligned, so only some of them can be mapped
+    SINVARIANT(!use_mmap || nmapped > 0);
+    cout << format("read %s: %d of %d plain extents mapped\n")
+        % (use_mmap ? "mmap" : "pread") % nmapped % nplain;
+}
+
+int main() {
+    string filename("mmap-extent.ds");
+    writeFile(filename);
+    readFile(filename, false);
+    readFile(filename, true);
+    // and again to check that the file was not modified by the writes
+    readFile(filename, true);
+    cout << "mmap extent tests passed.\n";
+    return 0;
+}
@@ -0,0 +1,147 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that the per-module statistics count every extent into and out of
+    each module of a pipeline, and that ModuleStatsLogger writes them.
+*/
+
+#include <iostream>
+#include <sstream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/ModuleStatsLogger.hpp>
+#include <DataSeries/PrefetchBufferModule.hpp>
+#include <DataSeries/RowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ModuleStats\" version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 20, nrecords = 1000;
+
+void writeFile(const string &filename) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field value(s, "value");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            value.set(i * nrecords + j);
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+class CountAnalysis : public RowAnalysisModule {
+  public:
+    CountAnalysis(DataSeriesModule &source) : RowAnalysisModule(source), count(0) { }
+
+    virtual void processRow() {
+        ++count;
+    }
+
+    uint64_t count;
+};
+
+DataSeriesModule::ModuleStats findStats(const string &name) {
+    vector<pair<string, DataSeriesModule::ModuleStats> > all;
+    DataSeriesModule::getAllStats(all);
+    for (vector<pair<string, DataSeriesModule::ModuleStats> >::iterator i = all.begin();
+         i != all.end(); ++i) {
+        if (i->first == name) {
+            return i->second;
+        }
+    }
+    FATAL_ERROR(format("no module named %s") % name);
+}
+
+void checkFlow(const DataSeriesModule::ModuleStats &s, uint64_t bytes) {
+    SINVARIANT(s.extents_in == nextents && s.rows_in == nextents * nrecords);
+    SINVARIANT(s.extents_out == nextents && s.rows_out == nextents * nrecords);
+    SINVARIANT(s.bytes_out == bytes);
+    SINVARIANT(s.get_seconds >= s.upstream_seconds && s.computeSeconds() >= 0);
+}
+
+int main() {
+    writeFile("module-stats.ds");
+
+    {
+        TypeIndexModule source("Test::ModuleStats");
+        source.addSource("module-stats.ds");
+        PrefetchBufferModule prefetch(source);
+        CountAnalysis analysis(prefetch);
+        analysis.setModuleName("count");
+        SINVARIANT(source.getModuleName() == "TypeIndexModule");
+        SINVARIANT(analysis.getModuleName() == "count");
+
+        ModuleStatsLogger logger("module-stats-log.ds", 0.001);
+        logger.start();
+        analysis.getAndDeleteShared();
+        logger.stop();
+        SINVARIANT(analysis.count == nextents * nrecords);
+
+        uint64_t bytes = source.total_uncompressed_bytes;
+        checkFlow(findStats("count"), bytes);
+        checkFlow(findStats("PrefetchBufferModule"), bytes);
+        DataSeriesModule::ModuleStats s(findStats("TypeIndexModule"));
+        // the source counts what it read from the file as its input
+        SINVARIANT(s.extents_in == nextents && s.bytes_in == source.total_compressed_bytes);
+        SINVARIANT(s.extents_out == nextents && s.bytes_out == bytes);
+        SINVARIANT(s.queue_samples == nextents + 1);
+
+        ostringstream report;
+        DataSeriesModule::printAllStats(report);
+        SINVARIANT(report.str().find("count: in 20 extents, 20000 rows") != string::npos);
+        cout << report.str();
+    }
+
+    // modules are forgotten when they are destroyed
+    vector<pair<string, DataSeriesModule::ModuleStats> > all;
+    DataSeriesModule::getAllStats(all);
+    SINVARIANT(all.empty());
+
+    // the final snapshot of the log has the totals
+    TypeIndexModule log("DataSeries: ModuleStats");
+    log.addSource("module-stats-log.ds");
+    ExtentSeries s;
+    DoubleField snapshot_time(s, "snapshot_time");
+    Variable32Field module(s, "module");
+    Int64Field rows_out(s, "rows_out");
+    double last_time = 0;
+    int64_t last_rows = -1;
+    unsigned nsnapshots = 0;
+    for (Extent::Ptr e(log.getSharedExtent()); e != NULL; e = log.getSharedExtent()) {
+        for (s.setExtent(e); s.more(); s.next()) {
+            SINVARIANT(snapshot_time.val() >= last_time);
+            if (snapshot_time.val() > last_time) {
+                ++nsnapshots;
+            }
+            last_time = snapshot_time.val();
+            if (module.stringval() == "count") {
+                SINVARIANT(rows_out.val() >= last_rows);
+                last_rows = rows_out.val();
+            }
+        }
+    }
+    SINVARIANT(nsnapshots >= 1 && last_rows == nextents * nrecords);
+
+    cout << "module-stats tests passed.\n";
+    return 0;
+}
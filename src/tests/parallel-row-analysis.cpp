@@ -0,0 +1,163 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that a ParallelRowAnalysisModule gets the same answer as running
+    the analysis on one thread, and passes every extent on.
+*/
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/ParallelRowAnalysisModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ParallelRowAnalysis\" "
+        "  version=\"1.0\" >\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 50, nrecords = 2000, nbuckets = 10;
+
+void writeFile(const string &filename) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field value(s, "value");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            value.set((i * 7919 + j * 104729) % 100000);
+            name.set(str(format("name-%d") % (j % nbuckets)));
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+class SumAnalysis : public RowAnalysisModule {
+  public:
+    SumAnalysis(DataSeriesModule &source, const string &where = "value > 5000")
+        : RowAnalysisModule(source), value(series, "value"), name(series, "name"),
+          count(0), sum(0), buckets(nbuckets, 0), did_prepare(false)
+    {
+        if (!where.empty()) {
+            setWhereExpr(where);
+        }
+    }
+
+    virtual void prepareForProcessing() {
+        did_prepare = true;
+    }
+
+    virtual void processRow() {
+        ++count;
+        sum += value.val();
+        ++buckets[name.stringval()[5] - '0'];
+    }
+
+    static void merge(RowAnalysisModule &into, RowAnalysisModule &from) {
+        SumAnalysis &a(dynamic_cast<SumAnalysis &>(into)), &b(dynamic_cast<SumAnalysis &>(from));
+        a.count += b.count;
+        a.sum += b.sum;
+        for (unsigned i = 0; i < nbuckets; ++i) {
+            a.buckets[i] += b.buckets[i];
+        }
+    }
+
+    static RowAnalysisModule *make(DataSeriesModule &source) {
+        return new SumAnalysis(source);
+    }
+
+    static RowAnalysisModule *makeUnfiltered(DataSeriesModule &source) {
+        return new SumAnalysis(source, "");
+    }
+
+    Int64Field value;
+    Variable32Field name;
+    uint64_t count;
+    int64_t sum;
+    vector<uint64_t> buckets;
+    bool did_prepare;
+};
+
+void checkParallel(const string &filename, const SumAnalysis &expect, int n_threads,
+                   size_t max_queued_bytes, bool where_on_parallel = false) {
+    TypeIndexModule source("Test::ParallelRowAnalysis");
+    source.addSource(filename);
+    ParallelRowAnalysisModule parallel(source,
+                                       where_on_parallel
+                                       ? boost::bind(&SumAnalysis::makeUnfiltered, _1)
+                                       : boost::bind(&SumAnalysis::make, _1),
+                                       boost::bind(&SumAnalysis::merge, _1, _2),
+                                       n_threads, max_queued_bytes);
+    if (where_on_parallel) {
+        parallel.setWhereExpr("value > 5000");
+    }
+    unsigned nextent = 0;
+    for (Extent::Ptr e(parallel.getSharedExtent()); e != NULL; e = parallel.getSharedExtent()) {
+        ++nextent;
+    }
+    SINVARIANT(nextent == nextents);
+    SINVARIANT(parallel.getSharedExtent() == NULL);
+
+    SumAnalysis &result(dynamic_cast<SumAnalysis &>(parallel.getResult()));
+    SINVARIANT(result.count == expect.count && result.sum == expect.sum);
+    SINVARIANT(result.buckets == expect.buckets);
+    SINVARIANT(result.did_prepare);
+    SINVARIANT(parallel.processed_rows == expect.processed_rows
+               && parallel.ignored_rows == expect.ignored_rows);
+    SINVARIANT(result.processed_rows == expect.processed_rows
+               && result.ignored_rows == expect.ignored_rows);
+}
+
+int main() {
+    writeFile("parallel-row-analysis.ds");
+
+    TypeIndexModule source("Test::ParallelRowAnalysis");
+    source.addSource("parallel-row-analysis.ds");
+    SumAnalysis serial(source);
+    serial.getAndDeleteShared();
+    SINVARIANT(serial.count > 0 && serial.ignored_rows > 0);
+
+    checkParallel("parallel-row-analysis.ds", serial, 1, 64*1024*1024);
+    checkParallel("parallel-row-analysis.ds", serial, 4, 64*1024*1024);
+    checkParallel("parallel-row-analysis.ds", serial, 4, 1); // one extent at a time
+    checkParallel("parallel-row-analysis.ds", serial, -1, 64*1024*1024);
+    // more workers than extents, so some analyses never see one
+    checkParallel("parallel-row-analysis.ds", serial, 2 * nextents, 64*1024*1024);
+    checkParallel("parallel-row-analysis.ds", serial, 4, 64*1024*1024, true);
+
+    // abandoning the module part way through has to stop the workers
+    {
+        TypeIndexModule abandoned_source("Test::ParallelRowAnalysis");
+        abandoned_source.addSource("parallel-row-analysis.ds");
+        {
+            ParallelRowAnalysisModule abandoned(abandoned_source,
+                                                boost::bind(&SumAnalysis::make, _1),
+                                                boost::bind(&SumAnalysis::merge, _1, _2), 4);
+            SINVARIANT(abandoned.getSharedExtent() != NULL);
+        }
+        abandoned_source.close();
+    }
+
+    cout << "parallel row analysis tests passed.\n";
+    return 0;
+}
@@ -0,0 +1,236 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that a ParallelSequenceModule returns what its chain does on one
+    thread, in order or as a set, for chains that drop, transform and split
+    extents.
+*/
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/ParallelSequenceModule.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::ParallelSequence\" "
+        "  version=\"1.0\" >\n"
+        "  <field type=\"int32\" name=\"extent\" />\n"
+        "  <field type=\"int64\" name=\"value\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 60;
+
+void writeFile(const string &filename) {
+    ExtentTypeLibrary library;
+    ExtentType::Ptr type = library.registerTypePtr(test_xml);
+
+    DataSeriesSink sink(filename);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int32Field extent(s, "extent");
+        Int64Field value(s, "value");
+        for (unsigned j = 0; j < 500 + (i * 7919) % 1500; ++j) {
+            s.newRecord();
+            extent.set(i);
+            value.set((i * 7919 + j * 104729) % 100000);
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+// Drops every third extent, taking a varying time over each so the workers finish out of order
+class DropModule : public DataSeriesModule {
+  public:
+    DropModule(DataSeriesModule &source) : source(source), extent(series, "extent") { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        while (true) {
+            Extent::Ptr e = getUpstreamExtent(source);
+            if (e == NULL) {
+                return e;
+            }
+            series.setExtent(e);
+            int32_t num = extent.val();
+            series.clearExtent();
+            usleep((num * 37 % 5) * 1000);
+            if (num % 3 != 0) {
+                return e;
+            }
+        }
+    }
+
+    DataSeriesModule &source;
+    ExtentSeries series;
+    Int32Field extent;
+};
+
+// Makes a new extent of the rows with even values, with the values doubled
+class DoubleEvenModule : public DataSeriesModule {
+  public:
+    DoubleEvenModule(DataSeriesModule &source)
+        : source(source), in_extent(in, "extent"), in_value(in, "value"),
+          out_extent(out, "extent"), out_value(out, "value") { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        Extent::Ptr e = getUpstreamExtent(source);
+        if (e == NULL) {
+            return e;
+        }
+        Extent::Ptr ret(new Extent(e->getTypePtr()));
+        out.setExtent(ret);
+        for (in.setExtent(e); in.morerecords(); ++in) {
+            if (in_value.val() % 2 == 0) {
+                out.newRecord();
+                out_extent.set(in_extent.val());
+                out_value.set(in_value.val() * 2);
+            }
+        }
+        in.clearExtent();
+        out.clearExtent();
+        return ret;
+    }
+
+    DataSeriesModule &source;
+    ExtentSeries in, out;
+    Int32Field in_extent;
+    Int64Field in_value;
+    Int32Field out_extent;
+    Int64Field out_value;
+};
+
+// Returns the first and second halves of each extent separately
+class SplitModule : public DataSeriesModule {
+  public:
+    SplitModule(DataSeriesModule &source)
+        : source(source), in_extent(in, "extent"), in_value(in, "value"),
+          out_extent(out, "extent"), out_value(out, "value") { }
+
+    virtual Extent::Ptr getSharedExtent() {
+        if (second_half != NULL) {
+            Extent::Ptr ret;
+            ret.swap(second_half);
+            return ret;
+        }
+        Extent::Ptr e = getUpstreamExtent(source);
+        if (e == NULL) {
+            return e;
+        }
+        Extent::Ptr first_half(new Extent(e->getTypePtr()));
+        second_half.reset(new Extent(e->getTypePtr()));
+        size_t half = e->nRecords() / 2, row = 0;
+        for (in.setExtent(e); in.morerecords(); ++in, ++row) {
+            out.setExtent(row < half ? first_half : second_half);
+            out.newRecord();
+            out_extent.set(in_extent.val());
+            out_value.set(in_value.val());
+        }
+        in.clearExtent();
+        out.clearExtent();
+        return first_half;
+    }
+
+    DataSeriesModule &source;
+    ExtentSeries in, out;
+    Int32Field in_extent;
+    Int64Field in_value;
+    Int32Field out_extent;
+    Int64Field out_value;
+    Extent::Ptr second_half;
+};
+
+void makeChain(SequenceModule &chain) {
+    chain.addModule(new DropModule(chain.tail()));
+    chain.addModule(new DoubleEvenModule(chain.tail()));
+    chain.addModule(new SplitModule(chain.tail()));
+}
+
+// extent number, rows and sum of values of each extent, in the order returned
+typedef vector<boost::tuple<int32_t, size_t, int64_t> > Summary;
+
+void summarize(DataSeriesModule &module, Summary &into) {
+    ExtentSeries s;
+    Int32Field extent(s, "extent");
+    Int64Field value(s, "value");
+    for (Extent::Ptr e(module.getSharedExtent()); e != NULL; e = module.getSharedExtent()) {
+        int32_t num = -1;
+        int64_t sum = 0;
+        for (s.setExtent(e); s.morerecords(); ++s) {
+            INVARIANT(num == -1 || num == extent.val(), "rows from two extents mixed up");
+            num = extent.val();
+            sum += value.val();
+        }
+        into.push_back(boost::make_tuple(num, e->nRecords(), sum));
+    }
+    SINVARIANT(module.getSharedExtent() == NULL);
+}
+
+void checkParallel(const string &filename, const Summary &expect, bool in_order,
+                   int n_threads, size_t max_queued_bytes) {
+    TypeIndexModule source("Test::ParallelSequence");
+    source.addSource(filename);
+    ParallelSequenceModule parallel(source, boost::bind(makeChain, _1), in_order, n_threads,
+                                    max_queued_bytes);
+    Summary got;
+    summarize(parallel, got);
+    if (in_order) {
+        SINVARIANT(got == expect);
+    } else {
+        Summary sorted_expect(expect);
+        sort(sorted_expect.begin(), sorted_expect.end());
+        sort(got.begin(), got.end());
+        SINVARIANT(got == sorted_expect);
+    }
+}
+
+int main() {
+    writeFile("parallel-sequence.ds");
+
+    SequenceModule serial(new TypeIndexModule("Test::ParallelSequence"));
+    dynamic_cast<TypeIndexModule &>(serial.tail()).addSource("parallel-sequence.ds");
+    makeChain(serial);
+    Summary expect;
+    summarize(serial, expect);
+    SINVARIANT(expect.size() == 2 * (nextents - nextents / 3));
+
+    for (int in_order = 0; in_order < 2; ++in_order) {
+        checkParallel("parallel-sequence.ds", expect, in_order, 1, 64*1024*1024);
+        checkParallel("parallel-sequence.ds", expect, in_order, 4, 64*1024*1024);
+        checkParallel("parallel-sequence.ds", expect, in_order, 4, 1); // one extent at a time
+        checkParallel("parallel-sequence.ds", expect, in_order, -1, 64*1024*1024);
+    }
+
+    // abandoning the module part way through has to stop the workers
+    {
+        TypeIndexModule abandoned_source("Test::ParallelSequence");
+        abandoned_source.addSource("parallel-sequence.ds");
+        {
+            ParallelSequenceModule abandoned(abandoned_source, boost::bind(makeChain, _1),
+                                             true, 4);
+            SINVARIANT(abandoned.getSharedExtent() != NULL);
+        }
+        abandoned_source.close();
+    }
+
+    cout << "parallel sequence tests passed.\n";
+    return 0;
+}
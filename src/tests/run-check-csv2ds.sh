@@ -10,3 +10,28 @@ echo "Trying with different prefix/separator"
 ../process/csv2ds --compress-lzf --comment-prefix='CCC ' --field-separator=ZZZ --xml-desc-file=$SRC/check-data/csv2ds-1.xml $SRC/check-data/csv2ds-2.csv csv2ds-2.ds
 ../process/ds2txt --skip-index csv2ds-2.ds >csv2ds-2.txt
 cmp csv2ds-2.txt $SRC/check-data/csv2ds-1.txt.ref
+echo "Trying with many chunks parsed in parallel"
+awk 'BEGIN { for (i = 0; i < 20000; ++i) {
+    if (i % 1000 == 7) { print "# comment"; continue; }
+    printf "%s,%d,%d,%d,%g,\"v%d, \"\"q\"\"\"\n", (i % 2 ? "true" : "false"), i % 100, i, i * 1000, i / 7, i % 997
+} }' >csv2ds-3.csv
+../process/csv2ds --compress-lzf --parse-threads=1 --xml-desc-file=$SRC/check-data/csv2ds-1.xml csv2ds-3.csv csv2ds-3a.ds
+../process/csv2ds --compress-lzf --parse-threads=3 --chunk-size-kb=4 --xml-desc-file=$SRC/check-data/csv2ds-1.xml csv2ds-3.csv csv2ds-3b.ds
+../process/ds2txt --skip-all csv2ds-3a.ds >csv2ds-3a.txt
+../process/ds2txt --skip-all csv2ds-3b.ds >csv2ds-3b.txt
+test `wc -l <csv2ds-3a.txt` -eq 19980
+cmp csv2ds-3a.txt csv2ds-3b.txt
+echo "Trying with values that don't fit their columns"
+for bad in 'maybe,1,1,1,1,x' 'true,256,1,1,1,x' 'true,1,1x,1,1,x' 'true,1,3000000000,1,1,x' \
+           'true,1,1,1,1.5.5,x'; do
+    printf 'true,1,1,1,1,x\nfalse,2,2,2,2,y\n%s\ntrue,3,3,3,3,z\n' "$bad" >csv2ds-bad.csv
+    if ../process/csv2ds --xml-desc-file=$SRC/check-data/csv2ds-1.xml csv2ds-bad.csv csv2ds-bad.ds \
+        2>csv2ds-bad.err; then
+        echo "csv2ds accepted '$bad'"
+        exit 1
+    fi
+    grep 'csv line 3 field [1-5] is ' csv2ds-bad.err >/dev/null
+    # only the lines before the bad one are written
+    ../process/ds2txt --skip-all csv2ds-bad.ds >csv2ds-bad.txt
+    test `wc -l <csv2ds-bad.txt` -eq 2
+done
@@ -20,3 +20,10 @@ rm -f ds2txt.test.tmp ds2txt.test.txt
 cmp ds2txt-where.test.txt $1/check-data/ds2txt-where.test.ref
 rm -f ds2txt-where.test.tmp
 
+# every extent formatted on a different thread has to come out as a single thread writes it
+for opt in "" --csv; do
+    ../process/ds2txt --threads=1 $opt $SRC/check-data/nfs-2.set-1.20k.ds >ds2txt-threads.1.txt
+    ../process/ds2txt --threads=4 $opt $SRC/check-data/nfs-2.set-1.20k.ds >ds2txt-threads.4.txt
+    cmp ds2txt-threads.1.txt ds2txt-threads.4.txt
+done
+rm -f ds2txt-threads.1.txt ds2txt-threads.4.txt
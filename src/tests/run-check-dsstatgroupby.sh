@@ -12,6 +12,11 @@ set -e
 perl $1/check-data/clean-timing.pl <test.dsstatgroupby-tmp >test.dsstatgroupby.1
 perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.1 $1/check-data/test.dsstatgroupby.1.ref
 
+# the basic statistics merged from several threads have to come out the same
+../process/dsstatgroupby --threads=3 'I/O' basic '1000*(return_to_driver - leave_driver)' group by 'device_number' basic 'bytes/1024' group by 'machine_id' basic bytes quantile disk_offset basic bytes group by buffertype from $1/check-data/h03126.ds-littleend >test.dsstatgroupby-tmp
+perl $1/check-data/clean-timing.pl <test.dsstatgroupby-tmp >test.dsstatgroupby.threads
+cmp test.dsstatgroupby.1 test.dsstatgroupby.threads
+
 ../process/dsstatgroupby 'Batch::LSF' basic 'start_time - submit_time' where 'start_time - submit_time > 50000' group by 'production' basic 'cpu_time/(end_time-start_time)' group by production quantile 'start_time - submit_time' where 'start_time - submit_time > 50000' group by production from $1/check-data/lsb.acct.2007-01-01-p1.ds >test.dsstatgroupby.tmp
 perl $1/check-data/clean-timing.pl <test.dsstatgroupby.tmp >test.dsstatgroupby.2
 perl $1/check-data/unordered-file-equality.pl test.dsstatgroupby.2 $1/check-data/test.dsstatgroupby.2.ref
@@ -0,0 +1,160 @@
+// -*-C++-*-
+/*
+  (c) Copyright 2013, Hewlett-Packard Development Company, LP
+
+  See the file named COPYING for license details
+*/
+
+/** @file
+    Check that unpacking only some of the fields of an extent gets those
+    fields right, in both the row-major and columnar layouts.
+*/
+
+#include <cmath>
+#include <iostream>
+
+#include <DataSeries/DataSeriesFile.hpp>
+#include <DataSeries/ExtentField.hpp>
+#include <DataSeries/TypeIndexModule.hpp>
+
+using namespace std;
+using boost::format;
+
+const string test_xml =
+        "<ExtentType namespace=\"ssd.hpl.hp.com\" name=\"Test::UnpackFields\" version=\"1.0\" "
+        "  pack_null_compact=\"non_bool\" >\n"
+        "  <field type=\"int64\" name=\"time\" pack_relative=\"time\" />\n"
+        "  <field type=\"int64\" name=\"end\" pack_relative=\"time\" />\n"
+        "  <field type=\"int32\" name=\"count\" opt_nullable=\"yes\" />\n"
+        "  <field type=\"double\" name=\"latency\" pack_scale=\"1e-6\" />\n"
+        "  <field type=\"bool\" name=\"flag\" />\n"
+        "  <field type=\"variable32\" name=\"name\" />\n"
+        "</ExtentType>\n";
+
+const unsigned nextents = 5, nrecords = 1000;
+
+ExtentTypeLibrary library;
+ExtentType::Ptr type(library.registerTypePtr(test_xml));
+
+int64_t timeVal(unsigned e, unsigned j) { return 1000000LL * e + j * 17; }
+int64_t endVal(unsigned e, unsigned j) { return timeVal(e, j) + j % 31; }
+bool countNull(unsigned j) { return j % 11 == 0; }
+int32_t countVal(unsigned j) { return j * 13 % 4096; }
+double latencyVal(unsigned j) { return (j % 1000) * 1.0e-6; }
+string nameVal(unsigned j) { return str(format("file-%d") % (j % 50)); }
+
+void writeFile(const string &filename, bool columnar) {
+    DataSeriesSink sink(filename);
+    sink.setColumnarFixed(columnar);
+    sink.writeExtentLibrary(library);
+    for (unsigned i = 0; i < nextents; ++i) {
+        Extent::Ptr e(new Extent(type));
+        ExtentSeries s(e);
+        Int64Field time(s, "time"), end(s, "end");
+        Int32Field count(s, "count", Field::flag_nullable);
+        DoubleField latency(s, "latency");
+        BoolField flag(s, "flag");
+        Variable32Field name(s, "name");
+        for (unsigned j = 0; j < nrecords; ++j) {
+            s.newRecord();
+            time.set(timeVal(i, j));
+            end.set(endVal(i, j));
+            if (countNull(j)) {
+                count.setNull();
+            } else {
+                count.set(countVal(j));
+            }
+            latency.set(latencyVal(j));
+            flag.set(j % 3 == 0);
+            name.set(nameVal(j));
+        }
+        sink.writeExtent(*e, NULL);
+    }
+    sink.close();
+}
+
+void checkMask() {
+    vector<string> fields;
+    fields.push_back("end");
+    fields.push_back("count");
+    fields.push_back("no-such-field");
+    vector<bool> mask(type->unpackFieldMask(fields));
+    unsigned nwanted = 0;
+    for (vector<bool>::iterator i = mask.begin(); i != mask.end(); ++i) {
+        nwanted += *i ? 1 : 0;
+    }
+    // end, its base time, count and count's null field
+    SINVARIANT(nwanted == 4);
+}
+
+// Reads the file unpacking only fields, and checks the ones in fields
+void checkFile(const string &filename, const vector<string> &fields) {
+    TypeIndexModule source("Test::UnpackFields");
+    source.setUnpackFields(fields);
+    source.addSource(filename);
+
+    ExtentSeries s;
+    Int64Field time(s, "time"), end(s, "end");
+    Int32Field count(s, "count", Field::flag_nullable);
+    DoubleField latency(s, "latency");
+    BoolField flag(s, "flag");
+    Variable32Field name(s, "name");
+    bool all = fields.empty();
+    bool want_name = all, want_latency = all, want_end = all, want_count = all;
+    for (vector<string>::const_iterator i = fields.begin(); i != fields.end(); ++i) {
+        want_name = want_name || *i == "name";
+        want_latency = want_latency || *i == "latency";
+        want_end = want_end || *i == "end";
+        want_count = want_count || *i == "count";
+    }
+
+    unsigned extent_num = 0;
+    for (Extent::Ptr e(source.getSharedExtent()); e != NULL; e = source.getSharedExtent()) {
+        SINVARIANT(e->nRecords() == nrecords);
+        if (!want_name) {
+            SINVARIANT(e->variabledata.size() == 4);
+        }
+        unsigned j = 0;
+        for (s.setExtent(e); s.morerecords(); ++s, ++j) {
+            SINVARIANT(flag.val() == (j % 3 == 0)); // bools are always there
+            if (want_end) {
+                SINVARIANT(time.val() == timeVal(extent_num, j));
+                SINVARIANT(end.val() == endVal(extent_num, j));
+            }
+            if (want_count) {
+                SINVARIANT(count.isNull() == countNull(j));
+                SINVARIANT(count.isNull() || count.val() == countVal(j));
+            }
+            if (want_latency) {
+                SINVARIANT(fabs(latency.val() - latencyVal(j)) < 1.0e-9);
+            }
+            if (want_name) {
+                SINVARIANT(name.stringval() == nameVal(j));
+            }
+        }
+        ++extent_num;
+    }
+    SINVARIANT(extent_num == nextents);
+}
+
+void checkFiles(const string &filename) {
+    vector<string> fields;
+    checkFile(filename, fields); // everything
+    fields.push_back("end");
+    fields.push_back("count");
+    checkFile(filename, fields);
+    fields.clear();
+    fields.push_back("latency");
+    fields.push_back("name");
+    checkFile(filename, fields);
+}
+
+int main() {
+    checkMask();
+    writeFile("unpack-fields.ds", false);
+    checkFiles("unpack-fields.ds");
+    writeFile("unpack-fields.ds", true);
+    checkFiles("unpack-fields.ds");
+    cout << "unpack fields tests passed.\n";
+    return 0;
+}